@@ -0,0 +1,24 @@
+#include "audio_codec.h"
+#include "sdkconfig.h"
+
+// Formats with a magic number first, MP3 frame sync is the weakest test
+static const audio_codec_t* const audio_codecs[] = {
+#if CONFIG_AUDIO_DEC_WAV
+    &audio_codec_wav,
+#endif
+#if CONFIG_AUDIO_DEC_FLAC
+    &audio_codec_flac,
+#endif
+    &audio_codec_mp3,
+};
+
+const audio_codec_t* audio_codec_probe(const uint8_t* head, size_t len,
+                                       const char* path) {
+    for (size_t i = 0; i < sizeof(audio_codecs) / sizeof(audio_codecs[0]);
+         i++) {
+        if (audio_codecs[i]->probe(head, len, path)) {
+            return audio_codecs[i];
+        }
+    }
+    return nullptr;
+}
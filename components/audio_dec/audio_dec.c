@@ -0,0 +1,531 @@
+#include "audio_dec.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "audio_codec.h"
+#include "mp3_core.h"
+#include "pcm_resample.h"
+#include "sdkconfig.h"
+#include "stream_reader.h"
+#include "sys_mem.h"
+#include "sys_task.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames decoded per pull, a whole MP3 frame
+#define AUDIO_DEC_BLOCK AUDIO_CODEC_BLOCK
+
+// An open track, the playing one or the one queued after it
+typedef struct {
+    stream_reader_t* stream;
+    const audio_codec_t* codec;
+    void* arena; // the codec's state, sized by its query_mem
+
+    // start of a queued track, decoded ahead of the splice
+    int16_t head[AUDIO_DEC_BLOCK * 2];
+    uint32_t head_len; // frames
+} audio_dec_track_t;
+
+struct audio_dec {
+    audio_dec_track_t* cur;
+    audio_dec_track_t* next;
+    int16_t pcm[AUDIO_DEC_BLOCK * 2];
+    pcm_ring_t* ring;
+    pcm_resample_t* rs; // to 44.1 kHz, nullptr when the track is at it
+    bool rate_warned;
+
+    // decoded frames not in the ring yet, in pcm or a track head
+    const int16_t* pend;
+    uint32_t pend_len;
+    TaskHandle_t task;
+    SemaphoreHandle_t done;
+    SemaphoreHandle_t lock; // held to swap cur, and by audio_dec_get_stats
+    volatile bool stop;
+    volatile bool ended;
+    uint64_t decode_us;
+    _Atomic int32_t seek_ms; // requested position, -1 when none
+    uint32_t seek_us;
+    uint32_t tracks;
+
+    char next_path[AUDIO_DEC_PATH_MAX];
+    _Atomic bool queued; // next_path is set and not started yet
+    audio_dec_next_cb_t next_cb;
+    void* next_arg;
+};
+
+#define AUDIO_DEC_FRAME_BYTES (AUDIO_DEC_BLOCK * 2 * sizeof(int16_t))
+
+#if CONFIG_SYS_MEM_STATIC
+// Converter taps of the configured tier
+#define AUDIO_DEC_RESAMPLE_TAPS (8 << CONFIG_AUDIO_DEC_RESAMPLE_QUALITY)
+
+// The playing and the queued track. The arenas go to PSRAM when there is
+// one, the converter runs per sample and stays in internal RAM.
+static audio_dec_t dec_storage;
+static StaticSemaphore_t dec_done_buf;
+static StaticSemaphore_t dec_lock_buf;
+static audio_dec_track_t track_slots[2];
+static bool track_used[2];
+static uint8_t track_arenas[2][CONFIG_AUDIO_DEC_STATIC_ARENA] SYS_MEM_EXT
+    __attribute__((aligned(8)));
+static uint8_t rs_mem[PCM_RESAMPLE_MAX_SIZE(AUDIO_DEC_RESAMPLE_TAPS)]
+    __attribute__((aligned(8)));
+#endif
+
+// The decoder is outrunning the card
+static void audio_dec_low_water(stream_reader_t* stream, void* arg) {
+    ESP_LOGW("AUDIO_DEC", "Read-ahead low at offset %" PRIu64,
+             stream_reader_tell(stream));
+}
+
+// Skip an ID3v2 tag so its payload is not mistaken for frame sync
+static void audio_dec_skip_id3(stream_reader_t* stream) {
+    uint8_t hdr[10];
+    if (stream_reader_read(stream, hdr, sizeof(hdr)) == sizeof(hdr) &&
+        memcmp(hdr, "ID3", 3) == 0) {
+        // tag size is a 28-bit synchsafe integer
+        long size = ((long)(hdr[6] & 0x7f) << 21) | ((hdr[7] & 0x7f) << 14) |
+                    ((hdr[8] & 0x7f) << 7) | (hdr[9] & 0x7f);
+        if (hdr[5] & 0x10) {
+            size += 10; // footer present
+        }
+        stream_reader_seek(stream, sizeof(hdr) + size);
+        return;
+    }
+    stream_reader_seek(stream, 0);
+}
+
+static void audio_dec_track_close(audio_dec_track_t* t) {
+    if (t == NULL) {
+        return;
+    }
+    if (t->codec != NULL) {
+        t->codec->close(t->arena);
+    }
+    stream_reader_close(t->stream);
+#if CONFIG_SYS_MEM_STATIC
+    track_used[t - track_slots] = false;
+#else
+    free(t->arena);
+    free(t);
+#endif
+}
+
+#if CONFIG_SYS_MEM_STATIC
+static audio_dec_track_t* audio_dec_track_alloc(size_t mem) {
+    if (mem > CONFIG_AUDIO_DEC_STATIC_ARENA) {
+        ESP_LOGE("AUDIO_DEC", "%s %zu byte state over the arena", __func__,
+                 mem);
+        return nullptr;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (!track_used[i]) {
+            track_used[i] = true;
+            memset(&track_slots[i], 0, sizeof(audio_dec_track_t));
+            track_slots[i].arena = track_arenas[i];
+            return &track_slots[i];
+        }
+    }
+    ESP_LOGE("AUDIO_DEC", "%s no free track", __func__);
+    return nullptr;
+}
+#else
+static audio_dec_track_t* audio_dec_track_alloc(size_t mem) {
+    audio_dec_track_t* t = calloc(1, sizeof(audio_dec_track_t));
+    void* arena = malloc(mem);
+    if (t == NULL || arena == NULL) {
+        ESP_LOGE("AUDIO_DEC", "%s allocation failed", __func__);
+        free(t);
+        free(arena);
+        return nullptr;
+    }
+    t->arena = arena;
+    return t;
+}
+#endif
+
+static audio_dec_track_t* audio_dec_track_open(const char* path) {
+    stream_reader_t* stream = stream_reader_open(path);
+    if (stream == nullptr) {
+        return nullptr;
+    }
+    audio_dec_skip_id3(stream);
+    // nothing read ahead means the card is no longer keeping up
+    stream_reader_set_low_water(stream, 0, audio_dec_low_water, NULL);
+
+    // the codec is picked and sized from the first bytes after the tag
+    uint8_t head[AUDIO_CODEC_HEAD];
+    uint64_t at = stream_reader_tell(stream);
+    size_t len = stream_reader_read(stream, head, sizeof(head));
+    stream_reader_seek(stream, at);
+    const audio_codec_t* codec = audio_codec_probe(head, len, path);
+    size_t mem = codec != NULL ? codec->query_mem(head, len) : 0;
+    if (mem == 0) {
+        ESP_LOGW("AUDIO_DEC", "Unsupported file %s", path);
+        stream_reader_close(stream);
+        return nullptr;
+    }
+
+    audio_dec_track_t* t = audio_dec_track_alloc(mem);
+    if (t == NULL) {
+        stream_reader_close(stream);
+        return nullptr;
+    }
+    t->stream = stream;
+    if (!codec->open(t->arena, stream, path)) {
+        ESP_LOGW("AUDIO_DEC", "Cannot decode %s", path);
+        audio_dec_track_close(t);
+        return nullptr;
+    }
+    t->codec = codec;
+    ESP_LOGI("AUDIO_DEC", "Opened %s as %s, %zu byte state", path,
+             codec->name, mem);
+    return t;
+}
+
+static void audio_dec_do_seek(audio_dec_t* dec, uint32_t ms) {
+    audio_dec_track_t* t = dec->cur;
+    int64_t start = esp_timer_get_time();
+    audio_codec_info_t info;
+    t->codec->get_info(t->arena, &info);
+    uint64_t at =
+        t->codec->seek(t->arena, (uint64_t)ms * info.sample_rate / 1000);
+    dec->pend_len = 0;
+    if (dec->rs != NULL) {
+        pcm_resample_reset(dec->rs);
+    }
+    dec->seek_us = esp_timer_get_time() - start;
+    ESP_LOGI("AUDIO_DEC", "Seek to %" PRIu32 " ms: sample %" PRIu64
+             " in %" PRIu32 " us",
+             ms, at, dec->seek_us);
+}
+
+// Decode up to frames frames of t into out, returns 0 at its end
+static size_t audio_dec_decode(audio_dec_t* dec, audio_dec_track_t* t,
+                               int16_t* out, size_t frames) {
+    int64_t start = esp_timer_get_time();
+    size_t n = t->codec->decode(t->arena, out, frames);
+    dec->decode_us += esp_timer_get_time() - start;
+    return n;
+}
+
+// Open the queued track once the current one is about to end and decode
+// its start, so the splice does not wait on the card
+static void audio_dec_preload(audio_dec_t* dec) {
+    audio_dec_track_t* cur = dec->cur;
+    audio_codec_info_t info;
+    cur->codec->get_info(cur->arena, &info);
+    uint64_t left_ms = UINT64_MAX;
+    if (info.length != 0 && info.sample_rate != 0) {
+        left_ms = info.position < info.length
+                      ? (info.length - info.position) * 1000 / info.sample_rate
+                      : 0;
+    } else if (info.bitrate != 0) {
+        left_ms = (stream_reader_size(cur->stream) -
+                   stream_reader_tell(cur->stream)) *
+                  8000 / info.bitrate;
+    }
+    if (left_ms != UINT64_MAX && left_ms > CONFIG_AUDIO_DEC_PRELOAD_MS) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    audio_dec_track_t* next = audio_dec_track_open(dec->next_path);
+    if (next == NULL) {
+        ESP_LOGW("AUDIO_DEC", "Cannot open next track %s", dec->next_path);
+        atomic_store(&dec->queued, false);
+        return;
+    }
+    next->head_len = audio_dec_decode(dec, next, next->head, AUDIO_DEC_BLOCK);
+    dec->next = next;
+    ESP_LOGI("AUDIO_DEC", "Preloaded %s in %" PRIu32 " us", dec->next_path,
+             (uint32_t)(esp_timer_get_time() - start));
+}
+
+// Convert from rate from now on. The filter history is kept while the
+// rate stays, so the tracks of a 48 kHz album join without a gap.
+static void audio_dec_set_rate(audio_dec_t* dec, uint32_t rate) {
+    if (rate == 44100 || rate == 0) {
+#if !CONFIG_SYS_MEM_STATIC
+        pcm_resample_destroy(dec->rs);
+#endif
+        dec->rs = NULL;
+        return;
+    }
+    if (dec->rs != NULL && pcm_resample_in_rate(dec->rs) == rate) {
+        return;
+    }
+#if CONFIG_SYS_MEM_STATIC
+    dec->rs = pcm_resample_init(rs_mem, sizeof(rs_mem), rate, 44100,
+                                CONFIG_AUDIO_DEC_RESAMPLE_QUALITY);
+#else
+    pcm_resample_destroy(dec->rs);
+    dec->rs =
+        pcm_resample_create(rate, 44100, CONFIG_AUDIO_DEC_RESAMPLE_QUALITY);
+#endif
+    if (dec->rs == NULL && !dec->rate_warned) {
+        // played at the wrong speed rather than not at all
+        ESP_LOGW("AUDIO_DEC", "Unsupported sample rate: %" PRIu32, rate);
+        dec->rate_warned = true;
+    }
+}
+
+// Move pending frames into the ring, through the converter when there is
+// one. Returns false when the ring had no room for any.
+static bool audio_dec_drain(audio_dec_t* dec) {
+    size_t used;
+    if (dec->rs == NULL) {
+        used = pcm_ring_write(dec->ring, (const uint8_t*)dec->pend,
+                              dec->pend_len * 2 * sizeof(int16_t)) /
+               (2 * sizeof(int16_t));
+    } else {
+        uint8_t* span;
+        size_t room = pcm_ring_write_reserve(dec->ring, &span) /
+                      (2 * sizeof(int16_t));
+        size_t n = pcm_resample_process(dec->rs, dec->pend, dec->pend_len,
+                                        &used, (int16_t*)span, room);
+        int16_t out[2 * 8];
+        if (used == 0 && pcm_ring_space(dec->ring) >= sizeof(out)) {
+            // the span before the wrap is too short for the outputs of
+            // one input, bounce them
+            n = pcm_resample_process(dec->rs, dec->pend, 1, &used, out, 8);
+            pcm_ring_write(dec->ring, (const uint8_t*)out,
+                           n * 2 * sizeof(int16_t));
+        } else {
+            pcm_ring_write_commit(dec->ring, n * 2 * sizeof(int16_t));
+        }
+    }
+    dec->pend += 2 * used;
+    dec->pend_len -= used;
+    return used > 0;
+}
+
+// Continue with the preloaded track at the end of the current one
+static bool audio_dec_splice(audio_dec_t* dec) {
+    if (dec->next == NULL) {
+        return false;
+    }
+    xSemaphoreTake(dec->lock, portMAX_DELAY);
+    audio_dec_track_t* prev = dec->cur;
+    dec->cur = dec->next;
+    dec->next = NULL;
+    dec->tracks++;
+    xSemaphoreGive(dec->lock);
+    audio_dec_track_close(prev);
+
+    audio_codec_info_t info;
+    dec->cur->codec->get_info(dec->cur->arena, &info);
+    audio_dec_set_rate(dec, info.sample_rate);
+    dec->pend = dec->cur->head;
+    dec->pend_len = dec->cur->head_len;
+    // audio_dec_queue may reuse next_path once queued is clear
+    ESP_LOGI("AUDIO_DEC", "Playing %s", dec->next_path);
+    atomic_store(&dec->queued, false);
+    if (dec->next_cb != NULL) {
+        dec->next_cb(dec, dec->next_arg);
+    }
+    return true;
+}
+
+static void audio_dec_task_handler(void* arg) {
+    audio_dec_t* dec = (audio_dec_t*)arg;
+
+    while (!dec->stop) {
+        int32_t seek_ms = atomic_exchange(&dec->seek_ms, -1);
+        if (seek_ms >= 0) {
+            audio_dec_do_seek(dec, seek_ms);
+        }
+        if (dec->next == NULL && atomic_load(&dec->queued)) {
+            audio_dec_preload(dec);
+        }
+        if (dec->pend_len > 0) {
+            if (!audio_dec_drain(dec)) {
+                vTaskDelay(10 / portTICK_PERIOD_MS);
+            }
+            continue;
+        }
+
+        // wait for the A2DP side to drain room for a whole frame
+        if (pcm_ring_space(dec->ring) < AUDIO_DEC_FRAME_BYTES) {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        // decode straight into the ring unless the frame would wrap or
+        // needs converting
+        uint8_t* span;
+        bool direct =
+            pcm_ring_write_reserve(dec->ring, &span) >= AUDIO_DEC_FRAME_BYTES &&
+            dec->rs == NULL;
+        int16_t* out = direct ? (int16_t*)span : dec->pcm;
+
+        size_t samples = audio_dec_decode(dec, dec->cur, out, AUDIO_DEC_BLOCK);
+        if (samples == 0) {
+            if (atomic_load(&dec->queued) && dec->next == NULL) {
+                // queued too late to preload, open it now
+                audio_dec_preload(dec);
+            }
+            if (audio_dec_splice(dec)) {
+                continue;
+            }
+            break;
+        }
+
+        audio_codec_info_t info;
+        dec->cur->codec->get_info(dec->cur->arena, &info);
+        audio_dec_set_rate(dec, info.sample_rate);
+        size_t bytes = samples * 2 * sizeof(int16_t);
+        if (direct && dec->rs == NULL) {
+            pcm_ring_write_commit(dec->ring, bytes);
+            continue;
+        }
+        if (direct) {
+            // the first frame at a new rate
+            memcpy(dec->pcm, out, bytes);
+        }
+        dec->pend = dec->pcm;
+        dec->pend_len = samples;
+    }
+
+    dec->ended = true;
+    xSemaphoreGive(dec->done);
+    sys_task_exit();
+}
+
+static void audio_dec_free(audio_dec_t* dec) {
+#if CONFIG_SYS_MEM_STATIC
+    dec->ring = NULL;
+#else
+    pcm_resample_destroy(dec->rs);
+    free(dec);
+#endif
+}
+
+audio_dec_t* audio_dec_start(const char* path, pcm_ring_t* ring) {
+#if CONFIG_SYS_MEM_STATIC
+    // one decoder at a time, like its task
+    if (dec_storage.ring != NULL) {
+        ESP_LOGE("AUDIO_DEC", "%s already running", __func__);
+        return nullptr;
+    }
+    if (!mp3_core_reserve()) {
+        return nullptr;
+    }
+    audio_dec_t* dec = &dec_storage;
+    memset(dec, 0, sizeof(audio_dec_t));
+#else
+    audio_dec_t* dec = calloc(1, sizeof(audio_dec_t));
+    if (dec == NULL) {
+        ESP_LOGE("AUDIO_DEC", "%s calloc failed", __func__);
+        return nullptr;
+    }
+#endif
+    dec->ring = ring;
+    dec->tracks = 1;
+    atomic_init(&dec->seek_ms, -1);
+    atomic_init(&dec->queued, false);
+
+    dec->cur = audio_dec_track_open(path);
+    if (dec->cur == NULL) {
+        audio_dec_free(dec);
+        return nullptr;
+    }
+#if CONFIG_SYS_MEM_STATIC
+    dec->done = xSemaphoreCreateBinaryStatic(&dec_done_buf);
+    dec->lock = xSemaphoreCreateMutexStatic(&dec_lock_buf);
+#else
+    dec->done = xSemaphoreCreateBinary();
+    dec->lock = xSemaphoreCreateMutex();
+#endif
+    if (dec->done == NULL || dec->lock == NULL) {
+        ESP_LOGE("AUDIO_DEC", "%s semaphore allocation failed", __func__);
+        goto fail;
+    }
+
+    dec->task = sys_task_create(SYS_TASK_AUDIO_DEC, audio_dec_task_handler,
+                                dec);
+    if (dec->task == NULL) {
+        ESP_LOGE("AUDIO_DEC", "%s task creation failed", __func__);
+        goto fail;
+    }
+    ESP_LOGI("AUDIO_DEC", "Decoding %s", path);
+    return dec;
+
+fail:
+    if (dec->done != NULL) {
+        vSemaphoreDelete(dec->done);
+    }
+    if (dec->lock != NULL) {
+        vSemaphoreDelete(dec->lock);
+    }
+    audio_dec_track_close(dec->cur);
+    audio_dec_free(dec);
+    return nullptr;
+}
+
+void audio_dec_stop(audio_dec_t* dec) {
+    if (dec == nullptr) {
+        return;
+    }
+    dec->stop = true;
+    xSemaphoreTake(dec->done, portMAX_DELAY);
+    sys_task_delete(SYS_TASK_AUDIO_DEC);
+
+    vSemaphoreDelete(dec->done);
+    vSemaphoreDelete(dec->lock);
+    audio_dec_track_close(dec->cur);
+    audio_dec_track_close(dec->next);
+    audio_dec_free(dec);
+}
+
+bool audio_dec_queue(audio_dec_t* dec, const char* path) {
+    if (atomic_load(&dec->queued) || dec->ended ||
+        strlen(path) >= sizeof(dec->next_path)) {
+        return false;
+    }
+    strcpy(dec->next_path, path);
+    atomic_store(&dec->queued, true);
+    return true;
+}
+
+void audio_dec_set_next_cb(audio_dec_t* dec, audio_dec_next_cb_t cb,
+                           void* arg) {
+    dec->next_arg = arg;
+    dec->next_cb = cb;
+}
+
+void audio_dec_seek(audio_dec_t* dec, uint32_t ms) {
+    atomic_store(&dec->seek_ms, ms > INT32_MAX ? INT32_MAX : (int32_t)ms);
+}
+
+void audio_dec_get_stats(audio_dec_t* dec, audio_dec_stats_t* stats) {
+    memset(stats, 0, sizeof(audio_dec_stats_t));
+    if (dec == nullptr) {
+        return;
+    }
+    xSemaphoreTake(dec->lock, portMAX_DELAY);
+    audio_dec_track_t* t = dec->cur;
+    audio_codec_info_t info;
+    t->codec->get_info(t->arena, &info);
+    stats->format = t->codec->name;
+    stats->frames = info.frames;
+    stats->errors = info.errors;
+    stats->decode_us = dec->decode_us;
+    stats->sample_rate = info.sample_rate;
+    stats->bitrate = info.bitrate;
+    if (info.sample_rate != 0) {
+        stats->position_ms = info.position * 1000 / info.sample_rate;
+        stats->duration_ms = info.length * 1000 / info.sample_rate;
+    }
+    stats->seek_us = dec->seek_us;
+    stats->tracks = dec->tracks;
+    stats->ended = dec->ended;
+
+    stream_reader_stats_t rs;
+    stream_reader_get_stats(t->stream, &rs);
+    stats->read_stalls = rs.stalls;
+    stats->read_stall_us_max = rs.stall_us_max;
+    xSemaphoreGive(dec->lock);
+}
@@ -0,0 +1,756 @@
+#include "audio_codec.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <inttypes.h>
+#include <string.h>
+
+#if CONFIG_AUDIO_DEC_FLAC
+
+// Seek points kept from a SEEKTABLE, thinned evenly when it has more
+#define CODEC_FLAC_POINTS 64
+// Bytes of a frame header at most, with the CRC-8
+#define CODEC_FLAC_HDR_MAX 16
+
+typedef struct {
+    uint64_t sample;
+    uint64_t offset; // from the first frame
+} codec_flac_point_t;
+
+// A frame header
+typedef struct {
+    uint32_t block;  // samples per channel
+    uint32_t rate;
+    uint8_t assign;  // 0-7 independent channels - 1, 8-10 stereo modes
+    uint8_t bits;
+    uint64_t sample; // of the first one in the frame
+    uint32_t len;    // bytes
+} codec_flac_hdr_t;
+
+typedef struct {
+    stream_reader_t* stream;
+
+    // STREAMINFO
+    uint32_t min_block;
+    uint32_t max_block;
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint8_t bits;
+    uint64_t total; // samples per channel, 0 if unknown
+    uint64_t first_frame;
+    codec_flac_point_t points[CODEC_FLAC_POINTS];
+    uint32_t npoints;
+
+    // whole frames are decoded from in[pos, len)
+    uint8_t* in;
+    uint32_t in_size;
+    uint32_t in_pos;
+    uint32_t in_len;
+    uint64_t in_base; // file offset of in[0]
+    bool eof;
+
+    // the current block, the first two channels and one to skip others
+    int32_t* ch[3];
+    uint32_t block_len;
+    uint32_t block_pos;
+    uint64_t block_start;
+    uint64_t skip_to; // output before this sample is dropped after a seek
+
+    uint32_t frames;
+    uint32_t errors;
+} codec_flac_t;
+
+// Bits of a frame are read from a 64-bit cache, left-aligned. Bits past
+// the end read as zero, callers check the position at the frame end.
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint64_t cache;
+    uint32_t n; // valid bits in cache
+} codec_flac_bits_t;
+
+static const uint16_t codec_flac_crc16[256] = {
+    0x0000, 0x8005, 0x800f, 0x000a, 0x801b, 0x001e, 0x0014, 0x8011,
+    0x8033, 0x0036, 0x003c, 0x8039, 0x0028, 0x802d, 0x8027, 0x0022,
+    0x8063, 0x0066, 0x006c, 0x8069, 0x0078, 0x807d, 0x8077, 0x0072,
+    0x0050, 0x8055, 0x805f, 0x005a, 0x804b, 0x004e, 0x0044, 0x8041,
+    0x80c3, 0x00c6, 0x00cc, 0x80c9, 0x00d8, 0x80dd, 0x80d7, 0x00d2,
+    0x00f0, 0x80f5, 0x80ff, 0x00fa, 0x80eb, 0x00ee, 0x00e4, 0x80e1,
+    0x00a0, 0x80a5, 0x80af, 0x00aa, 0x80bb, 0x00be, 0x00b4, 0x80b1,
+    0x8093, 0x0096, 0x009c, 0x8099, 0x0088, 0x808d, 0x8087, 0x0082,
+    0x8183, 0x0186, 0x018c, 0x8189, 0x0198, 0x819d, 0x8197, 0x0192,
+    0x01b0, 0x81b5, 0x81bf, 0x01ba, 0x81ab, 0x01ae, 0x01a4, 0x81a1,
+    0x01e0, 0x81e5, 0x81ef, 0x01ea, 0x81fb, 0x01fe, 0x01f4, 0x81f1,
+    0x81d3, 0x01d6, 0x01dc, 0x81d9, 0x01c8, 0x81cd, 0x81c7, 0x01c2,
+    0x0140, 0x8145, 0x814f, 0x014a, 0x815b, 0x015e, 0x0154, 0x8151,
+    0x8173, 0x0176, 0x017c, 0x8179, 0x0168, 0x816d, 0x8167, 0x0162,
+    0x8123, 0x0126, 0x012c, 0x8129, 0x0138, 0x813d, 0x8137, 0x0132,
+    0x0110, 0x8115, 0x811f, 0x011a, 0x810b, 0x010e, 0x0104, 0x8101,
+    0x8303, 0x0306, 0x030c, 0x8309, 0x0318, 0x831d, 0x8317, 0x0312,
+    0x0330, 0x8335, 0x833f, 0x033a, 0x832b, 0x032e, 0x0324, 0x8321,
+    0x0360, 0x8365, 0x836f, 0x036a, 0x837b, 0x037e, 0x0374, 0x8371,
+    0x8353, 0x0356, 0x035c, 0x8359, 0x0348, 0x834d, 0x8347, 0x0342,
+    0x03c0, 0x83c5, 0x83cf, 0x03ca, 0x83db, 0x03de, 0x03d4, 0x83d1,
+    0x83f3, 0x03f6, 0x03fc, 0x83f9, 0x03e8, 0x83ed, 0x83e7, 0x03e2,
+    0x83a3, 0x03a6, 0x03ac, 0x83a9, 0x03b8, 0x83bd, 0x83b7, 0x03b2,
+    0x0390, 0x8395, 0x839f, 0x039a, 0x838b, 0x038e, 0x0384, 0x8381,
+    0x0280, 0x8285, 0x828f, 0x028a, 0x829b, 0x029e, 0x0294, 0x8291,
+    0x82b3, 0x02b6, 0x02bc, 0x82b9, 0x02a8, 0x82ad, 0x82a7, 0x02a2,
+    0x82e3, 0x02e6, 0x02ec, 0x82e9, 0x02f8, 0x82fd, 0x82f7, 0x02f2,
+    0x02d0, 0x82d5, 0x82df, 0x02da, 0x82cb, 0x02ce, 0x02c4, 0x82c1,
+    0x8243, 0x0246, 0x024c, 0x8249, 0x0258, 0x825d, 0x8257, 0x0252,
+    0x0270, 0x8275, 0x827f, 0x027a, 0x826b, 0x026e, 0x0264, 0x8261,
+    0x0220, 0x8225, 0x822f, 0x022a, 0x823b, 0x023e, 0x0234, 0x8231,
+    0x8213, 0x0216, 0x021c, 0x8219, 0x0208, 0x820d, 0x8207, 0x0202,
+};
+
+static inline void codec_flac_fill(codec_flac_bits_t* b) {
+    while (b->n <= 56) {
+        uint64_t byte = b->p < b->end ? *b->p : 0;
+        b->p++;
+        b->cache |= byte << (56 - b->n);
+        b->n += 8;
+    }
+}
+
+// k bits, 0 to 32
+static inline uint32_t codec_flac_read(codec_flac_bits_t* b, uint32_t k) {
+    if (k == 0) {
+        return 0;
+    }
+    if (b->n < k) {
+        codec_flac_fill(b);
+    }
+    uint32_t v = b->cache >> (64 - k);
+    b->cache <<= k;
+    b->n -= k;
+    return v;
+}
+
+static inline int32_t codec_flac_sread(codec_flac_bits_t* b, uint32_t k) {
+    if (k == 0) {
+        return 0;
+    }
+    uint32_t v = codec_flac_read(b, k);
+    return (int32_t)(v << (32 - k)) >> (32 - k);
+}
+
+// Zeros before the next one bit, false past the end
+static inline bool codec_flac_unary(codec_flac_bits_t* b, uint32_t* q) {
+    uint32_t zeros = 0;
+    while (b->cache == 0) {
+        zeros += b->n;
+        b->n = 0;
+        if (b->p >= b->end) {
+            return false;
+        }
+        codec_flac_fill(b);
+    }
+    uint32_t lz = __builtin_clzll(b->cache);
+    b->cache = lz == 63 ? 0 : b->cache << (lz + 1);
+    b->n -= lz + 1;
+    *q = zeros + lz;
+    return true;
+}
+
+// Bits consumed since start
+static size_t codec_flac_tell(const codec_flac_bits_t* b,
+                              const uint8_t* start) {
+    return (b->p - start) * 8 - b->n;
+}
+
+static uint8_t codec_flac_crc8(const uint8_t* p, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint16_t codec_flac_crc(const uint8_t* p, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc << 8) ^ codec_flac_crc16[(crc >> 8) ^ p[i]];
+    }
+    return crc;
+}
+
+static uint32_t codec_flac_be(const uint8_t* p, int n) {
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+// Parse a frame header at p, checking its CRC-8
+static bool codec_flac_header(const codec_flac_t* f, const uint8_t* p,
+                              size_t len, codec_flac_hdr_t* h) {
+    static const uint32_t rates[] = {0,     88200, 176400, 192000,
+                                     8000,  16000, 22050,  24000,
+                                     32000, 44100, 48000,  96000};
+    static const uint8_t sizes[] = {0, 8, 12, 0, 16, 20, 24, 0};
+    if (len < 6 || p[0] != 0xff || (p[1] & 0xfe) != 0xf8 || (p[3] & 1)) {
+        return false;
+    }
+    uint32_t bs = p[2] >> 4, sr = p[2] & 15, sz = (p[3] >> 1) & 7;
+    h->assign = p[3] >> 4;
+    if (bs == 0 || sr == 15 || h->assign > 10 || (sz != 0 && !sizes[sz])) {
+        return false;
+    }
+
+    // frame or sample number, coded like UTF-8 up to 36 bits
+    size_t i = 4;
+    uint64_t num = p[i++];
+    int more = 0;
+    if (num == 0xff) {
+        return false;
+    }
+    if (num >= 0x80) {
+        while (more < 7 && (num & (0x80 >> more))) {
+            more++;
+        }
+        if (more < 2) {
+            return false;
+        }
+        num &= 0x7f >> more;
+        more--;
+    }
+    if (i + more + 4 > len) {
+        return false;
+    }
+    for (; more > 0; more--, i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+            return false;
+        }
+        num = num << 6 | (p[i] & 0x3f);
+    }
+
+    if (bs == 1) {
+        h->block = 192;
+    } else if (bs <= 5) {
+        h->block = 576 << (bs - 2);
+    } else if (bs == 6) {
+        h->block = p[i++] + 1;
+    } else if (bs == 7) {
+        h->block = codec_flac_be(p + i, 2) + 1;
+        i += 2;
+    } else {
+        h->block = 256 << (bs - 8);
+    }
+    if (sr == 0) {
+        h->rate = f->sample_rate;
+    } else if (sr < 12) {
+        h->rate = rates[sr];
+    } else if (sr == 12) {
+        h->rate = p[i++] * 1000;
+    } else {
+        h->rate = codec_flac_be(p + i, 2) * (sr == 14 ? 10 : 1);
+        i += 2;
+    }
+    if (i >= len || codec_flac_crc8(p, i) != p[i]) {
+        return false;
+    }
+    h->len = i + 1;
+    h->bits = sz == 0 ? f->bits : sizes[sz];
+    // fixed-size blocks are numbered by frame
+    h->sample = p[1] & 1 ? num : num * f->min_block;
+    return h->block <= f->max_block && h->bits <= 24 &&
+           (h->assign < 8 ? h->assign + 1u : 2u) == f->channels;
+}
+
+static bool codec_flac_residual(codec_flac_bits_t* b, int32_t* r,
+                                uint32_t block, uint32_t order) {
+    uint32_t method = codec_flac_read(b, 2);
+    if (method > 1) {
+        return false;
+    }
+    uint32_t pbits = method ? 5 : 4;
+    uint32_t escape = (1u << pbits) - 1;
+    uint32_t porder = codec_flac_read(b, 4);
+    uint32_t part = block >> porder;
+    if (part << porder != block || part < order) {
+        return false;
+    }
+    for (uint32_t p = 0; p < 1u << porder; p++) {
+        uint32_t n = p == 0 ? part - order : part;
+        uint32_t k = codec_flac_read(b, pbits);
+        if (k == escape) {
+            uint32_t raw = codec_flac_read(b, 5);
+            for (uint32_t i = 0; i < n; i++) {
+                r[i] = codec_flac_sread(b, raw);
+            }
+        } else {
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t q;
+                if (!codec_flac_unary(b, &q)) {
+                    return false;
+                }
+                uint32_t u = q << k | codec_flac_read(b, k);
+                r[i] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+            }
+        }
+        r += n;
+    }
+    return true;
+}
+
+// Predictions wrap in unsigned arithmetic: a damaged frame may overflow
+// before its CRC rejects it
+static void codec_flac_fixed(int32_t* s, uint32_t block, uint32_t order) {
+    uint32_t* u = (uint32_t*)s;
+    switch (order) {
+    case 1:
+        for (uint32_t i = 1; i < block; i++) {
+            u[i] += u[i - 1];
+        }
+        break;
+    case 2:
+        for (uint32_t i = 2; i < block; i++) {
+            u[i] += 2 * u[i - 1] - u[i - 2];
+        }
+        break;
+    case 3:
+        for (uint32_t i = 3; i < block; i++) {
+            u[i] += 3 * (u[i - 1] - u[i - 2]) + u[i - 3];
+        }
+        break;
+    case 4:
+        for (uint32_t i = 4; i < block; i++) {
+            u[i] += 4 * (u[i - 1] + u[i - 3]) - 6 * u[i - 2] - u[i - 4];
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void codec_flac_lpc(int32_t* s, uint32_t block, const int32_t* c,
+                           uint32_t order, int shift, bool wide) {
+    if (!wide) {
+        for (uint32_t i = order; i < block; i++) {
+            uint32_t sum = 0;
+            for (uint32_t j = 0; j < order; j++) {
+                sum += (uint32_t)c[j] * (uint32_t)s[i - 1 - j];
+            }
+            s[i] = (uint32_t)s[i] + (uint32_t)((int32_t)sum >> shift);
+        }
+        return;
+    }
+    for (uint32_t i = order; i < block; i++) {
+        int64_t sum = 0;
+        for (uint32_t j = 0; j < order; j++) {
+            sum += (int64_t)c[j] * s[i - 1 - j];
+        }
+        s[i] = (uint32_t)s[i] + (uint32_t)(sum >> shift);
+    }
+}
+
+static bool codec_flac_subframe(codec_flac_bits_t* b, int32_t* s,
+                                uint32_t block, uint32_t bps) {
+    if (codec_flac_read(b, 1) != 0) {
+        return false;
+    }
+    uint32_t type = codec_flac_read(b, 6);
+    uint32_t wasted = 0;
+    if (codec_flac_read(b, 1)) {
+        if (!codec_flac_unary(b, &wasted) || ++wasted >= bps) {
+            return false;
+        }
+        bps -= wasted;
+    }
+
+    if (type == 0) {
+        int32_t v = codec_flac_sread(b, bps);
+        for (uint32_t i = 0; i < block; i++) {
+            s[i] = v;
+        }
+    } else if (type == 1) {
+        for (uint32_t i = 0; i < block; i++) {
+            s[i] = codec_flac_sread(b, bps);
+        }
+    } else if (type >= 8 && type <= 12) {
+        uint32_t order = type - 8;
+        if (order > block) {
+            return false;
+        }
+        for (uint32_t i = 0; i < order; i++) {
+            s[i] = codec_flac_sread(b, bps);
+        }
+        if (!codec_flac_residual(b, s + order, block, order)) {
+            return false;
+        }
+        codec_flac_fixed(s, block, order);
+    } else if (type >= 32) {
+        uint32_t order = type - 31;
+        if (order > block) {
+            return false;
+        }
+        for (uint32_t i = 0; i < order; i++) {
+            s[i] = codec_flac_sread(b, bps);
+        }
+        uint32_t precision = codec_flac_read(b, 4) + 1;
+        int shift = codec_flac_sread(b, 5);
+        if (precision == 16 || shift < 0) {
+            return false;
+        }
+        int32_t c[32];
+        for (uint32_t i = 0; i < order; i++) {
+            c[i] = codec_flac_sread(b, precision);
+        }
+        if (!codec_flac_residual(b, s + order, block, order)) {
+            return false;
+        }
+        // the sum fits 32 bits unless the samples or coefficients are wide
+        uint32_t log2_order = 31 - __builtin_clz(order);
+        codec_flac_lpc(s, block, c, order, shift,
+                       bps + precision + log2_order > 32);
+    } else {
+        return false;
+    }
+
+    if (wasted != 0) {
+        for (uint32_t i = 0; i < block; i++) {
+            s[i] = (int32_t)((uint32_t)s[i] << wasted);
+        }
+    }
+    return true;
+}
+
+// Keep in[] holding a whole frame past in_pos unless the file ends first
+static void codec_flac_refill(codec_flac_t* f) {
+    if (f->eof || f->in_len - f->in_pos >= f->in_size / 2) {
+        return;
+    }
+    memmove(f->in, f->in + f->in_pos, f->in_len - f->in_pos);
+    f->in_base += f->in_pos;
+    f->in_len -= f->in_pos;
+    f->in_pos = 0;
+    while (f->in_len < f->in_size) {
+        size_t n = stream_reader_read(f->stream, f->in + f->in_len,
+                                      f->in_size - f->in_len);
+        if (n == 0) {
+            f->eof = true;
+            break;
+        }
+        f->in_len += n;
+    }
+}
+
+// Decode one frame at in_pos into the channel buffers, or skip a corrupt
+// one. False at the end of the stream.
+static bool codec_flac_frame(codec_flac_t* f) {
+    for (;;) {
+        codec_flac_refill(f);
+        const uint8_t* p = f->in + f->in_pos;
+        size_t left = f->in_len - f->in_pos;
+        codec_flac_hdr_t h;
+        if (left < 2) {
+            return false;
+        }
+        if (!codec_flac_header(f, p, left, &h)) {
+            f->in_pos++;
+            continue;
+        }
+
+        codec_flac_bits_t b = {p + h.len, p + left, 0, 0};
+        bool ok = true;
+        for (uint32_t c = 0; c < f->channels && ok; c++) {
+            // the side channel needs a bit more
+            uint32_t bps = h.bits;
+            if ((h.assign == 8 && c == 1) || (h.assign == 9 && c == 0) ||
+                (h.assign == 10 && c == 1)) {
+                bps++;
+            }
+            ok = codec_flac_subframe(&b, f->ch[c < 2 ? c : 2], h.block, bps);
+        }
+        size_t bits = codec_flac_tell(&b, p);
+        size_t len = (bits + 7) / 8 + 2;
+        if (ok && len <= left) {
+            uint16_t crc = codec_flac_be(p + len - 2, 2);
+            ok = codec_flac_crc(p, len - 2) == crc;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            // a false sync or a damaged frame, resync after it
+            f->errors++;
+            f->in_pos++;
+            continue;
+        }
+        f->in_pos += len;
+
+        int32_t* l = f->ch[0];
+        int32_t* r = f->ch[1];
+        switch (h.assign) {
+        case 8: // left, side
+            for (uint32_t i = 0; i < h.block; i++) {
+                r[i] = l[i] - r[i];
+            }
+            break;
+        case 9: // side, right
+            for (uint32_t i = 0; i < h.block; i++) {
+                l[i] += r[i];
+            }
+            break;
+        case 10: // mid, side
+            for (uint32_t i = 0; i < h.block; i++) {
+                int32_t mid = (int32_t)((uint32_t)l[i] << 1) | (r[i] & 1);
+                l[i] = (mid + r[i]) >> 1;
+                r[i] = (mid - r[i]) >> 1;
+            }
+            break;
+        default:
+            break;
+        }
+        f->bits = h.bits;
+        f->block_len = h.block;
+        f->block_pos = 0;
+        f->block_start = h.sample;
+        f->frames++;
+        return true;
+    }
+}
+
+static bool codec_flac_probe(const uint8_t* head, size_t len,
+                             const char* path) {
+    return len >= 4 && memcmp(head, "fLaC", 4) == 0;
+}
+
+// STREAMINFO, the first metadata block, at head + 8
+static bool codec_flac_info(const uint8_t* head, size_t len,
+                            codec_flac_t* f) {
+    if (len < 8 + 34 || (head[4] & 0x7f) != 0) {
+        return false;
+    }
+    const uint8_t* si = head + 8;
+    f->min_block = codec_flac_be(si, 2);
+    f->max_block = codec_flac_be(si + 2, 2);
+    uint32_t max_frame = codec_flac_be(si + 7, 3);
+    f->sample_rate = codec_flac_be(si + 10, 3) >> 4;
+    f->channels = ((si[12] >> 1) & 7) + 1;
+    f->bits = ((si[12] & 1) << 4 | si[13] >> 4) + 1;
+    f->total = (uint64_t)(si[13] & 15) << 32 | codec_flac_be(si + 14, 4);
+
+    // a whole frame must fit, without a size use a verbatim frame's
+    f->in_size = max_frame != 0
+                     ? max_frame + CODEC_FLAC_HDR_MAX
+                     : f->max_block * f->channels * (f->bits + 1) / 8 +
+                           CODEC_FLAC_HDR_MAX + 2;
+    // twice, so a frame found half way is whole after a refill
+    f->in_size *= 2;
+    if (f->max_block < 16 || f->max_block > CONFIG_AUDIO_DEC_FLAC_MAX_BLOCK ||
+        f->bits > 24 || f->sample_rate == 0) {
+        ESP_LOGW("CODEC_FLAC", "Unsupported stream: %" PRIu32
+                 " sample blocks, %u bits",
+                 f->max_block, f->bits);
+        return false;
+    }
+    return true;
+}
+
+static uint32_t codec_flac_buffers(const codec_flac_t* f) {
+    return f->channels == 1 ? 1 : f->channels == 2 ? 2 : 3;
+}
+
+static size_t codec_flac_query_mem(const uint8_t* head, size_t len) {
+    codec_flac_t f;
+    if (!codec_flac_info(head, len, &f)) {
+        return 0;
+    }
+    return sizeof(codec_flac_t) +
+           codec_flac_buffers(&f) * f.max_block * sizeof(int32_t) +
+           f.in_size;
+}
+
+// Keep up to CODEC_FLAC_POINTS points of a SEEKTABLE block of len bytes
+static void codec_flac_seektable(codec_flac_t* f, uint32_t len) {
+    uint32_t count = len / 18;
+    uint32_t every = (count + CODEC_FLAC_POINTS - 1) / CODEC_FLAC_POINTS;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t pt[18];
+        if (stream_reader_read(f->stream, pt, sizeof(pt)) != sizeof(pt)) {
+            return;
+        }
+        uint64_t sample = (uint64_t)codec_flac_be(pt, 4) << 32 |
+                          codec_flac_be(pt + 4, 4);
+        // placeholders are all ones and come last
+        if (sample == UINT64_MAX || i % every != 0 ||
+            f->npoints == CODEC_FLAC_POINTS) {
+            continue;
+        }
+        f->points[f->npoints].sample = sample;
+        f->points[f->npoints].offset =
+            (uint64_t)codec_flac_be(pt + 8, 4) << 32 |
+            codec_flac_be(pt + 12, 4);
+        f->npoints++;
+    }
+}
+
+static bool codec_flac_open(void* arena, stream_reader_t* stream,
+                            const char* path) {
+    codec_flac_t* f = arena;
+    uint8_t head[8 + 34];
+    uint64_t at = stream_reader_tell(stream);
+    memset(f, 0, sizeof(codec_flac_t));
+    if (stream_reader_read(stream, head, sizeof(head)) != sizeof(head) ||
+        !codec_flac_info(head, sizeof(head), f)) {
+        return false;
+    }
+    f->stream = stream;
+    int32_t* buf = (int32_t*)(f + 1);
+    for (uint32_t c = 0; c < 3; c++) {
+        f->ch[c] = buf + (c < codec_flac_buffers(f) ? c : 0) * f->max_block;
+    }
+    f->in = (uint8_t*)(buf + codec_flac_buffers(f) * f->max_block);
+
+    // metadata blocks up to the last one
+    bool last = head[4] & 0x80;
+    at += sizeof(head);
+    while (!last) {
+        uint8_t hdr[4];
+        if (stream_reader_read(stream, hdr, sizeof(hdr)) != sizeof(hdr)) {
+            return false;
+        }
+        last = hdr[0] & 0x80;
+        uint32_t len = codec_flac_be(hdr + 1, 3);
+        at += sizeof(hdr);
+        if ((hdr[0] & 0x7f) == 3) {
+            codec_flac_seektable(f, len);
+        }
+        at += len;
+        stream_reader_seek(stream, at);
+    }
+    f->first_frame = at;
+    f->in_base = at;
+    return true;
+}
+
+static size_t codec_flac_decode(void* arena, int16_t* out, size_t frames) {
+    codec_flac_t* f = arena;
+    while (f->block_pos == f->block_len) {
+        if (!codec_flac_frame(f)) {
+            return 0;
+        }
+        // drop what precedes the sample sought
+        if (f->skip_to > f->block_start) {
+            uint64_t skip = f->skip_to - f->block_start;
+            f->block_pos = skip < f->block_len ? skip : f->block_len;
+        }
+    }
+
+    uint32_t n = f->block_len - f->block_pos;
+    if (n > frames) {
+        n = frames;
+    }
+    const int32_t* l = f->ch[0] + f->block_pos;
+    const int32_t* r = f->ch[f->channels > 1 ? 1 : 0] + f->block_pos;
+    if (f->bits >= 16) {
+        uint32_t shift = f->bits - 16;
+        for (uint32_t i = 0; i < n; i++) {
+            out[2 * i] = l[i] >> shift;
+            out[2 * i + 1] = r[i] >> shift;
+        }
+    } else {
+        uint32_t shift = 16 - f->bits;
+        for (uint32_t i = 0; i < n; i++) {
+            out[2 * i] = (uint32_t)l[i] << shift;
+            out[2 * i + 1] = (uint32_t)r[i] << shift;
+        }
+    }
+    f->block_pos += n;
+    return n;
+}
+
+// Drop the input and continue reading at offset
+static void codec_flac_restart(codec_flac_t* f, uint64_t offset) {
+    stream_reader_seek(f->stream, offset);
+    f->in_base = offset;
+    f->in_pos = 0;
+    f->in_len = 0;
+    f->eof = false;
+    f->block_pos = 0;
+    f->block_len = 0;
+}
+
+// The first frame header at or after offset: its offset and sample
+static bool codec_flac_find(codec_flac_t* f, uint64_t offset,
+                            uint64_t* at, uint64_t* sample) {
+    codec_flac_restart(f, offset);
+    codec_flac_refill(f);
+    for (uint32_t i = 0; i + 1 < f->in_len; i++) {
+        codec_flac_hdr_t h;
+        if (codec_flac_header(f, f->in + i, f->in_len - i, &h)) {
+            *at = offset + i;
+            *sample = h.sample;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t codec_flac_seek(void* arena, uint64_t sample) {
+    codec_flac_t* f = arena;
+    if (f->total != 0 && sample > f->total) {
+        sample = f->total;
+    }
+    // bracket with the seek points, then bisect on frame headers
+    uint64_t lo = f->first_frame;
+    uint64_t hi = stream_reader_size(f->stream);
+    for (uint32_t i = 0; i < f->npoints; i++) {
+        if (f->points[i].sample <= sample) {
+            lo = f->first_frame + f->points[i].offset;
+        } else {
+            hi = f->first_frame + f->points[i].offset;
+            break;
+        }
+    }
+    while (hi - lo > f->in_size) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        uint64_t at, s;
+        if (codec_flac_find(f, mid, &at, &s) && at < hi && s <= sample) {
+            lo = at;
+        } else {
+            hi = mid;
+        }
+    }
+    // decode forward from there, dropping up to sample
+    codec_flac_restart(f, lo);
+    f->skip_to = sample;
+    f->block_start = sample;
+    return sample;
+}
+
+static void codec_flac_get_info(void* arena, audio_codec_info_t* info) {
+    codec_flac_t* f = arena;
+    memset(info, 0, sizeof(audio_codec_info_t));
+    info->sample_rate = f->sample_rate;
+    info->channels = f->channels;
+    info->bits = f->bits;
+    if (f->total != 0) {
+        info->bitrate = (stream_reader_size(f->stream) - f->first_frame) *
+                        8 * f->sample_rate / f->total;
+    }
+    info->position = f->block_start + f->block_pos;
+    info->length = f->total;
+    info->frames = f->frames;
+    info->errors = f->errors;
+}
+
+static void codec_flac_close(void* arena) {
+}
+
+const audio_codec_t audio_codec_flac = {
+    .name = "flac",
+    .probe = codec_flac_probe,
+    .query_mem = codec_flac_query_mem,
+    .open = codec_flac_open,
+    .decode = codec_flac_decode,
+    .seek = codec_flac_seek,
+    .get_info = codec_flac_get_info,
+    .close = codec_flac_close,
+};
+
+#endif
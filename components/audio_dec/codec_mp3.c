@@ -0,0 +1,233 @@
+#include "audio_codec.h"
+#include "esp_log.h"
+#include "mp3_core.h"
+#include "mp3_seek.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+// Samples the synthesis filterbank delays the output by, on top of the
+// encoder delay of a LAME header
+#define CODEC_MP3_DECODER_DELAY 529
+
+typedef struct {
+    stream_reader_t* stream;
+    mp3_core_t core;
+    mp3_seek_t seek;
+    char seek_path[64];  // persisted table, empty when not persisted
+    uint32_t size;       // of the file, with mtime keys the table
+    uint32_t mtime;
+    bool seek_built;     // the table is built by this playback
+    uint32_t frame_base; // frame index at the last seek
+
+    // samples kept, from the LAME delay and padding: [skip, end)
+    uint64_t skip;
+    uint64_t end;
+
+    // a frame decoded for a caller offering less than one
+    int16_t pcm[MP3_CORE_MAX_FRAME * 2];
+    uint32_t pcm_off;
+    uint32_t pcm_len;
+
+    uint32_t offsets[]; // seek table, CONFIG_AUDIO_DEC_SEEK_ENTRIES
+} codec_mp3_t;
+
+static size_t codec_mp3_read(void* arg, uint8_t* buf, size_t len) {
+    return stream_reader_read((stream_reader_t*)arg, buf, len);
+}
+
+// A valid MPEG audio frame header
+static bool codec_mp3_sync(const uint8_t* p) {
+    return p[0] == 0xff && (p[1] & 0xe0) == 0xe0 && (p[1] & 0x18) != 0x08 &&
+           (p[1] & 0x06) != 0 && (p[2] & 0xf0) != 0xf0 && (p[2] & 0x0c) != 0x0c;
+}
+
+static bool codec_mp3_probe(const uint8_t* head, size_t len,
+                            const char* path) {
+    for (size_t i = 0; i + 4 <= len; i++) {
+        if (codec_mp3_sync(head + i)) {
+            return true;
+        }
+    }
+    const char* ext = strrchr(path, '.');
+    return ext != NULL && strcasecmp(ext, ".mp3") == 0;
+}
+
+static size_t codec_mp3_query_mem(const uint8_t* head, size_t len) {
+    return sizeof(codec_mp3_t) +
+           CONFIG_AUDIO_DEC_SEEK_ENTRIES * sizeof(uint32_t);
+}
+
+// Persisted table path of a track, keyed by a hash of its path
+static void codec_mp3_seek_path(codec_mp3_t* m, const char* path) {
+    if (CONFIG_AUDIO_DEC_SEEK_DIR[0] == '\0') {
+        return;
+    }
+    uint32_t h = 2166136261u; // FNV-1a
+    for (const char* c = path; *c; c++) {
+        h = (h ^ (uint8_t)*c) * 16777619u;
+    }
+    snprintf(m->seek_path, sizeof(m->seek_path),
+             CONFIG_AUDIO_DEC_SEEK_DIR "/%08" PRIx32 ".sk", h);
+}
+
+// Save a table completed by this playback, creating its directory
+static void codec_mp3_seek_save(codec_mp3_t* m) {
+    if (!m->seek_built || !m->seek.complete || m->seek_path[0] == '\0') {
+        return;
+    }
+    char dir[sizeof(m->seek_path)];
+    strcpy(dir, m->seek_path);
+    for (char* c = dir + 1; *c; c++) {
+        if (*c == '/') {
+            *c = '\0';
+            mkdir(dir, 0755);
+            *c = '/';
+        }
+    }
+    if (mp3_seek_save(&m->seek, m->seek_path, m->size, m->mtime)) {
+        ESP_LOGI("CODEC_MP3", "Saved seek table %s", m->seek_path);
+    }
+    m->seek_built = false;
+}
+
+static bool codec_mp3_open(void* arena, stream_reader_t* stream,
+                           const char* path) {
+    codec_mp3_t* m = arena;
+    memset(m, 0, sizeof(codec_mp3_t));
+    m->stream = stream;
+
+    // a stored table beats the TOC of the file, which is only approximate
+    mp3_seek_init(&m->seek, stream, m->offsets,
+                  CONFIG_AUDIO_DEC_SEEK_ENTRIES);
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        m->size = st.st_size;
+        m->mtime = st.st_mtime;
+    }
+    codec_mp3_seek_path(m, path);
+    m->seek_built =
+        !m->seek.complete &&
+        !mp3_seek_load(&m->seek, m->seek_path, m->size, m->mtime);
+
+    if (!mp3_core_init(&m->core, stream_reader_tell(stream))) {
+        return false;
+    }
+
+    m->end = UINT64_MAX;
+    if (m->seek.enc_delay != 0 || m->seek.enc_padding != 0) {
+        m->skip = m->seek.enc_delay + CODEC_MP3_DECODER_DELAY;
+        if (m->seek.frames != 0) {
+            m->end = (uint64_t)m->seek.frames * m->seek.frame_samples +
+                     CODEC_MP3_DECODER_DELAY - m->seek.enc_padding;
+        }
+    }
+    return true;
+}
+
+// Decode the next frame into out and trim it to the samples kept.
+// Returns the samples per channel left in out, possibly 0, or -1 at the
+// end of the stream.
+static int codec_mp3_frame(codec_mp3_t* m, int16_t* out) {
+    int samples = mp3_core_decode(&m->core, codec_mp3_read, m->stream, out);
+    uint32_t frame = m->frame_base + m->core.position;
+    if (samples <= 0) {
+        ESP_LOGI("CODEC_MP3", "End of stream after %" PRIu32 " frames",
+                 m->core.frames);
+        if (m->seek.exact) {
+            mp3_seek_end(&m->seek, frame);
+            codec_mp3_seek_save(m);
+        }
+        return -1;
+    }
+    if (m->seek.exact) {
+        mp3_seek_add(&m->seek, frame - 1, m->core.frame_offset);
+    }
+
+    // position of the frame in the track, counting frames the decoder
+    // dropped for an unfilled bit reservoir
+    uint64_t first = (uint64_t)(frame - 1) * samples;
+    uint64_t lo = first > m->skip ? first : m->skip;
+    uint64_t hi = first + samples < m->end ? first + samples : m->end;
+    if (hi <= lo) {
+        return 0;
+    }
+    if (lo > first) {
+        memmove(out, out + 2 * (lo - first), (hi - lo) * 2 * sizeof(int16_t));
+    }
+    return hi - lo;
+}
+
+static size_t codec_mp3_decode(void* arena, int16_t* out, size_t frames) {
+    codec_mp3_t* m = arena;
+    if (m->pcm_len == 0) {
+        // straight into out when a whole frame fits
+        bool direct = frames >= MP3_CORE_MAX_FRAME;
+        int samples;
+        do {
+            samples = codec_mp3_frame(m, direct ? out : m->pcm);
+        } while (samples == 0);
+        if (samples < 0) {
+            return 0;
+        }
+        if (direct) {
+            return samples;
+        }
+        m->pcm_off = 0;
+        m->pcm_len = samples;
+    }
+    size_t n = frames < m->pcm_len ? frames : m->pcm_len;
+    memcpy(out, m->pcm + 2 * m->pcm_off, n * 2 * sizeof(int16_t));
+    m->pcm_off += n;
+    m->pcm_len -= n;
+    return n;
+}
+
+static uint32_t codec_mp3_frame_samples(const codec_mp3_t* m) {
+    return m->seek.frame_samples != 0 ? m->seek.frame_samples
+                                      : MP3_CORE_MAX_FRAME;
+}
+
+static uint64_t codec_mp3_seek(void* arena, uint64_t sample) {
+    codec_mp3_t* m = arena;
+    uint32_t spf = codec_mp3_frame_samples(m);
+    uint64_t frame = sample / spf;
+    m->frame_base =
+        mp3_seek_to(&m->seek, m->stream, frame > UINT32_MAX ? UINT32_MAX
+                                                            : frame);
+    mp3_core_reset(&m->core, stream_reader_tell(m->stream));
+    m->pcm_len = 0;
+    return (uint64_t)m->frame_base * spf;
+}
+
+static void codec_mp3_get_info(void* arena, audio_codec_info_t* info) {
+    codec_mp3_t* m = arena;
+    uint32_t spf = codec_mp3_frame_samples(m);
+    memset(info, 0, sizeof(audio_codec_info_t));
+    info->sample_rate = m->core.sample_rate != 0 ? m->core.sample_rate
+                                                 : m->seek.sample_rate;
+    info->channels = m->core.channels;
+    info->bitrate = m->core.bitrate;
+    info->position = (uint64_t)(m->frame_base + m->core.position) * spf;
+    info->length = (uint64_t)m->seek.frames * spf;
+    info->frames = m->core.frames;
+    info->errors = m->core.errors;
+}
+
+static void codec_mp3_close(void* arena) {
+    codec_mp3_t* m = arena;
+    mp3_core_deinit(&m->core);
+}
+
+const audio_codec_t audio_codec_mp3 = {
+    .name = "mp3",
+    .probe = codec_mp3_probe,
+    .query_mem = codec_mp3_query_mem,
+    .open = codec_mp3_open,
+    .decode = codec_mp3_decode,
+    .seek = codec_mp3_seek,
+    .get_info = codec_mp3_get_info,
+    .close = codec_mp3_close,
+};
@@ -0,0 +1,173 @@
+#include "audio_codec.h"
+#include "esp_log.h"
+#include <string.h>
+
+#if CONFIG_AUDIO_DEC_WAV
+
+// Frames converted per read when the file is not 16-bit stereo
+#define CODEC_WAV_CHUNK 256
+// Largest frame converted: 8 channels of 32 bits
+#define CODEC_WAV_MAX_ALIGN 32
+
+typedef struct {
+    stream_reader_t* stream;
+    uint64_t data_start;
+    uint64_t frames; // in the data chunk
+    uint64_t position;
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t bits;
+    uint16_t align; // bytes per frame
+    uint8_t buf[CODEC_WAV_CHUNK * CODEC_WAV_MAX_ALIGN];
+} codec_wav_t;
+
+static uint16_t codec_wav_le16(const uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t codec_wav_le32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool codec_wav_probe(const uint8_t* head, size_t len,
+                            const char* path) {
+    return len >= 12 && memcmp(head, "RIFF", 4) == 0 &&
+           memcmp(head + 8, "WAVE", 4) == 0;
+}
+
+static size_t codec_wav_query_mem(const uint8_t* head, size_t len) {
+    return sizeof(codec_wav_t);
+}
+
+static bool codec_wav_open(void* arena, stream_reader_t* stream,
+                           const char* path) {
+    codec_wav_t* w = arena;
+    memset(w, 0, sizeof(codec_wav_t));
+    w->stream = stream;
+
+    uint8_t hdr[40];
+    uint64_t at = stream_reader_tell(stream) + 12;
+    stream_reader_seek(stream, at);
+    // chunks up to data, fmt comes first
+    for (;;) {
+        if (stream_reader_read(stream, hdr, 8) != 8) {
+            return false;
+        }
+        uint32_t size = codec_wav_le32(hdr + 4);
+        at += 8;
+        if (memcmp(hdr, "fmt ", 4) == 0) {
+            size_t n = size < sizeof(hdr) ? size : sizeof(hdr);
+            if (n < 16 || stream_reader_read(stream, hdr, n) != n) {
+                return false;
+            }
+            uint16_t format = codec_wav_le16(hdr);
+            if (format == 0xfffe && n >= 26) {
+                // WAVE_FORMAT_EXTENSIBLE, the subformat GUID leads with it
+                format = codec_wav_le16(hdr + 24);
+            }
+            w->channels = codec_wav_le16(hdr + 2);
+            w->sample_rate = codec_wav_le32(hdr + 4);
+            w->align = codec_wav_le16(hdr + 12);
+            w->bits = codec_wav_le16(hdr + 14);
+            if (format != 1 || w->channels == 0 ||
+                w->align != w->channels * ((w->bits + 7) / 8) ||
+                w->align > CODEC_WAV_MAX_ALIGN ||
+                (w->bits != 8 && w->bits != 16 && w->bits != 24 &&
+                 w->bits != 32)) {
+                ESP_LOGW("CODEC_WAV", "Unsupported format %u, %u bits",
+                         format, w->bits);
+                return false;
+            }
+        } else if (memcmp(hdr, "data", 4) == 0) {
+            if (w->align == 0) {
+                return false;
+            }
+            w->data_start = at;
+            uint64_t left = stream_reader_size(stream) - at;
+            w->frames = (size < left ? size : left) / w->align;
+            return true;
+        }
+        // chunks are padded to even sizes
+        at += size + (size & 1);
+        stream_reader_seek(stream, at);
+    }
+}
+
+// One sample of s, scaled to 16 bits
+static int16_t codec_wav_sample(const codec_wav_t* w, const uint8_t* s) {
+    switch (w->bits) {
+    case 8:
+        return (int16_t)((s[0] - 128) * 256);
+    case 16:
+        return (int16_t)codec_wav_le16(s);
+    case 24:
+        return (int16_t)codec_wav_le16(s + 1);
+    default:
+        return (int16_t)codec_wav_le16(s + 2);
+    }
+}
+
+static size_t codec_wav_decode(void* arena, int16_t* out, size_t frames) {
+    codec_wav_t* w = arena;
+    if (frames > w->frames - w->position) {
+        frames = w->frames - w->position;
+    }
+    if (frames == 0) {
+        return 0;
+    }
+
+    size_t n;
+    if (w->bits == 16 && w->channels == 2) {
+        // already the output format, on little-endian targets
+        n = stream_reader_read(w->stream, (uint8_t*)out, frames * 4) / 4;
+    } else {
+        if (frames > CODEC_WAV_CHUNK) {
+            frames = CODEC_WAV_CHUNK;
+        }
+        n = stream_reader_read(w->stream, w->buf, frames * w->align) /
+            w->align;
+        uint32_t width = w->bits / 8;
+        for (size_t i = 0; i < n; i++) {
+            const uint8_t* f = w->buf + i * w->align;
+            out[2 * i] = codec_wav_sample(w, f);
+            out[2 * i + 1] =
+                codec_wav_sample(w, w->channels > 1 ? f + width : f);
+        }
+    }
+    w->position += n;
+    return n;
+}
+
+static uint64_t codec_wav_seek(void* arena, uint64_t sample) {
+    codec_wav_t* w = arena;
+    w->position = sample < w->frames ? sample : w->frames;
+    stream_reader_seek(w->stream, w->data_start + w->position * w->align);
+    return w->position;
+}
+
+static void codec_wav_get_info(void* arena, audio_codec_info_t* info) {
+    codec_wav_t* w = arena;
+    memset(info, 0, sizeof(audio_codec_info_t));
+    info->sample_rate = w->sample_rate;
+    info->channels = w->channels;
+    info->bits = w->bits;
+    info->bitrate = w->sample_rate * w->align * 8;
+    info->position = w->position;
+    info->length = w->frames;
+}
+
+static void codec_wav_close(void* arena) {
+}
+
+const audio_codec_t audio_codec_wav = {
+    .name = "wav",
+    .probe = codec_wav_probe,
+    .query_mem = codec_wav_query_mem,
+    .open = codec_wav_open,
+    .decode = codec_wav_decode,
+    .seek = codec_wav_seek,
+    .get_info = codec_wav_get_info,
+    .close = codec_wav_close,
+};
+
+#endif
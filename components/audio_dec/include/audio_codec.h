@@ -0,0 +1,69 @@
+#pragma once
+#include "sdkconfig.h"
+#include "stream_reader.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes at the start of a file, after any ID3v2 tag, that the codecs are
+// probed and sized with
+#define AUDIO_CODEC_HEAD 128
+
+typedef struct {
+    uint32_t sample_rate; // 0 until known
+    uint8_t channels;     // of the file, the output is always stereo
+    uint8_t bits;         // per sample of the file, 0 for lossy formats
+    uint32_t bitrate;     // bps, of the last frame or the file's average
+    uint64_t position;    // samples per channel, decoded or sought past
+    uint64_t length;      // samples per channel, 0 while unknown
+    uint32_t frames;      // frames or blocks decoded
+    uint32_t errors;      // corrupt frames or blocks skipped
+} audio_codec_info_t;
+
+// A decoder backend. The caller allocates one arena per track of the size
+// query_mem asks for and all state lives in it: decoding never allocates.
+// Output is interleaved 16-bit stereo, mono is duplicated and channels
+// past the second are dropped.
+typedef struct {
+    const char* name;
+
+    // True if head, the first len bytes of the file, is this format. path
+    // is a hint for formats without a magic number.
+    bool (*probe)(const uint8_t* head, size_t len, const char* path);
+
+    // Arena bytes to play the file starting with head, 0 if it cannot be
+    size_t (*query_mem)(const uint8_t* head, size_t len);
+
+    // Parse the headers from stream, positioned at head, into arena.
+    // path keys state persisted for the file. False if it cannot be played.
+    bool (*open)(void* arena, stream_reader_t* stream, const char* path);
+
+    // Decode up to frames frames into out, frames the caller owns. Offer at
+    // least AUDIO_CODEC_BLOCK for codecs to skip a copy. Returns frames
+    // written, 0 at the end of the stream.
+    size_t (*decode)(void* arena, int16_t* out, size_t frames);
+
+    // Continue from sample, per channel. Returns the sample reached, which
+    // may be short of it for formats that only seek to frame starts.
+    uint64_t (*seek)(void* arena, uint64_t sample);
+
+    void (*get_info)(void* arena, audio_codec_info_t* info);
+
+    // Release what open took besides the arena and the stream
+    void (*close)(void* arena);
+} audio_codec_t;
+
+// Largest MPEG-1 Layer III frame, in frames
+#define AUDIO_CODEC_BLOCK 1152
+
+extern const audio_codec_t audio_codec_mp3;
+#if CONFIG_AUDIO_DEC_WAV
+extern const audio_codec_t audio_codec_wav;
+#endif
+#if CONFIG_AUDIO_DEC_FLAC
+extern const audio_codec_t audio_codec_flac;
+#endif
+
+// The first codec claiming head, nullptr if none does
+const audio_codec_t* audio_codec_probe(const uint8_t* head, size_t len,
+                                       const char* path);
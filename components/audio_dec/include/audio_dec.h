@@ -0,0 +1,55 @@
+#pragma once
+#include "pcm_ring.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Longest track path, in bytes including the terminator
+#define AUDIO_DEC_PATH_MAX 256
+
+typedef struct audio_dec audio_dec_t;
+
+// Called from the decoder task when it starts the queued track
+typedef void (*audio_dec_next_cb_t)(audio_dec_t* dec, void* arg);
+
+typedef struct {
+    const char* format;   // codec of the current track
+    uint32_t frames;      // frames or blocks decoded of the current track
+    uint32_t errors;      // corrupt frames skipped in the current track
+    uint64_t decode_us;   // time spent inside the decoder
+    uint32_t sample_rate; // of the current track
+    uint32_t bitrate;     // of the last decoded frame, in bps
+    uint32_t read_stalls; // waits on the file read-ahead
+    uint32_t read_stall_us_max;
+    uint32_t position_ms;
+    uint32_t duration_ms; // 0 until known
+    uint32_t seek_us;     // time taken by the last seek
+    uint32_t tracks;      // started, the first one included
+    bool ended;           // the last track is decoded
+} audio_dec_stats_t;
+
+// Open an MP3, WAV or FLAC file, picked by audio_codec_probe, and start
+// decoding it into ring in its own task.
+// The decoder is the ring's only producer, one runs at a time.
+// Returns nullptr if the file cannot be opened or a decoder is running.
+audio_dec_t* audio_dec_start(const char* path, pcm_ring_t* ring);
+
+// Stop the decoder task and release its resources
+void audio_dec_stop(audio_dec_t* dec);
+
+// Play path after the current track without a gap. It is opened and its
+// start decoded CONFIG_AUDIO_DEC_PRELOAD_MS before the current track ends,
+// and the encoder delay and padding of MP3s are trimmed when they have a
+// LAME header. Returns false if a track is already queued or the decoder
+// has ended.
+bool audio_dec_queue(audio_dec_t* dec, const char* path);
+
+// Call cb when the queued track starts, to queue the one after it
+void audio_dec_set_next_cb(audio_dec_t* dec, audio_dec_next_cb_t cb,
+                           void* arg);
+
+// Jump to ms in the current track, done by the decoder task before its
+// next frame. Called right after audio_dec_start it resumes a track from
+// a saved position.
+void audio_dec_seek(audio_dec_t* dec, uint32_t ms);
+
+void audio_dec_get_stats(audio_dec_t* dec, audio_dec_stats_t* stats);
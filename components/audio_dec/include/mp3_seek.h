@@ -0,0 +1,70 @@
+#pragma once
+#include "stream_reader.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Seek index of one MP3 file. The VBRI table of the file is used as is,
+// a Xing TOC gives approximate seeks. Files with neither get a sparse
+// table of frame offsets, built while the file is played or scanned and
+// persisted with mp3_seek_save, so later seeks jump to a nearby frame and
+// step over at most step - 1 frame headers.
+typedef struct {
+    uint64_t data_start;   // file offset of the first audio frame
+    uint32_t data_bytes;   // from the Xing or VBRI header, 0 if unknown
+    uint32_t frames;       // audio frames, 0 until known
+    uint32_t sample_rate;  // of the first frame
+    uint16_t frame_samples; // samples per channel per frame
+    uint16_t enc_delay;    // LAME encoder delay, in samples
+    uint16_t enc_padding;  // LAME end padding, in samples
+    bool has_toc;          // toc holds a Xing TOC
+    uint8_t toc[100];      // data_bytes at each percent, in 1/256
+    uint64_t toc_base;     // file offset the TOC counts from
+
+    // offsets[i] is the file offset of frame i * step, caller-owned
+    uint32_t* offsets;
+    uint32_t count;
+    uint32_t max;
+    uint32_t step;
+    bool complete; // the table covers the whole file and frames is exact
+    bool exact;    // the frame index after the last mp3_seek_to is exact,
+                   // frames past an estimate must not be added
+} mp3_seek_t;
+
+// Parse the first frame at the current position of stream for a Xing,
+// VBRI and LAME header. Leaves the stream at the first audio frame.
+// The table is kept in offsets, max entries, the step grows to keep
+// within it.
+void mp3_seek_init(mp3_seek_t* seek, stream_reader_t* stream,
+                   uint32_t* offsets, uint32_t max);
+
+// Note that frame starts at offset. The table grows while frames are
+// noted in order from the start of the file.
+void mp3_seek_add(mp3_seek_t* seek, uint32_t frame, uint64_t offset);
+
+// Note the end of the file after frames frames
+void mp3_seek_end(mp3_seek_t* seek, uint32_t frames);
+
+// Position stream at frame. Jumps through the table or the TOC, then
+// steps over frame headers, noting them, to reach frame. Returns the
+// frame the stream is at: frame itself, an estimate after a TOC jump, or
+// the frame count when frame is past the end. Sets exact.
+uint32_t mp3_seek_to(mp3_seek_t* seek, stream_reader_t* stream,
+                     uint32_t frame);
+
+// Build the whole table by stepping over every frame header, leaves the
+// stream at the end of the file
+void mp3_seek_scan(mp3_seek_t* seek, stream_reader_t* stream);
+
+// Frame at ms, and ms of frame
+uint32_t mp3_seek_frame_at(const mp3_seek_t* seek, uint32_t ms);
+uint32_t mp3_seek_ms_of(const mp3_seek_t* seek, uint32_t frame);
+
+// Load a complete table persisted for this file, identified by its size
+// and mtime. False if there is none or it is stale.
+bool mp3_seek_load(mp3_seek_t* seek, const char* table_path, uint32_t size,
+                   uint32_t mtime);
+
+// Persist a complete table, false if it is incomplete or cannot be
+// written
+bool mp3_seek_save(const mp3_seek_t* seek, const char* table_path,
+                   uint32_t size, uint32_t mtime);
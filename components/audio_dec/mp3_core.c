@@ -0,0 +1,192 @@
+#include "mp3_core.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <stdatomic.h>
+#include <string.h>
+#include "mp3common.h"
+
+#if CONFIG_SYS_MEM_STATIC
+// Decoders made by mp3_core_reserve and handed out by init, so tracks
+// open without allocating. One for the playing track, one for the queued.
+#define MP3_CORE_POOL 2
+
+static HMP3Decoder pool[MP3_CORE_POOL];
+static _Atomic bool pool_used[MP3_CORE_POOL];
+
+bool mp3_core_reserve(void) {
+    for (int i = 0; i < MP3_CORE_POOL; i++) {
+        if (pool[i] == NULL && (pool[i] = MP3InitDecoder()) == NULL) {
+            ESP_LOGE("MP3_CORE", "%s decoder allocation failed", __func__);
+            return false;
+        }
+    }
+    return true;
+}
+
+static HMP3Decoder mp3_core_take(void) {
+    for (int i = 0; i < MP3_CORE_POOL; i++) {
+        if (pool[i] != NULL && !atomic_exchange(&pool_used[i], true)) {
+            return pool[i];
+        }
+    }
+    return NULL;
+}
+
+static void mp3_core_give(HMP3Decoder hdec) {
+    for (int i = 0; i < MP3_CORE_POOL; i++) {
+        if (pool[i] == hdec) {
+            atomic_store(&pool_used[i], false);
+        }
+    }
+}
+
+#else
+bool mp3_core_reserve(void) {
+    return true;
+}
+#endif
+
+// Empty the bit reservoir, so the first frames decoded do not reach back
+// into data of the previous position. The filter history is kept, which
+// smears at most one frame across the jump. Helix has no reset of its
+// own, this keeps seeks from freeing and allocating a decoder.
+static void mp3_core_drop_reservoir(HMP3Decoder hdec) {
+    MP3DecInfo* info = hdec;
+    info->mainDataBegin = 0;
+    info->mainDataBytes = 0;
+}
+
+bool mp3_core_init(mp3_core_t* core, uint64_t offset) {
+    memset(core, 0, sizeof(mp3_core_t));
+#if CONFIG_SYS_MEM_STATIC
+    core->hdec = mp3_core_take();
+    if (core->hdec == NULL) {
+        ESP_LOGE("MP3_CORE", "%s no free decoder", __func__);
+        return false;
+    }
+    mp3_core_drop_reservoir(core->hdec);
+#else
+    core->hdec = MP3InitDecoder();
+    if (core->hdec == NULL) {
+        ESP_LOGE("MP3_CORE", "%s decoder allocation failed", __func__);
+        return false;
+    }
+#endif
+    core->in_ptr = core->in;
+    core->in_base = offset;
+    return true;
+}
+
+bool mp3_core_reset(mp3_core_t* core, uint64_t offset) {
+    mp3_core_drop_reservoir(core->hdec);
+    core->in_ptr = core->in;
+    core->in_left = 0;
+    core->in_base = offset;
+    core->eof = false;
+    core->position = 0;
+    return true;
+}
+
+void mp3_core_deinit(mp3_core_t* core) {
+    if (core->hdec != NULL) {
+#if CONFIG_SYS_MEM_STATIC
+        mp3_core_give(core->hdec);
+#else
+        MP3FreeDecoder(core->hdec);
+#endif
+        core->hdec = NULL;
+    }
+}
+
+// Move the unconsumed tail to the front of the input buffer and top it up
+static void mp3_core_refill(mp3_core_t* core, mp3_core_read_t read,
+                            void* arg) {
+    if (core->eof) {
+        return;
+    }
+    if (core->in_left > 0 && core->in_ptr != core->in) {
+        memmove(core->in, core->in_ptr, core->in_left);
+    }
+    core->in_base += core->in_ptr - core->in;
+    core->in_ptr = core->in;
+    if (core->in_left >= MP3_CORE_IN_SIZE) {
+        return;
+    }
+
+    size_t n = read(arg, core->in + core->in_left,
+                    MP3_CORE_IN_SIZE - core->in_left);
+    if (n == 0) {
+        core->eof = true;
+    }
+    core->in_left += n;
+}
+
+int mp3_core_decode(mp3_core_t* core, mp3_core_read_t read, void* arg,
+                    int16_t* out) {
+    for (;;) {
+        if (core->in_left < MP3_CORE_IN_SIZE / 2) {
+            mp3_core_refill(core, read, arg);
+        }
+        if (core->in_left == 0) {
+            return 0;
+        }
+
+        int offset = MP3FindSyncWord(core->in_ptr, core->in_left);
+        if (offset < 0) {
+            // no sync word in the buffer, keep the last byte in case it
+            // starts one
+            core->in_ptr += core->in_left - 1;
+            core->in_left = 1;
+            if (core->eof) {
+                return 0;
+            }
+            continue;
+        }
+        core->in_ptr += offset;
+        core->in_left -= offset;
+        uint64_t frame_offset = core->in_base + (core->in_ptr - core->in);
+
+        int ret = MP3Decode(core->hdec, &core->in_ptr, &core->in_left, out, 0);
+        switch (ret) {
+        case ERR_MP3_NONE: {
+            MP3FrameInfo info;
+            MP3GetLastFrameInfo(core->hdec, &info);
+            core->sample_rate = info.samprate;
+            core->bitrate = info.bitrate;
+            core->channels = info.nChans;
+            core->frames++;
+            core->position++;
+            core->frame_offset = frame_offset;
+
+            int samples = info.outputSamps / info.nChans;
+            if (info.nChans == 1) {
+                // duplicate mono into both channels, back to front
+                for (int i = samples - 1; i >= 0; i--) {
+                    out[2 * i + 1] = out[i];
+                    out[2 * i] = out[i];
+                }
+            }
+            return samples;
+        }
+        case ERR_MP3_INDATA_UNDERFLOW:
+            if (core->eof) {
+                return 0;
+            }
+            mp3_core_refill(core, read, arg);
+            break;
+        case ERR_MP3_MAINDATA_UNDERFLOW:
+            // bit reservoir not filled yet, frame is dropped by the decoder
+            core->position++;
+            break;
+        default:
+            // corrupt frame, skip past this sync word and resync
+            ESP_LOGD("MP3_CORE", "%s decode error: %d", __func__, ret);
+            core->errors++;
+            if (core->in_left > 0) {
+                core->in_ptr++;
+                core->in_left--;
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "mp3dec.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest MP3 frame at 320 kbps / 32 kHz plus padding is 1441 bytes, keep
+// room for two so a frame never straddles a refill.
+#define MP3_CORE_IN_SIZE 4096
+// Samples per channel in the largest (MPEG-1 Layer III) frame
+#define MP3_CORE_MAX_FRAME (MAX_NGRAN * MAX_NSAMP)
+
+// Reads up to len bytes into buf, returns the number of bytes read (0 on EOF)
+typedef size_t (*mp3_core_read_t)(void* arg, uint8_t* buf, size_t len);
+
+typedef struct {
+    HMP3Decoder hdec;
+    uint8_t in[MP3_CORE_IN_SIZE];
+    uint8_t* in_ptr;
+    int in_left;
+    uint64_t in_base; // file offset of in[0]
+    bool eof;
+    uint32_t sample_rate;
+    uint32_t bitrate;
+    uint8_t channels;
+    uint32_t frames;
+    uint32_t errors;
+    uint32_t position;     // frames consumed since init or reset
+    uint64_t frame_offset; // file offset of the last frame decoded
+} mp3_core_t;
+
+// Create the decoders of the static-allocation mode
+// (CONFIG_SYS_MEM_STATIC) at boot, a no-op otherwise
+bool mp3_core_reserve(void);
+
+// offset is the file offset of the first byte read
+bool mp3_core_init(mp3_core_t* core, uint64_t offset);
+
+// Drop buffered input and the bit reservoir after the file was
+// repositioned to offset. Never allocates.
+bool mp3_core_reset(mp3_core_t* core, uint64_t offset);
+
+void mp3_core_deinit(mp3_core_t* core);
+
+// Decode the next frame into out as interleaved 16-bit stereo.
+// out must hold MP3_CORE_MAX_FRAME * 2 samples.
+// Returns samples per channel, 0 at end of stream.
+int mp3_core_decode(mp3_core_t* core, mp3_core_read_t read, void* arg,
+                    int16_t* out);
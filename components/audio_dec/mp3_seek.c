@@ -0,0 +1,405 @@
+#include "mp3_seek.h"
+#include "esp_log.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MP3_SEEK_MAGIC 0x53525541 // "AURS"
+#define MP3_SEEK_VERSION 1
+// Frames between the entries of a new table, about 0.2 s at 44.1 kHz
+#define MP3_SEEK_STEP 8
+// Bytes of the first frame read for the Xing, VBRI and LAME headers
+#define MP3_SEEK_HEAD 512
+// The VBRI header follows the 32 bytes of side info of any frame
+#define MP3_SEEK_VBRI_AT 36
+
+// Persisted table, followed by count offsets
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t frame_samples;
+    uint32_t size;  // of the MP3, identifies it with mtime
+    uint32_t mtime;
+    uint32_t data_start;
+    uint32_t frames;
+    uint32_t sample_rate;
+    uint32_t step;
+    uint32_t count;
+} mp3_seek_file_t;
+
+typedef struct {
+    uint32_t len; // bytes, header included
+    uint32_t sample_rate;
+    uint16_t samples; // per channel
+    uint8_t side;     // side info bytes after the header
+} mp3_seek_hdr_t;
+
+// Layer III bitrates in kbps, MPEG-1 then MPEG-2 and 2.5
+static const uint16_t mp3_seek_kbps[2][16] = {
+    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},
+    {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+};
+// Sample rates by version bits: MPEG-2.5, reserved, MPEG-2, MPEG-1
+static const uint16_t mp3_seek_rates[4][3] = {
+    {11025, 12000, 8000},
+    {0, 0, 0},
+    {22050, 24000, 16000},
+    {44100, 48000, 32000},
+};
+
+static uint32_t mp3_seek_be32(const uint8_t* b) {
+    return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+// Parse a Layer III frame header, false if h is not one
+static bool mp3_seek_parse(const uint8_t* h, mp3_seek_hdr_t* hdr) {
+    if (h[0] != 0xff || (h[1] & 0xe0) != 0xe0) {
+        return false;
+    }
+    int ver = (h[1] >> 3) & 3;
+    int layer = (h[1] >> 1) & 3;
+    int br = h[2] >> 4;
+    int sr = (h[2] >> 2) & 3;
+    if (ver == 1 || layer != 1 || br == 0 || br == 15 || sr == 3) {
+        return false;
+    }
+    bool mpeg1 = ver == 3;
+    bool mono = (h[3] >> 6) == 3;
+    uint32_t kbps = mp3_seek_kbps[mpeg1 ? 0 : 1][br];
+    hdr->sample_rate = mp3_seek_rates[ver][sr];
+    hdr->samples = mpeg1 ? 1152 : 576;
+    hdr->len = (mpeg1 ? 144000 : 72000) * kbps / hdr->sample_rate +
+               ((h[2] >> 1) & 1);
+    hdr->side = mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17);
+    return true;
+}
+
+// Consume len bytes without copying them
+static void mp3_seek_skip(stream_reader_t* stream, uint64_t len) {
+    while (len > 0) {
+        const uint8_t* ptr;
+        size_t n = stream_reader_peek(stream, &ptr, portMAX_DELAY);
+        if (n == 0) {
+            return;
+        }
+        if (n > len) {
+            n = len;
+        }
+        stream_reader_consume(stream, n);
+        len -= n;
+    }
+}
+
+// Move stream to the next frame header, checking the one after it when
+// it is in view. False at end of file.
+static bool mp3_seek_sync(stream_reader_t* stream) {
+    for (;;) {
+        const uint8_t* p;
+        size_t n = stream_reader_peek(stream, &p, portMAX_DELAY);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 4) {
+            // a header split over two blocks is missed, the next is not
+            stream_reader_consume(stream, 1);
+            continue;
+        }
+        for (size_t i = 0; i + 4 <= n; i++) {
+            mp3_seek_hdr_t hdr, next;
+            if (p[i] != 0xff || !mp3_seek_parse(p + i, &hdr)) {
+                continue;
+            }
+            if (i + hdr.len + 4 <= n &&
+                !mp3_seek_parse(p + i + hdr.len, &next)) {
+                continue;
+            }
+            stream_reader_consume(stream, i);
+            return true;
+        }
+        stream_reader_consume(stream, n - 3);
+    }
+}
+
+// Xing or Info header at p, n bytes in view, of the frame at frame_start
+static void mp3_seek_xing(mp3_seek_t* seek, const uint8_t* p, size_t n,
+                          uint64_t frame_start) {
+    const uint8_t* end = p + n;
+    uint32_t flags = mp3_seek_be32(p + 4);
+    const uint8_t* q = p + 8;
+    if ((flags & 1) && q + 4 <= end) {
+        seek->frames = mp3_seek_be32(q);
+        q += 4;
+    }
+    if ((flags & 2) && q + 4 <= end) {
+        seek->data_bytes = mp3_seek_be32(q);
+        q += 4;
+    }
+    if ((flags & 4) && q + 100 <= end) {
+        memcpy(seek->toc, q, 100);
+        seek->has_toc = seek->frames != 0 && seek->data_bytes != 0;
+        seek->toc_base = frame_start;
+        q += 100;
+    }
+    if (flags & 8) {
+        q += 4; // quality
+    }
+    // LAME extension: 9 bytes of encoder version, then delay and padding
+    // as two 12-bit fields 21 bytes in
+    if (q + 24 <= end && memcmp(q, "LAME", 4) == 0) {
+        seek->enc_delay = (q[21] << 4) | (q[22] >> 4);
+        seek->enc_padding = ((q[22] & 0x0f) << 8) | q[23];
+    }
+}
+
+// VBRI header at p, n bytes in view. Its table holds the bytes of every
+// frames-per-entry frames from the first audio frame, so it is used as
+// the frame table when it fits in view.
+static void mp3_seek_vbri(mp3_seek_t* seek, const uint8_t* p, size_t n) {
+    if (n < 26) {
+        return;
+    }
+    seek->data_bytes = mp3_seek_be32(p + 10);
+    seek->frames = mp3_seek_be32(p + 14);
+    uint32_t entries = (p[18] << 8) | p[19];
+    uint32_t scale = (p[20] << 8) | p[21];
+    uint32_t size = (p[22] << 8) | p[23];
+    uint32_t per_entry = (p[24] << 8) | p[25];
+    if (seek->frames == 0 || size == 0 || size > 4 || per_entry == 0 ||
+        26 + entries * size > n) {
+        return;
+    }
+    seek->step = per_entry;
+    uint64_t offset = seek->data_start;
+    for (uint32_t i = 0; i < entries && i * per_entry < seek->frames; i++) {
+        mp3_seek_add(seek, i * per_entry, offset);
+        uint32_t bytes = 0;
+        for (uint32_t b = 0; b < size; b++) {
+            bytes = (bytes << 8) | p[26 + i * size + b];
+        }
+        offset += (uint64_t)bytes * scale;
+    }
+    seek->complete = seek->count > 0;
+}
+
+void mp3_seek_init(mp3_seek_t* seek, stream_reader_t* stream,
+                   uint32_t* offsets, uint32_t max) {
+    memset(seek, 0, sizeof(mp3_seek_t));
+    seek->offsets = offsets;
+    seek->max = max;
+    seek->step = MP3_SEEK_STEP;
+    seek->exact = true;
+
+    mp3_seek_sync(stream);
+    seek->data_start = stream_reader_tell(stream);
+    uint8_t buf[MP3_SEEK_HEAD];
+    size_t n = stream_reader_read(stream, buf, sizeof(buf));
+    mp3_seek_hdr_t hdr;
+    if (n >= 4 && mp3_seek_parse(buf, &hdr)) {
+        seek->sample_rate = hdr.sample_rate;
+        seek->frame_samples = hdr.samples;
+        uint64_t frame_start = seek->data_start;
+        uint32_t x = 4 + hdr.side;
+        // the tag frame decodes to silence, audio starts after it
+        if (x + 8 <= n && (memcmp(buf + x, "Xing", 4) == 0 ||
+                           memcmp(buf + x, "Info", 4) == 0)) {
+            seek->data_start += hdr.len;
+            mp3_seek_xing(seek, buf + x, n - x, frame_start);
+        } else if (MP3_SEEK_VBRI_AT + 4 <= n &&
+                   memcmp(buf + MP3_SEEK_VBRI_AT, "VBRI", 4) == 0) {
+            seek->data_start += hdr.len;
+            mp3_seek_vbri(seek, buf + MP3_SEEK_VBRI_AT,
+                          n - MP3_SEEK_VBRI_AT);
+        }
+    }
+    stream_reader_seek(stream, seek->data_start);
+}
+
+void mp3_seek_add(mp3_seek_t* seek, uint32_t frame, uint64_t offset) {
+    if (seek->complete || frame % seek->step != 0 ||
+        frame / seek->step != seek->count) {
+        return;
+    }
+    if (seek->count == seek->max) {
+        // full: keep every other entry at twice the step
+        for (uint32_t i = 0; 2 * i < seek->count; i++) {
+            seek->offsets[i] = seek->offsets[2 * i];
+        }
+        seek->count = (seek->count + 1) / 2;
+        seek->step *= 2;
+        if (frame % seek->step != 0) {
+            return;
+        }
+    }
+    seek->offsets[seek->count++] = offset;
+}
+
+void mp3_seek_end(mp3_seek_t* seek, uint32_t frames) {
+    if (seek->complete || frames == 0) {
+        return;
+    }
+    // every step-th frame noted up to the last one
+    if (seek->count == (frames - 1) / seek->step + 1) {
+        seek->frames = frames;
+        seek->complete = true;
+    }
+}
+
+// Step over frame headers from *frame to target, noting them when the
+// frame index is exact. Stops early at the end of the file.
+static void mp3_seek_hop(mp3_seek_t* seek, stream_reader_t* stream,
+                         uint32_t* frame, uint32_t target, bool exact) {
+    while (*frame < target) {
+        uint64_t offset = stream_reader_tell(stream);
+        uint8_t h[4];
+        mp3_seek_hdr_t hdr;
+        size_t n = stream_reader_read(stream, h, sizeof(h));
+        if (n < sizeof(h) || !mp3_seek_parse(h, &hdr)) {
+            // the end, an ID3v1 tag or damage, the decoder resyncs
+            if (exact && (n < sizeof(h) || memcmp(h, "TAG", 3) == 0)) {
+                mp3_seek_end(seek, *frame);
+            }
+            stream_reader_seek(stream, offset);
+            return;
+        }
+        if (exact) {
+            mp3_seek_add(seek, *frame, offset);
+        }
+        mp3_seek_skip(stream, hdr.len - sizeof(h));
+        (*frame)++;
+    }
+}
+
+uint32_t mp3_seek_to(mp3_seek_t* seek, stream_reader_t* stream,
+                     uint32_t frame) {
+    if (seek->frames != 0 && frame > seek->frames) {
+        frame = seek->frames;
+    }
+
+    uint32_t at = 0;
+    uint64_t offset = seek->data_start;
+    bool exact = true;
+    uint32_t entry = frame / seek->step;
+    if (seek->count > 0 &&
+        (entry < seek->count || seek->complete || !seek->has_toc)) {
+        // through the table, or from its last entry onwards
+        if (entry >= seek->count) {
+            entry = seek->count - 1;
+        }
+        at = entry * seek->step;
+        offset = seek->offsets[entry];
+    } else if (seek->has_toc) {
+        uint32_t pct = (uint64_t)frame * 100 / seek->frames;
+        if (pct > 99) {
+            pct = 99;
+        }
+        at = (uint64_t)pct * seek->frames / 100;
+        offset = seek->toc_base +
+                 (uint64_t)seek->toc[pct] * seek->data_bytes / 256;
+        exact = false;
+    }
+
+    stream_reader_seek(stream, offset);
+    const uint8_t* p;
+    mp3_seek_hdr_t hdr;
+    if (stream_reader_peek(stream, &p, portMAX_DELAY) < 4 ||
+        !mp3_seek_parse(p, &hdr)) {
+        // TOC offsets are not frame aligned, a stale table neither
+        mp3_seek_sync(stream);
+        exact = false;
+    }
+    mp3_seek_hop(seek, stream, &at, frame, exact);
+    seek->exact = exact;
+    return at;
+}
+
+void mp3_seek_scan(mp3_seek_t* seek, stream_reader_t* stream) {
+    if (seek->complete) {
+        return;
+    }
+    // from the last entry, not through the TOC, so every frame is exact
+    uint32_t at = 0;
+    uint64_t offset = seek->data_start;
+    if (seek->count > 0) {
+        at = (seek->count - 1) * seek->step;
+        offset = seek->offsets[seek->count - 1];
+    }
+    stream_reader_seek(stream, offset);
+    mp3_seek_hop(seek, stream, &at, UINT32_MAX, true);
+}
+
+uint32_t mp3_seek_frame_at(const mp3_seek_t* seek, uint32_t ms) {
+    if (seek->frame_samples == 0) {
+        return 0;
+    }
+    return (uint64_t)ms * seek->sample_rate / 1000 / seek->frame_samples;
+}
+
+uint32_t mp3_seek_ms_of(const mp3_seek_t* seek, uint32_t frame) {
+    if (seek->sample_rate == 0) {
+        return 0;
+    }
+    return (uint64_t)frame * seek->frame_samples * 1000 / seek->sample_rate;
+}
+
+bool mp3_seek_load(mp3_seek_t* seek, const char* table_path, uint32_t size,
+                   uint32_t mtime) {
+    // plain file descriptors, stdio would allocate a FILE and its buffer
+    int fd = open(table_path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    mp3_seek_file_t hdr;
+    bool ok = read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+              hdr.magic == MP3_SEEK_MAGIC &&
+              hdr.version == MP3_SEEK_VERSION && hdr.size == size &&
+              hdr.mtime == mtime && hdr.data_start == seek->data_start &&
+              hdr.step != 0 && hdr.count <= seek->max &&
+              read(fd, seek->offsets, hdr.count * sizeof(uint32_t)) ==
+                  (ssize_t)(hdr.count * sizeof(uint32_t));
+    close(fd);
+    if (!ok) {
+        seek->count = 0;
+        return false;
+    }
+    seek->frames = hdr.frames;
+    seek->sample_rate = hdr.sample_rate;
+    seek->frame_samples = hdr.frame_samples;
+    seek->step = hdr.step;
+    seek->count = hdr.count;
+    seek->complete = true;
+    return true;
+}
+
+bool mp3_seek_save(const mp3_seek_t* seek, const char* table_path,
+                   uint32_t size, uint32_t mtime) {
+    if (!seek->complete) {
+        return false;
+    }
+    int fd = open(table_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ESP_LOGW("MP3_SEEK", "%s failed to create %s", __func__, table_path);
+        return false;
+    }
+    mp3_seek_file_t hdr = {
+        .magic = MP3_SEEK_MAGIC,
+        .version = MP3_SEEK_VERSION,
+        .frame_samples = seek->frame_samples,
+        .size = size,
+        .mtime = mtime,
+        .data_start = seek->data_start,
+        .frames = seek->frames,
+        .sample_rate = seek->sample_rate,
+        .step = seek->step,
+        .count = seek->count,
+    };
+    bool ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+              write(fd, seek->offsets, seek->count * sizeof(uint32_t)) ==
+                  (ssize_t)(seek->count * sizeof(uint32_t));
+    ok = close(fd) == 0 && ok;
+    if (!ok) {
+        // a short file fails the count check on load
+        ESP_LOGW("MP3_SEEK", "%s failed to write %s", __func__, table_path);
+    }
+    return ok;
+}
@@ -1,12 +1,72 @@
 #include "bt_a2dp.h"
 #include "bt_core.h"
+#include "bt_dlog.h"
 #include "esp_a2dp_api.h"
 #include "esp_avrc_api.h"
 #include "esp_gap_bt_api.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "pcm_eq.h"
+#include "pcm_gain.h"
 #include "sdkconfig.h"
+#include "sys_boot.h"
+#include <stdatomic.h>
+#include <string.h>
 
 static bt_ctx_t* bt_ctx = nullptr;
+static pcm_ring_t* pcm_ring = nullptr;
+// software volume, unity while the sink does absolute volume
+static pcm_gain_t pcm_gain;
+// equalizer ahead of the volume, bypassed without bands
+static pcm_eq_t* pcm_eq = nullptr;
+// depth the decoder fills pcm_ring to, adapted in the data callback
+static pcm_jitter_t pcm_jitter;
+
+// last connected sink as stored in NVS
+static esp_bd_addr_t nvs_peer_bda;
+static bool nvs_peer_valid = false;
+// connecting straight to the stored sink, inquiry is the fallback
+static bool fast_connecting = false;
+static bool audio_started = false;
+static const char* connect_path = "inquiry";
+
+// Private events on BT_SIG_A2DP, above the esp_a2d_cb_event_t range
+enum {
+    BT_A2DP_TMR_CONNECT = 0xff00, // connect attempt timed out
+    BT_A2DP_TMR_RECONNECT,        // next connect attempt is due
+    BT_A2DP_TMR_MEDIA,            // media command retry or ack timeout
+    BT_A2DP_EVT_SUSPEND,          // bt_a2dp_suspend
+    BT_A2DP_EVT_RESUME,           // bt_a2dp_resume
+    BT_A2DP_EVT_IDLE,             // bt_a2dp_idle
+    BT_A2DP_TMR_IDLE,             // look for sound while idle
+};
+
+// Private events on BT_SIG_AVRC_CT, above the esp_avrc_ct_cb_event_t range
+enum {
+    BT_A2DP_EVT_VOLUME = 0xff00, // bt_a2dp_set_volume, param the volume
+};
+
+// retry delays, doubled on each failure and reset on success
+static uint32_t connect_retry_ms = CONFIG_BT_A2DP_RETRY_MIN_MS;
+static uint32_t media_retry_ms = CONFIG_BT_A2DP_MEDIA_RETRY_MS;
+static bool media_paused = false;
+
+// Samples within this of zero are silence, about -66 dBFS
+#define BT_A2DP_SILENCE 16
+// Period of the look for sound while idle
+#define BT_A2DP_IDLE_POLL_MS 100
+
+// suspended by bt_a2dp_idle, until there is sound. The core task then
+// drains silence from the ring, a second reader beside the data callback:
+// the callback stops reading once it sees media_idle, the core task only
+// drains while no callback is in the ring. Both sides store their flag
+// before loading the other's, so one of them always backs off.
+static _Atomic bool media_idle;
+static _Atomic bool media_reading;
+// start of the silence sent to the sink, 0 while it gets sound
+static _Atomic int64_t silent_since_us;
 
 static char* bda2str(esp_bd_addr_t bda, char* str, size_t size) {
     if (bda == NULL || str == NULL || size < 18)
@@ -52,6 +112,108 @@ static bool get_name_from_eir(uint8_t* eir, uint8_t* bdname,
     return false;
 }
 
+#if CONFIG_BT_A2DP_FAST_RECONNECT
+// Load the last connected sink from NVS into ctx
+static bool bt_a2dp_peer_load(bt_ctx_t* ctx) {
+    nvs_handle_t nvs;
+    if (nvs_open("bt_a2dp", NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    size_t len = ESP_BD_ADDR_LEN;
+    esp_err_t ret = nvs_get_blob(nvs, "peer_bda", nvs_peer_bda, &len);
+    if (ret == ESP_OK && len == ESP_BD_ADDR_LEN) {
+        nvs_peer_valid = true;
+        memcpy(ctx->peer_bda, nvs_peer_bda, ESP_BD_ADDR_LEN);
+        len = sizeof(ctx->peer_bdname);
+        if (nvs_get_str(nvs, "peer_name", (char*)ctx->peer_bdname, &len) !=
+            ESP_OK) {
+            ctx->peer_bdname[0] = '\0';
+        }
+    }
+    nvs_close(nvs);
+    return nvs_peer_valid;
+}
+#endif
+
+// Store the connected sink, skipped when it is already stored
+static void bt_a2dp_peer_save(bt_ctx_t* ctx) {
+    if (nvs_peer_valid &&
+        memcmp(nvs_peer_bda, ctx->peer_bda, ESP_BD_ADDR_LEN) == 0) {
+        return;
+    }
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open("bt_a2dp", NVS_READWRITE, &nvs);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(nvs, "peer_bda", ctx->peer_bda, ESP_BD_ADDR_LEN);
+        if (ret == ESP_OK) {
+            ret = nvs_set_str(nvs, "peer_name", (char*)ctx->peer_bdname);
+        }
+        if (ret == ESP_OK) {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW("BT_A2DP", "%s failed: %s", __func__, esp_err_to_name(ret));
+        return;
+    }
+    memcpy(nvs_peer_bda, ctx->peer_bda, ESP_BD_ADDR_LEN);
+    nvs_peer_valid = true;
+    ESP_LOGI("BT_A2DP", "Stored peer %s for fast reconnect", ctx->peer_bdname);
+}
+
+static void bt_a2dp_start_discovery(bt_ctx_t* ctx) {
+    ESP_LOGI("BT_A2DP", "Starting device discovery...");
+    ctx->a2dp_state = BT_STATE_DISCOVERING;
+    esp_bt_gap_start_discovery(ESP_BT_INQ_MODE_GENERAL_INQUIRY, 10, 0);
+}
+
+// Connect to ctx->peer_bda, bounded by the connect timeout
+static void bt_a2dp_connect(bt_ctx_t* ctx) {
+    char bda_str[18];
+    ESP_LOGI("BT_A2DP", "a2dp connecting to peer: %s [%s]", ctx->peer_bdname,
+             bda2str(ctx->peer_bda, bda_str, sizeof(bda_str)));
+    ctx->a2dp_state = BT_STATE_CONNECTING;
+    esp_a2d_source_connect(ctx->peer_bda);
+    bt_core_timer_arm(ctx, BT_SIG_A2DP, BT_A2DP_TMR_CONNECT,
+                      CONFIG_BT_A2DP_CONNECT_TIMEOUT_MS);
+}
+
+// Current retry delay, the next one is doubled up to the maximum
+static uint32_t bt_a2dp_backoff(uint32_t* delay_ms) {
+    uint32_t delay = *delay_ms;
+    *delay_ms = delay < CONFIG_BT_A2DP_RETRY_MAX_MS / 2
+                    ? delay * 2
+                    : CONFIG_BT_A2DP_RETRY_MAX_MS;
+    return delay;
+}
+
+static void bt_a2dp_schedule_reconnect(bt_ctx_t* ctx) {
+    uint32_t delay = bt_a2dp_backoff(&connect_retry_ms);
+    ESP_LOGI("BT_A2DP", "a2dp reconnecting in %" PRIu32 " ms", delay);
+    ctx->a2dp_state = BT_STATE_UNCONNECTED;
+    bt_core_timer_arm(ctx, BT_SIG_A2DP, BT_A2DP_TMR_RECONNECT, delay);
+}
+
+// Send a media command, the media timer guards against a lost ack
+static void bt_a2dp_media_cmd(bt_ctx_t* ctx, esp_a2d_media_ctrl_t cmd) {
+    esp_a2d_media_ctrl(cmd);
+    bt_core_timer_arm(ctx, BT_SIG_A2DP, BT_A2DP_TMR_MEDIA,
+                      CONFIG_BT_A2DP_CONNECT_TIMEOUT_MS);
+}
+
+static void bt_a2dp_media_retry(bt_ctx_t* ctx) {
+    bt_core_timer_arm(ctx, BT_SIG_A2DP, BT_A2DP_TMR_MEDIA,
+                      bt_a2dp_backoff(&media_retry_ms));
+}
+
+// The stored sink did not answer, find it again by name
+static void bt_a2dp_fast_connect_failed(bt_ctx_t* ctx) {
+    ESP_LOGW("BT_A2DP", "Stored peer unreachable, falling back to inquiry");
+    fast_connecting = false;
+    bt_a2dp_start_discovery(ctx);
+}
+
 static void filter_inquiry_scan_result(esp_bt_gap_cb_param_t* param) {
     char bda_str[18];
     uint32_t cod = 0;    /* class of device */
@@ -59,9 +221,11 @@ static void filter_inquiry_scan_result(esp_bt_gap_cb_param_t* param) {
     uint8_t* eir = NULL;
     esp_bt_gap_dev_prop_t* p;
 
-    // handle the discovery results
-    ESP_LOGI("BT_A2DP", "Scanned device: %s",
-             bda2str(param->disc_res.bda, bda_str, 18));
+    // handle the discovery results, runs once per device in the Bluedroid
+    // task so the log is deferred
+    uint8_t* bda = param->disc_res.bda;
+    BT_DLOGI("BT_A2DP", "Scanned device: %02x:%02x:%02x:%02x:%02x:%02x",
+             bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
 
     // iterate through device properties
     for (int i = 0; i < param->disc_res.num_prop; i++) {
@@ -69,11 +233,11 @@ static void filter_inquiry_scan_result(esp_bt_gap_cb_param_t* param) {
         switch (p->type) {
         case ESP_BT_GAP_DEV_PROP_COD:
             cod = *(uint32_t*)(p->val);
-            ESP_LOGI("BT_A2DP", "--Class of Device: 0x%" PRIx32, cod);
+            BT_DLOGI("BT_A2DP", "--Class of Device: 0x%" PRIx32, cod);
             break;
         case ESP_BT_GAP_DEV_PROP_RSSI:
             rssi = *(int8_t*)(p->val);
-            ESP_LOGI("BT_A2DP", "--RSSI: %" PRId32, rssi);
+            BT_DLOGI("BT_A2DP", "--RSSI: %" PRId32, rssi);
             break;
         case ESP_BT_GAP_DEV_PROP_EIR:
             eir = (uint8_t*)(p->val);
@@ -96,7 +260,8 @@ static void filter_inquiry_scan_result(esp_bt_gap_cb_param_t* param) {
         get_name_from_eir(eir, bt_ctx->peer_bdname, NULL);
         if (strcmp((char*)bt_ctx->peer_bdname, remote_device_name) == 0) {
             ESP_LOGI("BT_A2DP", "Found a target device, address %s, name %s",
-                     bda_str, bt_ctx->peer_bdname);
+                     bda2str(bda, bda_str, sizeof(bda_str)),
+                     bt_ctx->peer_bdname);
             bt_ctx->a2dp_state = BT_STATE_DISCOVERED;
             memcpy(bt_ctx->peer_bda, param->disc_res.bda, ESP_BD_ADDR_LEN);
             ESP_LOGI("BT_A2DP", "Cancel device discovery ...");
@@ -105,39 +270,11 @@ static void filter_inquiry_scan_result(esp_bt_gap_cb_param_t* param) {
     }
 }
 
-static void bt_a2dp_gap_cb(esp_bt_gap_cb_event_t event,
-                           esp_bt_gap_cb_param_t* param) {
+// GAP events that only need logging or a reply, handled in the core task
+static void bt_a2dp_hdl_gap_evt(bt_ctx_t* ctx, uint16_t event, void* p_param) {
+    esp_bt_gap_cb_param_t* param = (esp_bt_gap_cb_param_t*)(p_param);
+
     switch (event) {
-    /* when device discovered a result, this event comes */
-    case ESP_BT_GAP_DISC_RES_EVT: {
-        if (bt_ctx->a2dp_state == BT_STATE_DISCOVERING) {
-            filter_inquiry_scan_result(param);
-        }
-        break;
-    }
-    /* when discovery state changed, this event comes */
-    case ESP_BT_GAP_DISC_STATE_CHANGED_EVT: {
-        if (param->disc_st_chg.state == ESP_BT_GAP_DISCOVERY_STOPPED) {
-            if (bt_ctx->a2dp_state == BT_STATE_DISCOVERED) {
-                bt_ctx->a2dp_state = BT_STATE_CONNECTING;
-                ESP_LOGI("BT_A2DP", "Device discovery stopped.");
-                ESP_LOGI("BT_A2DP", "a2dp connecting to peer: %s",
-                         bt_ctx->peer_bdname);
-                /* connect source to peer device specified by Bluetooth Device
-                 * Address */
-                esp_a2d_source_connect(bt_ctx->peer_bda);
-            } else {
-                /* not discovered, continue to discover */
-                ESP_LOGI("BT_A2DP",
-                         "Device discovery failed, continue to discover...");
-                esp_bt_gap_start_discovery(ESP_BT_INQ_MODE_GENERAL_INQUIRY, 10,
-                                           0);
-            }
-        } else if (param->disc_st_chg.state == ESP_BT_GAP_DISCOVERY_STARTED) {
-            ESP_LOGI("BT_A2DP", "Discovery started.");
-        }
-        break;
-    }
     /* when authentication completed, this event comes */
     case ESP_BT_GAP_AUTH_CMPL_EVT: {
         if (param->auth_cmpl.stat == ESP_BT_STATUS_SUCCESS) {
@@ -176,6 +313,46 @@ static void bt_a2dp_gap_cb(esp_bt_gap_cb_event_t event,
         ESP_LOGI("BT_A2DP", "ESP_BT_GAP_MODE_CHG_EVT mode: %d",
                  param->mode_chg.mode);
         break;
+
+    /* other */
+    default: {
+        ESP_LOGI("BT_A2DP", "GAP event: %d", event);
+        break;
+    }
+    }
+}
+
+static void bt_a2dp_gap_cb(esp_bt_gap_cb_event_t event,
+                           esp_bt_gap_cb_param_t* param) {
+    switch (event) {
+    /* when device discovered a result, this event comes */
+    case ESP_BT_GAP_DISC_RES_EVT: {
+        if (bt_ctx->a2dp_state == BT_STATE_DISCOVERING) {
+            filter_inquiry_scan_result(param);
+        }
+        break;
+    }
+    /* when discovery state changed, this event comes */
+    case ESP_BT_GAP_DISC_STATE_CHANGED_EVT: {
+        if (param->disc_st_chg.state == ESP_BT_GAP_DISCOVERY_STOPPED) {
+            if (bt_ctx->a2dp_state == BT_STATE_DISCOVERED) {
+                ESP_LOGI("BT_A2DP", "Device discovery stopped.");
+                /* connect source to peer device specified by Bluetooth Device
+                 * Address */
+                bt_a2dp_connect(bt_ctx);
+            } else {
+                /* not discovered, continue to discover */
+                ESP_LOGI("BT_A2DP",
+                         "Device discovery failed, continue to discover...");
+                esp_bt_gap_start_discovery(ESP_BT_INQ_MODE_GENERAL_INQUIRY, 10,
+                                           0);
+            }
+        } else if (param->disc_st_chg.state == ESP_BT_GAP_DISCOVERY_STARTED) {
+            ESP_LOGI("BT_A2DP", "Discovery started.");
+        }
+        break;
+    }
+    /* device name points into stack memory, log it before returning */
     case ESP_BT_GAP_GET_DEV_NAME_CMPL_EVT:
         if (param->get_dev_name_cmpl.status == ESP_BT_STATUS_SUCCESS) {
             ESP_LOGI("BT_A2DP",
@@ -188,33 +365,50 @@ static void bt_a2dp_gap_cb(esp_bt_gap_cb_event_t event,
         }
         break;
 
-    /* other */
-    default: {
-        ESP_LOGI("BT_A2DP", "GAP event: %d", event);
+    /* other events are deferred to the core task at low priority */
+    default:
+        bt_core_dispatch(bt_ctx, BT_SIG_GAP, event, param,
+                         sizeof(esp_bt_gap_cb_param_t));
         break;
     }
-    }
+}
+
+// The sink takes absolute volume commands and reports its own changes
+static bool bt_av_abs_volume(void) {
+    return esp_avrc_rn_evt_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_TEST,
+                                              &bt_ctx->avrc_peer_rn_cap,
+                                              ESP_AVRC_RN_VOLUME_CHANGE);
 }
 
 static void bt_av_volume_changed(void) {
-    if (esp_avrc_rn_evt_bit_mask_operation(ESP_AVRC_BIT_MASK_OP_TEST,
-                                           &bt_ctx->avrc_peer_rn_cap,
-                                           ESP_AVRC_RN_VOLUME_CHANGE)) {
+    if (bt_av_abs_volume()) {
         esp_avrc_ct_send_register_notification_cmd(1, ESP_AVRC_RN_VOLUME_CHANGE,
                                                    0);
     }
 }
 
+// Apply bt_ctx->volume on the sink when it has absolute volume, else in
+// the PCM, never both
+static void bt_av_volume_apply(void) {
+    if (bt_av_abs_volume()) {
+        ESP_LOGI("BT_A2DP_RC", "Set absolute volume: volume %d",
+                 bt_ctx->volume);
+        pcm_gain_set(&pcm_gain, PCM_GAIN_UNITY);
+        esp_avrc_ct_send_set_absolute_volume_cmd(1, bt_ctx->volume);
+    } else {
+        ESP_LOGI("BT_A2DP_RC", "Software volume: volume %d", bt_ctx->volume);
+        pcm_gain_set_volume(&pcm_gain, bt_ctx->volume);
+    }
+}
+
 void bt_av_notify_evt_handler(uint8_t event_id,
                               esp_avrc_rn_param_t* event_parameter) {
     switch (event_id) {
     /* when volume changed locally on target, this event comes */
     case ESP_AVRC_RN_VOLUME_CHANGE: {
+        // the sink applies it, only track it
         ESP_LOGI("BT_A2DP_RC", "Volume changed: %d", event_parameter->volume);
-        ESP_LOGI("BT_A2DP_RC", "Set absolute volume: volume %d",
-                 event_parameter->volume + 5);
-        esp_avrc_ct_send_set_absolute_volume_cmd(1,
-                                                 event_parameter->volume + 5);
+        bt_ctx->volume = event_parameter->volume & 0x7f;
         bt_av_volume_changed();
         break;
     }
@@ -243,7 +437,9 @@ static void bt_a2dp_hdl_avrc_ct_evt(bt_ctx_t* ctx, uint16_t event,
         if (rc->conn_stat.connected) {
             esp_avrc_ct_send_get_rn_capabilities_cmd(0);
         } else {
+            // back to software volume until a sink says otherwise
             ctx->avrc_peer_rn_cap.bits = 0;
+            bt_av_volume_apply();
         }
         break;
     }
@@ -286,6 +482,7 @@ static void bt_a2dp_hdl_avrc_ct_evt(bt_ctx_t* ctx, uint16_t event,
                  rc->get_rn_caps_rsp.evt_set.bits);
         ctx->avrc_peer_rn_cap.bits = rc->get_rn_caps_rsp.evt_set.bits;
 
+        bt_av_volume_apply();
         bt_av_volume_changed();
         break;
     }
@@ -295,6 +492,11 @@ static void bt_a2dp_hdl_avrc_ct_evt(bt_ctx_t* ctx, uint16_t event,
                  rc->set_volume_rsp.volume);
         break;
     }
+    case BT_A2DP_EVT_VOLUME: {
+        ctx->volume = *(uint8_t*)p_param & 0x7f;
+        bt_av_volume_apply();
+        break;
+    }
     /* other */
     default: {
         ESP_LOGE("BT_A2DP_RC", "%s unhandled event: %d", __func__, event);
@@ -307,14 +509,27 @@ static void bt_a2dp_hdl_avrc_ct_evt(bt_ctx_t* ctx, uint16_t event,
 static void bt_a2dp_rc_ct_cb(esp_avrc_ct_cb_event_t event,
                              esp_avrc_ct_cb_param_t* param) {
     switch (event) {
-    case ESP_AVRC_CT_CONNECTION_STATE_EVT:
+    case ESP_AVRC_CT_CONNECTION_STATE_EVT: {
+        bt_core_dispatch_ex(bt_ctx, BT_SIG_AVRC_CT, event, param,
+                            sizeof(esp_avrc_ct_cb_param_t), BT_MSG_F_CRITICAL);
+        break;
+    }
+    case ESP_AVRC_CT_CHANGE_NOTIFY_EVT: {
+        // only the latest volume matters
+        uint8_t flags =
+            param->change_ntf.event_id == ESP_AVRC_RN_VOLUME_CHANGE
+                ? BT_MSG_F_COALESCE
+                : BT_MSG_F_NONE;
+        bt_core_dispatch_ex(bt_ctx, BT_SIG_AVRC_CT, event, param,
+                            sizeof(esp_avrc_ct_cb_param_t), flags);
+        break;
+    }
     case ESP_AVRC_CT_PASSTHROUGH_RSP_EVT:
     case ESP_AVRC_CT_METADATA_RSP_EVT:
-    case ESP_AVRC_CT_CHANGE_NOTIFY_EVT:
     case ESP_AVRC_CT_REMOTE_FEATURES_EVT:
     case ESP_AVRC_CT_GET_RN_CAPABILITIES_RSP_EVT:
     case ESP_AVRC_CT_SET_ABSOLUTE_VOLUME_RSP_EVT: {
-        bt_core_dispatch(bt_ctx, bt_a2dp_hdl_avrc_ct_evt, event, param,
+        bt_core_dispatch(bt_ctx, BT_SIG_AVRC_CT, event, param,
                          sizeof(esp_avrc_ct_cb_param_t));
         break;
     }
@@ -326,30 +541,20 @@ static void bt_a2dp_rc_ct_cb(esp_avrc_ct_cb_event_t event,
 }
 
 static void bt_a2dp_state_unconnected_hdlr(uint16_t event, void* param) {
-    esp_a2d_cb_param_t* a2d = NULL;
     /* handle the events of interest in unconnected state */
     switch (event) {
     case ESP_A2D_CONNECTION_STATE_EVT:
     case ESP_A2D_AUDIO_STATE_EVT:
     case ESP_A2D_AUDIO_CFG_EVT:
     case ESP_A2D_MEDIA_CTRL_ACK_EVT:
+    case BT_A2DP_TMR_CONNECT:
+    case BT_A2DP_TMR_MEDIA:
+    case BT_A2DP_EVT_SUSPEND:
+    case BT_A2DP_EVT_RESUME:
         break;
-    case 0xff00: {
-        uint8_t* bda = bt_ctx->peer_bda;
-        ESP_LOGI("BT_A2DP",
-                 "a2dp connecting to peer: %02x:%02x:%02x:%02x:%02x:%02x",
-                 bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
-        esp_a2d_source_connect(bt_ctx->peer_bda);
-        bt_ctx->a2dp_state = BT_STATE_CONNECTING;
-        bt_ctx->connecting_intv = 0;
+    case BT_A2DP_TMR_RECONNECT:
+        bt_a2dp_connect(bt_ctx);
         break;
-    }
-    case ESP_A2D_REPORT_SNK_DELAY_VALUE_EVT: {
-        a2d = (esp_a2d_cb_param_t*)(param);
-        ESP_LOGI("BT_A2DP", "%s, delay value: %u * 1/10 ms", __func__,
-                 a2d->a2d_report_delay_value_stat.delay_value);
-        break;
-    }
     default: {
         ESP_LOGE("BT_A2DP", "%s unhandled event: %d", __func__, event);
         break;
@@ -367,32 +572,46 @@ static void bt_a2dp_state_connecting_hdlr(uint16_t event, void *param)
         a2d = (esp_a2d_cb_param_t *)(param);
         if (a2d->conn_stat.state == ESP_A2D_CONNECTION_STATE_CONNECTED) {
             ESP_LOGI("BT_A2DP", "a2dp connected");
+            bt_core_timer_cancel(bt_ctx, BT_SIG_A2DP, BT_A2DP_TMR_CONNECT);
             bt_ctx->a2dp_state =  BT_STATE_CONNECTED;
             bt_ctx->media_state = BT_MEDIA_STATE_IDLE;
+            connect_retry_ms = CONFIG_BT_A2DP_RETRY_MIN_MS;
+            media_retry_ms = CONFIG_BT_A2DP_MEDIA_RETRY_MS;
+            if (fast_connecting) {
+                connect_path = "fast reconnect";
+                fast_connecting = false;
+            }
+            bt_a2dp_peer_save(bt_ctx);
+            if (!media_paused) {
+                ESP_LOGI("BT_A2DP", "a2dp media ready checking ...");
+                bt_a2dp_media_cmd(bt_ctx, ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY);
+            }
         } else if (a2d->conn_stat.state == ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
-            bt_ctx->a2dp_state =  BT_STATE_UNCONNECTED;
+            bt_core_timer_cancel(bt_ctx, BT_SIG_A2DP, BT_A2DP_TMR_CONNECT);
+            if (fast_connecting) {
+                bt_a2dp_fast_connect_failed(bt_ctx);
+                break;
+            }
+            bt_a2dp_schedule_reconnect(bt_ctx);
         }
         break;
     }
     case ESP_A2D_AUDIO_STATE_EVT:
     case ESP_A2D_AUDIO_CFG_EVT:
     case ESP_A2D_MEDIA_CTRL_ACK_EVT:
+    case BT_A2DP_TMR_RECONNECT:
+    case BT_A2DP_TMR_MEDIA:
+    case BT_A2DP_EVT_SUSPEND:
+    case BT_A2DP_EVT_RESUME:
         break;
-    case 0xff00:
-        /**
-         * Switch state to APP_AV_STATE_UNCONNECTED
-         * when connecting lasts more than 2 heart beat intervals.
-         */
-        if (++bt_ctx->connecting_intv >= 2) {
-            bt_ctx->a2dp_state = BT_STATE_UNCONNECTED;
-            bt_ctx->connecting_intv = 0;
+    case BT_A2DP_TMR_CONNECT:
+        ESP_LOGW("BT_A2DP", "a2dp connect timed out");
+        if (fast_connecting) {
+            bt_a2dp_fast_connect_failed(bt_ctx);
+            break;
         }
+        bt_a2dp_schedule_reconnect(bt_ctx);
         break;
-    case ESP_A2D_REPORT_SNK_DELAY_VALUE_EVT: {
-        a2d = (esp_a2d_cb_param_t *)(param);
-        ESP_LOGI("BT_A2DP", "%s, delay value: %u * 1/10 ms", __func__, a2d->a2d_report_delay_value_stat.delay_value);
-        break;
-    }
     default:
         ESP_LOGE("BT_A2DP", "%s unhandled event: %d", __func__, event);
         break;
@@ -405,16 +624,22 @@ static void bt_a2dp_media_proc(uint16_t event, void *param)
 
     switch (bt_ctx->media_state) {
     case BT_MEDIA_STATE_IDLE: {
-        if (event == 0xff00) {
+        if ((event == BT_A2DP_TMR_MEDIA || event == BT_A2DP_EVT_RESUME) &&
+            !media_paused) {
             ESP_LOGI("BT_A2DP", "a2dp media ready checking ...");
-            esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY);
+            bt_a2dp_media_cmd(bt_ctx, ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY);
         } else if (event == ESP_A2D_MEDIA_CTRL_ACK_EVT) {
             a2d = (esp_a2d_cb_param_t *)(param);
-            if (a2d->media_ctrl_stat.cmd == ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY &&
-                    a2d->media_ctrl_stat.status == ESP_A2D_MEDIA_CTRL_ACK_SUCCESS) {
+            if (a2d->media_ctrl_stat.cmd != ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY) {
+                break;
+            }
+            if (a2d->media_ctrl_stat.status == ESP_A2D_MEDIA_CTRL_ACK_SUCCESS &&
+                !media_paused) {
                 ESP_LOGI("BT_A2DP", "a2dp media ready, starting ...");
-                esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_START);
+                bt_a2dp_media_cmd(bt_ctx, ESP_A2D_MEDIA_CTRL_START);
                 bt_ctx->media_state = BT_MEDIA_STATE_STARTING;
+            } else if (!media_paused) {
+                bt_a2dp_media_retry(bt_ctx);
             }
         }
         break;
@@ -425,25 +650,48 @@ static void bt_a2dp_media_proc(uint16_t event, void *param)
             if (a2d->media_ctrl_stat.cmd == ESP_A2D_MEDIA_CTRL_START &&
                     a2d->media_ctrl_stat.status == ESP_A2D_MEDIA_CTRL_ACK_SUCCESS) {
                 ESP_LOGI("BT_A2DP", "a2dp media start successfully.");
-                bt_ctx->intv_cnt = 0;
+                if (!audio_started) {
+                    audio_started = true;
+                    ESP_LOGI("BT_A2DP", "Boot to audio: %" PRId64 " ms (%s)",
+                             esp_timer_get_time() / 1000, connect_path);
+                    sys_boot_mark("first audio");
+                    sys_boot_log();
+                    // past the NVS commit and the boot log, the deepest
+                    // calls this task makes
+                    ESP_LOGI("BT_A2DP", "Core stack never used: %" PRIu32
+                             " bytes",
+                             (uint32_t)uxTaskGetStackHighWaterMark(NULL));
+                }
+                bt_core_timer_cancel(bt_ctx, BT_SIG_A2DP, BT_A2DP_TMR_MEDIA);
+                media_retry_ms = CONFIG_BT_A2DP_MEDIA_RETRY_MS;
                 bt_ctx->media_state = BT_MEDIA_STATE_STARTED;
+                // silence counts from the start of the stream
+                atomic_store_explicit(&silent_since_us, 0,
+                                      memory_order_relaxed);
+                if (media_paused) {
+                    // suspend requested while starting
+                    ESP_LOGI("BT_A2DP", "a2dp media suspending...");
+                    bt_a2dp_media_cmd(bt_ctx, ESP_A2D_MEDIA_CTRL_SUSPEND);
+                    bt_ctx->media_state = BT_MEDIA_STATE_STOPPING;
+                }
             } else {
                 /* not started successfully, transfer to idle state */
                 ESP_LOGI("BT_A2DP", "a2dp media start failed.");
                 bt_ctx->media_state = BT_MEDIA_STATE_IDLE;
+                bt_a2dp_media_retry(bt_ctx);
             }
+        } else if (event == BT_A2DP_TMR_MEDIA) {
+            ESP_LOGW("BT_A2DP", "a2dp media start not acknowledged");
+            bt_ctx->media_state = BT_MEDIA_STATE_IDLE;
+            bt_a2dp_media_retry(bt_ctx);
         }
         break;
     }
     case BT_MEDIA_STATE_STARTED: {
-        if (event == 0xff00) {
-            /* stop media after 10 heart beat intervals */
-            if (++bt_ctx->intv_cnt >= 10) {
-                ESP_LOGI("BT_A2DP", "a2dp media suspending...");
-                esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_SUSPEND);
-                bt_ctx->media_state = BT_MEDIA_STATE_STOPPING;
-                bt_ctx->intv_cnt = 0;
-            }
+        if (event == BT_A2DP_EVT_SUSPEND) {
+            ESP_LOGI("BT_A2DP", "a2dp media suspending...");
+            bt_a2dp_media_cmd(bt_ctx, ESP_A2D_MEDIA_CTRL_SUSPEND);
+            bt_ctx->media_state = BT_MEDIA_STATE_STOPPING;
         }
         break;
     }
@@ -452,14 +700,22 @@ static void bt_a2dp_media_proc(uint16_t event, void *param)
             a2d = (esp_a2d_cb_param_t *)(param);
             if (a2d->media_ctrl_stat.cmd == ESP_A2D_MEDIA_CTRL_SUSPEND &&
                     a2d->media_ctrl_stat.status == ESP_A2D_MEDIA_CTRL_ACK_SUCCESS) {
-                ESP_LOGI("BT_A2DP", "a2dp media suspend successfully, disconnecting...");
+                ESP_LOGI("BT_A2DP", "a2dp media suspend successfully.");
+                bt_core_timer_cancel(bt_ctx, BT_SIG_A2DP, BT_A2DP_TMR_MEDIA);
+                media_retry_ms = CONFIG_BT_A2DP_MEDIA_RETRY_MS;
                 bt_ctx->media_state = BT_MEDIA_STATE_IDLE;
-                esp_a2d_source_disconnect(bt_ctx->peer_bda);
-                bt_ctx->a2dp_state = BT_STATE_DISCONNECTING;
+                if (!media_paused) {
+                    // resumed while suspending
+                    bt_a2dp_media_cmd(bt_ctx,
+                                      ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY);
+                }
             } else {
-                ESP_LOGI("BT_A2DP", "a2dp media suspending...");
-                esp_a2d_media_ctrl(ESP_A2D_MEDIA_CTRL_SUSPEND);
+                // back off instead of hammering a sink that refuses
+                bt_a2dp_media_retry(bt_ctx);
             }
+        } else if (event == BT_A2DP_TMR_MEDIA) {
+            ESP_LOGI("BT_A2DP", "a2dp media suspending...");
+            bt_a2dp_media_cmd(bt_ctx, ESP_A2D_MEDIA_CTRL_SUSPEND);
         }
         break;
     }
@@ -479,30 +735,29 @@ static void bt_a2dp_state_connected_hdlr(uint16_t event, void *param)
         a2d = (esp_a2d_cb_param_t *)(param);
         if (a2d->conn_stat.state == ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
             ESP_LOGI("BT_A2DP", "a2dp disconnected");
-            bt_ctx->a2dp_state = BT_STATE_UNCONNECTED;
+            pcm_jitter_set_sink_delay(&pcm_jitter, 0);
+            bt_core_timer_cancel(bt_ctx, BT_SIG_A2DP, BT_A2DP_TMR_MEDIA);
+            bt_ctx->media_state = BT_MEDIA_STATE_IDLE;
+            bt_a2dp_schedule_reconnect(bt_ctx);
         }
         break;
     }
-    case ESP_A2D_AUDIO_STATE_EVT: {
-        a2d = (esp_a2d_cb_param_t *)(param);
-        if (ESP_A2D_AUDIO_STATE_STARTED == a2d->audio_stat.state) {
-            bt_ctx->pkt_cnt = 0;
-        }
+    case ESP_A2D_AUDIO_STATE_EVT:
+        // the jitter buffer restarts on its own after the gap in reads
         break;
-    }
     case ESP_A2D_AUDIO_CFG_EVT:
         // not supposed to occur for A2DP source
         break;
+    case BT_A2DP_TMR_CONNECT:
+    case BT_A2DP_TMR_RECONNECT:
+        break;
     case ESP_A2D_MEDIA_CTRL_ACK_EVT:
-    case 0xff00: {
+    case BT_A2DP_TMR_MEDIA:
+    case BT_A2DP_EVT_SUSPEND:
+    case BT_A2DP_EVT_RESUME: {
         bt_a2dp_media_proc(event, param);
         break;
     }
-    case ESP_A2D_REPORT_SNK_DELAY_VALUE_EVT: {
-        a2d = (esp_a2d_cb_param_t *)(param);
-        ESP_LOGI("BT_A2DP", "%s, delay value: %u * 1/10 ms", __func__, a2d->a2d_report_delay_value_stat.delay_value);
-        break;
-    }
     default: {
         ESP_LOGE("BT_A2DP", "%s unhandled event: %d", __func__, event);
         break;
@@ -527,13 +782,12 @@ static void bt_a2dp_state_disconnecting_hdlr(uint16_t event, void *param)
     case ESP_A2D_AUDIO_STATE_EVT:
     case ESP_A2D_AUDIO_CFG_EVT:
     case ESP_A2D_MEDIA_CTRL_ACK_EVT:
-    case 0xff00:
-        break;
-    case ESP_A2D_REPORT_SNK_DELAY_VALUE_EVT: {
-        a2d = (esp_a2d_cb_param_t *)(param);
-        ESP_LOGI("BT_A2DP", "%s, delay value: 0x%u * 1/10 ms", __func__, a2d->a2d_report_delay_value_stat.delay_value);
+    case BT_A2DP_TMR_CONNECT:
+    case BT_A2DP_TMR_RECONNECT:
+    case BT_A2DP_TMR_MEDIA:
+    case BT_A2DP_EVT_SUSPEND:
+    case BT_A2DP_EVT_RESUME:
         break;
-    }
     default: {
         ESP_LOGE("BT_A2DP", "%s unhandled event: %d", __func__, event);
         break;
@@ -541,10 +795,107 @@ static void bt_a2dp_state_disconnecting_hdlr(uint16_t event, void *param)
     }
 }
 
+// Bytes of silence at the start of pcm, in whole frames
+static size_t bt_a2dp_silence(const uint8_t* pcm, size_t len) {
+    const int16_t* s = (const int16_t*)pcm;
+    size_t n = len / sizeof(int16_t);
+    size_t i = 0;
+    while (i < n && s[i] >= -BT_A2DP_SILENCE && s[i] <= BT_A2DP_SILENCE) {
+        i++;
+    }
+    return i * sizeof(int16_t) & ~3u;
+}
+
+// Drop the silence at the head of the ring, as much as plays in a poll,
+// so a silent passage ends while suspended. True when sound is left.
+static bool bt_a2dp_idle_drain(void) {
+    size_t budget = 44100 * 4 * BT_A2DP_IDLE_POLL_MS / 1000;
+    while (budget > 0) {
+        const uint8_t* pcm;
+        size_t len = pcm_ring_read_reserve(pcm_ring, &pcm);
+        if (len > budget) {
+            len = budget;
+        }
+        len &= ~3u;
+        if (len == 0) {
+            return false;
+        }
+        size_t silent = bt_a2dp_silence(pcm, len);
+        pcm_ring_read_commit(pcm_ring, silent);
+        if (silent < len) {
+            return true;
+        }
+        budget -= len;
+    }
+    return false;
+}
+
+static void bt_a2dp_idle_poll(bt_ctx_t* ctx) {
+    if (!atomic_load(&media_idle)) {
+        return;
+    }
+    // Bluedroid may still call for data after the suspend ack, the ring
+    // is left alone while a callback is in it
+    if (ctx->a2dp_state == BT_STATE_CONNECTED &&
+        ctx->media_state == BT_MEDIA_STATE_IDLE && pcm_ring != nullptr &&
+        !atomic_load(&media_reading) && bt_a2dp_idle_drain()) {
+        ESP_LOGI("BT_A2DP", "Sound after silence, resuming");
+        atomic_store(&media_idle, false);
+        media_paused = false;
+        bt_a2dp_media_proc(BT_A2DP_EVT_RESUME, NULL);
+        return;
+    }
+    bt_core_timer_arm(ctx, BT_SIG_A2DP, BT_A2DP_TMR_IDLE,
+                      BT_A2DP_IDLE_POLL_MS);
+}
+
 static void bt_a2dp_av_sm_hdlr(bt_ctx_t* ctx, uint16_t event, void* param) {
-    ESP_LOGI("BT_A2DP", "%s state: %d, event: 0x%x", __func__, ctx->a2dp_state,
+    BT_DLOGI("BT_A2DP", "av sm state: %d, event: 0x%x", ctx->a2dp_state,
              event);
 
+    // sinks report their delay in any state, it caps the jitter buffer
+    if (event == ESP_A2D_REPORT_SNK_DELAY_VALUE_EVT) {
+        esp_a2d_cb_param_t* a2d = param;
+        uint16_t delay = a2d->a2d_report_delay_value_stat.delay_value;
+        ESP_LOGI("BT_A2DP", "Sink delay: %u.%u ms", delay / 10, delay % 10);
+        pcm_jitter_set_sink_delay(&pcm_jitter, delay / 10);
+        return;
+    }
+
+    // an idle suspend ends by itself once there is sound, the app's
+    // suspend and resume take over from it
+    if (event == BT_A2DP_TMR_IDLE) {
+        bt_a2dp_idle_poll(ctx);
+        return;
+    }
+    if (event == BT_A2DP_EVT_IDLE) {
+        if (media_paused) {
+            return;
+        }
+        atomic_store(&media_idle, true);
+        bt_core_timer_arm(ctx, BT_SIG_A2DP, BT_A2DP_TMR_IDLE,
+                          BT_A2DP_IDLE_POLL_MS);
+        event = BT_A2DP_EVT_SUSPEND;
+    } else if (event == BT_A2DP_EVT_SUSPEND || event == BT_A2DP_EVT_RESUME) {
+        atomic_store(&media_idle, false);
+        bt_core_timer_cancel(ctx, BT_SIG_A2DP, BT_A2DP_TMR_IDLE);
+    } else if (event == ESP_A2D_CONNECTION_STATE_EVT &&
+               atomic_load(&media_idle) &&
+               ((esp_a2d_cb_param_t*)param)->conn_stat.state ==
+                   ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
+        // the suspend was ours, the next connection streams again
+        atomic_store(&media_idle, false);
+        media_paused = false;
+        bt_core_timer_cancel(ctx, BT_SIG_A2DP, BT_A2DP_TMR_IDLE);
+    }
+
+    // remembered in any state, acted on once connected
+    if (event == BT_A2DP_EVT_SUSPEND) {
+        media_paused = true;
+    } else if (event == BT_A2DP_EVT_RESUME) {
+        media_paused = false;
+    }
+
     /* select handler according to different states */
     switch (ctx->a2dp_state) {
     case BT_STATE_DISCOVERING:
@@ -569,8 +920,19 @@ static void bt_a2dp_av_sm_hdlr(bt_ctx_t* ctx, uint16_t event, void* param) {
 }
 
 static void bt_a2dp_cb(esp_a2d_cb_event_t event, esp_a2d_cb_param_t* param) {
-    bt_core_dispatch(bt_ctx, bt_a2dp_av_sm_hdlr, event, param,
-                     sizeof(esp_a2d_cb_param_t));
+    uint8_t flags = BT_MSG_F_NONE;
+    switch (event) {
+    // state changes must survive a burst of other events
+    case ESP_A2D_CONNECTION_STATE_EVT:
+    case ESP_A2D_AUDIO_STATE_EVT:
+    case ESP_A2D_MEDIA_CTRL_ACK_EVT:
+        flags = BT_MSG_F_CRITICAL;
+        break;
+    default:
+        break;
+    }
+    bt_core_dispatch_ex(bt_ctx, BT_SIG_A2DP, event, param,
+                        sizeof(esp_a2d_cb_param_t), flags);
 }
 
 static int32_t bt_a2dp_data_cb(uint8_t* data, int32_t len) {
@@ -578,59 +940,105 @@ static int32_t bt_a2dp_data_cb(uint8_t* data, int32_t len) {
         return 0;
     }
 
-    // generate a simple sine wave
-    static int16_t sample = 0;
-    static int16_t step = 1000;
-    int16_t* p_buf = (int16_t*)data;
-    for (int i = 0; i < (len >> 1); i++) {
-        p_buf[i] = sample;
-        sample += step;
-        if (sample > 32767 || sample < -32768) {
-            step = -step;
-        }
+    if (pcm_ring == nullptr) {
+        memset(data, 0, len);
+        return len;
     }
-
+    // the core task drains the ring while the stream is idle
+    atomic_store(&media_reading, true);
+    if (atomic_load(&media_idle)) {
+        atomic_store(&media_reading, false);
+        memset(data, 0, len);
+        return len;
+    }
+    // runs in the Bluedroid task: copy straight out of the ring, underruns
+    // are padded with silence
+    int64_t now = esp_timer_get_time();
+    uint32_t fill = pcm_ring_fill(pcm_ring);
+    pcm_ring_read(pcm_ring, data, len);
+    atomic_store(&media_reading, false);
+    pcm_ring_set_limit(pcm_ring,
+                       pcm_jitter_read(&pcm_jitter, len, fill, now));
+    if (bt_a2dp_silence(data, len) < ((size_t)len & ~3u)) {
+        atomic_store_explicit(&silent_since_us, 0, memory_order_relaxed);
+    } else if (atomic_load_explicit(&silent_since_us,
+                                    memory_order_relaxed) == 0) {
+        atomic_store_explicit(&silent_since_us, now, memory_order_relaxed);
+    }
+    size_t frames = len / (2 * sizeof(int16_t));
+    if (pcm_eq != nullptr) {
+        pcm_eq_process(pcm_eq, (int16_t*)data, frames);
+    }
+    pcm_gain_process(&pcm_gain, (int16_t*)data, frames);
     return len;
 }
 
-static void bt_a2dp_sm_hdlr(bt_ctx_t* ctx, uint16_t event, void *param)
-{
-    ESP_LOGI("BT_A2DP", "%s state: %d, event: 0x%x", __func__, ctx->a2dp_state, event);
+void bt_a2dp_set_pcm_ring(pcm_ring_t* ring) {
+    // 44.1 kHz 16-bit stereo, never deeper than the ring
+    uint32_t byte_rate = 44100 * 4;
+    uint32_t max_ms = (uint64_t)ring->size * 1000 / byte_rate;
+    if (max_ms > CONFIG_BT_A2DP_JITTER_MAX_MS) {
+        max_ms = CONFIG_BT_A2DP_JITTER_MAX_MS;
+    }
+    pcm_jitter_init(&pcm_jitter, byte_rate, CONFIG_BT_A2DP_JITTER_MIN_MS,
+                    CONFIG_BT_A2DP_JITTER_START_MS, max_ms,
+                    CONFIG_BT_A2DP_AV_LATENCY_MS);
+    pcm_ring_set_limit(ring, pcm_jitter_target(&pcm_jitter));
+    pcm_ring = ring;
+}
 
-    /* select handler according to different states */
-    switch (ctx->a2dp_state) {
-    case BT_STATE_DISCOVERING:
-    case BT_STATE_DISCOVERED:
-        break;
-    case BT_STATE_UNCONNECTED:
-        bt_a2dp_state_unconnected_hdlr(event, param);
-        break;
-    case BT_STATE_CONNECTING:
-        bt_a2dp_state_connecting_hdlr(event, param);
-        break;
-    case BT_STATE_CONNECTED:
-        bt_a2dp_state_connected_hdlr(event, param);
-        break;
-    case BT_STATE_DISCONNECTING:
-        bt_a2dp_state_disconnecting_hdlr(event, param);
-        break;
-    default:
-        ESP_LOGE("BT_A2DP", "%s invalid state: %d", __func__, ctx->a2dp_state);
-        break;
+void bt_a2dp_get_jitter_stats(pcm_jitter_stats_t* stats) {
+    pcm_jitter_get_stats(&pcm_jitter, stats);
+}
+
+void bt_a2dp_set_volume(uint8_t volume) {
+    // only the latest volume matters
+    bt_core_dispatch_ex(bt_ctx, BT_SIG_AVRC_CT, BT_A2DP_EVT_VOLUME, &volume,
+                        sizeof(volume), BT_MSG_F_COALESCE);
+}
+
+uint8_t bt_a2dp_get_volume(void) {
+    return bt_ctx->volume;
+}
+
+bool bt_a2dp_set_eq(const pcm_eq_band_t* bands, size_t count) {
+    if (pcm_eq == nullptr) {
+        return false;
     }
+    return pcm_eq_set(pcm_eq, bands, count);
 }
 
-static void bt_a2dp_heart_beat(TimerHandle_t arg)
-{
-    bt_core_dispatch(bt_ctx, bt_a2dp_sm_hdlr, 0xff00, NULL, 0);
+void bt_a2dp_suspend(void) {
+    bt_core_dispatch_ex(bt_ctx, BT_SIG_A2DP, BT_A2DP_EVT_SUSPEND, NULL, 0,
+                        BT_MSG_F_CRITICAL);
+}
+
+void bt_a2dp_resume(void) {
+    bt_core_dispatch_ex(bt_ctx, BT_SIG_A2DP, BT_A2DP_EVT_RESUME, NULL, 0,
+                        BT_MSG_F_CRITICAL);
+}
+
+void bt_a2dp_idle(void) {
+    bt_core_dispatch_ex(bt_ctx, BT_SIG_A2DP, BT_A2DP_EVT_IDLE, NULL, 0,
+                        BT_MSG_F_CRITICAL);
+}
+
+bool bt_a2dp_streaming(void) {
+    return bt_ctx->media_state == BT_MEDIA_STATE_STARTED;
 }
 
-void bt_a2dp_stack_event(bt_ctx_t* ctx, uint16_t event, void* event_data) {
+uint32_t bt_a2dp_get_silent_ms(void) {
+    int64_t since =
+        atomic_load_explicit(&silent_since_us, memory_order_relaxed);
+    return since == 0 ? 0 : (esp_timer_get_time() - since) / 1000;
+}
+
+static void bt_a2dp_stack_event(bt_ctx_t* ctx, uint16_t event,
+                                void* event_data) {
     ESP_LOGD("BT_A2DP", "%s event received: %d", __func__, event);
 
     switch (event) {
-    case 0: { // Stack up event
-        bt_ctx = ctx;
+    case BT_CORE_EVT_STACK_UP: {
         const char* device_name = CONFIG_BT_A2DP_HOST_NAME;
         esp_bt_gap_set_device_name(device_name);
         esp_bt_gap_register_callback(bt_a2dp_gap_cb);
@@ -651,18 +1059,19 @@ void bt_a2dp_stack_event(bt_ctx_t* ctx, uint16_t event, void* event_data) {
         esp_bt_gap_set_scan_mode(ESP_BT_NON_CONNECTABLE, ESP_BT_NON_DISCOVERABLE);
         esp_bt_gap_get_device_name();
 
-        ESP_LOGI("BT_A2DP", "Starting device discovery...");
-        ctx->a2dp_state = BT_STATE_DISCOVERING;
-        esp_bt_gap_start_discovery(ESP_BT_INQ_MODE_GENERAL_INQUIRY, 10, 0);
-
-        /* create and start heart beat timer */
-        do {
-            int tmr_id = 0;
-            ctx->heart_beat_timer =
-                xTimerCreate("connTmr", (10000 / portTICK_PERIOD_MS), pdTRUE,
-                             (void*)&tmr_id, bt_a2dp_heart_beat);
-            xTimerStart(ctx->heart_beat_timer, portMAX_DELAY);
-        } while (0);
+#if CONFIG_BT_A2DP_FAST_RECONNECT
+        if (bt_a2dp_peer_load(ctx)) {
+            char bda_str[18];
+            ESP_LOGI("BT_A2DP", "Fast reconnect to %s [%s]", ctx->peer_bdname,
+                     bda2str(ctx->peer_bda, bda_str, sizeof(bda_str)));
+            fast_connecting = true;
+            bt_a2dp_connect(ctx);
+        } else {
+            bt_a2dp_start_discovery(ctx);
+        }
+#else
+        bt_a2dp_start_discovery(ctx);
+#endif
         break;
     }
 
@@ -673,3 +1082,16 @@ void bt_a2dp_stack_event(bt_ctx_t* ctx, uint16_t event, void* event_data) {
     }
     }
 }
+
+void bt_a2dp_register(bt_ctx_t* ctx) {
+    bt_ctx = ctx;
+    // software volume until the sink shows absolute volume support
+    ctx->volume = CONFIG_BT_A2DP_VOLUME;
+    pcm_gain_init(&pcm_gain, pcm_gain_of_volume(ctx->volume));
+    // the source always streams 44.1 kHz
+    pcm_eq = pcm_eq_create(44100);
+    bt_core_subscribe(ctx, BT_SIG_STACK, bt_a2dp_stack_event);
+    bt_core_subscribe(ctx, BT_SIG_GAP, bt_a2dp_hdl_gap_evt);
+    bt_core_subscribe(ctx, BT_SIG_A2DP, bt_a2dp_av_sm_hdlr);
+    bt_core_subscribe(ctx, BT_SIG_AVRC_CT, bt_a2dp_hdl_avrc_ct_evt);
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include <stdint.h>
 #include "bt_core.h"
+#include "pcm_eq.h"
+#include "pcm_jitter.h"
+#include "pcm_ring.h"
 
 typedef enum {
     BT_A2DP_STATE_IDLE,
@@ -12,4 +15,47 @@ typedef enum {
     BT_A2DP_STATE_DISCONNECTING,
 } a2dp_state_t;
 
-void bt_a2dp_stack_event(bt_ctx_t* ctx, uint16_t event, void* event_data);
+// Subscribe the A2DP source to its bt_core signals.
+// Call before bt_core_start.
+void bt_a2dp_register(bt_ctx_t* ctx);
+
+// Set the ring the A2DP data callback consumes PCM from.
+// Silence is streamed while no ring is set. The callback limits how far
+// the producer fills it to a depth adapted to underruns, read bursts and
+// the sink delay.
+void bt_a2dp_set_pcm_ring(pcm_ring_t* ring);
+
+// Depth of the ring and why it last changed
+void bt_a2dp_get_jitter_stats(pcm_jitter_stats_t* stats);
+
+// Set the volume, AVRCP absolute volume 0-127. Sent to sinks with
+// absolute volume support, applied to the PCM for the others. Callable
+// from any task.
+void bt_a2dp_set_volume(uint8_t volume);
+
+// Volume last set or reported by the sink
+uint8_t bt_a2dp_get_volume(void);
+
+// Set the equalizer bands applied to the PCM ahead of the volume, count 0
+// for none. Call from one task at a time. Returns false if count exceeds
+// PCM_EQ_MAX_BANDS.
+bool bt_a2dp_set_eq(const pcm_eq_band_t* bands, size_t count);
+
+// Suspend the media stream, the link stays up. Callable from any task.
+void bt_a2dp_suspend(void);
+
+// Restart the media stream after bt_a2dp_suspend
+void bt_a2dp_resume(void);
+
+// Suspend the media stream until the ring holds sound again. Silence at
+// the head of the ring is dropped at the pace it would have played, so
+// a silent passage ends. bt_a2dp_suspend and bt_a2dp_resume override it.
+// Callable from any task.
+void bt_a2dp_idle(void);
+
+// True while the media stream is started
+bool bt_a2dp_streaming(void);
+
+// Ms the sink has been sent only silence, from the start of the stream,
+// 0 while it gets sound. Callable from any task.
+uint32_t bt_a2dp_get_silent_ms(void);
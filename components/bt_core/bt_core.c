@@ -1,4 +1,8 @@
 #include "bt_core.h"
+#include "bt_dlog.h"
+#include "bt_instr.h"
+#include "bt_pool.h"
+#include "bt_trace.h"
 #include "esp_bt.h"
 #include "esp_bt_device.h"
 #include "esp_bt_main.h"
@@ -8,6 +12,10 @@
 #include "freertos/idf_additions.h"
 #include "freertos/projdefs.h"
 #include "nvs_flash.h"
+#include "sys_boot.h"
+#include "sys_mem.h"
+#include "sys_task.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -38,6 +46,7 @@ bt_ctx_t* bt_init(void) {
         return nullptr;
     }
     ESP_LOGI("BT_CORE", "NVS initialized");
+    sys_boot_mark("nvs");
 
     // Release BLE memory
     ret = esp_bt_controller_mem_release(ESP_BT_MODE_BLE);
@@ -47,6 +56,7 @@ bt_ctx_t* bt_init(void) {
         return nullptr;
     }
     ESP_LOGI("BT_CORE", "BLE memory released");
+    sys_boot_mark("ble release");
 
     // Initialize Bluetooth controller
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -66,6 +76,7 @@ bt_ctx_t* bt_init(void) {
         return nullptr;
     }
     ESP_LOGI("BT_CORE", "Bluetooth controller enabled");
+    sys_boot_mark("controller");
 
     esp_bluedroid_config_t bluedroid_cfg = BT_BLUEDROID_INIT_CONFIG_DEFAULT();
     bluedroid_cfg.ssp_en = true;
@@ -79,6 +90,7 @@ bt_ctx_t* bt_init(void) {
         ESP_LOGE("BT_CORE", "%s enable bluedroid failed", __func__);
         return nullptr;
     }
+    sys_boot_mark("bluedroid");
 
     esp_bt_sp_param_t param_type = ESP_BT_SP_IOCAP_MODE;
     esp_bt_io_cap_t iocap = ESP_BT_IO_CAP_IO;
@@ -91,91 +103,470 @@ bt_ctx_t* bt_init(void) {
         "BT_CORE", "Own address:[%s]",
         bda2str((uint8_t*)esp_bt_dev_get_address(), bda_str, sizeof(bda_str)));
 
-    bt_ctx_t* ctx = malloc(sizeof(bt_ctx_t));
+#if CONFIG_SYS_MEM_STATIC
+    static bt_ctx_t ctx_storage;
+    bt_ctx_t* ctx = &ctx_storage;
+    memset(ctx, 0, sizeof(bt_ctx_t));
+#else
+    bt_ctx_t* ctx = calloc(1, sizeof(bt_ctx_t));
+#endif
+    if (ctx == NULL) {
+        ESP_LOGE("BT_CORE", "%s context allocation failed", __func__);
+        return nullptr;
+    }
     ctx->state = BT_STATE_ON;
+    // audio control jumps ahead of GAP logging
+    ctx->sig_prio[BT_SIG_STACK] = BT_PRIO_HIGH;
+    ctx->sig_prio[BT_SIG_GAP] = BT_PRIO_LOW;
+    ctx->sig_prio[BT_SIG_A2DP] = BT_PRIO_HIGH;
+    ctx->sig_prio[BT_SIG_AVRC_CT] = BT_PRIO_HIGH;
+    ctx->sig_prio[BT_SIG_PLAYER] = BT_PRIO_HIGH;
 
     ESP_LOGI("BT_CORE", "Bluetooth initialized successfully");
     return ctx;
 }
 
+// An undelivered coalescable message, its param slot may still be rewritten
+typedef struct {
+    bool pending;
+    uint16_t id;
+    uint16_t event;
+    void* param;
+} bt_coalesce_t;
+
+static bt_coalesce_t coalesce[CONFIG_BT_CORE_COALESCE_SLOTS];
+static portMUX_TYPE coalesce_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// A one-shot deadline, serviced by the core task
+typedef struct {
+    bool armed;
+    uint16_t id;
+    uint16_t event;
+    TickType_t deadline;
+} bt_core_timer_t;
+
+static bt_core_timer_t timers[CONFIG_BT_CORE_TIMERS];
+static portMUX_TYPE timer_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_SYS_MEM_STATIC
+static StaticQueue_t queue_buf[BT_PRIO_MAX];
+static uint8_t queue_storage[BT_PRIO_MAX]
+                            [CONFIG_BT_CORE_QUEUE_LEN * sizeof(bt_msg_t)];
+static StaticSemaphore_t queue_sem_buf;
+#endif
+
+static _Atomic uint32_t queue_sent[BT_PRIO_MAX];
+static _Atomic uint32_t queue_dropped[BT_PRIO_MAX];
+static _Atomic uint32_t queue_dropped_critical;
+static _Atomic uint32_t queue_coalesced;
+static _Atomic uint32_t queue_batches;
+static _Atomic uint32_t queue_max_batch;
+
+static uint32_t bt_core_queued(bt_ctx_t* ctx) {
+    uint32_t n = 0;
+    for (int prio = 0; prio < BT_PRIO_MAX; prio++) {
+        n += uxQueueMessagesWaiting(ctx->event_queue[prio]);
+    }
+    return n;
+}
+
 static bool bt_core_send_msg(bt_ctx_t* ctx, bt_msg_t* msg) {
     if (msg == NULL) {
         return false;
     }
 
-    if (pdTRUE != xQueueSend(ctx->event_queue, msg, 10 / portTICK_PERIOD_MS)) {
-        ESP_LOGE("BT_CORE", "%s xQueue send failed", __func__);
-        return false;
+    bt_prio_t prio = ctx->sig_prio[msg->id];
+    QueueHandle_t queue = ctx->event_queue[prio];
+    if (msg->flags & BT_MSG_F_CRITICAL) {
+        if (pdTRUE != xQueueSend(queue, msg,
+                                 pdMS_TO_TICKS(
+                                     CONFIG_BT_CORE_CRITICAL_TIMEOUT_MS))) {
+            atomic_fetch_add(&queue_dropped_critical, 1);
+            ESP_LOGE("BT_CORE", "%s critical event 0x%x dropped", __func__,
+                     msg->event);
+            return false;
+        }
+    } else {
+        // leave the reserved slots to critical events, never block here
+        if (uxQueueSpacesAvailable(queue) <= CONFIG_BT_CORE_RESERVED_SLOTS ||
+            pdTRUE != xQueueSend(queue, msg, 0)) {
+            atomic_fetch_add(&queue_dropped[prio], 1);
+            ESP_LOGW("BT_CORE", "%s queue full, event 0x%x dropped", __func__,
+                     msg->event);
+            return false;
+        }
     }
+    atomic_fetch_add(&queue_sent[prio], 1);
+    bt_instr_queue_depth(prio, uxQueueMessagesWaiting(queue));
+    xSemaphoreGive(ctx->event_sem);
 
     return true;
 }
 
+// Merge into a pending message with the same signal and event.
+// Returns true if the message was absorbed.
+static bool bt_core_coalesce(bt_msg_t* msg, void* params, uint32_t param_len) {
+    bool merged = false;
+    portENTER_CRITICAL(&coalesce_lock);
+    for (int i = 0; i < CONFIG_BT_CORE_COALESCE_SLOTS; i++) {
+        bt_coalesce_t* c = &coalesce[i];
+        if (c->pending && c->id == msg->id && c->event == msg->event &&
+            (c->param != NULL) == (param_len != 0 && params) &&
+            param_len <= sizeof(bt_pool_param_t)) {
+            if (c->param != NULL) {
+                memcpy(c->param, params, param_len);
+            }
+            merged = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&coalesce_lock);
+    if (merged) {
+        atomic_fetch_add(&queue_coalesced, 1);
+    }
+    return merged;
+}
+
+// Track a coalescable message until the core task picks it up.
+// Returns the tracking slot or NULL if all slots are busy.
+static bt_coalesce_t* bt_core_coalesce_track(bt_msg_t* msg) {
+    bt_coalesce_t* slot = NULL;
+    portENTER_CRITICAL(&coalesce_lock);
+    for (int i = 0; i < CONFIG_BT_CORE_COALESCE_SLOTS; i++) {
+        if (!coalesce[i].pending) {
+            slot = &coalesce[i];
+            slot->pending = true;
+            slot->id = msg->id;
+            slot->event = msg->event;
+            slot->param = msg->param;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&coalesce_lock);
+    return slot;
+}
+
+// Stop tracking a message, its params are stable from here on
+static void bt_core_coalesce_release(bt_msg_t* msg) {
+    portENTER_CRITICAL(&coalesce_lock);
+    for (int i = 0; i < CONFIG_BT_CORE_COALESCE_SLOTS; i++) {
+        bt_coalesce_t* c = &coalesce[i];
+        if (c->pending && c->id == msg->id && c->event == msg->event &&
+            c->param == msg->param) {
+            c->pending = false;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&coalesce_lock);
+}
+
+bool bt_core_subscribe(bt_ctx_t* ctx, bt_signal_t sig, bt_core_cb_t cb) {
+    if (sig >= BT_SIG_MAX || cb == NULL) {
+        return false;
+    }
+    for (int i = 0; i < CONFIG_BT_CORE_MAX_SUBSCRIBERS; i++) {
+        if (ctx->handlers[sig][i] == NULL) {
+            ctx->handlers[sig][i] = cb;
+            return true;
+        }
+    }
+    ESP_LOGE("BT_CORE", "%s no free slot for signal %d", __func__, sig);
+    return false;
+}
+
+void bt_core_set_priority(bt_ctx_t* ctx, bt_signal_t sig, bt_prio_t prio) {
+    if (sig < BT_SIG_MAX && prio < BT_PRIO_MAX) {
+        ctx->sig_prio[sig] = prio;
+    }
+}
+
 // Dispatch a message to the Bluetooth core task.
-// cback: Callback function to handle the event.
+// sig: Signal whose subscribers handle the event.
 // event: Event identifier.
 // param_len: Length of event parameters, in bytes.
-bool bt_core_dispatch(bt_ctx_t* ctx, bt_core_cb_t cback, uint16_t event,
+// Parameters are copied into a preallocated pool slot, never the heap.
+bool bt_core_dispatch(bt_ctx_t* ctx, bt_signal_t sig, uint16_t event,
                       void* params, uint32_t param_len) {
-    ESP_LOGD("BT_CORE", "%s event: 0x%x, param len: %d", __func__, event,
-             param_len);
+    return bt_core_dispatch_ex(ctx, sig, event, params, param_len,
+                               BT_MSG_F_NONE);
+}
+
+bool bt_core_dispatch_ex(bt_ctx_t* ctx, bt_signal_t sig, uint16_t event,
+                         void* params, uint32_t param_len, uint8_t flags) {
+    BT_DLOGD("BT_CORE", "dispatch sig: %d, event: 0x%x, param len: %" PRIu32,
+             sig, event, param_len);
+
+    if (sig >= BT_SIG_MAX) {
+        ESP_LOGE("BT_CORE", "%s invalid signal: %d", __func__, sig);
+        return false;
+    }
+
+    // a trace replay is the only input while it runs
+    if (bt_trace_replaying()) {
+        return false;
+    }
 
     bt_msg_t msg;
     memset(&msg, 0, sizeof(bt_msg_t));
 
-    // FIXME: Use proper signal
-    msg.id = 0;
+    msg.id = sig;
     msg.event = event;
-    msg.cb = cback;
+    msg.flags = flags;
+    msg.param_len = param_len;
+
+    if ((flags & BT_MSG_F_COALESCE) &&
+        bt_core_coalesce(&msg, params, param_len)) {
+        bt_trace_record(BT_TRACE_COALESCED, &msg, params, param_len,
+                        bt_core_queued(ctx));
+        return true;
+    }
 
     if (param_len != 0 && params) {
-        if ((msg.param = malloc(param_len)) != NULL) {
+        bool critical = flags & BT_MSG_F_CRITICAL;
+        if ((msg.param = bt_pool_alloc(param_len, critical)) != NULL) {
             memcpy(msg.param, params, param_len);
         } else {
-            ESP_LOGE("BT_CORE", "%s malloc failed", __func__);
+            if (critical) {
+                atomic_fetch_add(&queue_dropped_critical, 1);
+            }
+            ESP_LOGE("BT_CORE", "%s message pool exhausted", __func__);
+            bt_trace_record(BT_TRACE_DROPPED, &msg, params, param_len,
+                            bt_core_queued(ctx));
             return false;
         }
     }
 
-    return bt_core_send_msg(ctx, &msg);
+    // track before sending so the core task never sees an untracked copy
+    bt_coalesce_t* tracked = NULL;
+    if (flags & BT_MSG_F_COALESCE) {
+        tracked = bt_core_coalesce_track(&msg);
+        if (tracked == NULL) {
+            msg.flags &= ~BT_MSG_F_COALESCE;
+        }
+    }
+
+    if (!bt_core_send_msg(ctx, &msg)) {
+        bt_trace_record(BT_TRACE_DROPPED, &msg, params, param_len,
+                        bt_core_queued(ctx));
+        if (tracked) {
+            portENTER_CRITICAL(&coalesce_lock);
+            tracked->pending = false;
+            portEXIT_CRITICAL(&coalesce_lock);
+        }
+        if (msg.param) {
+            bt_pool_free(msg.param);
+        }
+        return false;
+    }
+    bt_trace_record(BT_TRACE_DISPATCH, &msg, params, param_len,
+                    bt_core_queued(ctx));
+    return true;
+}
+
+bool bt_core_timer_arm(bt_ctx_t* ctx, bt_signal_t sig, uint16_t event,
+                       uint32_t delay_ms) {
+    if (sig >= BT_SIG_MAX) {
+        return false;
+    }
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(delay_ms);
+    bt_core_timer_t* slot = NULL;
+
+    portENTER_CRITICAL(&timer_lock);
+    for (int i = 0; i < CONFIG_BT_CORE_TIMERS; i++) {
+        bt_core_timer_t* t = &timers[i];
+        if (t->armed && t->id == sig && t->event == event) {
+            slot = t;
+            break;
+        }
+        if (!t->armed && slot == NULL) {
+            slot = t;
+        }
+    }
+    if (slot != NULL) {
+        slot->armed = true;
+        slot->id = sig;
+        slot->event = event;
+        slot->deadline = deadline;
+    }
+    portEXIT_CRITICAL(&timer_lock);
+
+    if (slot == NULL) {
+        ESP_LOGE("BT_CORE", "%s no free timer for event 0x%x", __func__,
+                 event);
+        return false;
+    }
+    // the core task sleeps until its earliest deadline, wake it to re-check
+    if (ctx->event_task != NULL &&
+        xTaskGetCurrentTaskHandle() != ctx->event_task) {
+        xSemaphoreGive(ctx->event_sem);
+    }
+    return true;
+}
+
+void bt_core_timer_cancel(bt_ctx_t* ctx, bt_signal_t sig, uint16_t event) {
+    portENTER_CRITICAL(&timer_lock);
+    for (int i = 0; i < CONFIG_BT_CORE_TIMERS; i++) {
+        bt_core_timer_t* t = &timers[i];
+        if (t->armed && t->id == sig && t->event == event) {
+            t->armed = false;
+        }
+    }
+    portEXIT_CRITICAL(&timer_lock);
+}
+
+// Disarm the next expired timer and build its message
+static bool bt_core_timer_expired(bt_msg_t* msg) {
+    TickType_t now = xTaskGetTickCount();
+    bool fired = false;
+    portENTER_CRITICAL(&timer_lock);
+    for (int i = 0; i < CONFIG_BT_CORE_TIMERS; i++) {
+        bt_core_timer_t* t = &timers[i];
+        if (t->armed && (int32_t)(t->deadline - now) <= 0) {
+            t->armed = false;
+            memset(msg, 0, sizeof(bt_msg_t));
+            msg->id = t->id;
+            msg->event = t->event;
+            msg->flags = BT_MSG_F_TIMER;
+            fired = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&timer_lock);
+    return fired;
+}
+
+// Ticks until the earliest deadline, portMAX_DELAY when none is armed
+static TickType_t bt_core_timer_next(void) {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+    portENTER_CRITICAL(&timer_lock);
+    for (int i = 0; i < CONFIG_BT_CORE_TIMERS; i++) {
+        bt_core_timer_t* t = &timers[i];
+        if (t->armed) {
+            int32_t left = t->deadline - now;
+            TickType_t ticks = left > 0 ? left : 0;
+            if (ticks < wait) {
+                wait = ticks;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&timer_lock);
+    return wait;
+}
+
+void bt_core_get_queue_stats(bt_core_queue_stats_t* stats) {
+    for (int prio = 0; prio < BT_PRIO_MAX; prio++) {
+        stats->sent[prio] = atomic_load(&queue_sent[prio]);
+        stats->dropped[prio] = atomic_load(&queue_dropped[prio]);
+    }
+    stats->dropped_critical = atomic_load(&queue_dropped_critical);
+    stats->coalesced = atomic_load(&queue_coalesced);
+    stats->batches = atomic_load(&queue_batches);
+    stats->max_batch = atomic_load(&queue_max_batch);
+}
+
+// Take the next message, high priority queue first
+static bool bt_core_recv_msg(bt_ctx_t* ctx, bt_msg_t* msg) {
+    for (int prio = BT_PRIO_MAX - 1; prio >= 0; prio--) {
+        if (pdTRUE == xQueueReceive(ctx->event_queue[prio], msg, 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void bt_core_handle_msg(bt_ctx_t* ctx, bt_msg_t* event) {
+    BT_DLOGI("BT_CORE", "Received signal: %d, event: 0x%x", event->id,
+             event->event);
+
+    if (event->flags & BT_MSG_F_COALESCE) {
+        bt_core_coalesce_release(event);
+    }
+    bt_trace_record(BT_TRACE_HANDLE, event, event->param, event->param_len,
+                    bt_core_queued(ctx));
+
+    bool handled = false;
+    bt_core_cb_t* subs = ctx->handlers[event->id];
+    for (int i = 0; i < CONFIG_BT_CORE_MAX_SUBSCRIBERS && subs[i]; i++) {
+        uint32_t start = bt_instr_now();
+        subs[i](ctx, event->event, event->param);
+        bt_instr_handler(event->id, i, bt_instr_now() - start);
+        handled = true;
+    }
+    if (!handled) {
+        ESP_LOGW("BT_CORE", "%s, unhandled signal: %d", __func__, event->id);
+    }
+
+    if (event->param) {
+        bt_pool_free(event->param);
+    }
+}
+
+// Deliver expired timers, handlers may arm new ones meanwhile
+static void bt_core_timer_service(bt_ctx_t* ctx) {
+    bt_msg_t msg;
+    while (bt_core_timer_expired(&msg)) {
+        // a trace replay is the only input while it runs
+        if (!bt_trace_replaying()) {
+            bt_core_handle_msg(ctx, &msg);
+        }
+    }
 }
 
 static void bt_core_task_handler(void* arg) {
     bt_ctx_t* ctx = (bt_ctx_t*)arg;
     bt_msg_t event;
     for (;;) {
-        if (pdTRUE == xQueueReceive(ctx->event_queue, &event,
-                                    (TickType_t)portMAX_DELAY)) {
-            ESP_LOGI("BT_CORE", "Received event: %d", event.id);
-
-            switch (event.id) {
-            case 0: // FIXME: Use proper signal
-                if (event.cb) {
-                    event.cb(ctx, event.event, event.param);
-                }
-            default:
-                ESP_LOGW("BT_CORE", "%s, unhandled signal: %d", __func__,
-                         event.id);
-                break;
-            }
+        bt_core_timer_service(ctx);
+        if (pdTRUE != xSemaphoreTake(ctx->event_sem, bt_core_timer_next())) {
+            continue;
+        }
 
-            if (event.param) {
-                free(event.param);
+        // drain a batch per wake-up, later arrivals coalesce meanwhile
+        uint32_t batch = 0;
+        do {
+            if (bt_core_recv_msg(ctx, &event)) {
+                bt_core_handle_msg(ctx, &event);
+                batch++;
             }
+        } while (batch < CONFIG_BT_CORE_BATCH_SIZE &&
+                 pdTRUE == xSemaphoreTake(ctx->event_sem, 0));
+
+        atomic_fetch_add(&queue_batches, 1);
+        if (batch > atomic_load(&queue_max_batch)) {
+            atomic_store(&queue_max_batch, batch);
         }
     }
 }
 
 void bt_core_start(bt_ctx_t* ctx) {
-    ctx->event_queue = xQueueCreate(10, sizeof(bt_msg_t));
-    xTaskCreate(bt_core_task_handler, "BtCoreTask", 2048, ctx, 10,
-                &ctx->event_task);
+#if CONFIG_SYS_MEM_STATIC
+    for (int prio = 0; prio < BT_PRIO_MAX; prio++) {
+        ctx->event_queue[prio] = xQueueCreateStatic(
+            CONFIG_BT_CORE_QUEUE_LEN, sizeof(bt_msg_t), queue_storage[prio],
+            &queue_buf[prio]);
+    }
+    ctx->event_sem = xSemaphoreCreateCountingStatic(
+        CONFIG_BT_CORE_QUEUE_LEN * BT_PRIO_MAX, 0, &queue_sem_buf);
+#else
+    for (int prio = 0; prio < BT_PRIO_MAX; prio++) {
+        ctx->event_queue[prio] =
+            xQueueCreate(CONFIG_BT_CORE_QUEUE_LEN, sizeof(bt_msg_t));
+    }
+    ctx->event_sem =
+        xSemaphoreCreateCounting(CONFIG_BT_CORE_QUEUE_LEN * BT_PRIO_MAX, 0);
+#endif
+    ctx->event_task =
+        sys_task_create(SYS_TASK_BT_CORE, bt_core_task_handler, ctx);
+    bt_dlog_start();
     ESP_LOGI("BT_CORE", "Bluetooth core started");
 }
 
 int bt_deinit(bt_ctx_t* ctx) {
+#if !CONFIG_SYS_MEM_STATIC
     if (ctx != nullptr)
         free(ctx);
+#endif
 
     if (esp_bluedroid_disable() != ESP_OK) {
         ESP_LOGE("BT_AV", "%s disable bluedroid failed", __func__);
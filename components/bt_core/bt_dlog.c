@@ -0,0 +1,137 @@
+#include "bt_dlog.h"
+#include "sdkconfig.h"
+
+#if CONFIG_BT_CORE_DLOG
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sys_mem.h"
+#include "sys_task.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define BT_DLOG_RECORDS CONFIG_BT_CORE_DLOG_RECORDS
+#define BT_DLOG_MASK (BT_DLOG_RECORDS - 1)
+
+_Static_assert((BT_DLOG_RECORDS & BT_DLOG_MASK) == 0,
+               "BT_CORE_DLOG_RECORDS must be a power of two");
+
+typedef struct {
+    // Sequence relative to the slot index, so the zeroed ring starts out
+    // free: the position it is free for, position + 1 once written.
+    _Atomic uint32_t seq;
+    uint32_t ts; // esp_log_timestamp
+    const char* tag;
+    const char* fmt;
+    uint8_t level;
+    uint32_t args[BT_DLOG_MAX_ARGS];
+} bt_dlog_rec_t;
+
+static bt_dlog_rec_t dlog_ring[BT_DLOG_RECORDS];
+static _Atomic uint32_t dlog_head; // next position to claim
+static uint32_t dlog_tail;         // next position to format
+static _Atomic uint32_t dlog_dropped;
+static SemaphoreHandle_t dlog_lock; // single consumer: task or flush
+static TaskHandle_t dlog_task;
+
+static uint32_t bt_dlog_seq(bt_dlog_rec_t* rec, uint32_t pos) {
+    return atomic_load_explicit(&rec->seq, memory_order_acquire) +
+           (pos & BT_DLOG_MASK);
+}
+
+static void bt_dlog_set_seq(bt_dlog_rec_t* rec, uint32_t pos, uint32_t seq) {
+    atomic_store_explicit(&rec->seq, seq - (pos & BT_DLOG_MASK),
+                          memory_order_release);
+}
+
+void bt_dlog_write(esp_log_level_t level, const char* tag, const char* fmt,
+                   const uint32_t* args, uint32_t nargs) {
+    // multi-producer: claim a slot by moving the head past it, a slot is
+    // free once the formatter has set its seq to the claimed position
+    uint32_t pos = atomic_load_explicit(&dlog_head, memory_order_relaxed);
+    bt_dlog_rec_t* rec;
+    for (;;) {
+        rec = &dlog_ring[pos & BT_DLOG_MASK];
+        uint32_t seq = bt_dlog_seq(rec, pos);
+        int32_t dif = (int32_t)(seq - pos);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &dlog_head, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            atomic_fetch_add_explicit(&dlog_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&dlog_head, memory_order_relaxed);
+        }
+    }
+
+    rec->ts = esp_log_timestamp();
+    rec->tag = tag;
+    rec->fmt = fmt;
+    rec->level = level;
+    memcpy(rec->args, args, nargs * sizeof(uint32_t));
+    bt_dlog_set_seq(rec, pos, pos + 1);
+}
+
+static const char bt_dlog_letter[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+
+// Format the next record, false when none is complete
+static bool bt_dlog_format_one(void) {
+    bt_dlog_rec_t* rec = &dlog_ring[dlog_tail & BT_DLOG_MASK];
+    if (bt_dlog_seq(rec, dlog_tail) != dlog_tail + 1) {
+        return false;
+    }
+
+    esp_log_level_t level = rec->level;
+    const uint32_t* a = rec->args;
+    esp_log_write(level, rec->tag, "%c (%" PRIu32 ") %s: ",
+                  bt_dlog_letter[level], rec->ts, rec->tag);
+    // unused trailing arguments are ignored by the format
+    esp_log_write(level, rec->tag, rec->fmt, a[0], a[1], a[2], a[3], a[4],
+                  a[5]);
+    esp_log_write(level, rec->tag, "\n");
+
+    bt_dlog_set_seq(rec, dlog_tail, dlog_tail + BT_DLOG_RECORDS);
+    dlog_tail++;
+    return true;
+}
+
+void bt_dlog_flush(void) {
+    if (dlog_lock != NULL) {
+        xSemaphoreTake(dlog_lock, portMAX_DELAY);
+    }
+    uint32_t dropped = atomic_exchange(&dlog_dropped, 0);
+    if (dropped) {
+        ESP_LOGW("BT_DLOG", "%" PRIu32 " records dropped", dropped);
+    }
+    while (bt_dlog_format_one()) {
+    }
+    if (dlog_lock != NULL) {
+        xSemaphoreGive(dlog_lock);
+    }
+}
+
+static void bt_dlog_task_handler(void* arg) {
+    for (;;) {
+        bt_dlog_flush();
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_BT_CORE_DLOG_PERIOD_MS));
+    }
+}
+
+void bt_dlog_start(void) {
+    if (dlog_task == NULL) {
+#if CONFIG_SYS_MEM_STATIC
+        static StaticSemaphore_t dlog_lock_buf;
+        dlog_lock = xSemaphoreCreateMutexStatic(&dlog_lock_buf);
+#else
+        dlog_lock = xSemaphoreCreateMutex();
+#endif
+        dlog_task = sys_task_create(SYS_TASK_BT_DLOG, bt_dlog_task_handler,
+                                    NULL);
+    }
+}
+
+#endif
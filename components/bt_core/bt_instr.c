@@ -0,0 +1,122 @@
+#include "bt_instr.h"
+#include "sdkconfig.h"
+
+#if CONFIG_BT_CORE_INSTRUMENT
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_system.h"
+#endif
+
+static bt_instr_hist_t instr_handler[BT_SIG_MAX]
+                                    [CONFIG_BT_CORE_MAX_SUBSCRIBERS];
+static _Atomic uint32_t instr_queue_high_water[BT_PRIO_MAX];
+
+// Not the cycle counter, sys_pm moves the CPU between 80, 160 and 240 MHz
+// so cycles have no fixed length
+uint32_t bt_instr_now(void) {
+    return esp_timer_get_time();
+}
+
+void bt_instr_handler(uint16_t sig, int sub, uint32_t ticks) {
+    bt_instr_hist_t* h = &instr_handler[sig][sub];
+    int b = 0;
+    if (ticks >> BT_INSTR_FIRST_SHIFT) {
+        b = 31 - __builtin_clz(ticks) - BT_INSTR_FIRST_SHIFT + 1;
+        if (b >= BT_INSTR_BUCKETS) {
+            b = BT_INSTR_BUCKETS - 1;
+        }
+    }
+    h->hist[b]++;
+    h->count++;
+    h->total += ticks;
+    if (ticks > h->max) {
+        h->max = ticks;
+    }
+}
+
+void bt_instr_queue_depth(bt_prio_t prio, uint32_t depth) {
+    uint32_t high = atomic_load_explicit(&instr_queue_high_water[prio],
+                                         memory_order_relaxed);
+    while (depth > high &&
+           !atomic_compare_exchange_weak_explicit(
+               &instr_queue_high_water[prio], &high, depth,
+               memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void bt_instr_get(bt_ctx_t* ctx, bt_instr_t* instr) {
+    instr->clock_hz = 1000000;
+    memcpy(instr->handler, instr_handler, sizeof(instr_handler));
+    for (int prio = 0; prio < BT_PRIO_MAX; prio++) {
+        instr->queue_high_water[prio] =
+            atomic_load_explicit(&instr_queue_high_water[prio],
+                                 memory_order_relaxed);
+    }
+    // ESP-IDF reports the watermark in bytes
+    instr->stack_free_min = ctx->event_task != NULL
+                                ? uxTaskGetStackHighWaterMark(ctx->event_task)
+                                : 0;
+#if CONFIG_IDF_TARGET_LINUX
+    instr->heap_free = 0;
+    instr->heap_free_min = 0;
+#else
+    instr->heap_free = esp_get_free_heap_size();
+    instr->heap_free_min = esp_get_minimum_free_heap_size();
+#endif
+    bt_core_get_pool_stats(&instr->pool);
+}
+
+void bt_instr_reset(void) {
+    memset(instr_handler, 0, sizeof(instr_handler));
+    for (int prio = 0; prio < BT_PRIO_MAX; prio++) {
+        atomic_store(&instr_queue_high_water[prio], 0);
+    }
+}
+
+void bt_instr_dump(bt_ctx_t* ctx) {
+    static bt_instr_t instr;
+    bt_instr_get(ctx, &instr);
+    uint32_t per_us = instr.clock_hz / 1000000;
+
+    for (int sig = 0; sig < BT_SIG_MAX; sig++) {
+        for (int sub = 0; sub < CONFIG_BT_CORE_MAX_SUBSCRIBERS; sub++) {
+            bt_instr_hist_t* h = &instr.handler[sig][sub];
+            if (h->count == 0) {
+                continue;
+            }
+            ESP_LOGI("BT_INSTR",
+                     "sig %d sub %d: %" PRIu32 " calls, avg %" PRIu32
+                     " us, max %" PRIu32 " us",
+                     sig, sub, h->count,
+                     (uint32_t)(h->total / h->count / per_us),
+                     h->max / per_us);
+            // one column per bucket, the upper bound in clock ticks is
+            // 2^(column + BT_INSTR_FIRST_SHIFT)
+            char line[BT_INSTR_BUCKETS * 11 + 1];
+            int len = 0;
+            for (int b = 0; b < BT_INSTR_BUCKETS; b++) {
+                len += snprintf(line + len, sizeof(line) - len, " %" PRIu32,
+                                h->hist[b]);
+            }
+            ESP_LOGI("BT_INSTR", "  hist:%s", line);
+        }
+    }
+    ESP_LOGI("BT_INSTR", "queue high water: low %" PRIu32 ", high %" PRIu32,
+             instr.queue_high_water[BT_PRIO_LOW],
+             instr.queue_high_water[BT_PRIO_HIGH]);
+    ESP_LOGI("BT_INSTR", "core stack never used: %" PRIu32 " bytes",
+             instr.stack_free_min);
+    ESP_LOGI("BT_INSTR", "pool: %" PRIu32 "/%" PRIu32 " high water, %" PRIu32
+             " exhausted", instr.pool.high_water, instr.pool.slots,
+             instr.pool.exhausted);
+    ESP_LOGI("BT_INSTR", "heap free: %" PRIu32 ", min %" PRIu32,
+             instr.heap_free, instr.heap_free_min);
+}
+
+#endif
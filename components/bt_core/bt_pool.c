@@ -0,0 +1,73 @@
+#include "bt_pool.h"
+#include "bt_core.h"
+#include "sdkconfig.h"
+#include <stdatomic.h>
+
+#define BT_POOL_SLOTS CONFIG_BT_CORE_MSG_POOL_SIZE
+#define BT_POOL_MASK ((uint32_t)(((uint64_t)1 << BT_POOL_SLOTS) - 1))
+// as many as the queues hold back for critical messages, so a flood of
+// other events queued up to the reserved slots cannot starve them
+#define BT_POOL_RESERVED (CONFIG_BT_CORE_RESERVED_SLOTS * BT_PRIO_MAX)
+
+_Static_assert(BT_POOL_RESERVED < BT_POOL_SLOTS,
+               "BT_CORE_MSG_POOL_SIZE must exceed the reserved queue slots");
+
+static bt_pool_param_t pool_slots[BT_POOL_SLOTS];
+// bit n set when slot n is in use
+static _Atomic uint32_t pool_used;
+static _Atomic uint32_t pool_high_water;
+static _Atomic uint32_t pool_exhausted;
+static _Atomic uint32_t pool_oversize;
+
+void* bt_pool_alloc(uint32_t len, bool critical) {
+    if (len > sizeof(bt_pool_param_t)) {
+        atomic_fetch_add_explicit(&pool_oversize, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    uint32_t used = atomic_load_explicit(&pool_used, memory_order_relaxed);
+    for (;;) {
+        uint32_t free_bits = ~used & BT_POOL_MASK;
+        if (free_bits == 0 ||
+            (!critical &&
+             (uint32_t)__builtin_popcount(free_bits) <= BT_POOL_RESERVED)) {
+            atomic_fetch_add_explicit(&pool_exhausted, 1,
+                                      memory_order_relaxed);
+            return NULL;
+        }
+        uint32_t bit = free_bits & -free_bits;
+        if (atomic_compare_exchange_weak_explicit(&pool_used, &used,
+                                                  used | bit,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed)) {
+            uint32_t in_use = __builtin_popcount(used | bit);
+            uint32_t high = atomic_load_explicit(&pool_high_water,
+                                                 memory_order_relaxed);
+            while (in_use > high &&
+                   !atomic_compare_exchange_weak_explicit(
+                       &pool_high_water, &high, in_use, memory_order_relaxed,
+                       memory_order_relaxed)) {
+            }
+            return &pool_slots[__builtin_ctz(bit)];
+        }
+    }
+}
+
+void bt_pool_free(void* param) {
+    uint32_t idx = (bt_pool_param_t*)param - pool_slots;
+    atomic_fetch_and_explicit(&pool_used, ~((uint32_t)1 << idx),
+                              memory_order_release);
+}
+
+void bt_core_get_pool_stats(bt_core_pool_stats_t* stats) {
+    uint32_t used = atomic_load_explicit(&pool_used, memory_order_relaxed);
+    stats->slots = BT_POOL_SLOTS;
+    stats->slot_size = sizeof(bt_pool_param_t);
+    stats->in_use = __builtin_popcount(used);
+    stats->high_water =
+        atomic_load_explicit(&pool_high_water, memory_order_relaxed);
+    stats->exhausted =
+        atomic_load_explicit(&pool_exhausted, memory_order_relaxed);
+    stats->oversize =
+        atomic_load_explicit(&pool_oversize, memory_order_relaxed);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdbool.h>
+#include "esp_a2dp_api.h"
+#include "esp_avrc_api.h"
+#include "esp_gap_bt_api.h"
+
+// A pool slot fits the parameters of any callback dispatched to the core
+typedef union {
+    esp_a2d_cb_param_t a2d;
+    esp_avrc_ct_cb_param_t avrc_ct;
+    esp_bt_gap_cb_param_t gap;
+} bt_pool_param_t;
+
+// Take a slot from the pool, returns NULL when exhausted. The last
+// BT_POOL_RESERVED slots are only taken for critical messages.
+// Lock-free, callable from any task.
+void* bt_pool_alloc(uint32_t len, bool critical);
+
+// Return a slot taken with bt_pool_alloc
+void bt_pool_free(void* param);
@@ -0,0 +1,181 @@
+#include "bt_trace.h"
+#include "sdkconfig.h"
+
+#if CONFIG_BT_CORE_TRACE
+#include "bt_pool.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BT_TRACE_RECORDS CONFIG_BT_CORE_TRACE_RECORDS
+#define BT_TRACE_PARAM_BYTES CONFIG_BT_CORE_TRACE_PARAM_BYTES
+
+static bt_trace_rec_t trace_ring[BT_TRACE_RECORDS];
+static uint32_t trace_head; // records ever written
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+static atomic_bool trace_replay;
+
+void bt_trace_record(bt_trace_kind_t kind, const bt_msg_t* msg,
+                     const void* params, uint32_t param_len, uint32_t qdepth) {
+    bt_trace_rec_t rec;
+    rec.ts_us = esp_timer_get_time();
+    rec.event = msg->event;
+    rec.sig = msg->id;
+    rec.kind = kind;
+    rec.flags = msg->flags;
+    rec.qdepth = qdepth > UINT8_MAX ? UINT8_MAX : qdepth;
+    rec.param_len = params != NULL ? param_len : 0;
+
+    uint32_t n = rec.param_len < BT_TRACE_PARAM_BYTES ? rec.param_len
+                                                      : BT_TRACE_PARAM_BYTES;
+    if (n != 0) {
+        memcpy(rec.param, params, n);
+    }
+    memset(rec.param + n, 0, BT_TRACE_PARAM_BYTES - n);
+
+    portENTER_CRITICAL_SAFE(&trace_lock);
+    trace_ring[trace_head % BT_TRACE_RECORDS] = rec;
+    trace_head++;
+    portEXIT_CRITICAL_SAFE(&trace_lock);
+}
+
+void bt_trace_dump(void) {
+    portENTER_CRITICAL(&trace_lock);
+    uint32_t head = trace_head;
+    portEXIT_CRITICAL(&trace_lock);
+    uint32_t first = head > BT_TRACE_RECORDS ? head - BT_TRACE_RECORDS : 0;
+
+    printf("BTT:BEGIN %" PRIu32 " %d\n", head - first, BT_TRACE_PARAM_BYTES);
+    for (uint32_t i = first; i < head; i++) {
+        bt_trace_rec_t rec;
+        portENTER_CRITICAL(&trace_lock);
+        rec = trace_ring[i % BT_TRACE_RECORDS];
+        portEXIT_CRITICAL(&trace_lock);
+
+        // ts event sig kind flags qdepth param_len, then the param bytes
+        printf("BTT:%08" PRIx32 " %04x %02x %02x %02x %02x %04x ", rec.ts_us,
+               rec.event, rec.sig, rec.kind, rec.flags, rec.qdepth,
+               rec.param_len);
+        uint32_t n = rec.param_len < BT_TRACE_PARAM_BYTES
+                         ? rec.param_len
+                         : BT_TRACE_PARAM_BYTES;
+        for (uint32_t b = 0; b < n; b++) {
+            printf("%02x", rec.param[b]);
+        }
+        printf("\n");
+    }
+    printf("BTT:END\n");
+}
+
+void bt_trace_clear(void) {
+    portENTER_CRITICAL(&trace_lock);
+    trace_head = 0;
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+static int bt_trace_hex(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool bt_trace_parse(const char* line, bt_trace_rec_t* rec) {
+    // the record may be preceded by log output on the same line
+    const char* p = strstr(line, "BTT:");
+    if (p == NULL) {
+        return false;
+    }
+
+    unsigned ts, event, sig, kind, flags, qdepth, len;
+    int used = 0;
+    if (sscanf(p, "BTT:%8x %4x %2x %2x %2x %2x %4x %n", &ts, &event, &sig,
+               &kind, &flags, &qdepth, &len, &used) != 7 ||
+        sig >= BT_SIG_MAX || kind > BT_TRACE_HANDLE) {
+        return false;
+    }
+
+    memset(rec, 0, sizeof(bt_trace_rec_t));
+    rec->ts_us = ts;
+    rec->event = event;
+    rec->sig = sig;
+    rec->kind = kind;
+    rec->flags = flags;
+    rec->qdepth = qdepth;
+    rec->param_len = len;
+
+    // a dump from a build with more param bytes is truncated to ours
+    p += used;
+    for (uint32_t b = 0; b < BT_TRACE_PARAM_BYTES; b++) {
+        int hi = bt_trace_hex(p[0]);
+        int lo = hi < 0 ? -1 : bt_trace_hex(p[1]);
+        if (lo < 0) {
+            break;
+        }
+        rec->param[b] = hi << 4 | lo;
+        p += 2;
+    }
+    return true;
+}
+
+bool bt_trace_replaying(void) {
+    return atomic_load(&trace_replay);
+}
+
+void bt_trace_replay(bt_ctx_t* ctx, const bt_trace_rec_t* recs, size_t count,
+                     bool timed, bt_trace_replay_stats_t* stats) {
+    static bt_pool_param_t param;
+    const bt_trace_rec_t* prev = NULL;
+
+    memset(stats, 0, sizeof(bt_trace_replay_stats_t));
+    atomic_store(&trace_replay, true);
+
+    for (size_t i = 0; i < count; i++) {
+        const bt_trace_rec_t* rec = &recs[i];
+        if (rec->kind != BT_TRACE_HANDLE) {
+            continue;
+        }
+        uint32_t gap_us = prev ? rec->ts_us - prev->ts_us : 0;
+        if (timed && gap_us >= 1000) {
+            vTaskDelay(pdMS_TO_TICKS(gap_us / 1000));
+        }
+        stats->span_us += gap_us;
+        prev = rec;
+
+        ESP_LOGI("BT_TRACE", "+%" PRIu32 " us sig: %d, event: 0x%x, q: %d",
+                 gap_us, rec->sig, rec->event, rec->qdepth);
+
+        // handlers get a private copy, zero padded past the recorded bytes
+        memset(&param, 0, sizeof(param));
+        memcpy(&param, rec->param, BT_TRACE_PARAM_BYTES);
+        void* p = rec->param_len != 0 ? &param : NULL;
+
+        int64_t start = esp_timer_get_time();
+        bt_core_cb_t* subs = ctx->handlers[rec->sig];
+        for (int s = 0; s < CONFIG_BT_CORE_MAX_SUBSCRIBERS && subs[s]; s++) {
+            subs[s](ctx, rec->event, p);
+        }
+        uint32_t took = esp_timer_get_time() - start;
+
+        stats->handler_us += took;
+        if (took > stats->slowest_us) {
+            stats->slowest_us = took;
+            stats->slowest = i;
+        }
+        stats->records++;
+    }
+
+    atomic_store(&trace_replay, false);
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include "esp_bt_defs.h"
 #include "esp_gap_bt_api.h"
 #include "freertos/idf_additions.h"
+#include "sdkconfig.h"
 #include <stdint.h>
 
 typedef enum {
@@ -26,31 +27,86 @@ typedef enum {
     BT_MEDIA_STATE_STOPPING,
 } bt_media_state_t;
 
-typedef struct {
+// Signals route messages to the subsystems subscribed to them
+typedef enum {
+    BT_SIG_STACK = 0, // stack lifecycle, see bt_core_evt_t
+    BT_SIG_GAP,       // GAP events that only need logging or a reply
+    BT_SIG_A2DP,      // A2DP source events and connection timers
+    BT_SIG_AVRC_CT,   // AVRC controller events
+    BT_SIG_PLAYER,    // playback control
+    BT_SIG_MAX,
+} bt_signal_t;
+
+// Messages on high priority signals are handled before any low priority one
+typedef enum {
+    BT_PRIO_LOW = 0,
+    BT_PRIO_HIGH,
+    BT_PRIO_MAX,
+} bt_prio_t;
+
+// Events on BT_SIG_STACK
+typedef enum {
+    BT_CORE_EVT_STACK_UP = 0,
+} bt_core_evt_t;
+
+typedef struct bt_ctx bt_ctx_t;
+
+typedef void (*bt_core_cb_t)(bt_ctx_t* ctx, uint16_t event, void* event_data);
+
+struct bt_ctx {
     bt_state_t state;
     bt_state_t a2dp_state;
     bt_media_state_t media_state;
-    QueueHandle_t event_queue;
+    QueueHandle_t event_queue[BT_PRIO_MAX];
+    SemaphoreHandle_t event_sem; // counts messages across both queues
     TaskHandle_t event_task;
+    bt_core_cb_t handlers[BT_SIG_MAX][CONFIG_BT_CORE_MAX_SUBSCRIBERS];
+    bt_prio_t sig_prio[BT_SIG_MAX];
     uint8_t peer_bdname[ESP_BT_GAP_MAX_BDNAME_LEN + 1];
     esp_bd_addr_t peer_bda;
     esp_avrc_rn_evt_cap_mask_t avrc_peer_rn_cap;
-    int connecting_intv;
-    int intv_cnt;
-    TimerHandle_t heart_beat_timer;
     uint8_t volume;
-    uint32_t pkt_cnt;
-} bt_ctx_t;
+};
 
-typedef void (*bt_core_cb_t)(bt_ctx_t* ctx, uint16_t event, void* event_data);
+// Overflow policy for a dispatched message
+typedef enum {
+    BT_MSG_F_NONE = 0,
+    // state change that must not be lost: may use the reserved queue slots
+    // and waits up to BT_CORE_CRITICAL_TIMEOUT_MS for room
+    BT_MSG_F_CRITICAL = 1 << 0,
+    // replaces the params of an undelivered message with the same signal
+    // and event instead of queueing a duplicate
+    BT_MSG_F_COALESCE = 1 << 1,
+    // raised by an expired bt_core timer, never queued
+    BT_MSG_F_TIMER = 1 << 2,
+} bt_msg_flags_t;
 
 typedef struct {
-    uint16_t id;
+    uint16_t id; // bt_signal_t
     uint16_t event;
-    bt_core_cb_t cb;
+    uint8_t flags; // bt_msg_flags_t
+    uint16_t param_len;
     void* param;
 } bt_msg_t;
 
+typedef struct {
+    uint32_t sent[BT_PRIO_MAX];    // messages queued per priority
+    uint32_t dropped[BT_PRIO_MAX]; // non-critical messages refused
+    uint32_t dropped_critical;     // critical messages that timed out
+    uint32_t coalesced;            // messages merged into a pending one
+    uint32_t batches;              // wake-ups of the core task
+    uint32_t max_batch;            // most messages handled in one batch
+} bt_core_queue_stats_t;
+
+typedef struct {
+    uint32_t slots;      // parameter slots in the pool
+    uint32_t slot_size;  // bytes per slot
+    uint32_t in_use;     // slots currently held by queued messages
+    uint32_t high_water; // most slots ever in use at once
+    uint32_t exhausted;  // dispatches dropped because the pool was empty
+    uint32_t oversize;   // dispatches dropped because params did not fit
+} bt_core_pool_stats_t;
+
 // initialize Bluetooth and allocate resources
 // ctx will be allocated and must be freed with bt_deinit
 bt_ctx_t* bt_init(void);
@@ -58,9 +114,37 @@ bt_ctx_t* bt_init(void);
 // Starts the bluetooth task and queue
 void bt_core_start(bt_ctx_t* ctx);
 
-bool bt_core_dispatch(bt_ctx_t* ctx, bt_core_cb_t cback, uint16_t event,
+// Subscribe cb to every event posted on sig. Subscribers of a signal are
+// called in subscription order and share the same params.
+// Call before bt_core_start or from the core task.
+bool bt_core_subscribe(bt_ctx_t* ctx, bt_signal_t sig, bt_core_cb_t cb);
+
+// Change the queue priority of a signal
+void bt_core_set_priority(bt_ctx_t* ctx, bt_signal_t sig, bt_prio_t prio);
+
+// Post an event to the subscribers of sig, handled in the core task
+bool bt_core_dispatch(bt_ctx_t* ctx, bt_signal_t sig, uint16_t event,
                       void* params, uint32_t param_len);
 
+// bt_core_dispatch with an overflow policy, see bt_msg_flags_t
+bool bt_core_dispatch_ex(bt_ctx_t* ctx, bt_signal_t sig, uint16_t event,
+                         void* params, uint32_t param_len, uint8_t flags);
+
+// Deliver event to the subscribers of sig after delay_ms, in the core task.
+// A timer is identified by sig and event: arming it again moves its
+// deadline. Callable from any task. Returns false if no timer is free.
+bool bt_core_timer_arm(bt_ctx_t* ctx, bt_signal_t sig, uint16_t event,
+                       uint32_t delay_ms);
+
+// Disarm a timer, nothing is delivered for it afterwards
+void bt_core_timer_cancel(bt_ctx_t* ctx, bt_signal_t sig, uint16_t event);
+
+// Snapshot of the event queue counters
+void bt_core_get_queue_stats(bt_core_queue_stats_t* stats);
+
+// Snapshot of the message parameter pool counters
+void bt_core_get_pool_stats(bt_core_pool_stats_t* stats);
+
 // deinitialize Bluetooth and release resources
 // ctx willl be freed
 int bt_deinit(bt_ctx_t* ctx);
@@ -0,0 +1,61 @@
+#pragma once
+// Deferred logging: the BT_DLOGx macros copy the format pointer and up to
+// BT_DLOG_MAX_ARGS integer arguments into a lock-free ring, and a low
+// priority task formats them later. Use them on hot paths where ESP_LOGx
+// would stall the caller on the UART. Arguments are stored as uint32_t, so
+// only 32-bit integer conversions are allowed; pass no strings.
+// Without CONFIG_BT_CORE_DLOG the macros are plain ESP_LOGx calls.
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <stdint.h>
+
+#define BT_DLOG_MAX_ARGS 6
+
+#if CONFIG_BT_CORE_DLOG
+
+// Append a record, callable from any task. The record is dropped when the
+// ring is full.
+void bt_dlog_write(esp_log_level_t level, const char* tag, const char* fmt,
+                   const uint32_t* args, uint32_t nargs);
+
+// Start the formatter task
+void bt_dlog_start(void);
+
+// Format every pending record in the calling task
+void bt_dlog_flush(void);
+
+// never called, lets the compiler check the format against the arguments
+static inline void __attribute__((format(printf, 1, 2)))
+bt_dlog_check(const char* fmt, ...) {}
+
+#define BT_DLOG(level, tag, fmt, ...)                                          \
+    do {                                                                       \
+        if (LOG_LOCAL_LEVEL >= level) {                                        \
+            const uint32_t _args[] = {0, ##__VA_ARGS__};                       \
+            _Static_assert(sizeof(_args) / sizeof(_args[0]) - 1 <=             \
+                               BT_DLOG_MAX_ARGS,                               \
+                           "too many deferred log arguments");                 \
+            if (0) {                                                           \
+                bt_dlog_check(fmt, ##__VA_ARGS__);                             \
+            }                                                                  \
+            bt_dlog_write(level, tag, fmt, _args + 1,                          \
+                          sizeof(_args) / sizeof(_args[0]) - 1);               \
+        }                                                                      \
+    } while (0)
+
+#define BT_DLOGE(tag, fmt, ...) BT_DLOG(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#define BT_DLOGW(tag, fmt, ...) BT_DLOG(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#define BT_DLOGI(tag, fmt, ...) BT_DLOG(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#define BT_DLOGD(tag, fmt, ...) BT_DLOG(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+
+#else
+
+static inline void bt_dlog_start(void) {}
+static inline void bt_dlog_flush(void) {}
+
+#define BT_DLOGE(tag, fmt, ...) ESP_LOGE(tag, fmt, ##__VA_ARGS__)
+#define BT_DLOGW(tag, fmt, ...) ESP_LOGW(tag, fmt, ##__VA_ARGS__)
+#define BT_DLOGI(tag, fmt, ...) ESP_LOGI(tag, fmt, ##__VA_ARGS__)
+#define BT_DLOGD(tag, fmt, ...) ESP_LOGD(tag, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+// Hot-path instrumentation of the Bluetooth core: handler latency
+// histograms, queue depth and stack high-water marks, pool and heap usage.
+// Compiled out unless CONFIG_BT_CORE_INSTRUMENT is set.
+#include "bt_core.h"
+#include "sdkconfig.h"
+#include <stdint.h>
+
+// Bucket 0 counts latencies below 2^BT_INSTR_FIRST_SHIFT clock ticks,
+// bucket b those in [2^(b + BT_INSTR_FIRST_SHIFT - 1), 2^(b + SHIFT)),
+// the last bucket everything above.
+#define BT_INSTR_BUCKETS 20
+#define BT_INSTR_FIRST_SHIFT 4
+
+typedef struct {
+    uint32_t count;
+    uint32_t max;   // clock ticks
+    uint64_t total; // clock ticks
+    uint32_t hist[BT_INSTR_BUCKETS];
+} bt_instr_hist_t;
+
+typedef struct {
+    uint32_t clock_hz; // latency clock, esp_timer us
+    bt_instr_hist_t handler[BT_SIG_MAX][CONFIG_BT_CORE_MAX_SUBSCRIBERS];
+    uint32_t queue_high_water[BT_PRIO_MAX]; // most messages queued
+    uint32_t stack_free_min;                // BtCoreTask stack never used
+    uint32_t heap_free;
+    uint32_t heap_free_min;
+    bt_core_pool_stats_t pool;
+} bt_instr_t;
+
+#if CONFIG_BT_CORE_INSTRUMENT
+
+// Latency clock, see bt_instr_t.clock_hz
+uint32_t bt_instr_now(void);
+
+// Account one handler call, core task only
+void bt_instr_handler(uint16_t sig, int sub, uint32_t ticks);
+
+// Account the depth of a queue after a send, callable from any task
+void bt_instr_queue_depth(bt_prio_t prio, uint32_t depth);
+
+// Snapshot of the counters. Histograms are written by the core task
+// without locking, a snapshot taken meanwhile may be off by one call.
+void bt_instr_get(bt_ctx_t* ctx, bt_instr_t* instr);
+
+// Clear histograms and high-water marks
+void bt_instr_reset(void);
+
+// Log a summary of the counters
+void bt_instr_dump(bt_ctx_t* ctx);
+
+#else
+
+static inline uint32_t bt_instr_now(void) {
+    return 0;
+}
+static inline void bt_instr_handler(uint16_t sig, int sub, uint32_t ticks) {}
+static inline void bt_instr_queue_depth(bt_prio_t prio, uint32_t depth) {}
+
+#endif
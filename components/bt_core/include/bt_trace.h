@@ -0,0 +1,76 @@
+#pragma once
+// Event trace of the Bluetooth core: every dispatched and handled message
+// is recorded into a RAM ring with its params, so a field issue can be
+// dumped over the console and replayed against the handlers on the host.
+#include "bt_core.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef CONFIG_BT_CORE_TRACE_PARAM_BYTES
+#define CONFIG_BT_CORE_TRACE_PARAM_BYTES 0
+#endif
+
+typedef enum {
+    BT_TRACE_DISPATCH = 0, // queued by bt_core_dispatch
+    BT_TRACE_COALESCED,    // merged into a pending message
+    BT_TRACE_DROPPED,      // refused by the queue or the pool
+    BT_TRACE_HANDLE,       // taken by the core task, about to be handled
+} bt_trace_kind_t;
+
+typedef struct {
+    uint32_t ts_us;     // esp_timer time, wraps after ~71 minutes
+    uint16_t event;
+    uint8_t sig;        // bt_signal_t
+    uint8_t kind;       // bt_trace_kind_t
+    uint8_t flags;      // bt_msg_flags_t of the message
+    uint8_t qdepth;     // messages queued across priorities
+    uint16_t param_len; // full length, param keeps the leading bytes
+    uint8_t param[CONFIG_BT_CORE_TRACE_PARAM_BYTES];
+} bt_trace_rec_t;
+
+typedef struct {
+    uint32_t records;    // handled records fed to the subscribers
+    uint32_t span_us;    // recorded time from first to last record
+    uint32_t handler_us; // time spent in the subscribers
+    uint32_t slowest_us; // slowest single record
+    uint32_t slowest;    // index of the slowest record
+} bt_trace_replay_stats_t;
+
+#if CONFIG_BT_CORE_TRACE
+
+// Append a record, callable from any task
+void bt_trace_record(bt_trace_kind_t kind, const bt_msg_t* msg,
+                     const void* params, uint32_t param_len, uint32_t qdepth);
+
+// Print the ring oldest first, one "BTT:" line per record
+void bt_trace_dump(void);
+
+// Empty the ring
+void bt_trace_clear(void);
+
+// Parse one line of bt_trace_dump output, false if it is not a record
+bool bt_trace_parse(const char* line, bt_trace_rec_t* rec);
+
+// Feed the handled records of a trace to the subscribers of ctx, in the
+// calling task. Live dispatches are dropped meanwhile so the trace is the
+// only input. With timed set the recorded gaps are slept through.
+void bt_trace_replay(bt_ctx_t* ctx, const bt_trace_rec_t* recs, size_t count,
+                     bool timed, bt_trace_replay_stats_t* stats);
+
+// True while bt_trace_replay runs
+bool bt_trace_replaying(void);
+
+#else
+
+static inline void bt_trace_record(bt_trace_kind_t kind, const bt_msg_t* msg,
+                                   const void* params, uint32_t param_len,
+                                   uint32_t qdepth) {}
+static inline void bt_trace_dump(void) {}
+static inline void bt_trace_clear(void) {}
+static inline bool bt_trace_replaying(void) {
+    return false;
+}
+
+#endif
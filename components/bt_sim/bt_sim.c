@@ -0,0 +1,661 @@
+#include "bt_sim.h"
+#include "esp_a2dp_api.h"
+#include "esp_avrc_api.h"
+#include "esp_bt.h"
+#include "esp_bt_device.h"
+#include "esp_bt_main.h"
+#include "esp_gap_bt_api.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include <string.h>
+#include <time.h>
+
+#define BT_SIM_MAX_EVENTS 32
+#define BT_SIM_EIR_MAX 240
+
+typedef enum {
+    SIM_EV_DISC_STARTED,
+    SIM_EV_DISC_RES,
+    SIM_EV_DISC_STOPPED,
+    SIM_EV_DEV_NAME,
+    SIM_EV_A2D_CONN,      // arg: esp_a2d_connection_state_t
+    SIM_EV_A2D_MEDIA_ACK, // arg: esp_a2d_media_ctrl_t
+    SIM_EV_AVRC_CONN,     // arg: connected
+    SIM_EV_AVRC_RN_CAPS,
+    SIM_EV_AVRC_VOLUME_RSP,
+    SIM_EV_SCRIPT,
+} sim_ev_type_t;
+
+typedef struct {
+    bool used;
+    uint32_t due_ms;
+    uint32_t seq;
+    sim_ev_type_t type;
+    uint32_t arg;
+    const bt_sim_step_t* step;
+} sim_ev_t;
+
+static struct {
+    bt_sim_peer_t peer;
+    int64_t start_us;
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+    sim_ev_t events[BT_SIM_MAX_EVENTS];
+    uint32_t seq;
+
+    esp_bt_gap_cb_t gap_cb;
+    esp_a2d_cb_t a2d_cb;
+    esp_a2d_source_data_cb_t data_cb;
+    esp_avrc_ct_cb_t avrc_cb;
+
+    char local_name[ESP_BT_GAP_MAX_BDNAME_LEN + 1];
+    bool discovering;
+    bool connected;
+    bool streaming;
+    bool rn_volume_armed;
+    uint32_t next_pull_ms;
+    bt_sim_report_t report;
+} sim;
+
+static const uint8_t sim_own_bda[ESP_BD_ADDR_LEN] = {0x24, 0x0a, 0xc4,
+                                                     0x00, 0x00, 0x01};
+
+static int64_t bt_sim_real_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t bt_sim_now_ms(void) {
+    return (bt_sim_real_us() - sim.start_us) * CONFIG_BT_SIM_TIME_SCALE /
+           1000;
+}
+
+// Schedule an event delay_ms of simulated time from now. Caller holds lock.
+static sim_ev_t* bt_sim_schedule(sim_ev_type_t type, uint32_t delay_ms,
+                            uint32_t arg) {
+    for (int i = 0; i < BT_SIM_MAX_EVENTS; i++) {
+        sim_ev_t* ev = &sim.events[i];
+        if (!ev->used) {
+            ev->used = true;
+            ev->due_ms = bt_sim_now_ms() + delay_ms;
+            ev->seq = sim.seq++;
+            ev->type = type;
+            ev->arg = arg;
+            ev->step = NULL;
+            return ev;
+        }
+    }
+    ESP_LOGE("BT_SIM", "%s timeline full, event %d lost", __func__, type);
+    return NULL;
+}
+
+// Drop pending events of a type. Caller holds lock.
+static void bt_sim_cancel(sim_ev_type_t type) {
+    for (int i = 0; i < BT_SIM_MAX_EVENTS; i++) {
+        if (sim.events[i].used && sim.events[i].type == type) {
+            sim.events[i].used = false;
+        }
+    }
+}
+
+// Take the earliest event due at now, in scheduling order
+static bool bt_sim_pop_due(uint32_t now, sim_ev_t* out) {
+    sim_ev_t* next = NULL;
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    for (int i = 0; i < BT_SIM_MAX_EVENTS; i++) {
+        sim_ev_t* ev = &sim.events[i];
+        if (ev->used && ev->due_ms <= now &&
+            (next == NULL || ev->due_ms < next->due_ms ||
+             (ev->due_ms == next->due_ms && ev->seq < next->seq))) {
+            next = ev;
+        }
+    }
+    if (next != NULL) {
+        *out = *next;
+        next->used = false;
+    }
+    xSemaphoreGive(sim.lock);
+    return next != NULL;
+}
+
+static void bt_sim_milestone(uint32_t* at, const char* what) {
+    if (*at == 0) {
+        *at = bt_sim_now_ms();
+        ESP_LOGI("BT_SIM", "%s at %" PRIu32 " ms", what, *at);
+    }
+}
+
+static void bt_sim_gap_disc_state(esp_bt_gap_discovery_state_t state) {
+    esp_bt_gap_cb_param_t param = {0};
+    param.disc_st_chg.state = state;
+    sim.gap_cb(ESP_BT_GAP_DISC_STATE_CHANGED_EVT, &param);
+}
+
+static void bt_sim_gap_disc_res(void) {
+    uint32_t cod = sim.peer.cod;
+    int8_t rssi = -50;
+    uint8_t eir[BT_SIM_EIR_MAX] = {0};
+    size_t name_len = strnlen(sim.peer.name, BT_SIM_EIR_MAX - 3);
+    eir[0] = name_len + 1;
+    eir[1] = ESP_BT_EIR_TYPE_CMPL_LOCAL_NAME;
+    memcpy(&eir[2], sim.peer.name, name_len);
+
+    esp_bt_gap_dev_prop_t prop[] = {
+        {ESP_BT_GAP_DEV_PROP_COD, sizeof(cod), &cod},
+        {ESP_BT_GAP_DEV_PROP_RSSI, sizeof(rssi), &rssi},
+        {ESP_BT_GAP_DEV_PROP_EIR, sizeof(eir), eir},
+    };
+    esp_bt_gap_cb_param_t param = {0};
+    memcpy(param.disc_res.bda, sim.peer.bda, ESP_BD_ADDR_LEN);
+    param.disc_res.num_prop = sizeof(prop) / sizeof(prop[0]);
+    param.disc_res.prop = prop;
+
+    bt_sim_milestone(&sim.report.discovered_ms, "peer discovered");
+    sim.gap_cb(ESP_BT_GAP_DISC_RES_EVT, &param);
+}
+
+static void bt_sim_a2d_conn(esp_a2d_connection_state_t state) {
+    esp_a2d_cb_param_t param = {0};
+    param.conn_stat.state = state;
+    memcpy(param.conn_stat.remote_bda, sim.peer.bda, ESP_BD_ADDR_LEN);
+
+    if (state == ESP_A2D_CONNECTION_STATE_CONNECTED) {
+        sim.connected = true;
+        sim.report.connects++;
+        bt_sim_milestone(&sim.report.connected_ms, "a2dp connected");
+    } else if (state == ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
+        if (sim.connected) {
+            sim.report.disconnects++;
+        }
+        sim.connected = false;
+        sim.streaming = false;
+    }
+    sim.a2d_cb(ESP_A2D_CONNECTION_STATE_EVT, &param);
+}
+
+static void bt_sim_a2d_audio_state(esp_a2d_audio_state_t state) {
+    esp_a2d_cb_param_t param = {0};
+    param.audio_stat.state = state;
+    memcpy(param.audio_stat.remote_bda, sim.peer.bda, ESP_BD_ADDR_LEN);
+    sim.a2d_cb(ESP_A2D_AUDIO_STATE_EVT, &param);
+}
+
+static void bt_sim_a2d_media_ack(esp_a2d_media_ctrl_t cmd) {
+    esp_a2d_cb_param_t param = {0};
+    param.media_ctrl_stat.cmd = cmd;
+    param.media_ctrl_stat.status = sim.connected
+                                       ? ESP_A2D_MEDIA_CTRL_ACK_SUCCESS
+                                       : ESP_A2D_MEDIA_CTRL_ACK_FAILURE;
+    sim.a2d_cb(ESP_A2D_MEDIA_CTRL_ACK_EVT, &param);
+
+    if (param.media_ctrl_stat.status != ESP_A2D_MEDIA_CTRL_ACK_SUCCESS) {
+        return;
+    }
+    if (cmd == ESP_A2D_MEDIA_CTRL_START) {
+        sim.streaming = true;
+        sim.next_pull_ms = bt_sim_now_ms();
+        sim.report.media_starts++;
+        bt_sim_milestone(&sim.report.media_start_ms, "media started");
+        bt_sim_a2d_audio_state(ESP_A2D_AUDIO_STATE_STARTED);
+    } else if (cmd == ESP_A2D_MEDIA_CTRL_SUSPEND) {
+        sim.streaming = false;
+        sim.report.media_suspends++;
+        bt_sim_a2d_audio_state(ESP_A2D_AUDIO_STATE_SUSPEND);
+    }
+}
+
+static void bt_sim_avrc_conn(bool connected) {
+    if (sim.avrc_cb == NULL) {
+        return;
+    }
+    esp_avrc_ct_cb_param_t param = {0};
+    param.conn_stat.connected = connected;
+    memcpy(param.conn_stat.remote_bda, sim.peer.bda, ESP_BD_ADDR_LEN);
+    sim.avrc_cb(ESP_AVRC_CT_CONNECTION_STATE_EVT, &param);
+}
+
+static void bt_sim_avrc_volume_ntf(void) {
+    if (sim.avrc_cb == NULL || !sim.rn_volume_armed) {
+        return;
+    }
+    // notifications are one-shot until registered again
+    sim.rn_volume_armed = false;
+    esp_avrc_ct_cb_param_t param = {0};
+    param.change_ntf.event_id = ESP_AVRC_RN_VOLUME_CHANGE;
+    param.change_ntf.event_parameter.volume = sim.peer.volume;
+    sim.avrc_cb(ESP_AVRC_CT_CHANGE_NOTIFY_EVT, &param);
+}
+
+// The link to the peer went away, tell the stack like Bluedroid would
+static void bt_sim_drop_link(void) {
+    if (sim.connected) {
+        bt_sim_avrc_conn(false);
+        bt_sim_a2d_conn(ESP_A2D_CONNECTION_STATE_DISCONNECTED);
+    }
+}
+
+static void bt_sim_script_step(const bt_sim_step_t* step) {
+    ESP_LOGI("BT_SIM", "script at %" PRIu32 " ms: action %d, arg %" PRIu32,
+             step->at_ms, step->action, step->arg);
+    switch (step->action) {
+    case BT_SIM_ACT_PEER_ON:
+        sim.peer.present = true;
+        break;
+    case BT_SIM_ACT_PEER_OFF:
+        sim.peer.present = false;
+        bt_sim_drop_link();
+        break;
+    case BT_SIM_ACT_LINK_LOSS:
+        bt_sim_drop_link();
+        break;
+    case BT_SIM_ACT_VOLUME:
+        sim.peer.volume = step->arg;
+        bt_sim_avrc_volume_ntf();
+        break;
+    }
+}
+
+static void bt_sim_deliver(const sim_ev_t* ev) {
+    ESP_LOGD("BT_SIM", "%s type %d, arg %" PRIu32, __func__, ev->type,
+             ev->arg);
+    switch (ev->type) {
+    case SIM_EV_DISC_STARTED:
+        bt_sim_gap_disc_state(ESP_BT_GAP_DISCOVERY_STARTED);
+        break;
+    case SIM_EV_DISC_RES:
+        if (sim.discovering && sim.peer.present) {
+            bt_sim_gap_disc_res();
+        }
+        break;
+    case SIM_EV_DISC_STOPPED:
+        sim.discovering = false;
+        bt_sim_gap_disc_state(ESP_BT_GAP_DISCOVERY_STOPPED);
+        break;
+    case SIM_EV_DEV_NAME: {
+        esp_bt_gap_cb_param_t param = {0};
+        param.get_dev_name_cmpl.status = ESP_BT_STATUS_SUCCESS;
+        param.get_dev_name_cmpl.name = sim.local_name;
+        sim.gap_cb(ESP_BT_GAP_GET_DEV_NAME_CMPL_EVT, &param);
+        break;
+    }
+    case SIM_EV_A2D_CONN:
+        if (ev->arg == ESP_A2D_CONNECTION_STATE_CONNECTED &&
+            !sim.peer.present) {
+            bt_sim_a2d_conn(ESP_A2D_CONNECTION_STATE_DISCONNECTED);
+            break;
+        }
+        bt_sim_a2d_conn(ev->arg);
+        if (ev->arg == ESP_A2D_CONNECTION_STATE_CONNECTED) {
+            bt_sim_avrc_conn(true);
+        }
+        break;
+    case SIM_EV_A2D_MEDIA_ACK:
+        bt_sim_a2d_media_ack(ev->arg);
+        break;
+    case SIM_EV_AVRC_CONN:
+        bt_sim_avrc_conn(ev->arg);
+        break;
+    case SIM_EV_AVRC_RN_CAPS: {
+        esp_avrc_ct_cb_param_t param = {0};
+        if (sim.peer.abs_volume) {
+            param.get_rn_caps_rsp.cap_count = 1;
+            esp_avrc_rn_evt_bit_mask_operation(
+                ESP_AVRC_BIT_MASK_OP_SET, &param.get_rn_caps_rsp.evt_set,
+                ESP_AVRC_RN_VOLUME_CHANGE);
+        }
+        sim.avrc_cb(ESP_AVRC_CT_GET_RN_CAPABILITIES_RSP_EVT, &param);
+        break;
+    }
+    case SIM_EV_AVRC_VOLUME_RSP: {
+        esp_avrc_ct_cb_param_t param = {0};
+        param.set_volume_rsp.volume = ev->arg;
+        sim.avrc_cb(ESP_AVRC_CT_SET_ABSOLUTE_VOLUME_RSP_EVT, &param);
+        break;
+    }
+    case SIM_EV_SCRIPT:
+        bt_sim_script_step(ev->step);
+        break;
+    }
+}
+
+// Pull PCM at the sink's pace while the stream is started
+static void bt_sim_pump_audio(uint32_t now) {
+    static uint8_t buf[4096];
+    uint32_t len = sim.peer.data_len;
+    if (len > sizeof(buf)) {
+        len = sizeof(buf);
+    }
+
+    while (sim.streaming && sim.data_cb != NULL && sim.next_pull_ms <= now) {
+        int32_t got = sim.data_cb(buf, len);
+        sim.next_pull_ms += sim.peer.data_period_ms;
+        sim.report.data_pulls++;
+        sim.report.data_bytes += got > 0 ? got : 0;
+        bt_sim_milestone(&sim.report.first_pull_ms, "first data pull");
+
+        if (sim.report.first_audio_ms == 0) {
+            for (int32_t i = 0; i < got; i++) {
+                if (buf[i] != 0) {
+                    bt_sim_milestone(&sim.report.first_audio_ms,
+                                     "first audio");
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void bt_sim_task_handler(void* arg) {
+    sim_ev_t ev;
+    for (;;) {
+        vTaskDelay(1);
+        uint32_t now = bt_sim_now_ms();
+        while (bt_sim_pop_due(now, &ev)) {
+            bt_sim_deliver(&ev);
+        }
+        bt_sim_pump_audio(now);
+    }
+}
+
+void bt_sim_default_peer(bt_sim_peer_t* peer) {
+    static const esp_bd_addr_t bda = {0x00, 0x1b, 0x66, 0x5a, 0x11, 0x22};
+    memset(peer, 0, sizeof(bt_sim_peer_t));
+    peer->name = CONFIG_BT_A2DP_REMOTE_NAME;
+    memcpy(peer->bda, bda, ESP_BD_ADDR_LEN);
+    peer->cod = 0x240404; // audio, rendering: wearable headset
+    peer->present = true;
+    peer->inquiry_result_ms = 2500;
+    peer->connect_ms = 600;
+    peer->page_timeout_ms = 5120;
+    peer->media_ack_ms = 40;
+    peer->data_period_ms = 20;
+    peer->data_len = 3528; // 20 ms of 44.1 kHz 16-bit stereo
+    peer->volume = 64;
+    peer->abs_volume = true;
+}
+
+void bt_sim_init(const bt_sim_peer_t* peer) {
+    if (sim.lock == NULL) {
+        sim.lock = xSemaphoreCreateMutex();
+    }
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    SemaphoreHandle_t lock = sim.lock;
+    TaskHandle_t task = sim.task;
+    memset(&sim, 0, sizeof(sim));
+    sim.lock = lock;
+    sim.task = task;
+    sim.peer = *peer;
+    sim.start_us = bt_sim_real_us();
+    xSemaphoreGive(sim.lock);
+
+    if (sim.task == NULL) {
+        xTaskCreate(bt_sim_task_handler, "BtSimTask", 4096, NULL, 19,
+                    &sim.task);
+    }
+    ESP_LOGI("BT_SIM", "Simulating peer %s, time scale %d", peer->name,
+             CONFIG_BT_SIM_TIME_SCALE);
+}
+
+void bt_sim_run_script(const bt_sim_step_t* steps, size_t count) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    uint32_t now = bt_sim_now_ms();
+    for (size_t i = 0; i < count; i++) {
+        uint32_t delay = steps[i].at_ms > now ? steps[i].at_ms - now : 0;
+        sim_ev_t* ev = bt_sim_schedule(SIM_EV_SCRIPT, delay, 0);
+        if (ev != NULL) {
+            ev->step = &steps[i];
+        }
+    }
+    xSemaphoreGive(sim.lock);
+}
+
+void bt_sim_get_report(bt_sim_report_t* report) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    *report = sim.report;
+    xSemaphoreGive(sim.lock);
+}
+
+/* Controller and Bluedroid lifecycle */
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_mem_release(esp_bt_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t* cfg) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_deinit(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_disable(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init_with_cfg(esp_bluedroid_config_t* cfg) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_deinit(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_disable(void) {
+    return ESP_OK;
+}
+
+const uint8_t* esp_bt_dev_get_address(void) {
+    return sim_own_bda;
+}
+
+/* GAP */
+
+esp_err_t esp_bt_gap_register_callback(esp_bt_gap_cb_t callback) {
+    sim.gap_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_device_name(const char* name) {
+    strncpy(sim.local_name, name, ESP_BT_GAP_MAX_BDNAME_LEN);
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_get_device_name(void) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    bt_sim_schedule(SIM_EV_DEV_NAME, 0, 0);
+    xSemaphoreGive(sim.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode,
+                                   esp_bt_discovery_mode_t d_mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_start_discovery(esp_bt_inq_mode_t mode,
+                                     uint8_t inq_len, uint8_t num_rsps) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    sim.discovering = true;
+    bt_sim_schedule(SIM_EV_DISC_STARTED, 0, 0);
+    bt_sim_schedule(SIM_EV_DISC_RES, sim.peer.inquiry_result_ms, 0);
+    // inquiry length is in units of 1.28 s
+    bt_sim_schedule(SIM_EV_DISC_STOPPED, inq_len * 1280, 0);
+    xSemaphoreGive(sim.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_cancel_discovery(void) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    bt_sim_cancel(SIM_EV_DISC_RES);
+    bt_sim_cancel(SIM_EV_DISC_STOPPED);
+    bt_sim_schedule(SIM_EV_DISC_STOPPED, 10, 0);
+    xSemaphoreGive(sim.lock);
+    return ESP_OK;
+}
+
+uint8_t* esp_bt_gap_resolve_eir_data(uint8_t* eir, uint8_t type,
+                                     uint8_t* length) {
+    // EIR is a sequence of [len][type][len - 1 bytes of data]
+    uint8_t* p = eir;
+    while (p < eir + BT_SIM_EIR_MAX && p[0] != 0) {
+        if (p[1] == type) {
+            if (length) {
+                *length = p[0] - 1;
+            }
+            return p + 2;
+        }
+        p += p[0] + 1;
+    }
+    if (length) {
+        *length = 0;
+    }
+    return NULL;
+}
+
+bool esp_bt_gap_is_valid_cod(uint32_t cod) {
+    // format type in the two low bits must be 0
+    return (cod & 0x3) == 0;
+}
+
+uint32_t esp_bt_gap_get_cod_srvc(uint32_t cod) {
+    return (cod & 0xffe000) >> 13;
+}
+
+esp_err_t esp_bt_gap_set_security_param(esp_bt_sp_param_t param_type,
+                                        void* value, uint8_t len) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_ssp_confirm_reply(esp_bd_addr_t bd_addr, bool accept) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_pin(esp_bt_pin_type_t pin_type, uint8_t pin_code_len,
+                             esp_bt_pin_code_t pin_code) {
+    return ESP_OK;
+}
+
+/* A2DP source */
+
+esp_err_t esp_a2d_register_callback(esp_a2d_cb_t callback) {
+    sim.a2d_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_source_register_data_callback(
+    esp_a2d_source_data_cb_t callback) {
+    sim.data_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_source_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_source_deinit(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_source_connect(esp_bd_addr_t remote_bda) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    bool known = memcmp(remote_bda, sim.peer.bda, ESP_BD_ADDR_LEN) == 0;
+    bt_sim_schedule(SIM_EV_A2D_CONN, 0, ESP_A2D_CONNECTION_STATE_CONNECTING);
+    if (known && sim.peer.present) {
+        bt_sim_schedule(SIM_EV_A2D_CONN, sim.peer.connect_ms,
+                        ESP_A2D_CONNECTION_STATE_CONNECTED);
+    } else {
+        bt_sim_schedule(SIM_EV_A2D_CONN, sim.peer.page_timeout_ms,
+                        ESP_A2D_CONNECTION_STATE_DISCONNECTED);
+    }
+    xSemaphoreGive(sim.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_source_disconnect(esp_bd_addr_t remote_bda) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    bt_sim_schedule(SIM_EV_AVRC_CONN, 50, false);
+    bt_sim_schedule(SIM_EV_A2D_CONN, 100,
+                    ESP_A2D_CONNECTION_STATE_DISCONNECTED);
+    xSemaphoreGive(sim.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_a2d_media_ctrl(esp_a2d_media_ctrl_t ctrl) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    bt_sim_schedule(SIM_EV_A2D_MEDIA_ACK, sim.peer.media_ack_ms, ctrl);
+    xSemaphoreGive(sim.lock);
+    return ESP_OK;
+}
+
+/* AVRC controller */
+
+esp_err_t esp_avrc_ct_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_register_callback(esp_avrc_ct_cb_t callback) {
+    sim.avrc_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_send_get_rn_capabilities_cmd(uint8_t tl) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    bt_sim_schedule(SIM_EV_AVRC_RN_CAPS, sim.peer.media_ack_ms, 0);
+    xSemaphoreGive(sim.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_send_register_notification_cmd(
+    uint8_t tl, uint8_t event_id, uint32_t event_parameter) {
+    if (event_id == ESP_AVRC_RN_VOLUME_CHANGE) {
+        sim.rn_volume_armed = true;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_avrc_ct_send_set_absolute_volume_cmd(uint8_t tl,
+                                                   uint8_t volume) {
+    xSemaphoreTake(sim.lock, portMAX_DELAY);
+    sim.peer.volume = volume & 0x7f;
+    bt_sim_schedule(SIM_EV_AVRC_VOLUME_RSP, sim.peer.media_ack_ms,
+                    sim.peer.volume);
+    xSemaphoreGive(sim.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_avrc_tg_set_rn_evt_cap(const esp_avrc_rn_evt_cap_mask_t* cap) {
+    return ESP_OK;
+}
+
+bool esp_avrc_rn_evt_bit_mask_operation(esp_avrc_bit_mask_op_t op,
+                                        esp_avrc_rn_evt_cap_mask_t* events,
+                                        esp_avrc_rn_event_ids_t event_id) {
+    uint16_t bit = 1 << event_id;
+    switch (op) {
+    case ESP_AVRC_BIT_MASK_OP_TEST:
+        return (events->bits & bit) != 0;
+    case ESP_AVRC_BIT_MASK_OP_SET:
+        events->bits |= bit;
+        return true;
+    case ESP_AVRC_BIT_MASK_OP_CLEAR:
+        events->bits &= ~bit;
+        return true;
+    }
+    return false;
+}
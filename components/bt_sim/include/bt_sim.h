@@ -0,0 +1,68 @@
+#pragma once
+// Host simulation of the Bluedroid stack and one A2DP sink.
+// Replaces the bt component on the linux target: the esp_bt_*, esp_a2d_*
+// and esp_avrc_* calls made by the firmware are answered by a scripted peer
+// that raises the same callbacks a real speaker would, from a task that
+// stands in for the Bluedroid task.
+#include "esp_bt_defs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Behaviour of the simulated sink, times in simulated milliseconds
+typedef struct {
+    const char* name;            // advertised in the EIR
+    esp_bd_addr_t bda;           // peer address
+    uint32_t cod;                // class of device
+    bool present;                // in range and powered
+    uint32_t inquiry_result_ms;  // from inquiry start to its result
+    uint32_t connect_ms;         // page, L2CAP and AVDTP signalling
+    uint32_t page_timeout_ms;    // failed connect when absent
+    uint32_t media_ack_ms;       // AVDTP media control round trip
+    uint32_t data_period_ms;     // A2DP data callback period while started
+    uint32_t data_len;           // bytes pulled per data callback
+    uint8_t volume;              // initial absolute volume
+    bool abs_volume;             // supports AVRCP absolute volume
+} bt_sim_peer_t;
+
+typedef enum {
+    BT_SIM_ACT_PEER_ON,   // peer enters range
+    BT_SIM_ACT_PEER_OFF,  // peer leaves range, drops any link
+    BT_SIM_ACT_LINK_LOSS, // link drops, peer stays in range
+    BT_SIM_ACT_VOLUME,    // user changes volume on the peer to arg
+} bt_sim_action_t;
+
+// A scripted step, at_ms is simulated time since bt_sim_init
+typedef struct {
+    uint32_t at_ms;
+    bt_sim_action_t action;
+    uint32_t arg;
+} bt_sim_step_t;
+
+// Milestones in simulated ms since bt_sim_init, 0 if not reached
+typedef struct {
+    uint32_t discovered_ms;    // first inquiry result for the peer
+    uint32_t connected_ms;     // first A2DP connection
+    uint32_t media_start_ms;   // first successful media start
+    uint32_t first_pull_ms;    // first data callback
+    uint32_t first_audio_ms;   // first data callback with non-silent PCM
+    uint32_t connects;         // A2DP connections established
+    uint32_t disconnects;      // A2DP connections closed
+    uint32_t media_starts;     // successful media starts
+    uint32_t media_suspends;   // successful media suspends
+    uint32_t data_pulls;       // data callbacks
+    uint64_t data_bytes;       // PCM bytes pulled
+} bt_sim_report_t;
+
+// Default peer: a speaker named CONFIG_BT_A2DP_REMOTE_NAME
+void bt_sim_default_peer(bt_sim_peer_t* peer);
+
+// Reset the simulation and start the stack task. Call before bt_init.
+void bt_sim_init(const bt_sim_peer_t* peer);
+
+// Schedule scripted steps, steps must stay valid until they have run
+void bt_sim_run_script(const bt_sim_step_t* steps, size_t count);
+
+// Simulated ms since bt_sim_init
+uint32_t bt_sim_now_ms(void);
+
+void bt_sim_get_report(bt_sim_report_t* report);
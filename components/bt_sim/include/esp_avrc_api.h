@@ -0,0 +1,87 @@
+#pragma once
+// Subset of the ESP-IDF Bluedroid API used by Aura, implemented by bt_sim
+#include "esp_bt_defs.h"
+#include "esp_err.h"
+
+typedef enum {
+    ESP_AVRC_CT_CONNECTION_STATE_EVT = 0,
+    ESP_AVRC_CT_PASSTHROUGH_RSP_EVT = 1,
+    ESP_AVRC_CT_METADATA_RSP_EVT = 2,
+    ESP_AVRC_CT_PLAY_STATUS_RSP_EVT = 3,
+    ESP_AVRC_CT_CHANGE_NOTIFY_EVT = 4,
+    ESP_AVRC_CT_REMOTE_FEATURES_EVT = 5,
+    ESP_AVRC_CT_GET_RN_CAPABILITIES_RSP_EVT = 6,
+    ESP_AVRC_CT_SET_ABSOLUTE_VOLUME_RSP_EVT = 7,
+} esp_avrc_ct_cb_event_t;
+
+typedef enum {
+    ESP_AVRC_RN_PLAY_STATUS_CHANGE = 0x01,
+    ESP_AVRC_RN_TRACK_CHANGE = 0x02,
+    ESP_AVRC_RN_VOLUME_CHANGE = 0x0d,
+} esp_avrc_rn_event_ids_t;
+
+typedef enum {
+    ESP_AVRC_BIT_MASK_OP_TEST = 0,
+    ESP_AVRC_BIT_MASK_OP_SET = 1,
+    ESP_AVRC_BIT_MASK_OP_CLEAR = 2,
+} esp_avrc_bit_mask_op_t;
+
+typedef struct {
+    uint16_t bits;
+} esp_avrc_rn_evt_cap_mask_t;
+
+typedef union {
+    uint8_t volume;
+    uint8_t elm_id[8];
+    uint32_t play_pos;
+} esp_avrc_rn_param_t;
+
+typedef union {
+    struct avrc_ct_conn_stat_param {
+        bool connected;
+        esp_bd_addr_t remote_bda;
+    } conn_stat;
+    struct avrc_ct_psth_rsp_param {
+        uint8_t tl;
+        uint8_t key_code;
+        uint8_t key_state;
+        uint8_t rsp_code;
+    } psth_rsp;
+    struct avrc_ct_meta_rsp_param {
+        uint8_t attr_id;
+        uint8_t* attr_text;
+        int attr_length;
+    } meta_rsp;
+    struct avrc_ct_change_notify_param {
+        uint8_t event_id;
+        esp_avrc_rn_param_t event_parameter;
+    } change_ntf;
+    struct avrc_ct_rmt_feats_param {
+        uint32_t feat_mask;
+        uint16_t tg_feat_flag;
+        esp_bd_addr_t remote_bda;
+    } rmt_feats;
+    struct avrc_ct_get_rn_caps_rsp_param {
+        uint8_t cap_count;
+        esp_avrc_rn_evt_cap_mask_t evt_set;
+    } get_rn_caps_rsp;
+    struct avrc_ct_set_volume_rsp_param {
+        uint8_t volume;
+    } set_volume_rsp;
+} esp_avrc_ct_cb_param_t;
+
+typedef void (*esp_avrc_ct_cb_t)(esp_avrc_ct_cb_event_t event,
+                                 esp_avrc_ct_cb_param_t* param);
+
+esp_err_t esp_avrc_ct_init(void);
+esp_err_t esp_avrc_ct_register_callback(esp_avrc_ct_cb_t callback);
+esp_err_t esp_avrc_ct_send_get_rn_capabilities_cmd(uint8_t tl);
+esp_err_t esp_avrc_ct_send_register_notification_cmd(uint8_t tl,
+                                                     uint8_t event_id,
+                                                     uint32_t event_parameter);
+esp_err_t esp_avrc_ct_send_set_absolute_volume_cmd(uint8_t tl,
+                                                   uint8_t volume);
+esp_err_t esp_avrc_tg_set_rn_evt_cap(const esp_avrc_rn_evt_cap_mask_t* cap);
+bool esp_avrc_rn_evt_bit_mask_operation(esp_avrc_bit_mask_op_t op,
+                                        esp_avrc_rn_evt_cap_mask_t* events,
+                                        esp_avrc_rn_event_ids_t event_id);
@@ -0,0 +1,5 @@
+#pragma once
+// Subset of the ESP-IDF Bluedroid API used by Aura, implemented by bt_sim
+#include <stdint.h>
+
+const uint8_t* esp_bt_dev_get_address(void);
@@ -0,0 +1,16 @@
+#pragma once
+// Subset of the ESP-IDF Bluedroid API used by Aura, implemented by bt_sim
+#include "esp_err.h"
+#include <stdbool.h>
+
+typedef struct {
+    bool ssp_en;
+} esp_bluedroid_config_t;
+
+#define BT_BLUEDROID_INIT_CONFIG_DEFAULT()                                     \
+    { .ssp_en = true }
+
+esp_err_t esp_bluedroid_init_with_cfg(esp_bluedroid_config_t* cfg);
+esp_err_t esp_bluedroid_deinit(void);
+esp_err_t esp_bluedroid_enable(void);
+esp_err_t esp_bluedroid_disable(void);
@@ -0,0 +1,66 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Music library index. media_lib_build scans a directory tree for MP3s
+// once and writes a binary index of their tags. media_lib_open only reads
+// its header, records are paged in on demand, so opening takes the same
+// time for any library size. A media_lib_t is used by one task at a time.
+typedef struct media_lib media_lib_t;
+
+// Where the index lives below the library root
+#define MEDIA_LIB_INDEX_DIR ".aura"
+#define MEDIA_LIB_INDEX_FILE ".aura/library.idx"
+
+// Longest path kept, in bytes including the terminator
+#define MEDIA_LIB_PATH_MAX 256
+// Longest tag kept, in bytes of UTF-8 including the terminator
+#define MEDIA_LIB_TAG_MAX 128
+
+typedef struct {
+    char path[MEDIA_LIB_PATH_MAX]; // root joined with the relative path
+    char artist[MEDIA_LIB_TAG_MAX];
+    char album[MEDIA_LIB_TAG_MAX];
+    char title[MEDIA_LIB_TAG_MAX];
+    uint16_t disc;
+    uint16_t track;
+    uint32_t size;
+} media_lib_track_t;
+
+// Browsing levels, see media_lib_group_end
+typedef enum {
+    MEDIA_LIB_ARTIST,
+    MEDIA_LIB_ALBUM,
+} media_lib_level_t;
+
+typedef struct {
+    uint32_t tracks;  // in the new index
+    uint32_t parsed;  // new or changed files whose tags were read
+    uint32_t reused;  // unchanged files taken from the previous index
+    uint32_t removed; // previous entries whose file is gone
+    uint32_t skipped; // paths too long or unreadable
+    uint64_t build_us;
+} media_lib_build_stats_t;
+
+// Scan root and write the index to index_path, replacing it atomically.
+// Entries of a previous index of the same root are reused for files whose
+// size and mtime are unchanged, so only new and changed files are read.
+// Holds the old and new index in RAM while it runs, about 64 bytes per
+// track plus its strings.
+bool media_lib_build(const char* root, const char* index_path,
+                     media_lib_build_stats_t* stats);
+
+// Open an index. Returns nullptr if it is missing or of another version.
+media_lib_t* media_lib_open(const char* index_path);
+
+void media_lib_close(media_lib_t* lib);
+
+// Tracks in the index, in artist, album, disc, track order
+uint32_t media_lib_count(media_lib_t* lib);
+
+// Read track i, false if i is out of range or the index is unreadable
+bool media_lib_get(media_lib_t* lib, uint32_t i, media_lib_track_t* track);
+
+// Index after the last track of the artist or album of track i
+uint32_t media_lib_group_end(media_lib_t* lib, uint32_t i,
+                             media_lib_level_t level);
@@ -0,0 +1,190 @@
+#include "media_lib.h"
+#include "esp_log.h"
+#include "media_lib_fmt.h"
+#include "sdkconfig.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MEDIA_LIB_PAGE_RECS 16
+
+typedef struct {
+    uint32_t page; // records [page * MEDIA_LIB_PAGE_RECS, ...)
+    uint32_t used; // lib->tick at the last hit, 0 when empty
+    media_lib_rec_t recs[MEDIA_LIB_PAGE_RECS];
+} media_lib_page_t;
+
+struct media_lib {
+    int fd;
+    media_lib_hdr_t hdr;
+    uint32_t pool_off; // file offset of the string pool
+    char root[MEDIA_LIB_PATH_MAX];
+    uint32_t tick;
+    media_lib_page_t cache[CONFIG_MEDIA_LIB_CACHE_PAGES];
+};
+
+// Read the pool string at off into out, truncated to len
+static void media_lib_str(media_lib_t* lib, uint32_t off, char* out,
+                          size_t len) {
+    out[0] = '\0';
+    if (off >= lib->hdr.pool_size) {
+        return;
+    }
+    size_t n = lib->hdr.pool_size - off;
+    if (n > len - 1) {
+        n = len - 1;
+    }
+    ssize_t got = pread(lib->fd, out, n, lib->pool_off + off);
+    out[got > 0 ? got : 0] = '\0';
+}
+
+media_lib_t* media_lib_open(const char* index_path) {
+    media_lib_t* lib = calloc(1, sizeof(media_lib_t));
+    if (lib == NULL) {
+        ESP_LOGE("MEDIA_LIB", "%s calloc failed", __func__);
+        return nullptr;
+    }
+    lib->fd = open(index_path, O_RDONLY);
+    if (lib->fd < 0) {
+        ESP_LOGW("MEDIA_LIB", "No index at %s", index_path);
+        free(lib);
+        return nullptr;
+    }
+    if (pread(lib->fd, &lib->hdr, sizeof(lib->hdr), 0) != sizeof(lib->hdr) ||
+        lib->hdr.magic != MEDIA_LIB_MAGIC ||
+        lib->hdr.version != MEDIA_LIB_VERSION ||
+        lib->hdr.rec_size != sizeof(media_lib_rec_t)) {
+        ESP_LOGW("MEDIA_LIB", "Index %s is not a version %d index",
+                 index_path, MEDIA_LIB_VERSION);
+        close(lib->fd);
+        free(lib);
+        return nullptr;
+    }
+    lib->pool_off =
+        sizeof(media_lib_hdr_t) + lib->hdr.count * sizeof(media_lib_rec_t);
+    // the builder keeps the root short enough to join with a path
+    media_lib_str(lib, lib->hdr.root, lib->root, MEDIA_LIB_PATH_MAX / 2);
+    return lib;
+}
+
+void media_lib_close(media_lib_t* lib) {
+    if (lib == nullptr) {
+        return;
+    }
+    close(lib->fd);
+    free(lib);
+}
+
+uint32_t media_lib_count(media_lib_t* lib) {
+    return lib->hdr.count;
+}
+
+// Record i through the page cache, NULL on a read error
+static const media_lib_rec_t* media_lib_rec(media_lib_t* lib, uint32_t i) {
+    uint32_t page = i / MEDIA_LIB_PAGE_RECS;
+    media_lib_page_t* victim = &lib->cache[0];
+    lib->tick++;
+    for (int p = 0; p < CONFIG_MEDIA_LIB_CACHE_PAGES; p++) {
+        media_lib_page_t* c = &lib->cache[p];
+        if (c->used != 0 && c->page == page) {
+            c->used = lib->tick;
+            return &c->recs[i % MEDIA_LIB_PAGE_RECS];
+        }
+        if (c->used < victim->used) {
+            victim = c;
+        }
+    }
+
+    uint32_t first = page * MEDIA_LIB_PAGE_RECS;
+    uint32_t n = lib->hdr.count - first;
+    if (n > MEDIA_LIB_PAGE_RECS) {
+        n = MEDIA_LIB_PAGE_RECS;
+    }
+    size_t len = n * sizeof(media_lib_rec_t);
+    if (pread(lib->fd, victim->recs, len,
+              sizeof(media_lib_hdr_t) + first * sizeof(media_lib_rec_t)) !=
+        (ssize_t)len) {
+        ESP_LOGE("MEDIA_LIB", "%s read failed at record %" PRIu32, __func__,
+                 first);
+        victim->used = 0;
+        return NULL;
+    }
+    victim->page = page;
+    victim->used = lib->tick;
+    return &victim->recs[i % MEDIA_LIB_PAGE_RECS];
+}
+
+bool media_lib_get(media_lib_t* lib, uint32_t i, media_lib_track_t* track) {
+    if (i >= lib->hdr.count) {
+        return false;
+    }
+    const media_lib_rec_t* rec = media_lib_rec(lib, i);
+    if (rec == NULL) {
+        return false;
+    }
+    // copy out, the strings below may evict the page
+    media_lib_rec_t r = *rec;
+
+    size_t root_len = strlen(lib->root);
+    memcpy(track->path, lib->root, root_len);
+    track->path[root_len] = '/';
+    media_lib_str(lib, r.path, track->path + root_len + 1,
+                  sizeof(track->path) - root_len - 1);
+    media_lib_str(lib, r.artist, track->artist, sizeof(track->artist));
+    media_lib_str(lib, r.album, track->album, sizeof(track->album));
+    media_lib_str(lib, r.title, track->title, sizeof(track->title));
+    track->disc = r.disc;
+    track->track = r.track;
+    track->size = r.size;
+    return true;
+}
+
+// Pool offset of the group key of a record
+static uint32_t media_lib_key(const media_lib_rec_t* rec,
+                              media_lib_level_t level) {
+    return level == MEDIA_LIB_ARTIST ? rec->artist : rec->album;
+}
+
+uint32_t media_lib_group_end(media_lib_t* lib, uint32_t i,
+                             media_lib_level_t level) {
+    if (i >= lib->hdr.count) {
+        return lib->hdr.count;
+    }
+    const media_lib_rec_t* rec = media_lib_rec(lib, i);
+    if (rec == NULL) {
+        return lib->hdr.count;
+    }
+    uint32_t artist = rec->artist;
+    uint32_t key = media_lib_key(rec, level);
+
+    // a group is one run of records, search for its end with gallop then
+    // bisection so long groups cost a few page reads
+    uint32_t lo = i, step = 1, hi;
+    for (;;) {
+        hi = lo + step;
+        if (hi >= lib->hdr.count) {
+            hi = lib->hdr.count;
+            break;
+        }
+        rec = media_lib_rec(lib, hi);
+        if (rec == NULL || rec->artist != artist ||
+            media_lib_key(rec, level) != key) {
+            break;
+        }
+        lo = hi;
+        step *= 2;
+    }
+    // lo is in the group, hi is past it
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        rec = media_lib_rec(lib, mid);
+        if (rec != NULL && rec->artist == artist &&
+            media_lib_key(rec, level) == key) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
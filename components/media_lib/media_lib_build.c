@@ -0,0 +1,433 @@
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "media_lib.h"
+#include "media_lib_fmt.h"
+#include "media_tag.h"
+#include "sdkconfig.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    // index being built
+    media_lib_rec_t* recs;
+    uint32_t count;
+    uint32_t cap;
+    char* pool;
+    uint32_t pool_size;
+    uint32_t pool_cap;
+    uint32_t* intern; // pool offsets of tag strings by hash, 0 when free
+    uint32_t intern_cap;
+    uint32_t intern_used;
+
+    // previous index of the same root
+    media_lib_rec_t* old;
+    uint32_t old_count;
+    char* old_pool;
+    uint32_t old_pool_size;
+    uint32_t* old_map; // old record index + 1 by path hash, 0 when free
+    uint32_t old_map_cap;
+    uint32_t old_found;
+
+    char path[MEDIA_LIB_PATH_MAX]; // directory or file being scanned
+    size_t root_len;
+    bool failed; // out of memory
+    media_lib_build_stats_t* stats;
+} media_lib_builder_t;
+
+static uint32_t media_lib_pool_add(media_lib_builder_t* b, const char* s) {
+    size_t n = strlen(s) + 1;
+    if (b->pool_size + n > b->pool_cap) {
+        uint32_t cap = b->pool_cap ? b->pool_cap : 4096;
+        while (cap < b->pool_size + n) {
+            cap *= 2;
+        }
+        char* pool = realloc(b->pool, cap);
+        if (pool == NULL) {
+            b->failed = true;
+            return 0;
+        }
+        b->pool = pool;
+        b->pool_cap = cap;
+    }
+    uint32_t off = b->pool_size;
+    memcpy(b->pool + off, s, n);
+    b->pool_size += n;
+    return off;
+}
+
+// Pool offset of s, added once however many tracks share it
+static uint32_t media_lib_intern(media_lib_builder_t* b, const char* s) {
+    if (*s == '\0') {
+        return 0;
+    }
+    if (b->intern_used * 2 >= b->intern_cap) {
+        uint32_t cap = b->intern_cap ? b->intern_cap * 2 : 256;
+        uint32_t* table = calloc(cap, sizeof(uint32_t));
+        if (table == NULL) {
+            b->failed = true;
+            return 0;
+        }
+        for (uint32_t i = 0; i < b->intern_cap; i++) {
+            uint32_t off = b->intern[i];
+            if (off == 0) {
+                continue;
+            }
+            uint32_t j = media_lib_hash(b->pool + off) & (cap - 1);
+            while (table[j] != 0) {
+                j = (j + 1) & (cap - 1);
+            }
+            table[j] = off;
+        }
+        free(b->intern);
+        b->intern = table;
+        b->intern_cap = cap;
+    }
+
+    uint32_t mask = b->intern_cap - 1;
+    for (uint32_t i = media_lib_hash(s) & mask;; i = (i + 1) & mask) {
+        uint32_t off = b->intern[i];
+        if (off == 0) {
+            off = media_lib_pool_add(b, s);
+            if (!b->failed) {
+                b->intern[i] = off;
+                b->intern_used++;
+            }
+            return off;
+        }
+        if (strcmp(b->pool + off, s) == 0) {
+            return off;
+        }
+    }
+}
+
+// Load the previous index if it was built from the same root
+static void media_lib_load_old(media_lib_builder_t* b, const char* root,
+                               const char* index_path) {
+    int fd = open(index_path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    media_lib_hdr_t hdr;
+    struct stat st;
+    bool ok = pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+              hdr.magic == MEDIA_LIB_MAGIC &&
+              hdr.version == MEDIA_LIB_VERSION &&
+              hdr.rec_size == sizeof(media_lib_rec_t) && hdr.pool_size > 0;
+    // the counts must add up to the file before they size anything, the
+    // map below holds twice the records
+    ok = ok && fstat(fd, &st) == 0 && hdr.count <= UINT32_MAX / 4 &&
+         (uint64_t)st.st_size ==
+             sizeof(hdr) + (uint64_t)hdr.count * sizeof(media_lib_rec_t) +
+                 hdr.pool_size;
+    if (ok) {
+        size_t len = hdr.count * sizeof(media_lib_rec_t);
+        b->old = malloc(len + 1);
+        b->old_pool = malloc(hdr.pool_size);
+        ok = b->old != NULL && b->old_pool != NULL &&
+             pread(fd, b->old, len, sizeof(hdr)) == (ssize_t)len &&
+             pread(fd, b->old_pool, hdr.pool_size, sizeof(hdr) + len) ==
+                 (ssize_t)hdr.pool_size &&
+             b->old_pool[hdr.pool_size - 1] == '\0' &&
+             hdr.root < hdr.pool_size &&
+             strcmp(b->old_pool + hdr.root, root) == 0;
+    }
+    close(fd);
+
+    uint32_t cap = 16;
+    while (ok && cap < hdr.count * 2) {
+        cap *= 2;
+    }
+    if (ok) {
+        b->old_map = calloc(cap, sizeof(uint32_t));
+        ok = b->old_map != NULL;
+    }
+    if (!ok) {
+        free(b->old);
+        free(b->old_pool);
+        b->old = NULL;
+        b->old_pool = NULL;
+        return;
+    }
+    b->old_count = hdr.count;
+    b->old_pool_size = hdr.pool_size;
+    b->old_map_cap = cap;
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        uint32_t j = b->old[i].path_hash & (cap - 1);
+        while (b->old_map[j] != 0) {
+            j = (j + 1) & (cap - 1);
+        }
+        b->old_map[j] = i + 1;
+    }
+}
+
+// Previous record of rel, NULL if there is none or it is damaged
+static const media_lib_rec_t* media_lib_find_old(media_lib_builder_t* b,
+                                                 const char* rel,
+                                                 uint32_t hash) {
+    if (b->old_map == NULL) {
+        return NULL;
+    }
+    uint32_t mask = b->old_map_cap - 1;
+    for (uint32_t j = hash & mask; b->old_map[j] != 0; j = (j + 1) & mask) {
+        const media_lib_rec_t* rec = &b->old[b->old_map[j] - 1];
+        if (rec->path_hash != hash || rec->path >= b->old_pool_size ||
+            strcmp(b->old_pool + rec->path, rel) != 0) {
+            continue;
+        }
+        bool valid = rec->artist < b->old_pool_size &&
+                     rec->album < b->old_pool_size &&
+                     rec->title < b->old_pool_size;
+        return valid ? rec : NULL;
+    }
+    return NULL;
+}
+
+// The file name without its extension, for untagged files
+static void media_lib_file_title(const char* path, char* title) {
+    const char* name = strrchr(path, '/') + 1;
+    const char* dot = strrchr(name, '.');
+    size_t n = dot != NULL ? (size_t)(dot - name) : strlen(name);
+    if (n > MEDIA_TAG_MAX - 1) {
+        n = MEDIA_TAG_MAX - 1;
+        // do not split a UTF-8 sequence
+        while (n > 0 && (name[n] & 0xc0) == 0x80) {
+            n--;
+        }
+    }
+    memcpy(title, name, n);
+    title[n] = '\0';
+}
+
+static void media_lib_add(media_lib_builder_t* b, const struct stat* st) {
+    const char* rel = b->path + b->root_len + 1;
+    media_lib_rec_t rec = {
+        .size = st->st_size,
+        .mtime = st->st_mtime,
+        .path_hash = media_lib_hash(rel),
+    };
+
+    const media_lib_rec_t* old = media_lib_find_old(b, rel, rec.path_hash);
+    if (old != NULL) {
+        b->old_found++;
+    }
+    if (old != NULL && old->size == rec.size && old->mtime == rec.mtime) {
+        rec.artist = media_lib_intern(b, b->old_pool + old->artist);
+        rec.album = media_lib_intern(b, b->old_pool + old->album);
+        rec.title = media_lib_intern(b, b->old_pool + old->title);
+        rec.disc = old->disc;
+        rec.track = old->track;
+        b->stats->reused++;
+    } else {
+        int fd = open(b->path, O_RDONLY);
+        if (fd < 0) {
+            b->stats->skipped++;
+            return;
+        }
+        media_tag_t tag;
+        media_tag_read(fd, rec.size, &tag);
+        close(fd);
+        if (tag.title[0] == '\0') {
+            media_lib_file_title(b->path, tag.title);
+        }
+        rec.artist = media_lib_intern(b, tag.artist);
+        rec.album = media_lib_intern(b, tag.album);
+        rec.title = media_lib_intern(b, tag.title);
+        rec.disc = tag.disc;
+        rec.track = tag.track;
+        b->stats->parsed++;
+    }
+    rec.path = media_lib_pool_add(b, rel);
+
+    if (b->count == b->cap) {
+        uint32_t cap = b->cap ? b->cap * 2 : 256;
+        media_lib_rec_t* recs = realloc(b->recs, cap * sizeof(rec));
+        if (recs == NULL) {
+            b->failed = true;
+            return;
+        }
+        b->recs = recs;
+        b->cap = cap;
+    }
+    b->recs[b->count++] = rec;
+}
+
+static bool media_lib_is_mp3(const char* name) {
+    size_t n = strlen(name);
+    return n > 4 && strcasecmp(name + n - 4, ".mp3") == 0;
+}
+
+// Scan the directory in b->path, len bytes long
+static void media_lib_walk(media_lib_builder_t* b, size_t len, int depth) {
+    DIR* dir = opendir(b->path);
+    if (dir == NULL) {
+        b->stats->skipped++;
+        return;
+    }
+    struct dirent* ent;
+    while (!b->failed && (ent = readdir(dir)) != NULL) {
+        // also skips the index directory
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        size_t n = strlen(ent->d_name);
+        if (len + 1 + n >= MEDIA_LIB_PATH_MAX) {
+            b->stats->skipped++;
+            continue;
+        }
+        b->path[len] = '/';
+        memcpy(b->path + len + 1, ent->d_name, n + 1);
+
+        struct stat st;
+        if (stat(b->path, &st) != 0) {
+            b->stats->skipped++;
+        } else if (S_ISDIR(st.st_mode)) {
+            if (depth < CONFIG_MEDIA_LIB_MAX_DEPTH) {
+                media_lib_walk(b, len + 1 + n, depth + 1);
+            }
+        } else if (media_lib_is_mp3(ent->d_name)) {
+            media_lib_add(b, &st);
+        }
+    }
+    b->path[len] = '\0';
+    closedir(dir);
+}
+
+// qsort has no context argument, builds run one at a time
+static const char* media_lib_sort_pool;
+
+// Case-insensitive, ties broken by case so equal strings stay adjacent
+static int media_lib_strcmp(uint32_t a, uint32_t b) {
+    if (a == b) {
+        return 0;
+    }
+    int c = strcasecmp(media_lib_sort_pool + a, media_lib_sort_pool + b);
+    return c != 0 ? c
+                  : strcmp(media_lib_sort_pool + a, media_lib_sort_pool + b);
+}
+
+static int media_lib_cmp(const void* pa, const void* pb) {
+    const media_lib_rec_t* a = pa;
+    const media_lib_rec_t* b = pb;
+    int c;
+    if ((c = media_lib_strcmp(a->artist, b->artist)) != 0 ||
+        (c = media_lib_strcmp(a->album, b->album)) != 0) {
+        return c;
+    }
+    if (a->disc != b->disc) {
+        return a->disc < b->disc ? -1 : 1;
+    }
+    if (a->track != b->track) {
+        return a->track < b->track ? -1 : 1;
+    }
+    if ((c = media_lib_strcmp(a->title, b->title)) != 0) {
+        return c;
+    }
+    return strcmp(media_lib_sort_pool + a->path, media_lib_sort_pool + b->path);
+}
+
+// Write the index next to index_path and move it into place
+static bool media_lib_write(media_lib_builder_t* b, uint32_t root,
+                            const char* index_path) {
+    char tmp[MEDIA_LIB_PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", index_path) >=
+        (int)sizeof(tmp)) {
+        ESP_LOGE("MEDIA_LIB", "%s index path too long", __func__);
+        return false;
+    }
+    FILE* f = fopen(tmp, "wb");
+    if (f == NULL) {
+        ESP_LOGE("MEDIA_LIB", "%s failed to create %s", __func__, tmp);
+        return false;
+    }
+    media_lib_hdr_t hdr = {
+        .magic = MEDIA_LIB_MAGIC,
+        .version = MEDIA_LIB_VERSION,
+        .rec_size = sizeof(media_lib_rec_t),
+        .count = b->count,
+        .pool_size = b->pool_size,
+        .root = root,
+    };
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(b->recs, sizeof(media_lib_rec_t), b->count, f) ==
+                  b->count &&
+              fwrite(b->pool, 1, b->pool_size, f) == b->pool_size;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        ESP_LOGE("MEDIA_LIB", "%s failed to write %s", __func__, tmp);
+        unlink(tmp);
+        return false;
+    }
+    // FATFS does not rename over an existing file
+    unlink(index_path);
+    if (rename(tmp, index_path) != 0) {
+        ESP_LOGE("MEDIA_LIB", "%s failed to rename %s", __func__, tmp);
+        return false;
+    }
+    return true;
+}
+
+bool media_lib_build(const char* root, const char* index_path,
+                     media_lib_build_stats_t* stats) {
+    memset(stats, 0, sizeof(media_lib_build_stats_t));
+    size_t root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') {
+        root_len--;
+    }
+    // leaves room for the relative paths, see media_lib_open
+    if (root_len >= MEDIA_LIB_PATH_MAX / 2) {
+        ESP_LOGE("MEDIA_LIB", "%s root too long: %s", __func__, root);
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+    media_lib_builder_t* b = calloc(1, sizeof(media_lib_builder_t));
+    if (b == NULL) {
+        ESP_LOGE("MEDIA_LIB", "%s calloc failed", __func__);
+        return false;
+    }
+    b->stats = stats;
+    b->root_len = root_len;
+    memcpy(b->path, root, root_len);
+    b->path[root_len] = '\0';
+
+    media_lib_pool_add(b, ""); // offset 0
+    uint32_t root_off = media_lib_pool_add(b, b->path);
+    media_lib_load_old(b, b->path, index_path);
+    media_lib_walk(b, root_len, 0);
+
+    bool ok = !b->failed;
+    if (ok) {
+        media_lib_sort_pool = b->pool;
+        qsort(b->recs, b->count, sizeof(media_lib_rec_t), media_lib_cmp);
+        ok = media_lib_write(b, root_off, index_path);
+    } else {
+        ESP_LOGE("MEDIA_LIB", "%s out of memory after %" PRIu32 " tracks",
+                 __func__, b->count);
+    }
+
+    stats->tracks = b->count;
+    stats->removed = b->old_count - b->old_found;
+    stats->build_us = esp_timer_get_time() - start;
+    if (ok) {
+        ESP_LOGI("MEDIA_LIB",
+                 "Indexed %" PRIu32 " tracks (%" PRIu32 " read, %" PRIu32
+                 " unchanged, %" PRIu32 " removed) in %" PRIu32 " ms",
+                 stats->tracks, stats->parsed, stats->reused, stats->removed,
+                 (uint32_t)(stats->build_us / 1000));
+    }
+
+    free(b->recs);
+    free(b->pool);
+    free(b->intern);
+    free(b->old);
+    free(b->old_pool);
+    free(b->old_map);
+    free(b);
+    return ok;
+}
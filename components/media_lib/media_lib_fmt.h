@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+
+// On-storage layout of the library index: a header, count fixed-size
+// records sorted for browsing, then a pool of NUL-terminated UTF-8
+// strings. Little-endian, so an index built on a host is read as is on
+// target.
+#define MEDIA_LIB_MAGIC 0x4c525541 // "AURL"
+#define MEDIA_LIB_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rec_size;  // sizeof(media_lib_rec_t)
+    uint32_t count;     // records
+    uint32_t pool_size; // string pool bytes after the records
+    uint32_t root;      // pool offset of the scanned directory
+    uint32_t reserved[3];
+} media_lib_hdr_t;
+
+_Static_assert(sizeof(media_lib_hdr_t) == 32, "index header layout");
+
+// Sorted by artist and album (case-insensitive), disc, track, title,
+// path. Tag strings are deduplicated, so the records of one artist or
+// album share its pool offset. Offset 0 is the empty string.
+typedef struct {
+    uint32_t path;   // pool offset, relative to the root
+    uint32_t artist; // pool offset
+    uint32_t album;  // pool offset
+    uint32_t title;  // pool offset, the file name when untagged
+    uint32_t size;   // file size at scan time
+    uint32_t mtime;  // file mtime at scan time
+    uint32_t path_hash;
+    uint16_t disc;
+    uint16_t track;
+} media_lib_rec_t;
+
+_Static_assert(sizeof(media_lib_rec_t) == 32, "index record layout");
+
+// FNV-1a, keys the previous records by path during a rescan
+static inline uint32_t media_lib_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
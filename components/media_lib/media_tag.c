@@ -0,0 +1,277 @@
+#include "media_tag.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Longest frame payload read, enough for MEDIA_TAG_MAX of UTF-8 from UTF-16
+#define MEDIA_TAG_FRAME_MAX 256
+
+enum {
+    MEDIA_TAG_ARTIST,
+    MEDIA_TAG_ALBUM_ARTIST,
+    MEDIA_TAG_ALBUM,
+    MEDIA_TAG_TITLE,
+    MEDIA_TAG_TRACK,
+    MEDIA_TAG_DISC,
+    MEDIA_TAG_FRAMES,
+};
+
+// Frame ids of ID3v2.3/2.4 and of ID3v2.2, in MEDIA_TAG_* order
+static const char media_tag_ids[MEDIA_TAG_FRAMES][4] = {
+    "TPE1", "TPE2", "TALB", "TIT2", "TRCK", "TPOS",
+};
+static const char media_tag_ids22[MEDIA_TAG_FRAMES][3] = {
+    "TP1", "TP2", "TAL", "TT2", "TRK", "TPA",
+};
+
+static uint32_t media_tag_synchsafe(const uint8_t* b) {
+    return ((uint32_t)(b[0] & 0x7f) << 21) | ((b[1] & 0x7f) << 14) |
+           ((b[2] & 0x7f) << 7) | (b[3] & 0x7f);
+}
+
+static uint32_t media_tag_be(const uint8_t* b, int len) {
+    uint32_t v = 0;
+    for (int i = 0; i < len; i++) {
+        v = (v << 8) | b[i];
+    }
+    return v;
+}
+
+// Append a code point as UTF-8, false when out is full
+static bool media_tag_put(char* out, size_t* len, uint32_t cp) {
+    uint8_t buf[4];
+    int n;
+    if (cp < 0x80) {
+        buf[0] = cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        buf[0] = 0xc0 | (cp >> 6);
+        buf[1] = 0x80 | (cp & 0x3f);
+        n = 2;
+    } else if (cp < 0x10000) {
+        buf[0] = 0xe0 | (cp >> 12);
+        buf[1] = 0x80 | ((cp >> 6) & 0x3f);
+        buf[2] = 0x80 | (cp & 0x3f);
+        n = 3;
+    } else {
+        buf[0] = 0xf0 | (cp >> 18);
+        buf[1] = 0x80 | ((cp >> 12) & 0x3f);
+        buf[2] = 0x80 | ((cp >> 6) & 0x3f);
+        buf[3] = 0x80 | (cp & 0x3f);
+        n = 4;
+    }
+    if (*len + n >= MEDIA_TAG_MAX) {
+        return false;
+    }
+    memcpy(out + *len, buf, n);
+    *len += n;
+    return true;
+}
+
+// Decode the first string of a text frame into UTF-8
+static void media_tag_text(const uint8_t* data, size_t size, char* out) {
+    size_t len = 0;
+    if (size > 0) {
+        uint8_t enc = data[0];
+        const uint8_t* p = data + 1;
+        const uint8_t* end = data + size;
+        if (enc == 0 || enc == 3) {
+            // ISO-8859-1 maps to the first 256 code points, UTF-8 is copied
+            while (p < end && *p != 0) {
+                if (enc == 0) {
+                    if (!media_tag_put(out, &len, *p++)) {
+                        break;
+                    }
+                    continue;
+                }
+                // copy whole UTF-8 sequences only
+                size_t n = *p >= 0xf0 ? 4 : *p >= 0xe0 ? 3 : *p >= 0xc0 ? 2 : 1;
+                if (n > (size_t)(end - p) || len + n >= MEDIA_TAG_MAX) {
+                    break;
+                }
+                memcpy(out + len, p, n);
+                len += n;
+                p += n;
+            }
+        } else {
+            bool le = false; // UTF-16BE unless a BOM says otherwise
+            if (enc == 1 && end - p >= 2) {
+                le = p[0] == 0xff && p[1] == 0xfe;
+                if ((p[0] == 0xff && p[1] == 0xfe) ||
+                    (p[0] == 0xfe && p[1] == 0xff)) {
+                    p += 2;
+                }
+            }
+            while (end - p >= 2) {
+                uint32_t cp = le ? p[0] | (p[1] << 8) : (p[0] << 8) | p[1];
+                p += 2;
+                if (cp == 0) {
+                    break;
+                }
+                if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 2) {
+                    uint32_t lo = le ? p[0] | (p[1] << 8) : (p[0] << 8) | p[1];
+                    p += 2;
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                }
+                if (!media_tag_put(out, &len, cp)) {
+                    break;
+                }
+            }
+        }
+    }
+    out[len] = '\0';
+}
+
+static bool media_tag_read_v2(int fd, media_tag_t* tag, char* album_artist) {
+    uint8_t hdr[10];
+    if (pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        memcmp(hdr, "ID3", 3) != 0) {
+        return false;
+    }
+    uint8_t ver = hdr[3];
+    if (ver < 2 || ver > 4) {
+        return false;
+    }
+    // 64 bits, frame sizes of 2.3 are raw 32-bit values
+    uint64_t end = sizeof(hdr) + media_tag_synchsafe(hdr + 6);
+    uint64_t pos = sizeof(hdr);
+    if (ver > 2 && (hdr[5] & 0x40)) {
+        // extended header, its size excludes itself in 2.3
+        uint8_t ext[4];
+        if (pread(fd, ext, sizeof(ext), pos) != sizeof(ext)) {
+            return false;
+        }
+        pos += ver == 3 ? 4 + media_tag_be(ext, 4) : media_tag_synchsafe(ext);
+    }
+
+    int fhdr = ver == 2 ? 6 : 10;
+    uint32_t found = 0;
+    while (pos + fhdr <= end && found != (1u << MEDIA_TAG_FRAMES) - 1) {
+        uint8_t f[10];
+        if (pread(fd, f, fhdr, pos) != fhdr || f[0] == 0) {
+            break; // padding
+        }
+        uint32_t size = ver == 2   ? media_tag_be(f + 3, 3)
+                        : ver == 3 ? media_tag_be(f + 4, 4)
+                                   : media_tag_synchsafe(f + 4);
+        uint64_t data = pos + fhdr;
+        if (size > end - data) {
+            break; // runs past the tag, corrupt
+        }
+        pos = data + size;
+
+        int id = -1;
+        for (int i = 0; i < MEDIA_TAG_FRAMES; i++) {
+            if (ver == 2 ? memcmp(f, media_tag_ids22[i], 3) == 0
+                         : memcmp(f, media_tag_ids[i], 4) == 0) {
+                id = i;
+                break;
+            }
+        }
+        if (id < 0 || size == 0) {
+            continue;
+        }
+        if (ver == 3 && (f[9] & 0xc0)) {
+            continue; // compressed or encrypted
+        }
+        if (ver == 4) {
+            if (f[9] & 0x0c) {
+                continue; // compressed or encrypted
+            }
+            if (f[9] & 0x01) {
+                // data length indicator
+                data += 4;
+                size = size > 4 ? size - 4 : 0;
+            }
+        }
+
+        uint8_t buf[MEDIA_TAG_FRAME_MAX];
+        size_t len = size < sizeof(buf) ? size : sizeof(buf);
+        if (pread(fd, buf, len, data) != (ssize_t)len) {
+            break;
+        }
+        char text[MEDIA_TAG_MAX];
+        media_tag_text(buf, len, text);
+        switch (id) {
+        case MEDIA_TAG_ARTIST:
+            strcpy(tag->artist, text);
+            break;
+        case MEDIA_TAG_ALBUM_ARTIST:
+            strcpy(album_artist, text);
+            break;
+        case MEDIA_TAG_ALBUM:
+            strcpy(tag->album, text);
+            break;
+        case MEDIA_TAG_TITLE:
+            strcpy(tag->title, text);
+            break;
+        case MEDIA_TAG_TRACK:
+            tag->track = atoi(text); // "3/12"
+            break;
+        case MEDIA_TAG_DISC:
+            tag->disc = atoi(text);
+            break;
+        }
+        found |= 1u << id;
+    }
+    return found != 0;
+}
+
+// Copy a fixed-width ID3v1 field, ISO-8859-1 padded with NULs or spaces
+static void media_tag_v1_field(const uint8_t* field, size_t width,
+                               char* out) {
+    size_t len = 0;
+    for (size_t i = 0; i < width && field[i] != 0; i++) {
+        if (!media_tag_put(out, &len, field[i])) {
+            break;
+        }
+    }
+    while (len > 0 && out[len - 1] == ' ') {
+        len--;
+    }
+    out[len] = '\0';
+}
+
+static bool media_tag_read_v1(int fd, uint32_t size, media_tag_t* tag) {
+    uint8_t v1[128];
+    if (size < sizeof(v1) ||
+        pread(fd, v1, sizeof(v1), size - sizeof(v1)) != sizeof(v1) ||
+        memcmp(v1, "TAG", 3) != 0) {
+        return false;
+    }
+    media_tag_v1_field(v1 + 3, 30, tag->title);
+    media_tag_v1_field(v1 + 33, 30, tag->artist);
+    media_tag_v1_field(v1 + 63, 30, tag->album);
+    if (v1[125] == 0 && v1[126] != 0) {
+        tag->track = v1[126]; // ID3v1.1
+    }
+    return true;
+}
+
+bool media_tag_read(int fd, uint32_t size, media_tag_t* tag) {
+    memset(tag, 0, sizeof(media_tag_t));
+    char album_artist[MEDIA_TAG_MAX] = "";
+    bool ok = media_tag_read_v2(fd, tag, album_artist);
+    if (album_artist[0] != '\0') {
+        // keeps compilations together when browsing by artist
+        strcpy(tag->artist, album_artist);
+    }
+    if (!ok || tag->title[0] == '\0') {
+        media_tag_t v1;
+        memset(&v1, 0, sizeof(v1));
+        if (media_tag_read_v1(fd, size, &v1)) {
+            ok = true;
+            strcpy(tag->title, v1.title);
+            if (tag->artist[0] == '\0') {
+                strcpy(tag->artist, v1.artist);
+            }
+            if (tag->album[0] == '\0') {
+                strcpy(tag->album, v1.album);
+            }
+            if (tag->track == 0) {
+                tag->track = v1.track;
+            }
+        }
+    }
+    return ok;
+}
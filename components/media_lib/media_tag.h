@@ -0,0 +1,19 @@
+#pragma once
+#include "media_lib.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MEDIA_TAG_MAX MEDIA_LIB_TAG_MAX
+
+typedef struct {
+    char artist[MEDIA_TAG_MAX]; // album artist when tagged, else artist
+    char album[MEDIA_TAG_MAX];
+    char title[MEDIA_TAG_MAX];
+    uint16_t disc;
+    uint16_t track;
+} media_tag_t;
+
+// Read the ID3v2 tag at the start of fd, or the ID3v1 tag at its end.
+// Only the wanted text frames are read, pictures and the rest are seeked
+// over. Returns false when the file has neither.
+bool media_tag_read(int fd, uint32_t size, media_tag_t* tag);
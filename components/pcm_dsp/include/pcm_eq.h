@@ -0,0 +1,44 @@
+#pragma once
+#include "sdkconfig.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bands of a pcm_eq_t
+#define PCM_EQ_MAX_BANDS CONFIG_PCM_DSP_EQ_BANDS
+
+typedef enum {
+    PCM_EQ_PEAK,       // bell around hz
+    PCM_EQ_LOW_SHELF,  // gain below hz
+    PCM_EQ_HIGH_SHELF, // gain above hz
+    PCM_EQ_HIGH_PASS,  // 12 dB/octave below hz, gain_db unused
+} pcm_eq_type_t;
+
+typedef struct {
+    pcm_eq_type_t type;
+    float hz;
+    float gain_db; // clamped to +-12 dB
+    float q;       // 0.707 for a flat shelf or high-pass
+} pcm_eq_band_t;
+
+// Parametric equalizer for 16-bit stereo, a cascade of biquads. Each
+// band is designed after the RBJ audio EQ cookbook when it changes. The
+// portable kernel is direct form I with Q31 coefficients scaled by 1/16,
+// which holds every band type at 12 dB, and 64-bit accumulators. With
+// CONFIG_PCM_DSP_EQ_ESP_DSP the target runs esp-dsp float biquads.
+typedef struct pcm_eq pcm_eq_t;
+
+// Returns nullptr on allocation failure
+pcm_eq_t* pcm_eq_create(uint32_t rate);
+
+void pcm_eq_destroy(pcm_eq_t* eq);
+
+// Replace the bands, count 0 bypasses the stage. Callable from one task
+// while another runs pcm_eq_process, which picks them up at its next
+// block. Returns false if count exceeds PCM_EQ_MAX_BANDS or a band's
+// coefficients do not fit the kernel, which only happens past Nyquist.
+bool pcm_eq_set(pcm_eq_t* eq, const pcm_eq_band_t* bands, size_t count);
+
+// Filter frames interleaved stereo frames in place, saturating
+void pcm_eq_process(pcm_eq_t* eq, int16_t* pcm, size_t frames);
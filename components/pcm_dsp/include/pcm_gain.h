@@ -0,0 +1,29 @@
+#pragma once
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Unity gain in Q15
+#define PCM_GAIN_UNITY 32768
+
+// Software volume for 16-bit stereo. The target is set from any task,
+// pcm_gain_process ramps to it linearly over one block so changes do not
+// click, then holds it.
+typedef struct {
+    _Atomic int32_t target; // Q15
+    int32_t current;        // Q15, owned by the processing task
+} pcm_gain_t;
+
+void pcm_gain_init(pcm_gain_t* gain, int32_t q15);
+
+void pcm_gain_set(pcm_gain_t* gain, int32_t q15);
+
+// Set the target to AVRCP absolute volume 0-127: 0 mutes, 1-127 are
+// -60 to 0 dB in steps of about 0.5 dB
+void pcm_gain_set_volume(pcm_gain_t* gain, uint8_t volume);
+
+// Q15 gain of an AVRCP absolute volume
+int32_t pcm_gain_of_volume(uint8_t volume);
+
+// Apply the gain in place to frames interleaved stereo frames, saturating
+void pcm_gain_process(pcm_gain_t* gain, int16_t* pcm, size_t frames);
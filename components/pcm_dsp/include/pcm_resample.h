@@ -0,0 +1,58 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-point polyphase sample-rate converter for 16-bit stereo. The
+// ratio out_rate / in_rate is reduced to L / M, the input is upsampled by
+// L through a windowed-sinc lowpass and decimated by M. The filter is
+// stored as L phases of Q15 taps, computed once at creation.
+typedef struct pcm_resample pcm_resample_t;
+
+// Taps per phase of each tier, and the band it converts with an error
+// below -50 dB (-70 dB for HIGH) from 32 and 48 kHz. Past it the output
+// rolls off, and from 48 kHz the content above 22.05 kHz aliases less.
+typedef enum {
+    PCM_RESAMPLE_FAST,   // 8 taps, 5 kHz
+    PCM_RESAMPLE_MEDIUM, // 16 taps, 10 kHz
+    PCM_RESAMPLE_HIGH,   // 32 taps, 12 kHz, 16 kHz from 48 kHz
+} pcm_resample_quality_t;
+
+// Returns nullptr on allocation failure or when the reduced ratio needs
+// more than PCM_RESAMPLE_MAX_PHASES phases. The table takes
+// L * taps * 2 bytes: 147 phases from 48 kHz to 44.1 kHz, 441 from
+// 32 kHz.
+#define PCM_RESAMPLE_MAX_PHASES 441
+#define PCM_RESAMPLE_MAX_TAPS 32
+pcm_resample_t* pcm_resample_create(uint32_t in_rate, uint32_t out_rate,
+                                    pcm_resample_quality_t quality);
+
+void pcm_resample_destroy(pcm_resample_t* rs);
+
+// Bytes a converter takes, its table and history after a header, 0 for
+// an unsupported ratio
+#define PCM_RESAMPLE_HEADER 64
+size_t pcm_resample_size(uint32_t in_rate, uint32_t out_rate,
+                         pcm_resample_quality_t quality);
+
+// Enough for any supported ratio with taps taps per phase
+#define PCM_RESAMPLE_MAX_SIZE(taps)                                            \
+    (PCM_RESAMPLE_HEADER + (PCM_RESAMPLE_MAX_PHASES + 4) * (taps) * 2)
+
+// Build a converter in size bytes of caller-owned mem, aligned for
+// pointers. Returns nullptr when they are too few or the ratio is
+// unsupported. Nothing to destroy.
+pcm_resample_t* pcm_resample_init(void* mem, size_t size, uint32_t in_rate,
+                                  uint32_t out_rate,
+                                  pcm_resample_quality_t quality);
+
+// Forget the input history, after a seek
+void pcm_resample_reset(pcm_resample_t* rs);
+
+// Convert up to in_frames interleaved stereo frames into out, which holds
+// out_frames. Stops before an input frame whose output would not fit.
+// Sets *used to the input frames consumed, returns the frames written.
+size_t pcm_resample_process(pcm_resample_t* rs, const int16_t* in,
+                            size_t in_frames, size_t* used, int16_t* out,
+                            size_t out_frames);
+
+uint32_t pcm_resample_in_rate(const pcm_resample_t* rs);
@@ -0,0 +1,262 @@
+#include "pcm_eq.h"
+#include "esp_log.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#if CONFIG_PCM_DSP_EQ_ESP_DSP
+#include "esp_dsp.h"
+#endif
+
+// Coefficients are Q31 scaled down by 2^PCM_EQ_SHIFT, range +-16. Below
+// Nyquist shelves at 12 dB reach about 8, designs past it are refused.
+#define PCM_EQ_SHIFT 4
+#define PCM_EQ_COEF_MAX (1 << PCM_EQ_SHIFT)
+// Fraction bits kept below the 16-bit sample LSB in the filter state
+#define PCM_EQ_FRAC 8
+// Frames filtered per pass over the bands
+#define PCM_EQ_CHUNK 128
+
+typedef struct {
+    int32_t b0, b1, b2, a1, a2; // a1 and a2 negated
+} pcm_eq_coef_t;
+
+// Direct form I state of one channel, samples with PCM_EQ_FRAC more bits
+typedef struct {
+    int32_t x1, x2, y1, y2;
+} pcm_eq_state_t;
+
+struct pcm_eq {
+    uint32_t rate;
+
+    // written by pcm_eq_set: odd while it is writing
+    _Atomic uint32_t seq;
+    pcm_eq_band_t bands[PCM_EQ_MAX_BANDS];
+    uint32_t count;
+
+    // owned by pcm_eq_process
+    uint32_t seen; // seq the coefficients were designed from
+    uint32_t active;
+#if CONFIG_PCM_DSP_EQ_ESP_DSP
+    float coef[PCM_EQ_MAX_BANDS][5];
+    float w[PCM_EQ_MAX_BANDS][2][2];
+    float buf[2][PCM_EQ_CHUNK];
+#else
+    pcm_eq_coef_t coef[PCM_EQ_MAX_BANDS];
+    pcm_eq_state_t state[PCM_EQ_MAX_BANDS][2];
+    int32_t buf[2 * PCM_EQ_CHUNK];
+#endif
+};
+
+pcm_eq_t* pcm_eq_create(uint32_t rate) {
+    pcm_eq_t* eq = calloc(1, sizeof(pcm_eq_t));
+    if (eq == NULL) {
+        ESP_LOGE("PCM_EQ", "%s calloc failed", __func__);
+        return nullptr;
+    }
+    eq->rate = rate;
+    atomic_init(&eq->seq, 0);
+    return eq;
+}
+
+void pcm_eq_destroy(pcm_eq_t* eq) {
+    free(eq);
+}
+
+static void pcm_eq_design(const pcm_eq_band_t* band, uint32_t rate,
+                          double c[5]);
+
+bool pcm_eq_set(pcm_eq_t* eq, const pcm_eq_band_t* bands, size_t count) {
+    if (count > PCM_EQ_MAX_BANDS) {
+        return false;
+    }
+    // the same bands on both kernels, the fixed-point one bounds them
+    for (size_t i = 0; i < count; i++) {
+        double c[5];
+        pcm_eq_design(&bands[i], eq->rate, c);
+        for (int k = 0; k < 5; k++) {
+            if (!(fabs(c[k]) < PCM_EQ_COEF_MAX)) {
+                ESP_LOGW("PCM_EQ", "%s band %zu does not fit", __func__, i);
+                return false;
+            }
+        }
+    }
+    atomic_fetch_add(&eq->seq, 1);
+    memcpy(eq->bands, bands, count * sizeof(pcm_eq_band_t));
+    eq->count = count;
+    atomic_fetch_add(&eq->seq, 1);
+    return true;
+}
+
+// RBJ cookbook biquad, normalized by a0: b0, b1, b2, a1, a2
+static void pcm_eq_design(const pcm_eq_band_t* band, uint32_t rate,
+                          double c[5]) {
+    double db = band->gain_db > 12 ? 12 : band->gain_db < -12 ? -12
+                                                               : band->gain_db;
+    double a = pow(10, db / 40);
+    double w0 = 2 * M_PI * band->hz / rate;
+    double cs = cos(w0);
+    double alpha = sin(w0) / (2 * (band->q > 0.1f ? band->q : 0.1f));
+    double sa = 2 * sqrt(a) * alpha;
+    double b0, b1, b2, a0, a1, a2;
+    switch (band->type) {
+    case PCM_EQ_PEAK:
+        b0 = 1 + alpha * a;
+        b1 = -2 * cs;
+        b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a;
+        a1 = -2 * cs;
+        a2 = 1 - alpha / a;
+        break;
+    case PCM_EQ_LOW_SHELF:
+        b0 = a * ((a + 1) - (a - 1) * cs + sa);
+        b1 = 2 * a * ((a - 1) - (a + 1) * cs);
+        b2 = a * ((a + 1) - (a - 1) * cs - sa);
+        a0 = (a + 1) + (a - 1) * cs + sa;
+        a1 = -2 * ((a - 1) + (a + 1) * cs);
+        a2 = (a + 1) + (a - 1) * cs - sa;
+        break;
+    case PCM_EQ_HIGH_SHELF:
+        b0 = a * ((a + 1) + (a - 1) * cs + sa);
+        b1 = -2 * a * ((a - 1) + (a + 1) * cs);
+        b2 = a * ((a + 1) + (a - 1) * cs - sa);
+        a0 = (a + 1) - (a - 1) * cs + sa;
+        a1 = 2 * ((a - 1) - (a + 1) * cs);
+        a2 = (a + 1) - (a - 1) * cs - sa;
+        break;
+    case PCM_EQ_HIGH_PASS:
+    default:
+        b0 = (1 + cs) / 2;
+        b1 = -(1 + cs);
+        b2 = (1 + cs) / 2;
+        a0 = 1 + alpha;
+        a1 = -2 * cs;
+        a2 = 1 - alpha;
+        break;
+    }
+    c[0] = b0 / a0;
+    c[1] = b1 / a0;
+    c[2] = b2 / a0;
+    c[3] = a1 / a0;
+    c[4] = a2 / a0;
+}
+
+// Take the bands of the last pcm_eq_set, unless one is under way
+static void pcm_eq_update(pcm_eq_t* eq) {
+    uint32_t seq = atomic_load(&eq->seq);
+    if (seq == eq->seen || (seq & 1)) {
+        return;
+    }
+    pcm_eq_band_t bands[PCM_EQ_MAX_BANDS];
+    uint32_t count = eq->count;
+    memcpy(bands, eq->bands, sizeof(bands));
+    // keep the copy above from sinking below the check
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load(&eq->seq) != seq) {
+        return; // torn, retry on the next block
+    }
+    eq->seen = seq;
+
+    for (uint32_t i = 0; i < count; i++) {
+        double c[5];
+        pcm_eq_design(&bands[i], eq->rate, c);
+#if CONFIG_PCM_DSP_EQ_ESP_DSP
+        for (int k = 0; k < 5; k++) {
+            eq->coef[i][k] = c[k];
+        }
+#else
+        double scale = (double)(1u << (31 - PCM_EQ_SHIFT));
+        eq->coef[i] = (pcm_eq_coef_t){
+            .b0 = lround(c[0] * scale),
+            .b1 = lround(c[1] * scale),
+            .b2 = lround(c[2] * scale),
+            .a1 = lround(-c[3] * scale),
+            .a2 = lround(-c[4] * scale),
+        };
+#endif
+    }
+    // bands that stay keep their state, new ones start from silence
+#if CONFIG_PCM_DSP_EQ_ESP_DSP
+    if (count > eq->active) {
+        memset(&eq->w[eq->active], 0, (count - eq->active) * sizeof(eq->w[0]));
+    }
+#else
+    if (count > eq->active) {
+        memset(&eq->state[eq->active], 0,
+               (count - eq->active) * sizeof(eq->state[0]));
+    }
+#endif
+    eq->active = count;
+}
+
+static inline int16_t pcm_eq_sat(int32_t v) {
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+#if CONFIG_PCM_DSP_EQ_ESP_DSP
+static void pcm_eq_chunk(pcm_eq_t* eq, int16_t* pcm, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        eq->buf[0][i] = pcm[2 * i];
+        eq->buf[1][i] = pcm[2 * i + 1];
+    }
+    for (uint32_t b = 0; b < eq->active; b++) {
+        for (int ch = 0; ch < 2; ch++) {
+            dsps_biquad_f32(eq->buf[ch], eq->buf[ch], frames, eq->coef[b],
+                            eq->w[b][ch]);
+        }
+    }
+    for (size_t i = 0; i < frames; i++) {
+        pcm[2 * i] = pcm_eq_sat(lrintf(eq->buf[0][i]));
+        pcm[2 * i + 1] = pcm_eq_sat(lrintf(eq->buf[1][i]));
+    }
+}
+#else
+// One band over an interleaved chunk. Both channels go through the same
+// loop body so the compiler can pair their multiplies.
+static void pcm_eq_band(const pcm_eq_coef_t* c, pcm_eq_state_t* st,
+                        int32_t* buf, size_t frames) {
+    pcm_eq_state_t l = st[0], r = st[1];
+    for (size_t i = 0; i < frames; i++) {
+        int32_t xl = buf[2 * i], xr = buf[2 * i + 1];
+        int64_t al = (int64_t)c->b0 * xl + (int64_t)c->b1 * l.x1 +
+                     (int64_t)c->b2 * l.x2 + (int64_t)c->a1 * l.y1 +
+                     (int64_t)c->a2 * l.y2;
+        int64_t ar = (int64_t)c->b0 * xr + (int64_t)c->b1 * r.x1 +
+                     (int64_t)c->b2 * r.x2 + (int64_t)c->a1 * r.y1 +
+                     (int64_t)c->a2 * r.y2;
+        int32_t yl = al >> (31 - PCM_EQ_SHIFT);
+        int32_t yr = ar >> (31 - PCM_EQ_SHIFT);
+        l.x2 = l.x1, l.x1 = xl, l.y2 = l.y1, l.y1 = yl;
+        r.x2 = r.x1, r.x1 = xr, r.y2 = r.y1, r.y1 = yr;
+        buf[2 * i] = yl;
+        buf[2 * i + 1] = yr;
+    }
+    st[0] = l;
+    st[1] = r;
+}
+
+static void pcm_eq_chunk(pcm_eq_t* eq, int16_t* pcm, size_t frames) {
+    for (size_t i = 0; i < 2 * frames; i++) {
+        eq->buf[i] = (int32_t)pcm[i] * (1 << PCM_EQ_FRAC);
+    }
+    for (uint32_t b = 0; b < eq->active; b++) {
+        pcm_eq_band(&eq->coef[b], eq->state[b], eq->buf, frames);
+    }
+    for (size_t i = 0; i < 2 * frames; i++) {
+        int32_t v = eq->buf[i] + (1 << (PCM_EQ_FRAC - 1));
+        pcm[i] = pcm_eq_sat(v >> PCM_EQ_FRAC);
+    }
+}
+#endif
+
+void pcm_eq_process(pcm_eq_t* eq, int16_t* pcm, size_t frames) {
+    pcm_eq_update(eq);
+    if (eq->active == 0) {
+        return;
+    }
+    while (frames > 0) {
+        size_t n = frames < PCM_EQ_CHUNK ? frames : PCM_EQ_CHUNK;
+        pcm_eq_chunk(eq, pcm, n);
+        pcm += 2 * n;
+        frames -= n;
+    }
+}
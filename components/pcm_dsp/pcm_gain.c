@@ -0,0 +1,84 @@
+#include "pcm_gain.h"
+#include <string.h>
+
+// Q15 gain of each AVRCP volume, 20 * log10(g) = -60 * (127 - v) / 126
+static const uint16_t pcm_gain_volume_q15[128] = {
+    0, 33, 35, 37, 39, 41, 43, 46,
+    48, 51, 54, 57, 60, 63, 67, 71,
+    75, 79, 83, 88, 93, 98, 104, 109,
+    116, 122, 129, 136, 144, 152, 161, 170,
+    179, 189, 200, 211, 223, 236, 249, 263,
+    278, 294, 310, 328, 346, 366, 386, 408,
+    431, 455, 481, 508, 537, 567, 599, 633,
+    668, 706, 746, 788, 832, 879, 929, 981,
+    1036, 1095, 1156, 1221, 1290, 1363, 1440, 1521,
+    1607, 1697, 1793, 1894, 2001, 2113, 2232, 2358,
+    2491, 2632, 2780, 2937, 3102, 3277, 3461, 3657,
+    3863, 4080, 4310, 4553, 4810, 5081, 5367, 5670,
+    5989, 6327, 6683, 7060, 7457, 7878, 8322, 8791,
+    9286, 9809, 10362, 10946, 11563, 12215, 12903, 13630,
+    14398, 15210, 16067, 16972, 17929, 18939, 20006, 21134,
+    22325, 23583, 24912, 26316, 27799, 29365, 31020, 32768,
+};
+
+void pcm_gain_init(pcm_gain_t* gain, int32_t q15) {
+    atomic_init(&gain->target, q15);
+    gain->current = q15;
+}
+
+int32_t pcm_gain_of_volume(uint8_t volume) {
+    return pcm_gain_volume_q15[volume & 0x7f];
+}
+
+void pcm_gain_set(pcm_gain_t* gain, int32_t q15) {
+    atomic_store(&gain->target, q15);
+}
+
+void pcm_gain_set_volume(pcm_gain_t* gain, uint8_t volume) {
+    atomic_store(&gain->target, pcm_gain_of_volume(volume));
+}
+
+static inline int16_t pcm_gain_sat(int32_t v) {
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+}
+
+void pcm_gain_process(pcm_gain_t* gain, int16_t* pcm, size_t frames) {
+    int32_t target = atomic_load(&gain->target);
+    int32_t g = gain->current;
+    size_t n = 2 * frames;
+    if (frames == 0) {
+        return;
+    }
+
+    if (g != target) {
+        // Q15 gain with 15 more fraction bits, stepped once per frame
+        int32_t ramp = g << 15;
+        int32_t step = (int64_t)(target - g) * 32768 / (int64_t)frames;
+        for (size_t i = 0; i < n; i += 2) {
+            int32_t q = ramp >> 15;
+            pcm[i] = pcm_gain_sat((pcm[i] * q + (1 << 14)) >> 15);
+            pcm[i + 1] = pcm_gain_sat((pcm[i + 1] * q + (1 << 14)) >> 15);
+            ramp += step;
+        }
+        gain->current = target;
+        return;
+    }
+
+    if (g == PCM_GAIN_UNITY) {
+        return;
+    }
+    if (g == 0) {
+        memset(pcm, 0, n * sizeof(int16_t));
+        return;
+    }
+    // fixed-length inner loop, so it vectorizes without -O3
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (size_t k = 0; k < 8; k++) {
+            pcm[i + k] = pcm_gain_sat((pcm[i + k] * g + (1 << 14)) >> 15);
+        }
+    }
+    for (; i < n; i++) {
+        pcm[i] = pcm_gain_sat((pcm[i] * g + (1 << 14)) >> 15);
+    }
+}
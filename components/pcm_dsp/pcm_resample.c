@@ -0,0 +1,224 @@
+#include "pcm_resample.h"
+#include "esp_log.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct pcm_resample {
+    uint32_t in_rate;
+    uint32_t l; // upsampling factor, phases of the filter
+    uint32_t m; // decimation factor
+    uint32_t taps;
+    uint32_t phase; // of the next output, below l once an input is pushed
+    uint32_t pos;   // next history slot
+
+    // phase p holds its taps oldest input first, so a dot product with the
+    // history window runs forward
+    int16_t* coef;
+    // each history is written twice, taps apart, so the window of the last
+    // taps inputs is contiguous at hist + pos
+    int16_t* hist[2];
+};
+
+static const struct {
+    uint8_t taps;
+    float beta;    // Kaiser window
+    float rolloff; // passband edge, fraction of the lower Nyquist
+} pcm_resample_tiers[] = {
+    [PCM_RESAMPLE_FAST] = {8, 5.0f, 0.80f},
+    [PCM_RESAMPLE_MEDIUM] = {16, 7.0f, 0.88f},
+    [PCM_RESAMPLE_HIGH] = {32, 9.0f, 0.93f},
+};
+
+static uint32_t pcm_resample_gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth-order modified Bessel function, for the Kaiser window
+static double pcm_resample_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Windowed-sinc prototype at l times the input rate, cut at the lower of
+// the two Nyquist rates, split into phases each normalized to unity gain
+// so a DC input comes out unchanged from every phase
+static void pcm_resample_design(pcm_resample_t* rs, double fc, double beta) {
+    uint32_t n = rs->l * rs->taps;
+    double center = (n - 1) / 2.0;
+    double norm = pcm_resample_i0(beta);
+    double phase[PCM_RESAMPLE_MAX_TAPS];
+    for (uint32_t p = 0; p < rs->l; p++) {
+        double sum = 0;
+        for (uint32_t k = 0; k < rs->taps; k++) {
+            // tap k of phase p weighs input k inputs back from the newest
+            double t = k * rs->l + p - center;
+            double x = 2 * fc * t;
+            double sinc = t == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+            double r = t / (center + 1);
+            double w = pcm_resample_i0(beta * sqrt(1 - r * r)) / norm;
+            phase[k] = sinc * w;
+            sum += phase[k];
+        }
+        // store oldest input first, the newest input is tap 0
+        int16_t* c = rs->coef + p * rs->taps;
+        int32_t total = 0;
+        for (uint32_t k = 0; k < rs->taps; k++) {
+            double q = phase[k] / sum * 32768;
+            c[rs->taps - 1 - k] = q > 32767 ? 32767 : lround(q);
+            total += c[rs->taps - 1 - k];
+        }
+        // put the rounding error on the largest tap
+        c[rs->taps / 2] += 32768 - total;
+    }
+}
+
+_Static_assert(sizeof(pcm_resample_t) <= PCM_RESAMPLE_HEADER,
+               "PCM_RESAMPLE_HEADER is too small");
+
+// L, or 0 when the ratio needs too many phases
+static uint32_t pcm_resample_phases(uint32_t in_rate, uint32_t out_rate) {
+    uint32_t g = pcm_resample_gcd(in_rate, out_rate);
+    if (g == 0 || out_rate / g > PCM_RESAMPLE_MAX_PHASES) {
+        ESP_LOGE("PCM_RESAMPLE", "Unsupported ratio %" PRIu32
+                 " -> %" PRIu32,
+                 in_rate, out_rate);
+        return 0;
+    }
+    return out_rate / g;
+}
+
+size_t pcm_resample_size(uint32_t in_rate, uint32_t out_rate,
+                         pcm_resample_quality_t quality) {
+    uint32_t l = pcm_resample_phases(in_rate, out_rate);
+    if (l == 0) {
+        return 0;
+    }
+    return PCM_RESAMPLE_HEADER +
+           (l + 4) * pcm_resample_tiers[quality].taps * sizeof(int16_t);
+}
+
+pcm_resample_t* pcm_resample_init(void* mem, size_t size, uint32_t in_rate,
+                                  uint32_t out_rate,
+                                  pcm_resample_quality_t quality) {
+    size_t need = pcm_resample_size(in_rate, out_rate, quality);
+    if (need == 0 || need > size) {
+        return nullptr;
+    }
+    pcm_resample_t* rs = mem;
+    memset(rs, 0, sizeof(pcm_resample_t));
+    rs->in_rate = in_rate;
+    rs->l = pcm_resample_phases(in_rate, out_rate);
+    rs->m = in_rate / (out_rate / rs->l);
+    rs->taps = pcm_resample_tiers[quality].taps;
+    rs->coef = (int16_t*)((uint8_t*)mem + PCM_RESAMPLE_HEADER);
+    rs->hist[0] = rs->coef + rs->l * rs->taps;
+    rs->hist[1] = rs->hist[0] + 2 * rs->taps;
+
+    // cutoff in cycles per sample at the upsampled rate
+    uint32_t nyquist = (in_rate < out_rate ? in_rate : out_rate) / 2;
+    double fc = pcm_resample_tiers[quality].rolloff * nyquist /
+                ((double)in_rate * rs->l);
+    pcm_resample_design(rs, fc, pcm_resample_tiers[quality].beta);
+    pcm_resample_reset(rs);
+    return rs;
+}
+
+pcm_resample_t* pcm_resample_create(uint32_t in_rate, uint32_t out_rate,
+                                    pcm_resample_quality_t quality) {
+    size_t size = pcm_resample_size(in_rate, out_rate, quality);
+    if (size == 0) {
+        return nullptr;
+    }
+    void* mem = malloc(size);
+    if (mem == NULL) {
+        ESP_LOGE("PCM_RESAMPLE", "%s allocation failed", __func__);
+        return nullptr;
+    }
+    return pcm_resample_init(mem, size, in_rate, out_rate, quality);
+}
+
+void pcm_resample_destroy(pcm_resample_t* rs) {
+    free(rs);
+}
+
+void pcm_resample_reset(pcm_resample_t* rs) {
+    memset(rs->hist[0], 0, 4 * rs->taps * sizeof(int16_t));
+    rs->pos = 0;
+    rs->phase = 0;
+}
+
+uint32_t pcm_resample_in_rate(const pcm_resample_t* rs) {
+    return rs->in_rate;
+}
+
+// 16x16 -> 32 multiply-accumulate, two accumulators so the loop maps onto
+// MAC16 pairs on Xtensa and vectorizes into pmaddwd on the host
+static inline __attribute__((always_inline)) int32_t
+pcm_resample_dot(const int16_t* restrict x, const int16_t* restrict c,
+                 uint32_t taps) {
+    int32_t a0 = 0, a1 = 0;
+    for (uint32_t k = 0; k < taps; k += 2) {
+        a0 += x[k] * c[k];
+        a1 += x[k + 1] * c[k + 1];
+    }
+    return a0 + a1;
+}
+
+static inline int16_t pcm_resample_q15(int32_t acc) {
+    acc = (acc + (1 << 14)) >> 15;
+    return acc > INT16_MAX ? INT16_MAX : acc < INT16_MIN ? INT16_MIN : acc;
+}
+
+// Inlined once per tier so taps is a constant and the dot product is
+// unrolled
+static inline __attribute__((always_inline)) size_t
+pcm_resample_run(pcm_resample_t* rs, const int16_t* in, size_t in_frames,
+                 size_t* used, int16_t* out, size_t out_frames,
+                 uint32_t taps) {
+    size_t n = 0, i = 0;
+    for (; i < in_frames; i++) {
+        // outputs between this input and the next
+        uint32_t outs = (rs->l - rs->phase + rs->m - 1) / rs->m;
+        if (n + outs > out_frames) {
+            break;
+        }
+        rs->hist[0][rs->pos] = rs->hist[0][rs->pos + taps] = in[2 * i];
+        rs->hist[1][rs->pos] = rs->hist[1][rs->pos + taps] = in[2 * i + 1];
+        rs->pos = rs->pos + 1 == taps ? 0 : rs->pos + 1;
+
+        const int16_t* x0 = rs->hist[0] + rs->pos;
+        const int16_t* x1 = rs->hist[1] + rs->pos;
+        for (; rs->phase < rs->l; rs->phase += rs->m) {
+            const int16_t* c = rs->coef + rs->phase * taps;
+            out[2 * n] = pcm_resample_q15(pcm_resample_dot(x0, c, taps));
+            out[2 * n + 1] = pcm_resample_q15(pcm_resample_dot(x1, c, taps));
+            n++;
+        }
+        rs->phase -= rs->l;
+    }
+    *used = i;
+    return n;
+}
+
+size_t pcm_resample_process(pcm_resample_t* rs, const int16_t* in,
+                            size_t in_frames, size_t* used, int16_t* out,
+                            size_t out_frames) {
+    switch (rs->taps) {
+    case 8:
+        return pcm_resample_run(rs, in, in_frames, used, out, out_frames, 8);
+    case 16:
+        return pcm_resample_run(rs, in, in_frames, used, out, out_frames, 16);
+    default:
+        return pcm_resample_run(rs, in, in_frames, used, out, out_frames, 32);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Why the target depth last changed
+typedef enum {
+    PCM_JITTER_START,    // initial depth
+    PCM_JITTER_UNDERRUN, // grew after reads were padded with silence
+    PCM_JITTER_BURST,    // grew after a burst of reads nearly drained it
+    PCM_JITTER_STABLE,   // shrank after a stable period
+    PCM_JITTER_SINK,     // capped by the A/V latency left by the sink delay
+} pcm_jitter_reason_t;
+
+typedef struct {
+    uint32_t target_ms;     // depth the producer fills the ring to
+    uint32_t max_ms;        // current cap, after the sink delay
+    uint32_t sink_delay_ms; // last delay reported by the sink
+    uint32_t headroom_ms;   // lowest fill after a read this period
+    uint32_t underruns;     // runs of padded reads, once primed
+    uint32_t grows;         // after underruns and bursts
+    uint32_t bursts;        // of those, after bursts
+    uint32_t shrinks;
+    pcm_jitter_reason_t reason; // of the last change
+    int64_t changed_us;         // time of the last change
+} pcm_jitter_stats_t;
+
+// Target depth of a PCM ring, adapted to the consumer. Grows by half on
+// an underrun and by a quarter when a burst of reads leaves less than an
+// eighth of it, shrinks by an eighth after each stable period whose reads
+// always left over a third of it. The sink delay caps it to keep their sum
+// within the A/V latency budget. The consumer calls pcm_jitter_read, any
+// task can read the target and stats.
+typedef struct {
+    // immutable after init
+    uint32_t byte_rate;
+    uint32_t min;
+    uint32_t max;
+    uint32_t budget_ms; // 0 for no A/V latency budget
+
+    _Atomic uint32_t target;
+    _Atomic uint32_t cap; // max after the sink delay
+    _Atomic uint32_t sink_delay_ms;
+    _Atomic uint32_t underruns;
+    _Atomic uint32_t grows;
+    _Atomic uint32_t bursts;
+    _Atomic uint32_t shrinks;
+    _Atomic uint32_t headroom;
+    _Atomic int reason;
+    _Atomic int64_t changed_us;
+
+    // owned by the consumer
+    int64_t last_us;   // of the last read
+    int64_t period_us; // start of the stable period
+    uint32_t seen_delay;
+    bool primed;      // a read was served since the stream (re)started
+    bool underrun;    // the last read was padded
+    bool burst;       // grew on a burst this period
+} pcm_jitter_t;
+
+// Depths in ms of PCM at byte_rate, target starts at start_ms clamped to
+// [min_ms, max_ms]
+void pcm_jitter_init(pcm_jitter_t* jitter, uint32_t byte_rate,
+                     uint32_t min_ms, uint32_t start_ms, uint32_t max_ms,
+                     uint32_t budget_ms);
+
+// Consumer: note a read of len bytes from a ring holding fill bytes, at
+// now_us. Returns the target, in bytes.
+uint32_t pcm_jitter_read(pcm_jitter_t* jitter, uint32_t len, uint32_t fill,
+                         int64_t now_us);
+
+// Note the delay the sink reported, in ms, 0 when it is gone
+void pcm_jitter_set_sink_delay(pcm_jitter_t* jitter, uint32_t delay_ms);
+
+// Target depth in bytes
+uint32_t pcm_jitter_target(pcm_jitter_t* jitter);
+
+void pcm_jitter_get_stats(pcm_jitter_t* jitter, pcm_jitter_stats_t* stats);
@@ -0,0 +1,86 @@
+#pragma once
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Indices owned by different cores live on separate cache lines.
+// 64 covers both the ESP32 (32) and typical hosts.
+#define PCM_RING_CACHE_LINE 64
+
+// Wait-free single-producer/single-consumer byte ring for PCM.
+// The producer is the decoder task, the consumer the A2DP data callback.
+// Keep every commit a multiple of the PCM frame size (4 bytes for 16-bit
+// stereo) so reservations never split a frame at the wrap point.
+typedef struct {
+    // written by the producer only
+    alignas(PCM_RING_CACHE_LINE) _Atomic uint32_t head; // bytes written
+    _Atomic uint32_t overruns; // writes that did not fit
+
+    // written by the consumer only
+    alignas(PCM_RING_CACHE_LINE) _Atomic uint32_t tail; // bytes read
+    _Atomic uint32_t underruns;      // reads padded with silence
+    _Atomic uint32_t underrun_bytes; // silence bytes inserted
+    _Atomic uint32_t min_fill;       // fill low-water mark at read time
+    _Atomic uint32_t limit;          // most the producer may fill
+
+    // immutable after init
+    alignas(PCM_RING_CACHE_LINE) uint8_t* buf;
+    uint32_t size;
+    uint32_t mask;
+} pcm_ring_t;
+
+typedef struct {
+    uint32_t size;
+    uint32_t fill;
+    uint32_t min_fill;
+    uint32_t underruns;
+    uint32_t underrun_bytes;
+    uint32_t overruns;
+} pcm_ring_stats_t;
+
+// Allocate a ring, size is rounded up to a power of two.
+// Returns nullptr on allocation failure.
+pcm_ring_t* pcm_ring_create(size_t size);
+
+// Initialize a ring over caller-owned storage, size must be a power of two
+void pcm_ring_init(pcm_ring_t* ring, uint8_t* buf, size_t size);
+
+// Free a ring returned by pcm_ring_create
+void pcm_ring_destroy(pcm_ring_t* ring);
+
+// Producer: get the largest contiguous writable span, returns its length
+size_t pcm_ring_write_reserve(pcm_ring_t* ring, uint8_t** ptr);
+
+// Producer: publish len bytes of the reserved span
+void pcm_ring_write_commit(pcm_ring_t* ring, size_t len);
+
+// Producer: copy as much of data as fits, returns bytes written
+size_t pcm_ring_write(pcm_ring_t* ring, const uint8_t* data, size_t len);
+
+// Consumer: get the largest contiguous readable span, returns its length
+size_t pcm_ring_read_reserve(pcm_ring_t* ring, const uint8_t** ptr);
+
+// Consumer: release len bytes of the reserved span
+void pcm_ring_read_commit(pcm_ring_t* ring, size_t len);
+
+// Consumer: copy len bytes into data, padding with silence on underrun.
+// Never blocks, always returns len.
+int32_t pcm_ring_read(pcm_ring_t* ring, uint8_t* data, int32_t len);
+
+// Bytes ready for the consumer. Callable from any task, the producer, the
+// consumer or an observer such as the power policy; from an observer the
+// fill may be stale but never exceeds the size.
+size_t pcm_ring_fill(const pcm_ring_t* ring);
+
+// Bytes free for the producer, up to the limit
+size_t pcm_ring_space(const pcm_ring_t* ring);
+
+// Consumer: let the producer fill up to limit bytes, at most the size.
+// Bytes already past a lowered limit stay readable.
+void pcm_ring_set_limit(pcm_ring_t* ring, size_t limit);
+
+void pcm_ring_get_stats(pcm_ring_t* ring, pcm_ring_stats_t* stats);
+
+// Reset the fill low-water mark and the underrun/overrun counters
+void pcm_ring_reset_stats(pcm_ring_t* ring);
@@ -0,0 +1,161 @@
+#include "pcm_jitter.h"
+#include <string.h>
+
+// Reads further apart restart the stream: nothing played in between
+#define PCM_JITTER_GAP_US 500000
+// Length of a stable period before a shrink
+#define PCM_JITTER_PERIOD_US 10000000
+
+static uint32_t pcm_jitter_bytes(const pcm_jitter_t* jitter, uint32_t ms) {
+    // whole frames of 16-bit stereo
+    return (uint32_t)((uint64_t)jitter->byte_rate * ms / 1000) & ~3u;
+}
+
+static uint32_t pcm_jitter_ms(const pcm_jitter_t* jitter, uint32_t bytes) {
+    return (uint64_t)bytes * 1000 / jitter->byte_rate;
+}
+
+void pcm_jitter_init(pcm_jitter_t* jitter, uint32_t byte_rate,
+                     uint32_t min_ms, uint32_t start_ms, uint32_t max_ms,
+                     uint32_t budget_ms) {
+    memset(jitter, 0, sizeof(pcm_jitter_t));
+    jitter->byte_rate = byte_rate;
+    jitter->min = pcm_jitter_bytes(jitter, min_ms);
+    jitter->max = pcm_jitter_bytes(jitter, max_ms);
+    jitter->budget_ms = budget_ms;
+    atomic_init(&jitter->cap, jitter->max);
+    // the Kconfig ranges do not order the three depths
+    uint32_t target = pcm_jitter_bytes(jitter, start_ms);
+    if (target > jitter->max) {
+        target = jitter->max;
+    }
+    if (target < jitter->min) {
+        target = jitter->min;
+    }
+    atomic_init(&jitter->target, target);
+    atomic_init(&jitter->headroom, UINT32_MAX);
+    atomic_init(&jitter->reason, PCM_JITTER_START);
+}
+
+static void pcm_jitter_change(pcm_jitter_t* jitter, uint32_t target,
+                              pcm_jitter_reason_t reason, int64_t now_us) {
+    if (target > jitter->cap) {
+        target = jitter->cap;
+    }
+    if (target < jitter->min) {
+        target = jitter->min;
+    }
+    atomic_store_explicit(&jitter->target, target, memory_order_relaxed);
+    atomic_store_explicit(&jitter->reason, reason, memory_order_relaxed);
+    atomic_store_explicit(&jitter->changed_us, now_us, memory_order_relaxed);
+    // a new period judges the new depth
+    jitter->period_us = now_us;
+    jitter->burst = false;
+    atomic_store_explicit(&jitter->headroom, UINT32_MAX,
+                          memory_order_relaxed);
+}
+
+uint32_t pcm_jitter_read(pcm_jitter_t* jitter, uint32_t len, uint32_t fill,
+                         int64_t now_us) {
+    uint32_t target =
+        atomic_load_explicit(&jitter->target, memory_order_relaxed);
+
+    // the producer needs a while to fill the ring after a pause
+    if (jitter->last_us == 0 || now_us - jitter->last_us > PCM_JITTER_GAP_US) {
+        jitter->primed = false;
+        jitter->period_us = now_us;
+    }
+    jitter->last_us = now_us;
+
+    uint32_t delay =
+        atomic_load_explicit(&jitter->sink_delay_ms, memory_order_relaxed);
+    if (delay != jitter->seen_delay) {
+        jitter->seen_delay = delay;
+        jitter->cap = jitter->max;
+        if (jitter->budget_ms != 0) {
+            uint32_t left =
+                delay < jitter->budget_ms ? jitter->budget_ms - delay : 0;
+            uint32_t cap = pcm_jitter_bytes(jitter, left);
+            jitter->cap = cap < jitter->max ? cap : jitter->max;
+        }
+        if (target > jitter->cap) {
+            pcm_jitter_change(jitter, jitter->cap, PCM_JITTER_SINK, now_us);
+            return atomic_load_explicit(&jitter->target, memory_order_relaxed);
+        }
+    }
+
+    if (fill < len) {
+        // one decision per run of padded reads
+        if (jitter->primed && !jitter->underrun) {
+            atomic_fetch_add_explicit(&jitter->underruns, 1,
+                                      memory_order_relaxed);
+            atomic_fetch_add_explicit(&jitter->grows, 1, memory_order_relaxed);
+            pcm_jitter_change(jitter, target + target / 2,
+                              PCM_JITTER_UNDERRUN, now_us);
+        }
+        jitter->underrun = true;
+        return atomic_load_explicit(&jitter->target, memory_order_relaxed);
+    }
+    jitter->underrun = false;
+    jitter->primed = true;
+
+    uint32_t left = fill - len;
+    uint32_t headroom =
+        atomic_load_explicit(&jitter->headroom, memory_order_relaxed);
+    if (left < headroom) {
+        atomic_store_explicit(&jitter->headroom, left, memory_order_relaxed);
+        headroom = left;
+    }
+
+    if (left < target / 8 && !jitter->burst && target < jitter->cap) {
+        atomic_fetch_add_explicit(&jitter->bursts, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&jitter->grows, 1, memory_order_relaxed);
+        pcm_jitter_change(jitter, target + target / 4, PCM_JITTER_BURST,
+                          now_us);
+        // at most one burst growth per period
+        jitter->burst = true;
+    } else if (now_us - jitter->period_us >= PCM_JITTER_PERIOD_US) {
+        if (headroom > target / 3 && target > jitter->min) {
+            atomic_fetch_add_explicit(&jitter->shrinks, 1,
+                                      memory_order_relaxed);
+            pcm_jitter_change(jitter, target - target / 8, PCM_JITTER_STABLE,
+                              now_us);
+        } else {
+            jitter->period_us = now_us;
+            jitter->burst = false;
+            atomic_store_explicit(&jitter->headroom, UINT32_MAX,
+                                  memory_order_relaxed);
+        }
+    }
+    return atomic_load_explicit(&jitter->target, memory_order_relaxed);
+}
+
+void pcm_jitter_set_sink_delay(pcm_jitter_t* jitter, uint32_t delay_ms) {
+    atomic_store_explicit(&jitter->sink_delay_ms, delay_ms,
+                          memory_order_relaxed);
+}
+
+uint32_t pcm_jitter_target(pcm_jitter_t* jitter) {
+    return atomic_load_explicit(&jitter->target, memory_order_relaxed);
+}
+
+void pcm_jitter_get_stats(pcm_jitter_t* jitter, pcm_jitter_stats_t* stats) {
+    uint32_t headroom =
+        atomic_load_explicit(&jitter->headroom, memory_order_relaxed);
+    stats->target_ms = pcm_jitter_ms(jitter, pcm_jitter_target(jitter));
+    stats->max_ms = pcm_jitter_ms(jitter, jitter->cap);
+    stats->sink_delay_ms =
+        atomic_load_explicit(&jitter->sink_delay_ms, memory_order_relaxed);
+    stats->headroom_ms =
+        headroom == UINT32_MAX ? 0 : pcm_jitter_ms(jitter, headroom);
+    stats->underruns =
+        atomic_load_explicit(&jitter->underruns, memory_order_relaxed);
+    stats->grows = atomic_load_explicit(&jitter->grows, memory_order_relaxed);
+    stats->bursts =
+        atomic_load_explicit(&jitter->bursts, memory_order_relaxed);
+    stats->shrinks =
+        atomic_load_explicit(&jitter->shrinks, memory_order_relaxed);
+    stats->reason = atomic_load_explicit(&jitter->reason, memory_order_relaxed);
+    stats->changed_us =
+        atomic_load_explicit(&jitter->changed_us, memory_order_relaxed);
+}
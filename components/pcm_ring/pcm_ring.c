@@ -0,0 +1,164 @@
+#include "pcm_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t pcm_ring_pow2(size_t size) {
+    uint32_t p = 4;
+    while (p < size) {
+        p <<= 1;
+    }
+    return p;
+}
+
+pcm_ring_t* pcm_ring_create(size_t size) {
+    uint32_t p = pcm_ring_pow2(size);
+    pcm_ring_t* ring = aligned_alloc(PCM_RING_CACHE_LINE, sizeof(pcm_ring_t));
+    uint8_t* buf = malloc(p);
+    if (ring == NULL || buf == NULL) {
+        free(ring);
+        free(buf);
+        return nullptr;
+    }
+    pcm_ring_init(ring, buf, p);
+    return ring;
+}
+
+void pcm_ring_init(pcm_ring_t* ring, uint8_t* buf, size_t size) {
+    memset(ring, 0, sizeof(pcm_ring_t));
+    ring->buf = buf;
+    ring->size = size;
+    ring->mask = size - 1;
+    atomic_store_explicit(&ring->min_fill, size, memory_order_relaxed);
+    atomic_store_explicit(&ring->limit, size, memory_order_relaxed);
+}
+
+void pcm_ring_destroy(pcm_ring_t* ring) {
+    if (ring == nullptr) {
+        return;
+    }
+    free(ring->buf);
+    free(ring);
+}
+
+size_t pcm_ring_write_reserve(pcm_ring_t* ring, uint8_t** ptr) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t limit = atomic_load_explicit(&ring->limit, memory_order_relaxed);
+    uint32_t space = head - tail < limit ? limit - (head - tail) : 0;
+    uint32_t to_end = ring->size - (head & ring->mask);
+
+    *ptr = ring->buf + (head & ring->mask);
+    return space < to_end ? space : to_end;
+}
+
+void pcm_ring_write_commit(pcm_ring_t* ring, size_t len) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + len, memory_order_release);
+}
+
+size_t pcm_ring_write(pcm_ring_t* ring, const uint8_t* data, size_t len) {
+    size_t done = 0;
+    // at most two spans: up to the end of the buffer, then from the start
+    for (int i = 0; i < 2 && done < len; i++) {
+        uint8_t* ptr;
+        size_t n = pcm_ring_write_reserve(ring, &ptr);
+        if (n == 0) {
+            break;
+        }
+        if (n > len - done) {
+            n = len - done;
+        }
+        memcpy(ptr, data + done, n);
+        pcm_ring_write_commit(ring, n);
+        done += n;
+    }
+    if (done < len) {
+        atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+    }
+    return done;
+}
+
+size_t pcm_ring_read_reserve(pcm_ring_t* ring, const uint8_t** ptr) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t fill = head - tail;
+    uint32_t to_end = ring->size - (tail & ring->mask);
+
+    *ptr = ring->buf + (tail & ring->mask);
+    return fill < to_end ? fill : to_end;
+}
+
+void pcm_ring_read_commit(pcm_ring_t* ring, size_t len) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);
+}
+
+int32_t pcm_ring_read(pcm_ring_t* ring, uint8_t* data, int32_t len) {
+    uint32_t fill = pcm_ring_fill(ring);
+    if (fill < atomic_load_explicit(&ring->min_fill, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->min_fill, fill, memory_order_relaxed);
+    }
+
+    size_t done = 0;
+    for (int i = 0; i < 2 && done < (size_t)len; i++) {
+        const uint8_t* ptr;
+        size_t n = pcm_ring_read_reserve(ring, &ptr);
+        if (n == 0) {
+            break;
+        }
+        if (n > len - done) {
+            n = len - done;
+        }
+        memcpy(data + done, ptr, n);
+        pcm_ring_read_commit(ring, n);
+        done += n;
+    }
+
+    if (done < (size_t)len) {
+        // underrun: play silence rather than stall the Bluetooth stack
+        memset(data + done, 0, len - done);
+        atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ring->underrun_bytes, len - done,
+                                  memory_order_relaxed);
+    }
+    return len;
+}
+
+size_t pcm_ring_fill(const pcm_ring_t* ring) {
+    // tail first: head only grows, so the head loaded after it is never
+    // behind, even from a task that is neither producer nor consumer
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
+
+size_t pcm_ring_space(const pcm_ring_t* ring) {
+    uint32_t limit = atomic_load_explicit(&ring->limit, memory_order_relaxed);
+    size_t fill = pcm_ring_fill(ring);
+    return fill < limit ? limit - fill : 0;
+}
+
+void pcm_ring_set_limit(pcm_ring_t* ring, size_t limit) {
+    atomic_store_explicit(&ring->limit, limit < ring->size ? limit : ring->size,
+                          memory_order_relaxed);
+}
+
+void pcm_ring_get_stats(pcm_ring_t* ring, pcm_ring_stats_t* stats) {
+    stats->size = ring->size;
+    stats->fill = pcm_ring_fill(ring);
+    stats->min_fill =
+        atomic_load_explicit(&ring->min_fill, memory_order_relaxed);
+    stats->underruns =
+        atomic_load_explicit(&ring->underruns, memory_order_relaxed);
+    stats->underrun_bytes =
+        atomic_load_explicit(&ring->underrun_bytes, memory_order_relaxed);
+    stats->overruns =
+        atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+}
+
+void pcm_ring_reset_stats(pcm_ring_t* ring) {
+    atomic_store_explicit(&ring->min_fill, ring->size, memory_order_relaxed);
+    atomic_store_explicit(&ring->underruns, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->underrun_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->overruns, 0, memory_order_relaxed);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-ahead file reader. A shared task keeps CONFIG_STREAM_READER_BLOCKS
+// blocks of CONFIG_STREAM_READER_BLOCK_SIZE bytes read ahead of every open
+// stream, refilling the stream with the fewest blocks ready first. Each
+// stream has a single consumer task.
+typedef struct stream_reader stream_reader_t;
+
+// Called from the consumer's task when the blocks read ahead fall to the
+// low-water mark, once per crossing
+typedef void (*stream_reader_low_water_t)(stream_reader_t* stream, void* arg);
+
+typedef struct {
+    uint64_t bytes;        // read from the file
+    uint32_t reads;        // block reads
+    uint32_t errors;       // failed reads, the stream ends at the first
+    uint64_t read_us;      // time spent in block reads
+    uint32_t read_us_max;  // slowest block read
+    uint32_t stalls;       // consumer waits on an empty read-ahead
+    uint64_t stall_us;     // time spent in those waits
+    uint32_t stall_us_max; // longest wait
+    uint32_t low_water;    // low-water crossings
+} stream_reader_stats_t;
+
+// Open a file and start reading it ahead.
+// Returns nullptr if the file cannot be opened or no stream is free.
+stream_reader_t* stream_reader_open(const char* path);
+
+// Stop reading ahead and close the file
+void stream_reader_close(stream_reader_t* stream);
+
+// Call cb when no more than blocks blocks are read ahead
+void stream_reader_set_low_water(stream_reader_t* stream, uint32_t blocks,
+                                 stream_reader_low_water_t cb, void* arg);
+
+// Zero-copy view of the next bytes of the file, valid until the next
+// consume or seek. Waits up to timeout for data. Returns its length,
+// 0 at end of file or on timeout.
+size_t stream_reader_peek(stream_reader_t* stream, const uint8_t** ptr,
+                          TickType_t timeout);
+
+// Release len bytes of the last view
+void stream_reader_consume(stream_reader_t* stream, size_t len);
+
+// Copy the next len bytes into buf, waiting for data.
+// Returns the bytes copied, less than len only at end of file.
+size_t stream_reader_read(stream_reader_t* stream, uint8_t* buf, size_t len);
+
+// Drop the read-ahead and continue from offset, clamped to the file size
+void stream_reader_seek(stream_reader_t* stream, uint64_t offset);
+
+// File offset of the next byte returned
+uint64_t stream_reader_tell(stream_reader_t* stream);
+
+uint64_t stream_reader_size(stream_reader_t* stream);
+
+// True once every byte of the file has been consumed
+bool stream_reader_eof(stream_reader_t* stream);
+
+void stream_reader_get_stats(stream_reader_t* stream,
+                             stream_reader_stats_t* stats);
@@ -0,0 +1,494 @@
+#include "stream_reader.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "sys_mem.h"
+#include "sys_task.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+#define STREAM_READER_BLOCK CONFIG_STREAM_READER_BLOCK_SIZE
+#define STREAM_READER_BLOCKS CONFIG_STREAM_READER_BLOCKS
+// Cache line on hosts, covers the 4-byte DMA alignment of the SD driver
+#define STREAM_READER_ALIGN 64
+
+_Static_assert(STREAM_READER_BLOCK % 512 == 0,
+               "STREAM_READER_BLOCK_SIZE must be a multiple of 512");
+
+typedef struct {
+    uint8_t* buf;
+    uint32_t len; // valid bytes, short only for the last block of the file
+} stream_reader_block_t;
+
+struct stream_reader {
+    int fd;
+    uint64_t size;
+    // held by the reader task around a block read, by seek, and taken by
+    // close to wait out a read in flight
+    SemaphoreHandle_t lock;
+    // given by the reader task after each block and at end of file
+    SemaphoreHandle_t ready;
+    stream_reader_block_t blocks[STREAM_READER_BLOCKS];
+
+    // written by the reader task, under lock
+    _Atomic uint32_t filled; // blocks published
+    _Atomic bool eof;        // no block after the last published one
+
+    // written by the consumer
+    _Atomic uint32_t consumed; // blocks released
+    uint32_t pos;              // offset in the oldest unreleased block
+    uint64_t base;             // file offset of that block
+    uint32_t low_water;
+    stream_reader_low_water_t low_cb;
+    void* low_arg;
+    bool low_hit;
+
+    stream_reader_stats_t stats;
+};
+
+static stream_reader_t* readers[CONFIG_STREAM_READER_MAX_STREAMS];
+// guards readers and the static slots, never held across a read so open
+// and close do not wait for the card
+static SemaphoreHandle_t readers_lock;
+static TaskHandle_t reader_task;
+
+#if CONFIG_SYS_MEM_STATIC
+// One slot per open stream. The blocks stay in internal RAM, which the SD
+// driver can DMA into.
+typedef struct {
+    stream_reader_t stream;
+    StaticSemaphore_t lock_buf;
+    StaticSemaphore_t ready_buf;
+    bool used; // under readers_lock
+} stream_reader_slot_t;
+
+static stream_reader_slot_t reader_slots[CONFIG_STREAM_READER_MAX_STREAMS];
+static uint8_t reader_blocks[CONFIG_STREAM_READER_MAX_STREAMS]
+                            [STREAM_READER_BLOCKS][STREAM_READER_BLOCK]
+    __attribute__((aligned(STREAM_READER_ALIGN)));
+static StaticSemaphore_t readers_lock_buf;
+#endif
+
+#if CONFIG_STREAM_READER_SIM_LATENCY_MS || CONFIG_STREAM_READER_SIM_STALL_MS
+static void stream_reader_sim_delay(uint32_t reads) {
+    uint32_t ms = CONFIG_STREAM_READER_SIM_LATENCY_MS;
+    if (reads % 32 == 31) {
+        ms += CONFIG_STREAM_READER_SIM_STALL_MS;
+    }
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+#endif
+
+static uint32_t stream_reader_ready(stream_reader_t* s) {
+    return atomic_load_explicit(&s->filled, memory_order_acquire) -
+           atomic_load_explicit(&s->consumed, memory_order_acquire);
+}
+
+static bool stream_reader_wants_block(stream_reader_t* s) {
+    return !atomic_load_explicit(&s->eof, memory_order_relaxed) &&
+           stream_reader_ready(s) < STREAM_READER_BLOCKS;
+}
+
+// Read the next block of s, reader task only. The caller holds s->lock,
+// given back here.
+static void stream_reader_fill(stream_reader_t* s) {
+    if (!stream_reader_wants_block(s)) {
+        xSemaphoreGive(s->lock);
+        return;
+    }
+
+    uint32_t filled = atomic_load_explicit(&s->filled, memory_order_relaxed);
+    stream_reader_block_t* blk = &s->blocks[filled % STREAM_READER_BLOCKS];
+    int64_t start = esp_timer_get_time();
+#if CONFIG_STREAM_READER_SIM_LATENCY_MS || CONFIG_STREAM_READER_SIM_STALL_MS
+    stream_reader_sim_delay(s->stats.reads);
+#endif
+    // one read per block, the VFS only returns short at end of file
+    uint32_t len = 0;
+    bool end = false;
+    while (len < STREAM_READER_BLOCK) {
+        ssize_t n = read(s->fd, blk->buf + len, STREAM_READER_BLOCK - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            ESP_LOGE("STREAM_READER", "%s read failed: %d", __func__, errno);
+            s->stats.errors++;
+        }
+        if (n <= 0) {
+            end = true;
+            break;
+        }
+        len += n;
+    }
+    uint32_t us = esp_timer_get_time() - start;
+
+    s->stats.reads++;
+    s->stats.bytes += len;
+    s->stats.read_us += us;
+    if (us > s->stats.read_us_max) {
+        s->stats.read_us_max = us;
+    }
+
+    blk->len = len;
+    if (len > 0) {
+        atomic_store_explicit(&s->filled, filled + 1, memory_order_release);
+    }
+    // after filled: a consumer that sees eof sees the last block
+    if (end) {
+        atomic_store_explicit(&s->eof, true, memory_order_release);
+    }
+    // ready first, a close waiting on the lock frees s once it is given
+    xSemaphoreGive(s->ready);
+    xSemaphoreGive(s->lock);
+}
+
+static void stream_reader_task_handler(void* arg) {
+    for (;;) {
+        xSemaphoreTake(readers_lock, portMAX_DELAY);
+        // the stream closest to running dry first
+        stream_reader_t* next = NULL;
+        uint32_t next_ready = STREAM_READER_BLOCKS;
+        for (int i = 0; i < CONFIG_STREAM_READER_MAX_STREAMS; i++) {
+            stream_reader_t* s = readers[i];
+            if (s == NULL || !stream_reader_wants_block(s)) {
+                continue;
+            }
+            uint32_t ready = stream_reader_ready(s);
+            if (ready < next_ready) {
+                next = s;
+                next_ready = ready;
+            }
+        }
+        // pinned by its lock, a close now waits for the read to end
+        if (next != NULL) {
+            xSemaphoreTake(next->lock, portMAX_DELAY);
+        }
+        xSemaphoreGive(readers_lock);
+
+        if (next != NULL) {
+            stream_reader_fill(next);
+        } else {
+            // woken by consume, seek and open
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+#if CONFIG_SYS_MEM_STATIC
+static stream_reader_t* stream_reader_alloc(void) {
+    stream_reader_t* s = NULL;
+    xSemaphoreTake(readers_lock, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_STREAM_READER_MAX_STREAMS; i++) {
+        stream_reader_slot_t* slot = &reader_slots[i];
+        if (!slot->used) {
+            slot->used = true;
+            s = &slot->stream;
+            memset(s, 0, sizeof(stream_reader_t));
+            s->lock = xSemaphoreCreateMutexStatic(&slot->lock_buf);
+            s->ready = xSemaphoreCreateBinaryStatic(&slot->ready_buf);
+            for (int b = 0; b < STREAM_READER_BLOCKS; b++) {
+                s->blocks[b].buf = reader_blocks[i][b];
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(readers_lock);
+    return s;
+}
+#else
+static stream_reader_t* stream_reader_alloc(void) {
+    stream_reader_t* s = calloc(1, sizeof(stream_reader_t));
+    if (s == NULL) {
+        return nullptr;
+    }
+    s->lock = xSemaphoreCreateMutex();
+    s->ready = xSemaphoreCreateBinary();
+    bool ok = s->lock != NULL && s->ready != NULL;
+    for (int i = 0; ok && i < STREAM_READER_BLOCKS; i++) {
+#if CONFIG_IDF_TARGET_LINUX
+        s->blocks[i].buf = aligned_alloc(STREAM_READER_ALIGN,
+                                         STREAM_READER_BLOCK);
+#else
+        // DMA capable, so the SD driver skips its bounce buffer
+        s->blocks[i].buf = heap_caps_aligned_alloc(
+            STREAM_READER_ALIGN, STREAM_READER_BLOCK, MALLOC_CAP_DMA);
+#endif
+        ok = s->blocks[i].buf != NULL;
+    }
+    return s;
+}
+#endif
+
+static void stream_reader_free(stream_reader_t* s) {
+#if !CONFIG_SYS_MEM_STATIC
+    for (int i = 0; i < STREAM_READER_BLOCKS; i++) {
+        free(s->blocks[i].buf);
+    }
+#endif
+    if (s->lock != NULL) {
+        vSemaphoreDelete(s->lock);
+    }
+    if (s->ready != NULL) {
+        vSemaphoreDelete(s->ready);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+#if CONFIG_SYS_MEM_STATIC
+    xSemaphoreTake(readers_lock, portMAX_DELAY);
+    ((stream_reader_slot_t*)s)->used = false;
+    xSemaphoreGive(readers_lock);
+#else
+    free(s);
+#endif
+}
+
+stream_reader_t* stream_reader_open(const char* path) {
+    if (reader_task == NULL) {
+#if CONFIG_SYS_MEM_STATIC
+        readers_lock = xSemaphoreCreateMutexStatic(&readers_lock_buf);
+#else
+        readers_lock = xSemaphoreCreateMutex();
+#endif
+        if (readers_lock == NULL ||
+            (reader_task = sys_task_create(SYS_TASK_STREAM_READER,
+                                           stream_reader_task_handler,
+                                           NULL)) == NULL) {
+            ESP_LOGE("STREAM_READER", "%s task creation failed", __func__);
+            return nullptr;
+        }
+    }
+
+    stream_reader_t* s = stream_reader_alloc();
+    if (s == NULL) {
+        ESP_LOGE("STREAM_READER", "%s allocation failed", __func__);
+        return nullptr;
+    }
+    // closed unless the open below succeeds
+    s->fd = -1;
+    bool ok = s->lock != NULL && s->ready != NULL;
+    for (int i = 0; ok && i < STREAM_READER_BLOCKS; i++) {
+        ok = s->blocks[i].buf != NULL;
+    }
+    if (!ok) {
+        ESP_LOGE("STREAM_READER", "%s allocation failed", __func__);
+        stream_reader_free(s);
+        return nullptr;
+    }
+
+    s->fd = open(path, O_RDONLY);
+    if (s->fd < 0) {
+        ESP_LOGE("STREAM_READER", "%s failed to open %s", __func__, path);
+        stream_reader_free(s);
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(s->fd, &st) == 0) {
+        s->size = st.st_size;
+    }
+
+    xSemaphoreTake(readers_lock, portMAX_DELAY);
+    int slot = -1;
+    for (int i = 0; i < CONFIG_STREAM_READER_MAX_STREAMS; i++) {
+        if (readers[i] == NULL) {
+            readers[i] = s;
+            slot = i;
+            break;
+        }
+    }
+    xSemaphoreGive(readers_lock);
+    if (slot < 0) {
+        ESP_LOGE("STREAM_READER", "%s no free stream", __func__);
+        stream_reader_free(s);
+        return nullptr;
+    }
+
+    xTaskNotifyGive(reader_task);
+    return s;
+}
+
+void stream_reader_close(stream_reader_t* stream) {
+    if (stream == nullptr) {
+        return;
+    }
+    xSemaphoreTake(readers_lock, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_STREAM_READER_MAX_STREAMS; i++) {
+        if (readers[i] == stream) {
+            readers[i] = NULL;
+        }
+    }
+    xSemaphoreGive(readers_lock);
+    // the reader task may have picked it before, its read holds the lock
+    xSemaphoreTake(stream->lock, portMAX_DELAY);
+    xSemaphoreGive(stream->lock);
+    stream_reader_free(stream);
+}
+
+void stream_reader_set_low_water(stream_reader_t* stream, uint32_t blocks,
+                                 stream_reader_low_water_t cb, void* arg) {
+    stream->low_water = blocks;
+    stream->low_cb = cb;
+    stream->low_arg = arg;
+    stream->low_hit = false;
+}
+
+// Release the oldest block and wake the reader task to refill it
+static void stream_reader_release(stream_reader_t* s) {
+    uint32_t consumed =
+        atomic_load_explicit(&s->consumed, memory_order_relaxed);
+    uint32_t len = s->blocks[consumed % STREAM_READER_BLOCKS].len;
+    s->pos -= len;
+    s->base += len;
+    atomic_store_explicit(&s->consumed, consumed + 1, memory_order_release);
+    xTaskNotifyGive(reader_task);
+
+    if (s->low_cb != NULL && !s->low_hit &&
+        !atomic_load_explicit(&s->eof, memory_order_acquire) &&
+        stream_reader_ready(s) <= s->low_water) {
+        s->low_hit = true;
+        s->stats.low_water++;
+        s->low_cb(s, s->low_arg);
+    }
+}
+
+size_t stream_reader_peek(stream_reader_t* stream, const uint8_t** ptr,
+                          TickType_t timeout) {
+    stream_reader_t* s = stream;
+    int64_t stall_start = 0;
+    size_t len = 0;
+    for (;;) {
+        // eof first: once it is set, filled is final
+        bool eof = atomic_load_explicit(&s->eof, memory_order_acquire);
+        uint32_t ready = stream_reader_ready(s);
+        if (ready > 0) {
+            uint32_t consumed =
+                atomic_load_explicit(&s->consumed, memory_order_relaxed);
+            stream_reader_block_t* blk =
+                &s->blocks[consumed % STREAM_READER_BLOCKS];
+            if (s->pos >= blk->len) {
+                // consumed up to the end, or seeked past it
+                stream_reader_release(s);
+                continue;
+            }
+            if (ready > s->low_water) {
+                s->low_hit = false;
+            }
+            *ptr = blk->buf + s->pos;
+            len = blk->len - s->pos;
+            break;
+        }
+        if (eof) {
+            break;
+        }
+        if (stall_start == 0) {
+            stall_start = esp_timer_get_time();
+        }
+        if (xSemaphoreTake(s->ready, timeout) != pdTRUE) {
+            break;
+        }
+    }
+
+    if (stall_start != 0) {
+        uint32_t us = esp_timer_get_time() - stall_start;
+        s->stats.stalls++;
+        s->stats.stall_us += us;
+        if (us > s->stats.stall_us_max) {
+            s->stats.stall_us_max = us;
+        }
+    }
+    return len;
+}
+
+void stream_reader_consume(stream_reader_t* stream, size_t len) {
+    stream->pos += len;
+    uint32_t consumed =
+        atomic_load_explicit(&stream->consumed, memory_order_relaxed);
+    if (stream->pos >= stream->blocks[consumed % STREAM_READER_BLOCKS].len) {
+        stream_reader_release(stream);
+    }
+}
+
+size_t stream_reader_read(stream_reader_t* stream, uint8_t* buf,
+                          size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        const uint8_t* ptr;
+        size_t n = stream_reader_peek(stream, &ptr, portMAX_DELAY);
+        if (n == 0) {
+            break;
+        }
+        if (n > len - done) {
+            n = len - done;
+        }
+        memcpy(buf + done, ptr, n);
+        stream_reader_consume(stream, n);
+        done += n;
+    }
+    return done;
+}
+
+void stream_reader_seek(stream_reader_t* stream, uint64_t offset) {
+    stream_reader_t* s = stream;
+    if (offset > s->size) {
+        offset = s->size;
+    }
+    // within the block being consumed: keep the read-ahead
+    if (stream_reader_ready(s) > 0 && offset >= s->base) {
+        uint32_t consumed =
+            atomic_load_explicit(&s->consumed, memory_order_relaxed);
+        if (offset - s->base < s->blocks[consumed % STREAM_READER_BLOCKS].len) {
+            s->pos = offset - s->base;
+            return;
+        }
+    }
+
+    // keep reads block aligned, the view starts inside the first block
+    uint64_t aligned = offset - offset % STREAM_READER_BLOCK;
+
+    xSemaphoreTake(s->lock, portMAX_DELAY);
+    lseek(s->fd, aligned, SEEK_SET);
+    atomic_store_explicit(&s->filled, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->consumed, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->eof, false, memory_order_relaxed);
+    s->base = aligned;
+    s->pos = offset - aligned;
+    s->low_hit = false;
+    xSemaphoreGive(s->lock);
+    xTaskNotifyGive(reader_task);
+}
+
+uint64_t stream_reader_tell(stream_reader_t* stream) {
+    return stream->base + stream->pos;
+}
+
+uint64_t stream_reader_size(stream_reader_t* stream) {
+    return stream->size;
+}
+
+bool stream_reader_eof(stream_reader_t* stream) {
+    if (!atomic_load_explicit(&stream->eof, memory_order_acquire)) {
+        return false;
+    }
+    uint32_t ready = stream_reader_ready(stream);
+    uint32_t consumed =
+        atomic_load_explicit(&stream->consumed, memory_order_relaxed);
+    return ready == 0 ||
+           (ready == 1 &&
+            stream->pos >= stream->blocks[consumed % STREAM_READER_BLOCKS].len);
+}
+
+void stream_reader_get_stats(stream_reader_t* stream,
+                             stream_reader_stats_t* stats) {
+    *stats = stream->stats;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Boot timeline. app_main brings Bluetooth up while the boot task runs the
+// storage and audio stages on the audio CPU. The end of every stage is
+// marked with its time, task and CPU, and the free RAM is noted with
+// sys_mem_stage. The timeline is logged once the first audio plays, so a
+// slower stage shows up next to time to first audio.
+
+// Stages kept in the timeline, later ones are only logged
+#define SYS_BOOT_STAGES 24
+
+// A stage of the boot task, false when it failed. The stages after it
+// still run and check what they need.
+typedef bool (*sys_boot_fn_t)(void* arg);
+
+typedef struct {
+    const char* name;
+    sys_boot_fn_t fn;
+    void* arg;
+} sys_boot_stage_t;
+
+typedef struct {
+    const char* name;
+    int8_t cpu;        // the task's CPU, -1 when not pinned
+    bool ok;
+    bool boot_task;    // run by the boot task, else by the marking task
+    uint32_t start_us; // since the timer started, at the previous mark of
+                       // the same task
+    uint32_t end_us;
+} sys_boot_entry_t;
+
+// Open the timeline in app_main, marks "boot"
+void sys_boot_init(void);
+
+// Mark the end of a stage of the calling task, which began at its
+// previous mark or, for its first, now. stage must be a literal.
+void sys_boot_mark(const char* stage);
+
+// Run stages in order on the boot task, returns false if it cannot start
+bool sys_boot_start(const sys_boot_stage_t* stages, size_t count);
+
+// Wait up to timeout_ms for stage to be marked, false if it was not
+bool sys_boot_wait(const char* stage, uint32_t timeout_ms);
+
+// Copy up to max entries of the timeline, in the order they ended
+size_t sys_boot_get_timeline(sys_boot_entry_t* entries, size_t max);
+
+// Log the timeline
+void sys_boot_log(void);
@@ -0,0 +1,144 @@
+#include "sys_boot.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sys_mem.h"
+#include "sys_task.h"
+#include <inttypes.h>
+#include <string.h>
+
+// Tasks whose previous mark is kept: app_main, the Bluetooth core task
+// and one more
+#define SYS_BOOT_TASKS 4
+
+static sys_boot_entry_t timeline[SYS_BOOT_STAGES];
+static size_t timeline_count;
+static struct {
+    TaskHandle_t task;
+    uint32_t at_us;
+} last_mark[SYS_BOOT_TASKS];
+static portMUX_TYPE timeline_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const sys_boot_stage_t* boot_stages;
+static size_t boot_count;
+
+static int8_t sys_boot_cpu(void) {
+    BaseType_t cpu = xTaskGetCoreID(xTaskGetCurrentTaskHandle());
+    return cpu == tskNO_AFFINITY ? -1 : cpu;
+}
+
+static void sys_boot_add(const char* stage, uint32_t start_us,
+                         uint32_t end_us, bool ok, bool boot_task) {
+    portENTER_CRITICAL(&timeline_lock);
+    if (timeline_count < SYS_BOOT_STAGES) {
+        timeline[timeline_count++] = (sys_boot_entry_t){
+            .name = stage,
+            .cpu = sys_boot_cpu(),
+            .ok = ok,
+            .boot_task = boot_task,
+            .start_us = start_us,
+            .end_us = end_us,
+        };
+    }
+    portEXIT_CRITICAL(&timeline_lock);
+    ESP_LOGI("SYS_BOOT", "%s %s at %" PRIu32 " ms, took %" PRIu32 " ms",
+             stage, ok ? "done" : "failed", end_us / 1000,
+             (end_us - start_us) / 1000);
+    sys_mem_stage(stage);
+}
+
+void sys_boot_mark(const char* stage) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    uint32_t now = esp_timer_get_time();
+    uint32_t start = now;
+    portENTER_CRITICAL(&timeline_lock);
+    int free_slot = -1;
+    for (int i = SYS_BOOT_TASKS - 1; i >= 0; i--) {
+        if (last_mark[i].task == task) {
+            start = last_mark[i].at_us;
+            free_slot = i;
+            break;
+        }
+        if (last_mark[i].task == NULL) {
+            free_slot = i;
+        }
+    }
+    if (free_slot >= 0) {
+        last_mark[free_slot].task = task;
+        last_mark[free_slot].at_us = now;
+    }
+    portEXIT_CRITICAL(&timeline_lock);
+    sys_boot_add(stage, start, now, true, false);
+}
+
+void sys_boot_init(void) {
+    sys_boot_mark("boot");
+}
+
+static void sys_boot_task_handler(void* arg) {
+    for (size_t i = 0; i < boot_count; i++) {
+        const sys_boot_stage_t* s = &boot_stages[i];
+        uint32_t start = esp_timer_get_time();
+        bool ok = s->fn(s->arg);
+        sys_boot_add(s->name, start, esp_timer_get_time(), ok, true);
+    }
+    sys_task_exit();
+}
+
+bool sys_boot_start(const sys_boot_stage_t* stages, size_t count) {
+    boot_stages = stages;
+    boot_count = count;
+    if (sys_task_create(SYS_TASK_BOOT, sys_boot_task_handler, NULL) ==
+        NULL) {
+        ESP_LOGE("SYS_BOOT", "%s task creation failed", __func__);
+        return false;
+    }
+    return true;
+}
+
+static bool sys_boot_marked(const char* stage) {
+    bool found = false;
+    portENTER_CRITICAL(&timeline_lock);
+    for (size_t i = 0; i < timeline_count && !found; i++) {
+        found = strcmp(timeline[i].name, stage) == 0;
+    }
+    portEXIT_CRITICAL(&timeline_lock);
+    return found;
+}
+
+bool sys_boot_wait(const char* stage, uint32_t timeout_ms) {
+    int64_t until = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    // a few waits at boot, polling keeps the marks lock free
+    while (!sys_boot_marked(stage)) {
+        if (esp_timer_get_time() >= until) {
+            ESP_LOGW("SYS_BOOT", "Timed out waiting for %s", stage);
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+size_t sys_boot_get_timeline(sys_boot_entry_t* entries, size_t max) {
+    portENTER_CRITICAL(&timeline_lock);
+    size_t n = timeline_count < max ? timeline_count : max;
+    memcpy(entries, timeline, n * sizeof(sys_boot_entry_t));
+    portEXIT_CRITICAL(&timeline_lock);
+    return n;
+}
+
+void sys_boot_log(void) {
+    static sys_boot_entry_t entries[SYS_BOOT_STAGES];
+    size_t n = sys_boot_get_timeline(entries, SYS_BOOT_STAGES);
+    ESP_LOGI("SYS_BOOT", "Boot timeline, ms since the timer started:");
+    for (size_t i = 0; i < n; i++) {
+        const sys_boot_entry_t* e = &entries[i];
+        ESP_LOGI("SYS_BOOT",
+                 "  %-14s %s cpu %2d %6" PRIu32 " .. %6" PRIu32
+                 " %6" PRIu32 " ms%s",
+                 e->name, e->boot_task ? "boot" : "    ", e->cpu,
+                 e->start_us / 1000, e->end_us / 1000,
+                 (e->end_us - e->start_us) / 1000, e->ok ? "" : " failed");
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Static storage for large buffers of the static allocation mode that the
+// CPU only reads and writes, in PSRAM when .bss may live there. Buffers
+// the SD driver DMAs into stay in internal RAM.
+#define SYS_MEM_EXT EXT_RAM_BSS_ATTR
+
+// Stages of the boot sys_mem_stage keeps
+#define SYS_MEM_STAGES 16
+
+// Free internal RAM after a stage of the boot. IRAM is the part only
+// 32-bit accesses reach. Both are 0 on the linux target.
+typedef struct {
+    const char* stage;
+    uint32_t dram;
+    uint32_t iram;
+} sys_mem_stage_t;
+
+// Note and log the free internal RAM after stage, and the change since
+// the previous stage of any task. stage must be a literal.
+void sys_mem_stage(const char* stage);
+
+// Copy up to max noted stages into stages, returns how many
+size_t sys_mem_get_stages(sys_mem_stage_t* stages, size_t max);
+
+// Size of a PCM ring, a power of two: the smallest holding want bytes if
+// the internal RAM above CONFIG_SYS_MEM_HEAP_RESERVE has a block that
+// large, else the largest that fits, never below min
+size_t sys_mem_ring_size(size_t min, size_t want);
+
+#if CONFIG_SYS_MEM_GUARD
+
+// One allocation made while the guard was armed
+typedef struct {
+    size_t size;
+    void* caller; // return address in the allocating function
+} sys_mem_guard_rec_t;
+
+typedef struct {
+    uint32_t count; // allocations while armed
+    uint64_t bytes;
+    uint32_t records;
+    sys_mem_guard_rec_t rec[CONFIG_SYS_MEM_GUARD_RECORDS];
+} sys_mem_guard_stats_t;
+
+// Count heap allocations from now on, once boot is over
+void sys_mem_guard_arm(void);
+
+void sys_mem_guard_disarm(void);
+
+void sys_mem_guard_get_stats(sys_mem_guard_stats_t* stats);
+
+#endif
@@ -0,0 +1,151 @@
+#include "sys_mem.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+static sys_mem_stage_t stages[SYS_MEM_STAGES];
+static size_t stage_count;
+// the boot task notes stages while app_main does
+static portMUX_TYPE stage_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void sys_mem_free(uint32_t* dram, uint32_t* iram, uint32_t* block) {
+#if CONFIG_IDF_TARGET_LINUX
+    *dram = 0;
+    *iram = 0;
+    *block = 0;
+#else
+    *dram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    // 32-bit capable minus byte capable leaves the IRAM heap
+    *iram = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT) -
+            *dram;
+    *block = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL |
+                                              MALLOC_CAP_8BIT);
+#endif
+}
+
+void sys_mem_stage(const char* stage) {
+    uint32_t dram, iram, block;
+    sys_mem_free(&dram, &iram, &block);
+    int32_t dram_delta = 0, iram_delta = 0;
+    portENTER_CRITICAL(&stage_lock);
+    if (stage_count > 0) {
+        dram_delta = dram - stages[stage_count - 1].dram;
+        iram_delta = iram - stages[stage_count - 1].iram;
+    }
+    if (stage_count < SYS_MEM_STAGES) {
+        stages[stage_count++] = (sys_mem_stage_t){stage, dram, iram};
+    }
+    portEXIT_CRITICAL(&stage_lock);
+    ESP_LOGI("SYS_MEM",
+             "%-12s DRAM %6" PRIu32 " (%+7" PRId32 ") IRAM %6" PRIu32
+             " (%+7" PRId32 ") free",
+             stage, dram, dram_delta, iram, iram_delta);
+}
+
+size_t sys_mem_get_stages(sys_mem_stage_t* out, size_t max) {
+    portENTER_CRITICAL(&stage_lock);
+    size_t n = stage_count < max ? stage_count : max;
+    memcpy(out, stages, n * sizeof(sys_mem_stage_t));
+    portEXIT_CRITICAL(&stage_lock);
+    return n;
+}
+
+size_t sys_mem_ring_size(size_t min, size_t want) {
+    size_t size = 1;
+    while (size < want) {
+        size <<= 1;
+    }
+#if !CONFIG_IDF_TARGET_LINUX
+    uint32_t dram, iram, block;
+    sys_mem_free(&dram, &iram, &block);
+    size_t spare = dram > CONFIG_SYS_MEM_HEAP_RESERVE
+                       ? dram - CONFIG_SYS_MEM_HEAP_RESERVE
+                       : 0;
+    if (spare > block) {
+        spare = block;
+    }
+    while (size > min && size > spare) {
+        size >>= 1;
+    }
+#endif
+    return size < min ? min : size;
+}
+
+#if CONFIG_SYS_MEM_GUARD
+
+static _Atomic bool guard_armed;
+static _Atomic uint32_t guard_count;
+static _Atomic uint64_t guard_bytes;
+static sys_mem_guard_rec_t guard_rec[CONFIG_SYS_MEM_GUARD_RECORDS];
+
+// The linker sends the sim's allocations here, see CMakeLists.txt
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __real_aligned_alloc(size_t align, size_t size);
+int __real_posix_memalign(void** ptr, size_t align, size_t size);
+
+static void sys_mem_guard_note(size_t size, void* caller) {
+    if (!atomic_load_explicit(&guard_armed, memory_order_relaxed)) {
+        return;
+    }
+    uint32_t n = atomic_fetch_add(&guard_count, 1);
+    atomic_fetch_add(&guard_bytes, size);
+    if (n < CONFIG_SYS_MEM_GUARD_RECORDS) {
+        guard_rec[n].size = size;
+        guard_rec[n].caller = caller;
+    }
+}
+
+void* __wrap_malloc(size_t size) {
+    sys_mem_guard_note(size, __builtin_return_address(0));
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    sys_mem_guard_note(n * size, __builtin_return_address(0));
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    sys_mem_guard_note(size, __builtin_return_address(0));
+    return __real_realloc(ptr, size);
+}
+
+void* __wrap_aligned_alloc(size_t align, size_t size) {
+    sys_mem_guard_note(size, __builtin_return_address(0));
+    return __real_aligned_alloc(align, size);
+}
+
+int __wrap_posix_memalign(void** ptr, size_t align, size_t size) {
+    sys_mem_guard_note(size, __builtin_return_address(0));
+    return __real_posix_memalign(ptr, align, size);
+}
+
+void sys_mem_guard_arm(void) {
+    atomic_store(&guard_count, 0);
+    atomic_store(&guard_bytes, 0);
+    atomic_store(&guard_armed, true);
+}
+
+void sys_mem_guard_disarm(void) {
+    atomic_store(&guard_armed, false);
+}
+
+void sys_mem_guard_get_stats(sys_mem_guard_stats_t* stats) {
+    memset(stats, 0, sizeof(sys_mem_guard_stats_t));
+    stats->count = atomic_load(&guard_count);
+    stats->bytes = atomic_load(&guard_bytes);
+    stats->records = stats->count < CONFIG_SYS_MEM_GUARD_RECORDS
+                         ? stats->count
+                         : CONFIG_SYS_MEM_GUARD_RECORDS;
+    memcpy(stats->rec, guard_rec, stats->records * sizeof(guard_rec[0]));
+}
+
+#endif
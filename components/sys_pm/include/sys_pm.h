@@ -0,0 +1,23 @@
+#pragma once
+#include "sys_pm_policy.h"
+#include <stdbool.h>
+
+// Fill in the policy inputs, called every CONFIG_SYS_PM_PERIOD_MS
+typedef void (*sys_pm_sample_fn_t)(sys_pm_input_t* in, void* arg);
+
+// Suspend the stream until there is sound again
+typedef void (*sys_pm_suspend_fn_t)(void* arg);
+
+// Run the power policy on its task. Each period it samples the player,
+// sets the CPU frequency ceiling through esp_pm and holds a lock against
+// light sleep unless the policy allows it, and calls suspend once the
+// stream has been silent CONFIG_SYS_PM_IDLE_MS. Without CONFIG_PM_ENABLE,
+// the linux target among them, only the suspends are acted on.
+bool sys_pm_start(sys_pm_sample_fn_t sample, sys_pm_suspend_fn_t suspend,
+                  void* arg);
+
+// Time per mode and frequency, and the current estimated for each mode
+void sys_pm_get_stats(sys_pm_stats_t* stats);
+
+// Log the stats
+void sys_pm_log(void);
@@ -0,0 +1,92 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// CPU frequency ceilings, the ESP32 PLL frequencies
+typedef enum {
+    SYS_PM_80_MHZ,
+    SYS_PM_160_MHZ,
+    SYS_PM_240_MHZ,
+    SYS_PM_LEVELS,
+} sys_pm_level_t;
+
+// What the player was doing, for the current estimates
+typedef enum {
+    SYS_PM_PLAY,   // streaming sound
+    SYS_PM_SILENT, // streaming silence, paused or between tracks
+    SYS_PM_IDLE,   // the stream is suspended or not started
+    SYS_PM_MODES,
+} sys_pm_mode_t;
+
+typedef struct {
+    uint32_t fill_ms;   // PCM in the ring
+    uint32_t target_ms; // depth the decoder fills the ring to
+    uint64_t decode_us; // time spent decoding so far
+    uint32_t silent_ms; // since the sink was last sent sound
+    bool streaming;     // the media stream is started
+} sys_pm_input_t;
+
+typedef struct {
+    sys_pm_level_t level; // CPU frequency ceiling
+    bool sleep;           // light sleep allowed while idle, the CPU runs
+                          // at 80 MHz when awake
+    bool suspend;         // suspend the stream until there is sound
+} sys_pm_decision_t;
+
+typedef struct {
+    uint8_t load_pct;   // decoder load aimed for at the chosen frequency
+    uint8_t boost_pct;  // fill below this share of the target boosts
+    uint8_t sleep_pct;  // fill above this share of the target sleeps
+    uint32_t hold_ms;   // at a frequency before stepping down
+    uint32_t idle_ms;   // of silence before the stream is suspended
+    bool light_sleep;   // the chip can light sleep, else it idles at
+                        // 80 MHz in modem sleep when allowed to
+} sys_pm_config_t;
+
+typedef struct {
+    uint64_t mode_us[SYS_PM_MODES];
+    uint64_t level_us[SYS_PM_LEVELS]; // at each frequency run at
+    uint64_t sleep_us;              // with light sleep allowed and possible
+    uint32_t avg_ua[SYS_PM_MODES];  // estimated average current per mode
+    uint32_t total_ua;              // and over the whole run
+    uint32_t load_pct;              // decoder load at 240 MHz, averaged
+    uint32_t boosts;                // to 240 MHz on a low ring
+    uint32_t changes;               // of the frequency ceiling
+    uint32_t suspends;
+} sys_pm_stats_t;
+
+// Power policy of the player, fed the ring and decoder state every few
+// tens of ms. The ceiling is the lowest frequency at which the averaged
+// decoder load stays under load_pct, 240 MHz while the decoder refills a
+// ring below boost_pct of its target. Frequencies step up at once and
+// down after hold_ms. Light sleep is allowed once the ring is above
+// sleep_pct, when the decoder only waits for the sink to read, and while
+// the stream is suspended; without light_sleep the CPU idles at 80 MHz
+// instead. The stream is suspended after idle_ms of silence. No RTOS
+// calls, so it runs on the host against traces.
+typedef struct {
+    sys_pm_config_t cfg;
+    sys_pm_decision_t out;
+    int64_t last_us;    // of the last update, 0 before the first
+    int64_t changed_us; // of the last ceiling change
+    uint64_t decode_us; // at the last update
+    uint32_t load;      // averaged load at 240 MHz, in 1/256 %
+    uint32_t awake;     // share of the last interval decoding, in 1/256
+    sys_pm_mode_t mode; // during the last interval
+    uint64_t charge[SYS_PM_MODES]; // uA us per mode
+    sys_pm_stats_t stats;
+} sys_pm_policy_t;
+
+// CPU frequency of a level, in MHz
+uint32_t sys_pm_level_mhz(sys_pm_level_t level);
+
+// Starts at 240 MHz, awake, streaming allowed
+void sys_pm_policy_init(sys_pm_policy_t* policy, const sys_pm_config_t* cfg);
+
+// Decide for the interval from now_us to the next update. Returns true
+// when the decision changed.
+bool sys_pm_policy_update(sys_pm_policy_t* policy, const sys_pm_input_t* in,
+                          int64_t now_us, sys_pm_decision_t* out);
+
+void sys_pm_policy_get_stats(const sys_pm_policy_t* policy,
+                             sys_pm_stats_t* stats);
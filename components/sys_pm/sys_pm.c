@@ -0,0 +1,166 @@
+#include "sys_pm.h"
+#include "sdkconfig.h"
+
+#if CONFIG_SYS_PM_ENABLE
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sys_task.h"
+#include <inttypes.h>
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+static sys_pm_policy_t policy;
+static portMUX_TYPE policy_lock = portMUX_INITIALIZER_UNLOCKED;
+static sys_pm_sample_fn_t sample_fn;
+static sys_pm_suspend_fn_t suspend_fn;
+static void* sample_arg;
+
+// The Bluetooth controller holds a no light sleep lock while it is
+// enabled, unless it keeps time on an external 32 kHz crystal
+#if CONFIG_SYS_PM_LIGHT_SLEEP && CONFIG_BTDM_CTRL_LPCLK_SEL_EXT_32K_XTAL
+#define SYS_PM_CAN_SLEEP true
+#else
+#define SYS_PM_CAN_SLEEP false
+#endif
+
+#if CONFIG_PM_ENABLE
+#if CONFIG_SYS_PM_LIGHT_SLEEP
+#define SYS_PM_LIGHT_SLEEP true
+#else
+#define SYS_PM_LIGHT_SLEEP false
+#endif
+
+static esp_pm_lock_handle_t freq_lock;
+static esp_pm_lock_handle_t awake_lock;
+
+static void sys_pm_apply(const sys_pm_decision_t* prev,
+                         const sys_pm_decision_t* next) {
+    if (next->level != prev->level) {
+        // the lock holds the CPU at the ceiling, move the ceiling
+        esp_pm_config_t cfg = {
+            .max_freq_mhz = sys_pm_level_mhz(next->level),
+            .min_freq_mhz = sys_pm_level_mhz(SYS_PM_80_MHZ),
+            .light_sleep_enable = SYS_PM_LIGHT_SLEEP,
+        };
+        esp_err_t err = esp_pm_configure(&cfg);
+        if (err != ESP_OK) {
+            ESP_LOGW("SYS_PM", "%s configure failed: %s", __func__,
+                     esp_err_to_name(err));
+        }
+    }
+    // light sleep needs both released, the CPU then idles at 80 MHz
+    if (next->sleep && !prev->sleep) {
+        esp_pm_lock_release(freq_lock);
+        esp_pm_lock_release(awake_lock);
+    } else if (!next->sleep && prev->sleep) {
+        esp_pm_lock_acquire(awake_lock);
+        esp_pm_lock_acquire(freq_lock);
+    }
+}
+
+static bool sys_pm_locks_init(void) {
+    esp_pm_config_t cfg = {
+        .max_freq_mhz = sys_pm_level_mhz(SYS_PM_240_MHZ),
+        .min_freq_mhz = sys_pm_level_mhz(SYS_PM_80_MHZ),
+        .light_sleep_enable = SYS_PM_LIGHT_SLEEP,
+    };
+    if (esp_pm_configure(&cfg) != ESP_OK ||
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "sys_pm",
+                           &freq_lock) != ESP_OK ||
+        esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "sys_pm_awake",
+                           &awake_lock) != ESP_OK) {
+        ESP_LOGE("SYS_PM", "%s esp_pm setup failed", __func__);
+        return false;
+    }
+    // the policy starts at 240 MHz, awake
+    esp_pm_lock_acquire(freq_lock);
+    esp_pm_lock_acquire(awake_lock);
+    return true;
+}
+#endif
+
+static void sys_pm_task_handler(void* arg) {
+    TickType_t wake = xTaskGetTickCount();
+    for (;;) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(CONFIG_SYS_PM_PERIOD_MS));
+        sys_pm_input_t in = {0};
+        sample_fn(&in, sample_arg);
+
+        sys_pm_decision_t prev, next;
+        portENTER_CRITICAL(&policy_lock);
+        prev = policy.out;
+        bool changed =
+            sys_pm_policy_update(&policy, &in, esp_timer_get_time(), &next);
+        portEXIT_CRITICAL(&policy_lock);
+        if (!changed) {
+            continue;
+        }
+        ESP_LOGD("SYS_PM", "%" PRIu32 " MHz%s%s, ring %" PRIu32 "/%" PRIu32
+                 " ms", sys_pm_level_mhz(next.level),
+                 next.sleep ? ", sleep" : "",
+                 next.suspend ? ", suspend" : "", in.fill_ms, in.target_ms);
+#if CONFIG_PM_ENABLE
+        sys_pm_apply(&prev, &next);
+#endif
+        if (next.suspend && !prev.suspend) {
+            ESP_LOGI("SYS_PM", "Silent for %" PRIu32 " ms, suspending",
+                     in.silent_ms);
+            suspend_fn(sample_arg);
+            sys_pm_log();
+        }
+    }
+}
+
+bool sys_pm_start(sys_pm_sample_fn_t sample, sys_pm_suspend_fn_t suspend,
+                  void* arg) {
+    const sys_pm_config_t cfg = {
+        .load_pct = CONFIG_SYS_PM_LOAD_PCT,
+        .boost_pct = CONFIG_SYS_PM_BOOST_PCT,
+        .sleep_pct = CONFIG_SYS_PM_SLEEP_PCT,
+        .hold_ms = CONFIG_SYS_PM_HOLD_MS,
+        .idle_ms = CONFIG_SYS_PM_IDLE_MS,
+        .light_sleep = SYS_PM_CAN_SLEEP,
+    };
+    sys_pm_policy_init(&policy, &cfg);
+    sample_fn = sample;
+    suspend_fn = suspend;
+    sample_arg = arg;
+#if CONFIG_PM_ENABLE
+    if (!sys_pm_locks_init()) {
+        return false;
+    }
+#else
+    ESP_LOGW("SYS_PM", "No power management, only suspending silence");
+#endif
+    if (sys_task_create(SYS_TASK_PM, sys_pm_task_handler, NULL) == NULL) {
+        ESP_LOGE("SYS_PM", "%s task creation failed", __func__);
+        return false;
+    }
+    return true;
+}
+
+void sys_pm_get_stats(sys_pm_stats_t* stats) {
+    portENTER_CRITICAL(&policy_lock);
+    sys_pm_policy_get_stats(&policy, stats);
+    portEXIT_CRITICAL(&policy_lock);
+}
+
+void sys_pm_log(void) {
+    static const char* const modes[SYS_PM_MODES] = {"play", "silent",
+                                                    "idle"};
+    sys_pm_stats_t s;
+    sys_pm_get_stats(&s);
+    for (int m = 0; m < SYS_PM_MODES; m++) {
+        ESP_LOGI("SYS_PM", "%-6s %8" PRIu64 " ms, %2" PRIu32 ".%" PRIu32
+                 " mA", modes[m], s.mode_us[m] / 1000, s.avg_ua[m] / 1000,
+                 s.avg_ua[m] % 1000 / 100);
+    }
+    ESP_LOGI("SYS_PM", "average %" PRIu32 ".%" PRIu32 " mA, decoder load %"
+             PRIu32 "%% at 240 MHz, %" PRIu32 " boosts, %" PRIu32
+             " suspends", s.total_ua / 1000, s.total_ua % 1000 / 100,
+             s.load_pct, s.boosts, s.suspends);
+}
+#endif
@@ -0,0 +1,128 @@
+#include "sys_pm_policy.h"
+#include <string.h>
+
+// Supply current of the ESP32 in modem sleep at each frequency, dual
+// core, and in light sleep, from the datasheet, in uA. The radio is not
+// counted, a suspended stream saves more than the estimate shows.
+static const uint32_t sys_pm_level_ua[SYS_PM_LEVELS] = {31000, 44000, 68000};
+#define SYS_PM_SLEEP_UA 800
+
+static const uint32_t sys_pm_mhz[SYS_PM_LEVELS] = {80, 160, 240};
+
+uint32_t sys_pm_level_mhz(sys_pm_level_t level) {
+    return sys_pm_mhz[level];
+}
+
+void sys_pm_policy_init(sys_pm_policy_t* policy, const sys_pm_config_t* cfg) {
+    memset(policy, 0, sizeof(sys_pm_policy_t));
+    policy->cfg = *cfg;
+    policy->out.level = SYS_PM_240_MHZ;
+    policy->mode = SYS_PM_IDLE;
+}
+
+// Level the CPU ran at: the ceiling, 80 MHz while it may sleep
+static sys_pm_level_t sys_pm_run_level(const sys_pm_decision_t* out) {
+    return out->sleep ? SYS_PM_80_MHZ : out->level;
+}
+
+// Charge the interval to the mode and level it ran in
+static void sys_pm_account(sys_pm_policy_t* policy, uint64_t dt) {
+    const sys_pm_decision_t* out = &policy->out;
+    sys_pm_level_t run = sys_pm_run_level(out);
+    uint64_t ua = sys_pm_level_ua[run];
+    if (out->sleep && policy->cfg.light_sleep) {
+        // asleep whenever the decoder is not running
+        ua = (ua * policy->awake + SYS_PM_SLEEP_UA * (256 - policy->awake)) /
+             256;
+        policy->stats.sleep_us += dt;
+    }
+    policy->stats.mode_us[policy->mode] += dt;
+    policy->stats.level_us[run] += dt;
+    policy->charge[policy->mode] += ua * dt;
+}
+
+bool sys_pm_policy_update(sys_pm_policy_t* policy, const sys_pm_input_t* in,
+                          int64_t now_us, sys_pm_decision_t* out) {
+    const sys_pm_config_t* cfg = &policy->cfg;
+    sys_pm_decision_t prev = policy->out;
+    sys_pm_decision_t next = prev;
+
+    if (policy->last_us != 0 && now_us > policy->last_us) {
+        uint64_t dt = now_us - policy->last_us;
+        uint64_t busy = in->decode_us > policy->decode_us
+                            ? in->decode_us - policy->decode_us
+                            : 0;
+        if (busy > dt) {
+            busy = dt;
+        }
+        sys_pm_account(policy, dt);
+
+        // the decoder is CPU bound, its load scales with the frequency
+        policy->awake = busy * 256 / dt;
+        uint32_t load = busy * 100 * 256 * sys_pm_mhz[sys_pm_run_level(&prev)] /
+                        sys_pm_mhz[SYS_PM_240_MHZ] / dt;
+        policy->load += ((int32_t)load - (int32_t)policy->load) / 4;
+    }
+    policy->last_us = now_us;
+    policy->decode_us = in->decode_us;
+
+    // the lowest frequency that leaves the decoder its headroom
+    sys_pm_level_t level = SYS_PM_80_MHZ;
+    while (level < SYS_PM_240_MHZ &&
+           (uint64_t)policy->load * sys_pm_mhz[SYS_PM_240_MHZ] >
+               (uint64_t)cfg->load_pct * 256 * sys_pm_mhz[level]) {
+        level++;
+    }
+    // a refill is boosted, an empty ring with nothing to decode is not
+    bool low = in->streaming && in->target_ms != 0 &&
+               in->fill_ms * 100 < in->target_ms * cfg->boost_pct &&
+               policy->awake != 0;
+    if (low) {
+        if (prev.level != SYS_PM_240_MHZ) {
+            policy->stats.boosts++;
+        }
+        level = SYS_PM_240_MHZ;
+    } else if (level < prev.level &&
+               now_us - policy->changed_us < (int64_t)cfg->hold_ms * 1000) {
+        level = prev.level;
+    }
+    next.level = level;
+
+    next.suspend = in->streaming && cfg->idle_ms != 0 &&
+                   in->silent_ms >= cfg->idle_ms;
+    if (next.suspend && !prev.suspend) {
+        policy->stats.suspends++;
+    }
+    next.sleep = !in->streaming || next.suspend ||
+                 (!low && in->fill_ms * 100 >= in->target_ms * cfg->sleep_pct);
+
+    if (next.level != prev.level) {
+        policy->changed_us = now_us;
+        policy->stats.changes++;
+    }
+    if (!in->streaming) {
+        policy->mode = SYS_PM_IDLE;
+    } else if (in->silent_ms > 0) {
+        policy->mode = SYS_PM_SILENT;
+    } else {
+        policy->mode = SYS_PM_PLAY;
+    }
+    policy->out = next;
+    *out = next;
+    return next.level != prev.level || next.sleep != prev.sleep ||
+           next.suspend != prev.suspend;
+}
+
+void sys_pm_policy_get_stats(const sys_pm_policy_t* policy,
+                             sys_pm_stats_t* stats) {
+    *stats = policy->stats;
+    uint64_t us = 0, charge = 0;
+    for (int m = 0; m < SYS_PM_MODES; m++) {
+        uint64_t mode_us = policy->stats.mode_us[m];
+        stats->avg_ua[m] = mode_us ? policy->charge[m] / mode_us : 0;
+        us += mode_us;
+        charge += policy->charge[m];
+    }
+    stats->total_ua = us ? charge / us : 0;
+    stats->load_pct = policy->load / 256;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// The long-lived tasks of the player. Each has its CPU, priority and stack
+// size in Kconfig and its stack and TCB in static storage, so one instance
+// of each can run at a time. The Bluetooth tasks run on PRO_CPU next to the
+// controller, decoding and storage on APP_CPU.
+typedef enum {
+    SYS_TASK_BT_CORE,
+    SYS_TASK_BT_DLOG,
+    SYS_TASK_AUDIO_DEC,
+    SYS_TASK_STREAM_READER,
+    SYS_TASK_LOAD_LOG,
+    SYS_TASK_BOOT,
+    SYS_TASK_PM,
+    SYS_TASK_MAX,
+} sys_task_id_t;
+
+// Tasks reported by sys_task_get_load, the rest are left out
+#define SYS_TASK_LOAD_TASKS 24
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    int8_t cpu;          // -1 when not pinned
+    uint8_t prio;
+    uint16_t load;       // share of one CPU over the period, per mille
+    uint32_t stack_free; // least free stack so far, in bytes
+} sys_task_load_entry_t;
+
+typedef struct {
+    uint32_t period_us;
+    uint8_t cpus;
+    uint16_t cpu_load[2]; // busy share of each CPU, per mille
+    uint32_t count;
+    sys_task_load_entry_t tasks[SYS_TASK_LOAD_TASKS];
+} sys_task_load_t;
+
+// Create task id running fn(arg). Returns nullptr if it is already running.
+TaskHandle_t sys_task_create(sys_task_id_t id, TaskFunction_t fn,
+                             void* arg);
+
+// Last call of a task that ends: parks it for sys_task_delete
+void sys_task_exit(void) __attribute__((noreturn));
+
+// Wait for task id to park itself, then delete it so it can be created
+// again
+void sys_task_delete(sys_task_id_t id);
+
+// Load of each CPU and task since the previous call, or since boot.
+// False without CONFIG_SYS_TASK_LOAD_STATS.
+bool sys_task_get_load(sys_task_load_t* load);
+
+// Log sys_task_get_load, busiest tasks first
+void sys_task_log_load(void);
+
+// Log the topology and start the load log when
+// CONFIG_SYS_TASK_LOAD_LOG_MS is set
+void sys_task_init(void);
@@ -0,0 +1,263 @@
+#include "sys_task.h"
+#include "esp_log.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include <inttypes.h>
+#include <string.h>
+
+// Tasks uxTaskGetSystemState can report, it fails with more
+#define SYS_TASK_STATUS_MAX 40
+// The load log task, low priority next to the Bluetooth tasks
+#define SYS_TASK_LOAD_LOG_PRIO 1
+#define SYS_TASK_LOAD_LOG_STACK 3072
+// The boot stages beside the Bluetooth bring-up, on the audio CPU below
+// the decoder it starts. The SD mount goes deep into the driver.
+#define SYS_TASK_BOOT_PRIO 4
+#define SYS_TASK_BOOT_STACK 4096
+// The power policy, on the Bluetooth CPU above the log tasks so a busy
+// decoder cannot hold up the boost it needs
+#define SYS_TASK_PM_PRIO 3
+#define SYS_TASK_PM_STACK 2560
+
+typedef struct {
+    const char* name;
+    StackType_t* stack; // nullptr when the task is configured out
+    uint32_t stack_size;
+    UBaseType_t prio;
+    BaseType_t cpu;
+} sys_task_def_t;
+
+static StackType_t bt_core_stack[CONFIG_SYS_TASK_BT_CORE_STACK];
+#if CONFIG_BT_CORE_DLOG
+static StackType_t bt_dlog_stack[CONFIG_SYS_TASK_BT_DLOG_STACK];
+#endif
+static StackType_t audio_dec_stack[CONFIG_SYS_TASK_AUDIO_DEC_STACK];
+static StackType_t stream_reader_stack[CONFIG_SYS_TASK_STREAM_READER_STACK];
+#if CONFIG_SYS_TASK_LOAD_LOG_MS > 0
+static StackType_t load_log_stack[SYS_TASK_LOAD_LOG_STACK];
+#endif
+static StackType_t boot_stack[SYS_TASK_BOOT_STACK];
+#if CONFIG_SYS_PM_ENABLE
+static StackType_t pm_stack[SYS_TASK_PM_STACK];
+#endif
+
+static const sys_task_def_t sys_task_defs[SYS_TASK_MAX] = {
+    [SYS_TASK_BT_CORE] = {"BtCoreTask", bt_core_stack,
+                          CONFIG_SYS_TASK_BT_CORE_STACK,
+                          CONFIG_SYS_TASK_BT_CORE_PRIO,
+                          CONFIG_SYS_TASK_BT_CORE_CPU},
+#if CONFIG_BT_CORE_DLOG
+    [SYS_TASK_BT_DLOG] = {"BtDlogTask", bt_dlog_stack,
+                          CONFIG_SYS_TASK_BT_DLOG_STACK,
+                          CONFIG_SYS_TASK_BT_DLOG_PRIO,
+                          CONFIG_SYS_TASK_BT_CORE_CPU},
+#endif
+    [SYS_TASK_AUDIO_DEC] = {"AudioDecTask", audio_dec_stack,
+                            CONFIG_SYS_TASK_AUDIO_DEC_STACK,
+                            CONFIG_SYS_TASK_AUDIO_DEC_PRIO,
+                            CONFIG_SYS_TASK_AUDIO_CPU},
+    [SYS_TASK_STREAM_READER] = {"StreamRdTask", stream_reader_stack,
+                                CONFIG_SYS_TASK_STREAM_READER_STACK,
+                                CONFIG_SYS_TASK_STREAM_READER_PRIO,
+                                CONFIG_SYS_TASK_AUDIO_CPU},
+#if CONFIG_SYS_TASK_LOAD_LOG_MS > 0
+    [SYS_TASK_LOAD_LOG] = {"LoadLogTask", load_log_stack,
+                           SYS_TASK_LOAD_LOG_STACK, SYS_TASK_LOAD_LOG_PRIO,
+                           CONFIG_SYS_TASK_BT_CORE_CPU},
+#endif
+    [SYS_TASK_BOOT] = {"BootTask", boot_stack, SYS_TASK_BOOT_STACK,
+                       SYS_TASK_BOOT_PRIO, CONFIG_SYS_TASK_AUDIO_CPU},
+#if CONFIG_SYS_PM_ENABLE
+    [SYS_TASK_PM] = {"PmTask", pm_stack, SYS_TASK_PM_STACK, SYS_TASK_PM_PRIO,
+                     CONFIG_SYS_TASK_BT_CORE_CPU},
+#endif
+};
+
+static StaticTask_t sys_task_tcbs[SYS_TASK_MAX];
+static TaskHandle_t sys_task_handles[SYS_TASK_MAX];
+
+// Single core targets, the linux one among them, run every task unpinned
+static BaseType_t sys_task_cpu(BaseType_t cpu) {
+    return cpu < portNUM_PROCESSORS ? cpu : tskNO_AFFINITY;
+}
+
+TaskHandle_t sys_task_create(sys_task_id_t id, TaskFunction_t fn,
+                             void* arg) {
+    const sys_task_def_t* def = &sys_task_defs[id];
+    if (def->stack == nullptr) {
+        ESP_LOGE("SYS_TASK", "Task %d is configured out", id);
+        return nullptr;
+    }
+    if (sys_task_handles[id] != NULL) {
+        ESP_LOGE("SYS_TASK", "%s is already running", def->name);
+        return nullptr;
+    }
+    sys_task_handles[id] = xTaskCreateStaticPinnedToCore(
+        fn, def->name, def->stack_size, arg, def->prio, def->stack,
+        &sys_task_tcbs[id], sys_task_cpu(def->cpu));
+    return sys_task_handles[id];
+}
+
+void sys_task_exit(void) {
+    for (;;) {
+        vTaskSuspend(NULL);
+    }
+}
+
+void sys_task_delete(sys_task_id_t id) {
+    TaskHandle_t task = sys_task_handles[id];
+    if (task == NULL) {
+        return;
+    }
+    // a task deleted while running on the other CPU is only freed later
+    // by the idle task, its TCB cannot be reused until then
+    while (eTaskGetState(task) != eSuspended) {
+        vTaskDelay(1);
+    }
+    vTaskDelete(task);
+    sys_task_handles[id] = NULL;
+}
+
+#if CONFIG_SYS_TASK_LOAD_STATS
+
+// Run time of each task at the previous sample
+static struct {
+    TaskHandle_t task;
+    uint32_t run_time;
+} load_prev[SYS_TASK_STATUS_MAX];
+static uint32_t load_prev_count;
+static uint32_t load_prev_total;
+
+static uint32_t sys_task_prev_run_time(TaskHandle_t task) {
+    for (uint32_t i = 0; i < load_prev_count; i++) {
+        if (load_prev[i].task == task) {
+            return load_prev[i].run_time;
+        }
+    }
+    return 0;
+}
+
+bool sys_task_get_load(sys_task_load_t* load) {
+    static TaskStatus_t status[SYS_TASK_STATUS_MAX];
+    uint32_t delta[SYS_TASK_STATUS_MAX];
+    memset(load, 0, sizeof(sys_task_load_t));
+    uint32_t total;
+    UBaseType_t n = uxTaskGetSystemState(status, SYS_TASK_STATUS_MAX, &total);
+    if (n == 0) {
+        ESP_LOGW("SYS_TASK", "More than %d tasks", SYS_TASK_STATUS_MAX);
+        return false;
+    }
+
+    uint32_t period = total - load_prev_total;
+    load->period_us = period;
+    load->cpus = portNUM_PROCESSORS < 2 ? portNUM_PROCESSORS : 2;
+    for (UBaseType_t i = 0; i < n; i++) {
+        delta[i] = status[i].ulRunTimeCounter -
+                   sys_task_prev_run_time(status[i].xHandle);
+    }
+    for (uint32_t cpu = 0; cpu < load->cpus; cpu++) {
+        TaskHandle_t idle = xTaskGetIdleTaskHandleForCore(cpu);
+        for (UBaseType_t i = 0; i < n && period != 0; i++) {
+            if (status[i].xHandle == idle) {
+                uint32_t idle_pm = (uint64_t)delta[i] * 1000 / period;
+                load->cpu_load[cpu] = idle_pm < 1000 ? 1000 - idle_pm : 0;
+            }
+        }
+    }
+
+    // busiest first, by selection, n is small
+    for (UBaseType_t i = 0; i < n && load->count < SYS_TASK_LOAD_TASKS;
+         i++) {
+        UBaseType_t max = i;
+        for (UBaseType_t j = i + 1; j < n; j++) {
+            if (delta[j] > delta[max]) {
+                max = j;
+            }
+        }
+        TaskStatus_t t = status[max];
+        uint32_t d = delta[max];
+        status[max] = status[i];
+        delta[max] = delta[i];
+        status[i] = t;
+        delta[i] = d;
+
+        sys_task_load_entry_t* e = &load->tasks[load->count++];
+        strncpy(e->name, t.pcTaskName, sizeof(e->name) - 1);
+        BaseType_t cpu = xTaskGetCoreID(t.xHandle);
+        e->cpu = cpu == tskNO_AFFINITY ? -1 : cpu;
+        e->prio = t.uxCurrentPriority;
+        e->load = period != 0 ? (uint64_t)d * 1000 / period : 0;
+        e->stack_free = t.usStackHighWaterMark;
+    }
+
+    for (UBaseType_t i = 0; i < n; i++) {
+        load_prev[i].task = status[i].xHandle;
+        load_prev[i].run_time = status[i].ulRunTimeCounter;
+    }
+    load_prev_count = n;
+    load_prev_total = total;
+    return true;
+}
+
+#else
+
+bool sys_task_get_load(sys_task_load_t* load) {
+    memset(load, 0, sizeof(sys_task_load_t));
+    return false;
+}
+
+#endif
+
+void sys_task_log_load(void) {
+    static sys_task_load_t load;
+    if (!sys_task_get_load(&load)) {
+        ESP_LOGW("SYS_TASK", "No load, enable SYS_TASK_LOAD_STATS");
+        return;
+    }
+    ESP_LOGI("SYS_TASK", "Load over %" PRIu32 " ms: CPU0 %u.%u%%, CPU1 %u.%u%%",
+             load.period_us / 1000, load.cpu_load[0] / 10,
+             load.cpu_load[0] % 10, load.cpu_load[1] / 10,
+             load.cpu_load[1] % 10);
+    for (uint32_t i = 0; i < load.count; i++) {
+        const sys_task_load_entry_t* e = &load.tasks[i];
+        ESP_LOGI("SYS_TASK",
+                 "  %-16s cpu %2d prio %2u %3u.%u%% stack free %" PRIu32,
+                 e->name, e->cpu, e->prio, e->load / 10, e->load % 10,
+                 e->stack_free);
+    }
+}
+
+#if CONFIG_SYS_TASK_LOAD_LOG_MS > 0
+static void sys_task_load_log_handler(void* arg) {
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_SYS_TASK_LOAD_LOG_MS));
+        sys_task_log_load();
+    }
+}
+#endif
+
+void sys_task_init(void) {
+    for (int id = 0; id < SYS_TASK_MAX; id++) {
+        const sys_task_def_t* def = &sys_task_defs[id];
+        if (def->stack != nullptr) {
+            ESP_LOGI("SYS_TASK", "%s: cpu %d, prio %u, %" PRIu32 " byte stack",
+                     def->name, (int)sys_task_cpu(def->cpu),
+                     (unsigned)def->prio, def->stack_size);
+        }
+    }
+#ifdef CONFIG_BT_BLUEDROID_PINNED_TO_CORE
+    if (CONFIG_BT_BLUEDROID_PINNED_TO_CORE != CONFIG_SYS_TASK_BT_CORE_CPU) {
+        ESP_LOGW("SYS_TASK", "Bluedroid runs on CPU%d, the core task on "
+                 "CPU%d", CONFIG_BT_BLUEDROID_PINNED_TO_CORE,
+                 CONFIG_SYS_TASK_BT_CORE_CPU);
+    }
+#endif
+#if CONFIG_SYS_TASK_LOAD_STATS
+    // the first period starts now
+    static sys_task_load_t load;
+    sys_task_get_load(&load);
+#endif
+#if CONFIG_SYS_TASK_LOAD_LOG_MS > 0
+    sys_task_create(SYS_TASK_LOAD_LOG, sys_task_load_log_handler, NULL);
+#endif
+}
@@ -1,16 +1,165 @@
 #include <stdio.h>
+#include "audio_dec.h"
 #include "bt_core.h"
 #include "bt_a2dp.h"
+#include "driver/sdmmc_host.h"
+#include "esp_vfs_fat.h"
+#include "media_lib.h"
+#include "pcm_ring.h"
+#include "sys_boot.h"
+#include "sys_mem.h"
+#include "sys_pm.h"
+#include "sys_task.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+// An MP3 frame of 16-bit stereo, what the decoder writes at once
+#define APP_PREBUFFER_BYTES (1152 * 4)
+#define APP_PREBUFFER_TIMEOUT_MS 2000
+#define APP_RING_TIMEOUT_MS 10000
+
+static pcm_ring_t* pcm_ring;
+static media_lib_t* lib;
+static audio_dec_t* dec;
+
+static bool app_sd_mount(void* arg) {
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    sdmmc_slot_config_t slot = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot.width = CONFIG_APP_SD_BUS_WIDTH;
+    esp_vfs_fat_sdmmc_mount_config_t mount = {
+        .format_if_mount_failed = false,
+        .max_files = CONFIG_APP_SD_MAX_FILES,
+        .allocation_unit_size = 0,
+    };
+    sdmmc_card_t* card;
+    esp_err_t err = esp_vfs_fat_sdmmc_mount(CONFIG_APP_SD_MOUNT, &host, &slot,
+                                            &mount, &card);
+    if (err != ESP_OK) {
+        ESP_LOGE("APP_MAIN", "SD card mount failed: %s\n",
+                 esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+static bool app_lib_open(void* arg) {
+    lib = media_lib_open(CONFIG_APP_SD_MOUNT "/" MEDIA_LIB_INDEX_FILE);
+    if (lib == nullptr) {
+        ESP_LOGW("APP_MAIN", "No library index, run media_lib_build\n");
+        return false;
+    }
+    return true;
+}
+
+// Opens the track and decodes ahead while Bluetooth comes up
+static bool app_dec_start(void* arg) {
+    if (!sys_boot_wait("pcm ring", APP_RING_TIMEOUT_MS) || pcm_ring == NULL) {
+        return false;
+    }
+    dec = audio_dec_start(CONFIG_AUDIO_DEC_TRACK_PATH, pcm_ring);
+    if (dec == nullptr) {
+        ESP_LOGW("APP_MAIN", "No track to play, streaming silence\n");
+        return false;
+    }
+    return true;
+}
+
+// The first frame is in the ring before the sink asks for it
+static bool app_prebuffer(void* arg) {
+    if (dec == nullptr) {
+        return false;
+    }
+    TickType_t start = xTaskGetTickCount();
+    while (pcm_ring_fill(pcm_ring) < APP_PREBUFFER_BYTES) {
+        if (xTaskGetTickCount() - start >=
+            pdMS_TO_TICKS(APP_PREBUFFER_TIMEOUT_MS)) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+// Storage and audio, on the boot task next to Bluetooth
+static const sys_boot_stage_t boot_stages[] = {
+    {"sd mount", app_sd_mount, NULL},
+    {"library", app_lib_open, NULL},
+    {"decoder", app_dec_start, NULL},
+    {"prebuffer", app_prebuffer, NULL},
+};
+
+#if CONFIG_SYS_PM_ENABLE
+static void app_pm_sample(sys_pm_input_t* in, void* arg) {
+    pcm_jitter_stats_t jitter;
+    bt_a2dp_get_jitter_stats(&jitter);
+    in->fill_ms = (uint64_t)pcm_ring_fill(pcm_ring) * 1000 / (44100 * 4);
+    in->target_ms = jitter.target_ms;
+    if (dec != nullptr) {
+        audio_dec_stats_t stats;
+        audio_dec_get_stats(dec, &stats);
+        in->decode_us = stats.decode_us;
+    }
+    in->silent_ms = bt_a2dp_get_silent_ms();
+    in->streaming = bt_a2dp_streaming();
+}
+
+static void app_pm_suspend(void* arg) {
+    bt_a2dp_idle();
+}
+#endif
+
+// The ring, before Bluetooth when it is static, after Bluedroid took its
+// RAM otherwise
+static bool app_ring_create(void) {
+#if CONFIG_SYS_MEM_STATIC
+    _Static_assert((CONFIG_PCM_RING_SIZE & (CONFIG_PCM_RING_SIZE - 1)) == 0,
+                   "PCM_RING_SIZE must be a power of two in static mode");
+    static uint8_t pcm_ring_buf[CONFIG_PCM_RING_SIZE] SYS_MEM_EXT;
+    static pcm_ring_t pcm_ring_storage;
+    pcm_ring_init(&pcm_ring_storage, pcm_ring_buf, sizeof(pcm_ring_buf));
+    pcm_ring = &pcm_ring_storage;
+#else
+    // the RAM trimming Bluetooth left deepens the ring, up to the most
+    // the jitter buffer fills at 44.1 kHz 16-bit stereo
+    size_t ring_size = sys_mem_ring_size(
+        CONFIG_PCM_RING_SIZE, CONFIG_BT_A2DP_JITTER_MAX_MS * 44100 * 4 / 1000);
+    pcm_ring = pcm_ring_create(ring_size);
+    if (pcm_ring == nullptr) {
+        ESP_LOGE("APP_MAIN", "PCM ring allocation failed\n");
+        return false;
+    }
+#endif
+    bt_a2dp_set_pcm_ring(pcm_ring);
+    sys_boot_mark("pcm ring");
+    return true;
+}
 
 void app_main(void) {
+    sys_task_init();
+    sys_boot_init();
+    sys_boot_start(boot_stages, sizeof(boot_stages) / sizeof(boot_stages[0]));
+#if CONFIG_SYS_MEM_STATIC
+    app_ring_create();
+#endif
     bt_ctx_t* bt_ctx = bt_init();
     if (bt_ctx == nullptr || bt_ctx->state == BT_STATE_UNINITIALIZED) {
         ESP_LOGE("APP_MAIN", "Bluetooth initialization failed\n");
         return;
     }
     ESP_LOGI("APP_MAIN", "Bluetooth initialized successfully\n");
+    bt_a2dp_register(bt_ctx);
     bt_core_start(bt_ctx);
-    bt_core_dispatch(bt_ctx, &bt_a2dp_stack_event, 0, nullptr, 0);
+    sys_boot_mark("a2dp");
+#if !CONFIG_SYS_MEM_STATIC
+    if (!app_ring_create()) {
+        return;
+    }
+#endif
+    bt_core_dispatch_ex(bt_ctx, BT_SIG_STACK, BT_CORE_EVT_STACK_UP, nullptr,
+                        0, BT_MSG_F_CRITICAL);
+#if CONFIG_SYS_PM_ENABLE
+    sys_pm_start(app_pm_sample, app_pm_suspend, NULL);
+#endif
 }
@@ -0,0 +1,1776 @@
+#include "sim_bench.h"
+#include "audio_codec.h"
+#include "audio_dec.h"
+#include "esp_a2dp_api.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "media_lib.h"
+#include "mp3_seek.h"
+#include "pcm_eq.h"
+#include "pcm_gain.h"
+#include "pcm_jitter.h"
+#include "pcm_resample.h"
+#include "pcm_ring.h"
+#include "sdkconfig.h"
+#include "stream_reader.h"
+#include "sys_mem.h"
+#include "sys_pm_policy.h"
+#include <dirent.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bytes the consumer takes per view, about a decoder refill
+#define SIM_BENCH_CHUNK 2048
+
+void sim_stream_bench(const char* path) {
+    stream_reader_t* stream = stream_reader_open(path);
+    if (stream == nullptr) {
+        ESP_LOGE("SIM_BENCH", "Cannot open %s\n", path);
+        exit(1);
+    }
+
+    int64_t start = esp_timer_get_time();
+    uint64_t total = 0;
+    uint32_t sum = 0; // touch the data like a decoder would
+    for (;;) {
+        const uint8_t* ptr;
+        size_t n = stream_reader_peek(stream, &ptr, portMAX_DELAY);
+        if (n == 0) {
+            break;
+        }
+        if (n > SIM_BENCH_CHUNK) {
+            n = SIM_BENCH_CHUNK;
+        }
+        for (size_t i = 0; i < n; i += 64) {
+            sum += ptr[i];
+        }
+        stream_reader_consume(stream, n);
+        total += n;
+    }
+    int64_t us = esp_timer_get_time() - start;
+
+    stream_reader_stats_t st;
+    stream_reader_get_stats(stream, &st);
+    stream_reader_close(stream);
+
+    printf("block:           %d bytes x %d\n", CONFIG_STREAM_READER_BLOCK_SIZE,
+           CONFIG_STREAM_READER_BLOCKS);
+    printf("read:            %" PRIu64 " bytes in %" PRId64 " us\n", total,
+           us);
+    printf("sustained:       %.2f MB/s\n",
+           us > 0 ? (double)total / us : 0.0);
+    printf("block reads:     %" PRIu32 ", avg %" PRIu32 " us, max %" PRIu32
+           " us\n",
+           st.reads, st.reads ? (uint32_t)(st.read_us / st.reads) : 0,
+           st.read_us_max);
+    printf("stalls:          %" PRIu32 ", total %" PRIu64 " us, worst %" PRIu32
+           " us\n",
+           st.stalls, st.stall_us, st.stall_us_max);
+    printf("checksum:        %" PRIu32 "\n", sum);
+    fflush(stdout);
+    exit(0);
+}
+
+void sim_lib_build(const char* root) {
+    char dir[MEDIA_LIB_PATH_MAX], index[MEDIA_LIB_PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/" MEDIA_LIB_INDEX_DIR, root);
+    snprintf(index, sizeof(index), "%s/" MEDIA_LIB_INDEX_FILE, root);
+    mkdir(dir, 0755);
+
+    media_lib_build_stats_t st;
+    bool ok = media_lib_build(root, index, &st);
+    printf("%s: %" PRIu32 " tracks, %" PRIu32 " read, %" PRIu32
+           " unchanged, %" PRIu32 " removed\n",
+           index, st.tracks, st.parsed, st.reused, st.removed);
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// Directory of the synthetic library, below the working directory
+#define SIM_LIB_ROOT "lib_bench"
+// Tracks per album and albums per artist of the synthetic library
+#define SIM_LIB_TRACKS 10
+#define SIM_LIB_ALBUMS 5
+
+static void sim_lib_put_frame(FILE* f, const char* id, const char* text) {
+    uint32_t size = strlen(text) + 1; // encoding byte
+    uint8_t hdr[10] = {id[0], id[1], id[2], id[3], size >> 24, size >> 16,
+                       size >> 8, size, 0, 0};
+    fwrite(hdr, 1, sizeof(hdr), f);
+    fputc(0, f); // ISO-8859-1
+    fwrite(text, 1, size - 1, f);
+}
+
+// An ID3v2.3 tagged file with a padded tag and a stand-in for the audio
+static void sim_lib_put_track(uint32_t i, uint32_t rev) {
+    uint32_t artist = i / (SIM_LIB_TRACKS * SIM_LIB_ALBUMS);
+    uint32_t album = i / SIM_LIB_TRACKS % SIM_LIB_ALBUMS;
+    uint32_t track = i % SIM_LIB_TRACKS;
+    char path[MEDIA_LIB_PATH_MAX], text[64];
+
+    snprintf(path, sizeof(path), SIM_LIB_ROOT "/Artist %04" PRIu32, artist);
+    mkdir(path, 0755);
+    snprintf(path + strlen(path), sizeof(path) - strlen(path),
+             "/Album %" PRIu32, album);
+    mkdir(path, 0755);
+    snprintf(path + strlen(path), sizeof(path) - strlen(path),
+             "/%02" PRIu32 " Track.mp3", track + 1);
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        ESP_LOGE("SIM_BENCH", "Cannot create %s\n", path);
+        exit(1);
+    }
+
+    // tag size is synchsafe, 1 KB of frames and padding
+    static const uint8_t id3[10] = {'I', 'D', '3', 3, 0, 0, 0, 0, 8, 0};
+    fwrite(id3, 1, sizeof(id3), f);
+    long start = ftell(f);
+    snprintf(text, sizeof(text), "Artist %04" PRIu32, artist);
+    sim_lib_put_frame(f, "TPE1", text);
+    snprintf(text, sizeof(text), "Album %" PRIu32 " of %04" PRIu32, album,
+             artist);
+    sim_lib_put_frame(f, "TALB", text);
+    snprintf(text, sizeof(text), "Song %" PRIu32 " rev %" PRIu32, i, rev);
+    sim_lib_put_frame(f, "TIT2", text);
+    snprintf(text, sizeof(text), "%" PRIu32 "/%d", track + 1, SIM_LIB_TRACKS);
+    sim_lib_put_frame(f, "TRCK", text);
+    static const uint8_t zero[1024];
+    fwrite(zero, 1, 1024 - (ftell(f) - start), f);
+    fwrite(zero, 1, 512 + rev, f);
+    fclose(f);
+}
+
+void sim_lib_bench(uint32_t files) {
+    const char* index = SIM_LIB_ROOT "/" MEDIA_LIB_INDEX_FILE;
+    mkdir(SIM_LIB_ROOT, 0755);
+    mkdir(SIM_LIB_ROOT "/" MEDIA_LIB_INDEX_DIR, 0755);
+    unlink(index);
+    for (uint32_t i = 0; i < files; i++) {
+        sim_lib_put_track(i, 0);
+    }
+
+    media_lib_build_stats_t st;
+    if (!media_lib_build(SIM_LIB_ROOT, index, &st)) {
+        exit(1);
+    }
+    printf("full build:      %" PRIu32 " tracks in %" PRIu64 " us\n",
+           st.tracks, st.build_us);
+    struct stat ist;
+    stat(index, &ist);
+    printf("index size:      %ld bytes\n", (long)ist.st_size);
+
+    int64_t t = esp_timer_get_time();
+    media_lib_t* lib = media_lib_open(index);
+    media_lib_track_t track;
+    if (lib == nullptr || !media_lib_get(lib, 0, &track)) {
+        exit(1);
+    }
+    printf("cold open:       %" PRId64 " us to the first track\n",
+           esp_timer_get_time() - t);
+
+    // walk the artist and album lists the way a browser would
+    t = esp_timer_get_time();
+    uint32_t artists = 0, albums = 0;
+    for (uint32_t i = 0; i < media_lib_count(lib);
+         i = media_lib_group_end(lib, i, MEDIA_LIB_ARTIST)) {
+        artists++;
+    }
+    for (uint32_t i = 0; i < media_lib_count(lib);
+         i = media_lib_group_end(lib, i, MEDIA_LIB_ALBUM)) {
+        albums++;
+    }
+    printf("browse:          %" PRIu32 " artists, %" PRIu32
+           " albums in %" PRId64 " us\n",
+           artists, albums, esp_timer_get_time() - t);
+
+    t = esp_timer_get_time();
+    for (uint32_t i = 0; i < media_lib_count(lib); i++) {
+        media_lib_get(lib, i, &track);
+    }
+    printf("read all:        %" PRId64 " us\n", esp_timer_get_time() - t);
+    media_lib_close(lib);
+
+    media_lib_build(SIM_LIB_ROOT, index, &st);
+    printf("rescan:          %" PRIu32 " read, %" PRIu32
+           " unchanged in %" PRIu64 " us\n",
+           st.parsed, st.reused, st.build_us);
+
+    // retag 1% of the library and drop its last album
+    for (uint32_t i = 0; i < files; i += 100) {
+        sim_lib_put_track(i, 1);
+    }
+    char path[MEDIA_LIB_PATH_MAX];
+    for (uint32_t i = files - SIM_LIB_TRACKS; i < files; i++) {
+        snprintf(path, sizeof(path),
+                 SIM_LIB_ROOT "/Artist %04" PRIu32 "/Album %" PRIu32
+                              "/%02" PRIu32 " Track.mp3",
+                 i / (SIM_LIB_TRACKS * SIM_LIB_ALBUMS),
+                 i / SIM_LIB_TRACKS % SIM_LIB_ALBUMS,
+                 i % SIM_LIB_TRACKS + 1);
+        unlink(path);
+    }
+    media_lib_build(SIM_LIB_ROOT, index, &st);
+    printf("rescan changed:  %" PRIu32 " read, %" PRIu32
+           " unchanged, %" PRIu32 " removed in %" PRIu64 " us\n",
+           st.parsed, st.reused, st.removed, st.build_us);
+
+    lib = media_lib_open(index);
+    bool ok = lib != nullptr && media_lib_get(lib, 0, &track) &&
+              strcmp(track.title, "Song 0 rev 1") == 0 &&
+              media_lib_count(lib) == files - SIM_LIB_TRACKS;
+    media_lib_close(lib);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// Time seeks to each quarter of the track, returning the slowest. With
+// fresh every seek starts from an empty table.
+static uint32_t sim_seek_quarters(mp3_seek_t* seek, stream_reader_t* stream,
+                                  const char* what, bool fresh) {
+    uint32_t worst = 0;
+    uint32_t step = seek->step;
+    for (uint32_t q = 1; q <= 4; q++) {
+        if (fresh) {
+            seek->count = 0;
+            seek->step = step;
+        }
+        uint32_t frame = (uint64_t)seek->frames * q / 4;
+        int64_t start = esp_timer_get_time();
+        uint32_t at = mp3_seek_to(seek, stream, frame);
+        uint32_t us = esp_timer_get_time() - start;
+        printf("%s seek to %" PRIu32 "%%: frame %" PRIu32 "/%" PRIu32
+               " in %" PRIu32 " us%s\n",
+               what, q * 25, at, frame, us, seek->exact ? "" : " (approx)");
+        if (us > worst) {
+            worst = us;
+        }
+    }
+    return worst;
+}
+
+void sim_seek_bench(const char* path) {
+    static uint32_t offsets[CONFIG_AUDIO_DEC_SEEK_ENTRIES];
+    stream_reader_t* stream = stream_reader_open(path);
+    mp3_seek_t seek;
+    if (stream == nullptr) {
+        ESP_LOGE("SIM_BENCH", "Cannot open %s\n", path);
+        exit(1);
+    }
+    mp3_seek_init(&seek, stream, offsets, CONFIG_AUDIO_DEC_SEEK_ENTRIES);
+    bool toc = seek.has_toc;
+
+    // table built up front to know the frame count, then dropped
+    mp3_seek_scan(&seek, stream);
+    uint32_t frames = seek.frames;
+    stream_reader_seek(stream, 0);
+    mp3_seek_init(&seek, stream, offsets, CONFIG_AUDIO_DEC_SEEK_ENTRIES);
+    seek.frames = frames;
+    uint32_t toc_us = 0;
+    if (toc) {
+        toc_us = sim_seek_quarters(&seek, stream, "toc", false);
+        stream_reader_seek(stream, 0);
+        mp3_seek_init(&seek, stream, offsets, CONFIG_AUDIO_DEC_SEEK_ENTRIES);
+        seek.frames = frames;
+    }
+    seek.has_toc = false;
+    uint32_t hop_us = sim_seek_quarters(&seek, stream, "hop", true);
+
+    stream_reader_seek(stream, 0);
+    mp3_seek_init(&seek, stream, offsets, CONFIG_AUDIO_DEC_SEEK_ENTRIES);
+    int64_t start = esp_timer_get_time();
+    mp3_seek_scan(&seek, stream);
+    uint32_t scan_us = esp_timer_get_time() - start;
+    mkdir("seek_bench", 0755);
+    start = esp_timer_get_time();
+    bool ok = mp3_seek_save(&seek, "seek_bench/table.sk", 1, 1);
+    uint32_t save_us = esp_timer_get_time() - start;
+
+    stream_reader_seek(stream, 0);
+    mp3_seek_init(&seek, stream, offsets, CONFIG_AUDIO_DEC_SEEK_ENTRIES);
+    start = esp_timer_get_time();
+    ok = ok && mp3_seek_load(&seek, "seek_bench/table.sk", 1, 1);
+    uint32_t load_us = esp_timer_get_time() - start;
+    uint32_t table_us = sim_seek_quarters(&seek, stream, "table", false);
+    ok = ok && seek.frames == frames;
+
+    printf("%" PRIu32 " frames, %" PRIu32 " entries every %" PRIu32
+           " frames\n",
+           frames, seek.count, seek.step);
+    printf("scan %" PRIu32 " us, save %" PRIu32 " us, load %" PRIu32
+           " us\n",
+           scan_us, save_us, load_us);
+    printf("worst seek: toc %" PRIu32 " us, hop %" PRIu32 " us, table %" PRIu32
+           " us\n",
+           toc_us, hop_us, table_us);
+    stream_reader_close(stream);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// The tone the gapless check expects, see sim_gapless_check
+#define SIM_GAPLESS_HZ 1000
+#define SIM_GAPLESS_AMP (0.5 * 32767)
+#define SIM_GAPLESS_SECONDS 6
+// Samples compared on each side of the splice
+#define SIM_GAPLESS_WINDOW 4096
+
+static double sim_gapless_tone(int64_t n) {
+    return SIM_GAPLESS_AMP * sin(2 * M_PI * SIM_GAPLESS_HZ * n / 44100.0);
+}
+
+// Shift of pcm[from, to) against the tone that fits best, 0 when aligned
+static int sim_gapless_shift(const int16_t* pcm, int64_t from, int64_t to) {
+    int best = 0;
+    double best_err = INFINITY;
+    for (int shift = -8; shift <= 8; shift++) {
+        double err = 0;
+        for (int64_t n = from; n < to; n++) {
+            double d = pcm[2 * n] - sim_gapless_tone(n + shift);
+            err += d * d;
+        }
+        if (err < best_err) {
+            best_err = err;
+            best = shift;
+        }
+    }
+    return best;
+}
+
+void sim_gapless_check(const char* dir) {
+    char a[AUDIO_DEC_PATH_MAX], b[AUDIO_DEC_PATH_MAX];
+    snprintf(a, sizeof(a), "%s/a.mp3", dir);
+    snprintf(b, sizeof(b), "%s/b.mp3", dir);
+
+    int64_t expect = SIM_GAPLESS_SECONDS * 44100;
+    // a little more than expected to see extra samples
+    int64_t max = expect + 44100;
+    int16_t* pcm = malloc(max * 2 * sizeof(int16_t));
+    pcm_ring_t* ring = pcm_ring_create(CONFIG_PCM_RING_SIZE);
+    audio_dec_t* dec = pcm != NULL && ring != nullptr
+                           ? audio_dec_start(a, ring)
+                           : nullptr;
+    if (dec == nullptr || !audio_dec_queue(dec, b)) {
+        ESP_LOGE("SIM_BENCH", "Cannot play %s then %s\n", a, b);
+        exit(1);
+    }
+
+    int64_t samples = 0;
+    int64_t boundary = 0;
+    audio_dec_stats_t stats;
+    for (;;) {
+        const uint8_t* ptr;
+        size_t n = pcm_ring_read_reserve(ring, &ptr);
+        audio_dec_get_stats(dec, &stats);
+        if (n == 0) {
+            if (stats.ended && pcm_ring_fill(ring) == 0) {
+                break;
+            }
+            vTaskDelay(1);
+            continue;
+        }
+        if (boundary == 0 && stats.tracks == 2) {
+            // the splice is somewhere in what is queued in the ring
+            boundary = samples;
+        }
+        int64_t frames = n / 4;
+        if (samples + frames > max) {
+            frames = max - samples;
+        }
+        memcpy(pcm + 2 * samples, ptr, frames * 4);
+        samples += frames;
+        pcm_ring_read_commit(ring, n);
+    }
+    audio_dec_stop(dec);
+    pcm_ring_destroy(ring);
+
+    // the first track is half of the tone
+    int64_t splice = expect / 2;
+    int64_t from = splice - SIM_GAPLESS_WINDOW;
+    int64_t to = splice + SIM_GAPLESS_WINDOW;
+    bool ok = samples == expect && boundary <= splice;
+    int before = 0, after = 0;
+    if (ok) {
+        before = sim_gapless_shift(pcm, from, splice);
+        after = sim_gapless_shift(pcm, splice, to);
+        ok = before == 0 && after == 0;
+    }
+    printf("samples %" PRId64 ", expected %" PRId64 "\n", samples, expect);
+    printf("shift before the splice %d, after %d\n", before, after);
+    free(pcm);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// Seconds of input per resampler measurement
+#define SIM_RESAMPLE_SECONDS 10
+
+static const struct {
+    const char* name;
+    double flat_hz; // highest tone checked
+    double snr;     // error it is checked against, in dB
+} sim_resample_tiers[] = {
+    {"fast", 5000, 50},
+    {"medium", 10000, 50},
+    {"high", 12000, 70},
+};
+
+// Resample a tone at hz from in_rate to 44.1 kHz and return the error
+// against the ideal tone at the output rate, in dB below it. With reject
+// the tone is above the output Nyquist rate and the result is its level
+// left in the output, in dB below the input.
+static double sim_resample_tone(uint32_t in_rate, pcm_resample_quality_t q,
+                                double hz, bool reject) {
+    pcm_resample_t* rs = pcm_resample_create(in_rate, 44100, q);
+    size_t in_frames = in_rate; // one second
+    size_t out_max = 44100 + 64;
+    int16_t* in = malloc(in_frames * 4);
+    int16_t* out = malloc(out_max * 4);
+    double amp = 0.5 * 32767;
+    for (size_t i = 0; i < in_frames; i++) {
+        in[2 * i] = in[2 * i + 1] = lrint(amp * sin(2 * M_PI * hz * i /
+                                                    in_rate));
+    }
+    size_t used;
+    size_t n = pcm_resample_process(rs, in, in_frames, &used, out, out_max);
+
+    // output n is the input at (n * m - center) / l, see pcm_resample.c
+    uint32_t g = in_rate;
+    for (uint32_t b = 44100; b != 0;) {
+        uint32_t t = g % b;
+        g = b;
+        b = t;
+    }
+    uint32_t l = 44100 / g, m = in_rate / g;
+    uint32_t taps = 8u << q;
+    double center = (l * taps - 1) / 2.0;
+    double sig = 0, err = 0;
+    for (size_t i = taps; i < n; i++) {
+        double t = (i * (double)m - center) / l;
+        double ref = amp * sin(2 * M_PI * hz * t / in_rate);
+        double d = reject ? out[2 * i] : out[2 * i] - ref;
+        sig += ref * ref;
+        err += d * d;
+    }
+    free(in);
+    free(out);
+    pcm_resample_destroy(rs);
+    return 10 * log10(sig / (err + 1e-9));
+}
+
+// Time every tier from 48 and 32 kHz and check its error on tones in its
+// band against the ideal tone at 44.1 kHz
+void sim_resample_bench(void) {
+    static const uint32_t rates[] = {48000, 32000};
+    bool ok = true;
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        uint32_t rate = rates[r];
+        size_t in_frames = (size_t)rate * SIM_RESAMPLE_SECONDS;
+        size_t out_max = (size_t)44100 * SIM_RESAMPLE_SECONDS + 64;
+        int16_t* in = malloc(in_frames * 4);
+        int16_t* out = malloc(out_max * 4);
+        uint32_t x = 1;
+        for (size_t i = 0; i < 2 * in_frames; i++) {
+            x = x * 1664525 + 1013904223; // noise, content does not matter
+            in[i] = x >> 17;
+        }
+        for (int q = PCM_RESAMPLE_FAST; q <= PCM_RESAMPLE_HIGH; q++) {
+            pcm_resample_t* rs = pcm_resample_create(rate, 44100, q);
+            if (rs == nullptr) {
+                exit(1);
+            }
+            size_t used, n = 0;
+            int64_t start = esp_timer_get_time();
+            // in decoder sized chunks, as audio_dec feeds it
+            for (size_t i = 0; i < in_frames; i += used) {
+                size_t len = in_frames - i < 1152 ? in_frames - i : 1152;
+                n += pcm_resample_process(rs, in + 2 * i, len, &used,
+                                          out + 2 * n, out_max - n);
+            }
+            int64_t us = esp_timer_get_time() - start;
+            pcm_resample_destroy(rs);
+
+            double flat_hz = sim_resample_tiers[q].flat_hz;
+            double snr_lo = sim_resample_tone(rate, q, 1000, false);
+            double snr_hi = sim_resample_tone(rate, q, flat_hz, false);
+            // a tone that aliases to 20.6 kHz
+            double stop = rate > 44100
+                              ? sim_resample_tone(rate, q, 23500, true)
+                              : NAN;
+            printf("%5" PRIu32 " Hz %-6s %6.2f Msamples/s, 1 kHz %5.1f dB, "
+                   "%2.0f kHz %5.1f dB, 23.5 kHz %5.1f dB\n",
+                   rate, sim_resample_tiers[q].name, n / (double)us, snr_lo,
+                   flat_hz / 1000, snr_hi, stop);
+            ok = ok && snr_lo > sim_resample_tiers[q].snr &&
+                 snr_hi > sim_resample_tiers[q].snr;
+        }
+        free(in);
+        free(out);
+    }
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// Frames per A2DP data callback in the gain benchmark, 20 ms
+#define SIM_GAIN_BLOCK 882
+#define SIM_GAIN_BLOCKS 20000
+
+// Time the gain stage on data callback sized blocks, holding a gain and
+// ramping on every block, and check the ramp and saturation
+void sim_gain_bench(void) {
+    int16_t* pcm = malloc(SIM_GAIN_BLOCK * 2 * sizeof(int16_t));
+    pcm_gain_t gain;
+    uint32_t x = 1;
+    for (size_t i = 0; i < 2 * SIM_GAIN_BLOCK; i++) {
+        x = x * 1664525 + 1013904223;
+        pcm[i] = x >> 16;
+    }
+
+    pcm_gain_init(&gain, pcm_gain_of_volume(100));
+    int64_t start = esp_timer_get_time();
+    for (int b = 0; b < SIM_GAIN_BLOCKS; b++) {
+        pcm_gain_process(&gain, pcm, SIM_GAIN_BLOCK);
+        // keep the data from decaying to silence
+        pcm[b % (2 * SIM_GAIN_BLOCK)] ^= 0x5555;
+    }
+    int64_t hold_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int b = 0; b < SIM_GAIN_BLOCKS; b++) {
+        pcm_gain_set_volume(&gain, b & 1 ? 127 : 64);
+        pcm_gain_process(&gain, pcm, SIM_GAIN_BLOCK);
+    }
+    int64_t ramp_us = esp_timer_get_time() - start;
+    double samples = 2.0 * SIM_GAIN_BLOCK * SIM_GAIN_BLOCKS;
+    printf("hold %.1f Msamples/s, ramp %.1f Msamples/s\n", samples / hold_us,
+           samples / ramp_us);
+
+    // a ramp from unity to mute starts at the input, ends near silence
+    // and never steps by more than one frame's share
+    for (size_t i = 0; i < 2 * SIM_GAIN_BLOCK; i++) {
+        pcm[i] = 16384;
+    }
+    pcm_gain_init(&gain, PCM_GAIN_UNITY);
+    pcm_gain_set(&gain, 0);
+    pcm_gain_process(&gain, pcm, SIM_GAIN_BLOCK);
+    bool ok = pcm[0] == 16384 && pcm[2 * SIM_GAIN_BLOCK - 1] < 32;
+    for (size_t i = 2; i < 2 * SIM_GAIN_BLOCK; i += 2) {
+        ok = ok && pcm[i] <= pcm[i - 2] && pcm[i - 2] - pcm[i] <= 20;
+    }
+    // the block after the ramp holds the target
+    pcm_gain_process(&gain, pcm, SIM_GAIN_BLOCK);
+    ok = ok && pcm[0] == 0;
+
+    // above unity clips instead of wrapping
+    pcm[0] = 30000;
+    pcm[1] = -30000;
+    pcm_gain_init(&gain, 2 * PCM_GAIN_UNITY);
+    pcm_gain_process(&gain, pcm, 1);
+    ok = ok && pcm[0] == INT16_MAX && pcm[1] == INT16_MIN;
+
+    free(pcm);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// Seconds of audio timed per band count
+#define SIM_EQ_SECONDS 20
+
+// Gain in dB of eq on a 0.125 full scale tone at hz, past the attack, so
+// a 12 dB boost does not clip
+static double sim_eq_gain(pcm_eq_t* eq, double hz) {
+    int16_t pcm[2 * SIM_GAIN_BLOCK];
+    double in = 0, out = 0;
+    for (int b = 0; b < 50; b++) {
+        for (size_t i = 0; i < SIM_GAIN_BLOCK; i++) {
+            double t = (double)(b * SIM_GAIN_BLOCK + i) / 44100;
+            pcm[2 * i] = pcm[2 * i + 1] = lrint(4096 * sin(2 * M_PI * hz * t));
+        }
+        double sum = 0;
+        for (size_t i = 0; i < SIM_GAIN_BLOCK; i++) {
+            sum += (double)pcm[2 * i] * pcm[2 * i];
+        }
+        pcm_eq_process(eq, pcm, SIM_GAIN_BLOCK);
+        // skip the first second
+        if (b >= 50 - 10) {
+            in += sum;
+            for (size_t i = 0; i < SIM_GAIN_BLOCK; i++) {
+                out += (double)pcm[2 * i + 1] * pcm[2 * i + 1];
+            }
+        }
+    }
+    return 10 * log10(out / in);
+}
+
+// Check the gain of band alone at hz is db within tol
+static bool sim_eq_expect(const pcm_eq_band_t* band, double hz, double db,
+                          double tol) {
+    pcm_eq_t* eq = pcm_eq_create(44100);
+    pcm_eq_set(eq, band, 1);
+    double got = sim_eq_gain(eq, hz);
+    pcm_eq_destroy(eq);
+    bool ok = fabs(got - db) <= tol;
+    printf("  %-10s %5.0f Hz %+5.1f dB at %5.0f Hz: %+6.2f dB%s\n",
+           band->type == PCM_EQ_PEAK         ? "peak"
+           : band->type == PCM_EQ_LOW_SHELF  ? "low shelf"
+           : band->type == PCM_EQ_HIGH_SHELF ? "high shelf"
+                                             : "high-pass",
+           band->hz, band->gain_db, hz, got, ok ? "" : " (bad)");
+    return ok;
+}
+
+void sim_eq_bench(void) {
+    int16_t* pcm = malloc(SIM_GAIN_BLOCK * 2 * sizeof(int16_t));
+    uint32_t x = 1;
+    for (size_t i = 0; i < 2 * SIM_GAIN_BLOCK; i++) {
+        x = x * 1664525 + 1013904223;
+        pcm[i] = (int32_t)(x >> 16) >> 2;
+    }
+
+    // CPU time per second of 44.1 kHz audio, bands spread over the octaves
+    pcm_eq_band_t bands[PCM_EQ_MAX_BANDS];
+    for (size_t n = 0; n < PCM_EQ_MAX_BANDS; n++) {
+        bands[n] = (pcm_eq_band_t){PCM_EQ_PEAK, 60 << n, -3, 1};
+    }
+    uint32_t blocks = SIM_EQ_SECONDS * 44100 / SIM_GAIN_BLOCK;
+    double base_us = 0;
+    for (size_t n = 0; n <= PCM_EQ_MAX_BANDS; n++) {
+        pcm_eq_t* eq = pcm_eq_create(44100);
+        pcm_eq_set(eq, bands, n);
+        int64_t start = esp_timer_get_time();
+        for (uint32_t b = 0; b < blocks; b++) {
+            pcm_eq_process(eq, pcm, SIM_GAIN_BLOCK);
+        }
+        double us = (double)(esp_timer_get_time() - start) / SIM_EQ_SECONDS;
+        pcm_eq_destroy(eq);
+        if (n == 0) {
+            base_us = us;
+            printf("bypass: %.1f us per second\n", us);
+        } else {
+            printf("%zu bands: %.1f us per second, %.3f%% of a core, "
+                   "%.1f us per band\n",
+                   n, us, us / 1e4, (us - base_us) / n);
+        }
+    }
+
+    // response of each band type against the RBJ design
+    bool ok = true;
+    pcm_eq_band_t band = {PCM_EQ_PEAK, 1000, 6, 1};
+    ok &= sim_eq_expect(&band, 1000, 6, 0.2);
+    ok &= sim_eq_expect(&band, 100, 0, 0.3);
+    ok &= sim_eq_expect(&band, 10000, 0, 0.3);
+    band = (pcm_eq_band_t){PCM_EQ_PEAK, 3000, -12, 2};
+    ok &= sim_eq_expect(&band, 3000, -12, 0.3);
+    band = (pcm_eq_band_t){PCM_EQ_LOW_SHELF, 200, 6, 0.707f};
+    ok &= sim_eq_expect(&band, 40, 6, 0.3);
+    ok &= sim_eq_expect(&band, 5000, 0, 0.3);
+    band = (pcm_eq_band_t){PCM_EQ_HIGH_SHELF, 4000, -6, 0.707f};
+    ok &= sim_eq_expect(&band, 15000, -6, 0.3);
+    ok &= sim_eq_expect(&band, 200, 0, 0.3);
+    // shelves at the limits, their b1 reaches about 8
+    band = (pcm_eq_band_t){PCM_EQ_HIGH_SHELF, 1000, 12, 0.707f};
+    ok &= sim_eq_expect(&band, 10000, 12, 0.3);
+    ok &= sim_eq_expect(&band, 100, 0, 0.3);
+    band = (pcm_eq_band_t){PCM_EQ_HIGH_SHELF, 1000, -12, 0.707f};
+    ok &= sim_eq_expect(&band, 10000, -12, 0.3);
+    band = (pcm_eq_band_t){PCM_EQ_LOW_SHELF, 1000, 12, 0.707f};
+    ok &= sim_eq_expect(&band, 100, 12, 0.3);
+    ok &= sim_eq_expect(&band, 10000, 0, 0.3);
+    band = (pcm_eq_band_t){PCM_EQ_LOW_SHELF, 1000, -12, 0.707f};
+    ok &= sim_eq_expect(&band, 100, -12, 0.3);
+    band = (pcm_eq_band_t){PCM_EQ_HIGH_PASS, 100, 0, 0.707f};
+    ok &= sim_eq_expect(&band, 25, -24, 1.5);
+    ok &= sim_eq_expect(&band, 100, -3, 0.3);
+    ok &= sim_eq_expect(&band, 2000, 0, 0.3);
+
+    // 0 dB peaks and the bypass leave the samples untouched
+    int16_t ref[2 * SIM_GAIN_BLOCK];
+    memcpy(ref, pcm, sizeof(ref));
+    pcm_eq_t* eq = pcm_eq_create(44100);
+    for (size_t n = 0; n < PCM_EQ_MAX_BANDS; n++) {
+        bands[n].gain_db = 0;
+    }
+    pcm_eq_set(eq, bands, PCM_EQ_MAX_BANDS);
+    pcm_eq_process(eq, pcm, SIM_GAIN_BLOCK);
+    ok &= memcmp(ref, pcm, sizeof(ref)) == 0;
+    pcm_eq_set(eq, bands, 0);
+    pcm_eq_process(eq, pcm, SIM_GAIN_BLOCK);
+    ok &= memcmp(ref, pcm, sizeof(ref)) == 0;
+    ok &= !pcm_eq_set(eq, bands, PCM_EQ_MAX_BANDS + 1);
+    // past Nyquist the design does not fit the kernel
+    band = (pcm_eq_band_t){PCM_EQ_PEAK, 27575, -12, 0.707f};
+    ok &= !pcm_eq_set(eq, &band, 1);
+
+    // a boost past full scale clips instead of wrapping
+    pcm[0] = 30000;
+    pcm[1] = -30000;
+    band = (pcm_eq_band_t){PCM_EQ_HIGH_SHELF, 1000, 12, 0.707f};
+    pcm_eq_set(eq, &band, 1);
+    pcm_eq_process(eq, pcm, 1);
+    ok &= pcm[0] == INT16_MAX && pcm[1] == INT16_MIN;
+    pcm_eq_destroy(eq);
+
+    free(pcm);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// A consumption trace for the jitter buffer: reads every pull_ms, paused
+// for burst_ms every burst_every_ms then caught up at once, as Bluedroid
+// does after retransmissions; a producer stalling for stall_ms every
+// stall_every_ms; a sink delay reported from the start, and bursts only
+// until bursts_until_s
+typedef struct {
+    const char* name;
+    uint32_t seconds;
+    uint32_t pull_ms;
+    uint32_t burst_every_ms, burst_ms, bursts_until_s;
+    uint32_t stall_every_ms, stall_ms;
+    uint32_t sink_delay_ms;
+} sim_jitter_trace_t;
+
+typedef struct {
+    uint32_t underruns;      // padded reads, primed or not
+    uint32_t late_underruns; // of those, in the second half
+    uint32_t peak_ms;        // deepest target
+    pcm_jitter_stats_t stats;
+} sim_jitter_result_t;
+
+// Decoded frame and decoder poll period, as in audio_dec
+#define SIM_JITTER_FRAME 4608
+#define SIM_JITTER_POLL_MS 10
+
+static void sim_jitter_run(const sim_jitter_trace_t* trace,
+                           sim_jitter_result_t* res) {
+    static uint8_t frame[SIM_JITTER_FRAME];
+    static uint8_t out[8192];
+    pcm_ring_t* ring = pcm_ring_create(CONFIG_PCM_RING_SIZE);
+    pcm_jitter_t jitter;
+    uint32_t byte_rate = 44100 * 4;
+    // as bt_a2dp_set_pcm_ring does
+    uint32_t max_ms = (uint64_t)ring->size * 1000 / byte_rate;
+    if (max_ms > CONFIG_BT_A2DP_JITTER_MAX_MS) {
+        max_ms = CONFIG_BT_A2DP_JITTER_MAX_MS;
+    }
+    pcm_jitter_init(&jitter, byte_rate, CONFIG_BT_A2DP_JITTER_MIN_MS,
+                    CONFIG_BT_A2DP_JITTER_START_MS, max_ms,
+                    CONFIG_BT_A2DP_AV_LATENCY_MS);
+    pcm_jitter_set_sink_delay(&jitter, trace->sink_delay_ms);
+    pcm_ring_set_limit(ring, pcm_jitter_target(&jitter));
+    memset(res, 0, sizeof(*res));
+
+    uint32_t len = (byte_rate * trace->pull_ms / 1000) & ~3u;
+    uint32_t owed = 0; // reads held back by a burst
+    for (uint32_t t = 1; t <= trace->seconds * 1000; t++) {
+        bool stalled = trace->stall_every_ms != 0 &&
+                       t % trace->stall_every_ms < trace->stall_ms;
+        if (t % SIM_JITTER_POLL_MS == 0 && !stalled) {
+            while (pcm_ring_space(ring) >= SIM_JITTER_FRAME) {
+                pcm_ring_write(ring, frame, SIM_JITTER_FRAME);
+            }
+        }
+
+        if (t % trace->pull_ms == 0) {
+            owed++;
+        }
+        bool paused = trace->burst_every_ms != 0 &&
+                      t < trace->bursts_until_s * 1000 &&
+                      t % trace->burst_every_ms < trace->burst_ms;
+        for (; owed > 0 && !paused; owed--) {
+            uint32_t fill = pcm_ring_fill(ring);
+            if (fill < len) {
+                res->underruns++;
+                if (t > trace->seconds * 500) {
+                    res->late_underruns++;
+                }
+            }
+            pcm_ring_read(ring, out, len);
+            uint32_t target =
+                pcm_jitter_read(&jitter, len, fill, (int64_t)t * 1000);
+            pcm_ring_set_limit(ring, target);
+            uint32_t ms = (uint64_t)target * 1000 / byte_rate;
+            if (ms > res->peak_ms) {
+                res->peak_ms = ms;
+            }
+        }
+    }
+    pcm_jitter_get_stats(&jitter, &res->stats);
+    pcm_ring_destroy(ring);
+}
+
+static const char* const sim_jitter_reasons[] = {
+    "start", "underrun", "burst", "stable", "sink",
+};
+
+void sim_jitter_check(void) {
+    static const sim_jitter_trace_t traces[] = {
+        {"steady", 120, 10, 0, 0, 0, 0, 0, 0},
+        {"rf bursts", 120, 10, 3000, 120, 120, 0, 0, 0},
+        {"card stalls", 120, 10, 0, 0, 0, 5000, 90, 0},
+        {"calm after", 180, 10, 3000, 120, 30, 0, 0, 0},
+        {"sink delay", 60, 10, 0, 0, 0, 0, 0, 260},
+    };
+    sim_jitter_result_t res[5];
+    for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+        sim_jitter_run(&traces[i], &res[i]);
+        const pcm_jitter_stats_t* s = &res[i].stats;
+        printf("%-12s underruns %3" PRIu32 " (%" PRIu32 " late), "
+               "depth %3" PRIu32 " ms, peak %3" PRIu32 " ms, cap %3" PRIu32
+               " ms, grows %" PRIu32 " (%" PRIu32 " bursts), shrinks %" PRIu32
+               ", last %s\n",
+               traces[i].name, res[i].underruns, res[i].late_underruns,
+               s->target_ms, res[i].peak_ms, s->max_ms, s->grows, s->bursts,
+               s->shrinks, sim_jitter_reasons[s->reason]);
+    }
+
+    bool ok = true;
+    // a steady link shrinks the buffer and never runs dry once primed
+    ok &= res[0].stats.underruns == 0 && res[0].stats.shrinks > 0 &&
+          res[0].stats.target_ms < CONFIG_BT_A2DP_JITTER_START_MS;
+    // bursts and stalls grow it until they no longer run it dry
+    ok &= res[1].stats.grows > 0 && res[1].late_underruns == 0;
+    ok &= res[2].stats.grows > 0 && res[2].late_underruns == 0;
+    // once the bursts stop it shrinks back
+    ok &= res[3].stats.shrinks > 0 && res[3].stats.target_ms < res[3].peak_ms;
+    // the sink delay leaves only the rest of the A/V budget
+    ok &= res[4].peak_ms <= CONFIG_BT_A2DP_AV_LATENCY_MS - 260 + 1 ||
+          res[4].peak_ms <= CONFIG_BT_A2DP_JITTER_MIN_MS;
+    ok &= res[4].stats.sink_delay_ms == 260;
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// Ring of the unit checks, small enough to wrap every few writes
+#define SIM_RING_SMALL 64
+// PCM moved by the throughput run, the decoder's frame and about what an
+// A2DP data callback takes at once
+#define SIM_RING_BYTES (256u << 20)
+#define SIM_RING_FRAME 4608
+#define SIM_RING_READ 512
+
+static void sim_ring_pattern(uint8_t* p, size_t n, uint8_t from) {
+    for (size_t i = 0; i < n; i++) {
+        p[i] = from + i;
+    }
+}
+
+static bool sim_ring_is_pattern(const uint8_t* p, size_t n, uint8_t from) {
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != (uint8_t)(from + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reserve and commit across the end of the buffer, then copy across the
+// wrap of the byte counters
+static bool sim_ring_wrap(void) {
+    static uint8_t buf[SIM_RING_SMALL];
+    uint8_t data[SIM_RING_SMALL], out[SIM_RING_SMALL];
+    pcm_ring_t ring;
+    pcm_ring_init(&ring, buf, sizeof(buf));
+    bool ok = true;
+
+    // 48 bytes through leave 16 to the end of the buffer
+    sim_ring_pattern(data, 48, 0);
+    ok &= pcm_ring_write(&ring, data, 48) == 48;
+    pcm_ring_read(&ring, out, 48);
+    ok &= sim_ring_is_pattern(out, 48, 0);
+
+    // the producer gets the span to the end, then the one from the start
+    uint8_t* w;
+    ok &= pcm_ring_write_reserve(&ring, &w) == 16 && w == buf + 48;
+    sim_ring_pattern(w, 16, 100);
+    pcm_ring_write_commit(&ring, 16);
+    ok &= pcm_ring_write_reserve(&ring, &w) == 48 && w == buf;
+    sim_ring_pattern(w, 32, 116);
+    pcm_ring_write_commit(&ring, 32);
+    ok &= pcm_ring_fill(&ring) == 48 && pcm_ring_space(&ring) == 16;
+
+    // and the consumer the same two
+    const uint8_t* r;
+    ok &= pcm_ring_read_reserve(&ring, &r) == 16 && r == buf + 48 &&
+          sim_ring_is_pattern(r, 16, 100);
+    pcm_ring_read_commit(&ring, 16);
+    ok &= pcm_ring_read_reserve(&ring, &r) == 32 && r == buf &&
+          sim_ring_is_pattern(r, 32, 116);
+    pcm_ring_read_commit(&ring, 32);
+    ok &= pcm_ring_fill(&ring) == 0;
+
+    // 8 bytes before the counters wrap, the copy spans both wraps
+    atomic_store(&ring.head, UINT32_MAX - 7);
+    atomic_store(&ring.tail, UINT32_MAX - 7);
+    sim_ring_pattern(data, 40, 7);
+    ok &= pcm_ring_write(&ring, data, 40) == 40 && pcm_ring_fill(&ring) == 40;
+    ok &= pcm_ring_read(&ring, out, 40) == 40 &&
+          sim_ring_is_pattern(out, 40, 7) && pcm_ring_fill(&ring) == 0;
+
+    pcm_ring_stats_t st;
+    pcm_ring_get_stats(&ring, &st);
+    ok &= st.underruns == 0 && st.overruns == 0;
+    return ok;
+}
+
+// A read the ring cannot cover is padded with silence and counted
+static bool sim_ring_underrun(void) {
+    static uint8_t buf[SIM_RING_SMALL];
+    uint8_t data[SIM_RING_SMALL], out[SIM_RING_SMALL];
+    pcm_ring_t ring;
+    pcm_ring_stats_t st;
+    pcm_ring_init(&ring, buf, sizeof(buf));
+    bool ok = true;
+
+    sim_ring_pattern(data, 8, 1);
+    pcm_ring_write(&ring, data, 8);
+    memset(out, 0xaa, sizeof(out));
+    ok &= pcm_ring_read(&ring, out, 32) == 32 && sim_ring_is_pattern(out, 8, 1);
+    for (int i = 8; i < 32; i++) {
+        ok &= out[i] == 0;
+    }
+    pcm_ring_get_stats(&ring, &st);
+    ok &= st.underruns == 1 && st.underrun_bytes == 24 && st.min_fill == 8;
+
+    // a covered read counts nothing, an empty one is all silence
+    pcm_ring_write(&ring, data, 16);
+    pcm_ring_read(&ring, out, 16);
+    pcm_ring_get_stats(&ring, &st);
+    ok &= st.underruns == 1 && st.min_fill == 8;
+    memset(out, 0xaa, sizeof(out));
+    ok &= pcm_ring_read(&ring, out, 16) == 16;
+    for (int i = 0; i < 16; i++) {
+        ok &= out[i] == 0;
+    }
+    pcm_ring_get_stats(&ring, &st);
+    ok &= st.underruns == 2 && st.underrun_bytes == 40 && st.min_fill == 0;
+
+    pcm_ring_reset_stats(&ring);
+    pcm_ring_get_stats(&ring, &st);
+    ok &= st.underruns == 0 && st.underrun_bytes == 0 &&
+          st.min_fill == SIM_RING_SMALL;
+    return ok;
+}
+
+// The limit caps the producer, never what is already readable
+static bool sim_ring_limit(void) {
+    static uint8_t buf[SIM_RING_SMALL];
+    uint8_t data[SIM_RING_SMALL], out[SIM_RING_SMALL];
+    pcm_ring_t ring;
+    pcm_ring_stats_t st;
+    pcm_ring_init(&ring, buf, sizeof(buf));
+    bool ok = pcm_ring_space(&ring) == SIM_RING_SMALL;
+
+    pcm_ring_set_limit(&ring, 32);
+    ok &= pcm_ring_space(&ring) == 32;
+    sim_ring_pattern(data, 48, 0);
+    ok &= pcm_ring_write(&ring, data, 48) == 32;
+    pcm_ring_get_stats(&ring, &st);
+    ok &= st.overruns == 1 && st.fill == 32 && pcm_ring_space(&ring) == 0;
+
+    // lowered under the fill, the bytes past it still play
+    pcm_ring_set_limit(&ring, 16);
+    ok &= pcm_ring_space(&ring) == 0 && pcm_ring_fill(&ring) == 32;
+    ok &= pcm_ring_read(&ring, out, 24) == 24 &&
+          sim_ring_is_pattern(out, 24, 0);
+    uint8_t* w;
+    ok &= pcm_ring_fill(&ring) == 8 && pcm_ring_space(&ring) == 8 &&
+          pcm_ring_write_reserve(&ring, &w) == 8;
+
+    // raised past the size, it stops at the size
+    pcm_ring_set_limit(&ring, 1000);
+    ok &= pcm_ring_space(&ring) == SIM_RING_SMALL - 8;
+    return ok;
+}
+
+typedef struct {
+    pcm_ring_t* ring;
+    uint64_t bytes;
+    _Atomic bool done;
+} sim_ring_producer_t;
+
+// The decoder side: frames of a word count, written in place
+static void sim_ring_producer_task(void* arg) {
+    sim_ring_producer_t* p = arg;
+    uint64_t left = p->bytes;
+    uint32_t word = 0;
+    while (left > 0) {
+        uint8_t* ptr;
+        size_t n = pcm_ring_write_reserve(p->ring, &ptr);
+        if (n == 0) {
+            taskYIELD();
+            continue;
+        }
+        if (n > SIM_RING_FRAME) {
+            n = SIM_RING_FRAME;
+        }
+        if (n > left) {
+            n = left;
+        }
+        uint32_t* w = (uint32_t*)ptr;
+        for (size_t i = 0; i < n / 4; i++) {
+            w[i] = word++;
+        }
+        pcm_ring_write_commit(p->ring, n);
+        left -= n;
+    }
+    atomic_store(&p->done, true);
+    vTaskDelete(NULL);
+}
+
+// Move SIM_RING_BYTES from a producer task to this one, the consumer,
+// checking every word arrives in order
+static bool sim_ring_throughput(void) {
+    pcm_ring_t* ring = pcm_ring_create(CONFIG_PCM_RING_SIZE);
+    if (ring == nullptr) {
+        return false;
+    }
+    sim_ring_producer_t prod = {.ring = ring, .bytes = SIM_RING_BYTES};
+    int64_t start = esp_timer_get_time();
+    if (xTaskCreate(sim_ring_producer_task, "SimRingTask", 2048, &prod,
+                    uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        pcm_ring_destroy(ring);
+        return false;
+    }
+
+    uint64_t got = 0;
+    uint32_t word = 0, errors = 0, waits = 0;
+    while (got < SIM_RING_BYTES) {
+        const uint8_t* ptr;
+        size_t n = pcm_ring_read_reserve(ring, &ptr);
+        if (n == 0) {
+            waits++;
+            taskYIELD();
+            continue;
+        }
+        if (n > SIM_RING_READ) {
+            n = SIM_RING_READ;
+        }
+        const uint32_t* w = (const uint32_t*)ptr;
+        for (size_t i = 0; i < n / 4; i++) {
+            errors += w[i] != word++;
+        }
+        pcm_ring_read_commit(ring, n);
+        got += n;
+    }
+    int64_t us = esp_timer_get_time() - start;
+    while (!atomic_load(&prod.done)) {
+        taskYIELD();
+    }
+
+    printf("ring:            %" PRIu32 " bytes, %d byte writes, %d byte "
+           "reads\n", ring->size, SIM_RING_FRAME, SIM_RING_READ);
+    printf("moved:           %" PRIu64 " bytes in %" PRId64 " us\n", got, us);
+    printf("throughput:      %.1f MB/s, %.0fx 44.1 kHz stereo\n",
+           us > 0 ? (double)got / us : 0.0,
+           us > 0 ? (double)got / us * 1e6 / (44100 * 4) : 0.0);
+    printf("out of order:    %" PRIu32 " words, consumer waits %" PRIu32 "\n",
+           errors, waits);
+    pcm_ring_destroy(ring);
+    return errors == 0;
+}
+
+void sim_ring_check(void) {
+    bool wrap = sim_ring_wrap();
+    bool underrun = sim_ring_underrun();
+    bool limit = sim_ring_limit();
+    printf("wrap:            %s\n", wrap ? "ok" : "FAIL");
+    printf("underrun:        %s\n", underrun ? "ok" : "FAIL");
+    printf("fill and limit:  %s\n", limit ? "ok" : "FAIL");
+    bool ok = wrap && underrun && limit && sim_ring_throughput();
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// Frames compared after the seek of the codec check
+#define SIM_CODEC_SEEK_FRAMES 4096
+
+typedef struct {
+    const audio_codec_t* codec;
+    stream_reader_t* stream;
+    void* arena;
+    size_t mem;
+} sim_codec_t;
+
+static bool sim_codec_open(sim_codec_t* c, const char* path) {
+    uint8_t head[AUDIO_CODEC_HEAD];
+    memset(c, 0, sizeof(sim_codec_t));
+    c->stream = stream_reader_open(path);
+    if (c->stream == nullptr) {
+        return false;
+    }
+    size_t len = stream_reader_read(c->stream, head, sizeof(head));
+    stream_reader_seek(c->stream, 0);
+    c->codec = audio_codec_probe(head, len, path);
+    c->mem = c->codec != nullptr ? c->codec->query_mem(head, len) : 0;
+    c->arena = c->mem != 0 ? malloc(c->mem) : NULL;
+    return c->arena != NULL && c->codec->open(c->arena, c->stream, path);
+}
+
+static void sim_codec_close(sim_codec_t* c) {
+    if (c->arena != NULL && c->codec != nullptr) {
+        c->codec->close(c->arena);
+    }
+    free(c->arena);
+    if (c->stream != nullptr) {
+        stream_reader_close(c->stream);
+    }
+}
+
+// Decode up to max frames, hashing them with FNV-1a. Returns the frames.
+static uint64_t sim_codec_run(sim_codec_t* c, uint64_t max, uint64_t* hash) {
+    static int16_t pcm[AUDIO_CODEC_BLOCK * 2];
+    uint64_t frames = 0;
+    *hash = 0xcbf29ce484222325ull;
+    while (frames < max) {
+        size_t want = max - frames < AUDIO_CODEC_BLOCK ? max - frames
+                                                        : AUDIO_CODEC_BLOCK;
+        size_t n = c->codec->decode(c->arena, pcm, want);
+        if (n == 0) {
+            break;
+        }
+        const uint8_t* b = (const uint8_t*)pcm;
+        for (size_t i = 0; i < n * 4; i++) {
+            *hash = (*hash ^ b[i]) * 0x100000001b3ull;
+        }
+        frames += n;
+    }
+    return frames;
+}
+
+// Check path decodes to the same PCM as its sibling WAV, from the start
+// and after a seek to a third of it. True if there is no sibling.
+static bool sim_codec_compare(const char* path, uint64_t frames,
+                              uint64_t hash) {
+    char wav[AUDIO_DEC_PATH_MAX];
+    snprintf(wav, sizeof(wav), "%.*s.wav",
+             (int)(strrchr(path, '.') - path), path);
+    sim_codec_t a, b;
+    if (access(wav, R_OK) != 0 || strcmp(wav, path) == 0) {
+        return true;
+    }
+    bool ok = sim_codec_open(&a, wav) && sim_codec_open(&b, path);
+    uint64_t wav_hash = 0, a_hash = 0, b_hash = 0;
+    uint64_t wav_frames = ok ? sim_codec_run(&a, UINT64_MAX, &wav_hash) : 0;
+    uint64_t at = frames / 3;
+    ok = ok && a.codec->seek(a.arena, at) == at &&
+         b.codec->seek(b.arena, at) == at;
+    uint64_t an = ok ? sim_codec_run(&a, SIM_CODEC_SEEK_FRAMES, &a_hash) : 0;
+    uint64_t bn = ok ? sim_codec_run(&b, SIM_CODEC_SEEK_FRAMES, &b_hash) : 0;
+    bool same = wav_frames == frames && wav_hash == hash;
+    bool seek = ok && an == bn && a_hash == b_hash;
+    printf("  against %s: %s, seek to %" PRIu64 ": %s\n", wav,
+           same ? "same" : "DIFFERENT", at, seek ? "same" : "DIFFERENT");
+    sim_codec_close(&a);
+    sim_codec_close(&b);
+    return ok && same && seek;
+}
+
+void sim_codec_bench(const char* dir) {
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        ESP_LOGE("SIM_BENCH", "Cannot open %s\n", dir);
+        exit(1);
+    }
+    bool ok = true;
+    uint32_t files = 0;
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL) {
+        const char* ext = strrchr(e->d_name, '.');
+        if (ext == NULL || (strcasecmp(ext, ".mp3") != 0 &&
+                            strcasecmp(ext, ".wav") != 0 &&
+                            strcasecmp(ext, ".flac") != 0)) {
+            continue;
+        }
+        char path[AUDIO_DEC_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        files++;
+
+        sim_codec_t c;
+        if (!sim_codec_open(&c, path)) {
+            printf("%s: cannot decode\n", path);
+            sim_codec_close(&c);
+            ok = false;
+            continue;
+        }
+        uint64_t hash;
+        int64_t start = esp_timer_get_time();
+        uint64_t frames = sim_codec_run(&c, UINT64_MAX, &hash);
+        int64_t us = esp_timer_get_time() - start;
+        audio_codec_info_t info;
+        c.codec->get_info(c.arena, &info);
+        double seconds = info.sample_rate ? (double)frames / info.sample_rate
+                                          : 0;
+        printf("%s: %s, %" PRIu32 " Hz, %u ch, %u bits, %zu byte state, "
+               "%.1f s in %.1f ms, %.0fx real time, %" PRIu32 " errors\n",
+               path, c.codec->name, info.sample_rate, info.channels,
+               info.bits, c.mem, seconds, us / 1000.0,
+               us > 0 ? seconds * 1e6 / us : 0, info.errors);
+        ok &= frames > 0 && info.errors == 0;
+        sim_codec_close(&c);
+        if (strcasecmp(strrchr(path, '.'), ".wav") != 0) {
+            ok &= sim_codec_compare(path, frames, hash);
+        }
+    }
+    closedir(d);
+
+    ok &= files > 0;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+#if CONFIG_SIM_PM_CHECK
+// A playback trace for the power policy: a decoder taking frame_us per
+// frame at 240 MHz, slower in proportion below, filling the ring to
+// target_ms; card reads stalling it for stall_ms every stall_every_ms;
+// content silent from silent_s to sound_s; no more track after end_s;
+// light sleep possible, a board with a 32 kHz crystal, if xtal32k
+typedef struct {
+    const char* name;
+    uint32_t seconds;
+    uint32_t frame_us;
+    uint32_t target_ms;
+    uint32_t stall_every_ms, stall_ms;
+    uint32_t silent_s, sound_s;
+    uint32_t end_s;
+    bool xtal32k;
+} sim_pm_trace_t;
+
+typedef struct {
+    uint32_t underruns;      // padded reads once playing
+    bool streaming;          // at the end of the trace
+    sys_pm_stats_t stats;
+} sim_pm_result_t;
+
+// Decoded frame, 1152 samples of 16-bit stereo, and the sink's read size
+#define SIM_PM_FRAME 4608
+#define SIM_PM_PULL_MS 10
+#define SIM_PM_RATE (44100 * 4)
+
+// Step the player 1 ms at a time. The sink reads while the stream runs,
+// the policy suspends it and, as bt_a2dp_idle does, the silence at the
+// head of the ring is then dropped at the pace it plays until sound
+// comes back.
+static void sim_pm_run(const sim_pm_trace_t* trace, sim_pm_result_t* res) {
+    const sys_pm_config_t cfg = {
+        .load_pct = CONFIG_SYS_PM_LOAD_PCT,
+        .boost_pct = CONFIG_SYS_PM_BOOST_PCT,
+        .sleep_pct = CONFIG_SYS_PM_SLEEP_PCT,
+        .hold_ms = CONFIG_SYS_PM_HOLD_MS,
+        .idle_ms = CONFIG_SYS_PM_IDLE_MS,
+        .light_sleep = trace->xtal32k,
+    };
+    sys_pm_policy_t policy;
+    sys_pm_policy_init(&policy, &cfg);
+    sys_pm_decision_t out = policy.out;
+    memset(res, 0, sizeof(*res));
+
+    uint64_t target = (uint64_t)SIM_PM_RATE * trace->target_ms / 1000;
+    uint64_t fill = 0;       // bytes in the ring
+    uint64_t decoded = 0;    // bytes of the track decoded
+    uint64_t played = 0;     // bytes of the track read by the sink
+    uint64_t decode_us = 0;  // time spent decoding
+    uint32_t frame_left = 0; // us of the frame being decoded
+    int64_t silent_since = 0;
+    bool streaming = true, primed = false;
+    uint64_t end = (uint64_t)SIM_PM_RATE * trace->end_s;
+    for (uint32_t t = 1; t <= trace->seconds * 1000; t++) {
+        int64_t now = (int64_t)t * 1000;
+        bool stalled = trace->stall_every_ms != 0 &&
+                       t % trace->stall_every_ms < trace->stall_ms;
+        uint32_t mhz = sys_pm_level_mhz(out.sleep ? SYS_PM_80_MHZ
+                                                  : out.level);
+        // the decoder gets the whole ms, the frame costs more below 240
+        uint32_t budget = 1000;
+        while (!stalled && budget > 0 && (end == 0 || decoded < end)) {
+            if (frame_left == 0) {
+                if (fill + SIM_PM_FRAME > target) {
+                    break;
+                }
+                frame_left = (uint64_t)trace->frame_us * 240 / mhz;
+            }
+            uint32_t run = frame_left < budget ? frame_left : budget;
+            frame_left -= run;
+            budget -= run;
+            decode_us += run;
+            if (frame_left == 0) {
+                fill += SIM_PM_FRAME;
+                decoded += SIM_PM_FRAME;
+            }
+        }
+
+        // the head of the ring is silent between silent_s and sound_s of
+        // the track, and past its end
+        uint64_t head_ms = played * 1000 / SIM_PM_RATE;
+        bool head_silent = (head_ms >= trace->silent_s * 1000 &&
+                            head_ms < trace->sound_s * 1000) ||
+                           fill == 0;
+        uint32_t len = SIM_PM_RATE * SIM_PM_PULL_MS / 1000;
+        if (t % SIM_PM_PULL_MS == 0 && streaming) {
+            if (fill < len && primed && (end == 0 || played < end)) {
+                res->underruns++;
+            }
+            primed |= fill >= len;
+            uint64_t n = fill < len ? fill : len;
+            fill -= n;
+            played += n;
+            if (!head_silent) {
+                silent_since = 0;
+            } else if (silent_since == 0) {
+                silent_since = now;
+            }
+        } else if (t % SIM_PM_PULL_MS == 0 && fill >= len) {
+            if (head_silent) {
+                fill -= len;
+                played += len;
+            } else {
+                // sound again, the stream restarts
+                streaming = true;
+                silent_since = 0;
+            }
+        }
+
+        if (t % CONFIG_SYS_PM_PERIOD_MS == 0) {
+            sys_pm_input_t in = {
+                .fill_ms = fill * 1000 / SIM_PM_RATE,
+                .target_ms = trace->target_ms,
+                .decode_us = decode_us,
+                .silent_ms = silent_since ? (now - silent_since) / 1000 : 0,
+                .streaming = streaming,
+            };
+            sys_pm_decision_t prev = out;
+            sys_pm_policy_update(&policy, &in, now, &out);
+            if (out.suspend && !prev.suspend) {
+                streaming = false;
+            }
+        }
+    }
+    res->streaming = streaming;
+    sys_pm_policy_get_stats(&policy, &res->stats);
+}
+
+void sim_pm_check(void) {
+    static const sim_pm_trace_t traces[] = {
+        {"mp3", 120, 2600, 150, 0, 0, 0, 0, 0, false},
+        {"mp3 32k", 120, 2600, 150, 0, 0, 0, 0, 0, true},
+        {"flac 24", 120, 11000, 150, 0, 0, 0, 0, 0, false},
+        {"card stalls", 120, 2600, 200, 5000, 150, 0, 0, 0, false},
+        {"silent gap", 90, 2600, 150, 0, 0, 30, 60, 0, false},
+        {"track end", 60, 2600, 150, 0, 0, 0, 0, 30, true},
+    };
+    static const char* const modes[SYS_PM_MODES] = {"play", "silent",
+                                                    "idle"};
+    sim_pm_result_t res[sizeof(traces) / sizeof(traces[0])];
+    for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+        sim_pm_run(&traces[i], &res[i]);
+        const sys_pm_stats_t* s = &res[i].stats;
+        uint64_t us = s->mode_us[SYS_PM_PLAY] + s->mode_us[SYS_PM_SILENT] +
+                      s->mode_us[SYS_PM_IDLE];
+        printf("%-12s underruns %2" PRIu32 ", load %2" PRIu32 "%%, "
+               "80/160/240 MHz %3" PRIu64 "/%3" PRIu64 "/%3" PRIu64
+               "%%, sleep %3" PRIu64 "%%, boosts %" PRIu32
+               ", suspends %" PRIu32 "\n",
+               traces[i].name, res[i].underruns, s->load_pct,
+               s->level_us[SYS_PM_80_MHZ] * 100 / us,
+               s->level_us[SYS_PM_160_MHZ] * 100 / us,
+               s->level_us[SYS_PM_240_MHZ] * 100 / us,
+               s->sleep_us * 100 / us, s->boosts, s->suspends);
+        for (int m = 0; m < SYS_PM_MODES; m++) {
+            if (s->mode_us[m] != 0) {
+                printf("%12s %-6s %6" PRIu64 " ms, %2" PRIu32 ".%" PRIu32
+                       " mA\n", "", modes[m], s->mode_us[m] / 1000,
+                       s->avg_ua[m] / 1000, s->avg_ua[m] % 1000 / 100);
+            }
+        }
+        printf("%12s %-6s %6" PRIu64 " ms, %2" PRIu32 ".%" PRIu32 " mA\n",
+               "", "all", us / 1000, s->total_ua / 1000,
+               s->total_ua % 1000 / 100);
+    }
+
+    bool ok = true;
+    const sys_pm_stats_t* s = &res[0].stats;
+    // MP3 leaves the CPU mostly at 80 MHz without underruns, awake: the
+    // Bluetooth controller keeps the chip out of light sleep
+    ok &= res[0].underruns == 0 && s->suspends == 0 &&
+          s->level_us[SYS_PM_80_MHZ] > s->mode_us[SYS_PM_PLAY] * 3 / 4 &&
+          s->sleep_us == 0;
+    // with a 32 kHz crystal it sleeps between refills and draws less
+    s = &res[1].stats;
+    ok &= res[1].underruns == 0 &&
+          s->sleep_us > s->mode_us[SYS_PM_PLAY] / 2 &&
+          s->avg_ua[SYS_PM_PLAY] < res[0].stats.avg_ua[SYS_PM_PLAY];
+    // a heavy decoder keeps its headroom at 240 MHz
+    s = &res[2].stats;
+    ok &= res[2].underruns == 0 && s->level_us[SYS_PM_240_MHZ] > 0 &&
+          s->avg_ua[SYS_PM_PLAY] > res[0].stats.avg_ua[SYS_PM_PLAY];
+    // a stalled card drains the ring, the policy boosts the refill
+    s = &res[3].stats;
+    ok &= res[3].underruns == 0 && s->boosts > 0;
+    // a long silence suspends the stream, the sound after it resumes it
+    s = &res[4].stats;
+    ok &= res[4].underruns == 0 && s->suspends == 1 && res[4].streaming &&
+          s->mode_us[SYS_PM_IDLE] > 0;
+    // the end of the music suspends it for good, asleep idle draws the
+    // least
+    s = &res[5].stats;
+    ok &= s->suspends == 1 && !res[5].streaming &&
+          s->avg_ua[SYS_PM_IDLE] < s->avg_ua[SYS_PM_PLAY];
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+#endif
+
+// Messages of the dispatch benchmark, sent in bursts as Bluedroid raises
+// a connection's events, from a task above the core task
+#define SIM_CORE_BENCH_MSGS 2000
+#define SIM_CORE_BENCH_BURST 8
+
+typedef struct {
+    _Atomic uint32_t handled;
+    _Atomic bool go;   // the sender may start
+    _Atomic bool sent; // the sender is done
+    uint64_t latency_us; // dispatch to handler, summed
+    uint32_t latency_max;
+    uint64_t dispatch_us; // in the dispatch call, summed
+    uint32_t dispatched;
+} sim_core_bench_t;
+
+static sim_core_bench_t core_bench;
+static bt_ctx_t* core_bench_ctx;
+static bool core_bench_baseline;
+
+// The malloc path bt_core had before its pool: a heap copy per message,
+// freed by the task that handles it
+static QueueHandle_t core_base_queue;
+static _Atomic uint32_t core_base_allocs;
+static _Atomic uint32_t core_base_in_flight; // bytes
+static _Atomic uint32_t core_base_peak;
+
+// Subscriber of both paths, the dispatch time rides in the params
+static void sim_core_bench_cb(bt_ctx_t* ctx, uint16_t event, void* param) {
+    int64_t sent;
+    memcpy(&sent, param, sizeof(sent));
+    uint32_t us = esp_timer_get_time() - sent;
+    core_bench.latency_us += us;
+    if (us > core_bench.latency_max) {
+        core_bench.latency_max = us;
+    }
+    atomic_fetch_add(&core_bench.handled, 1);
+}
+
+static void sim_core_base_task(void* arg) {
+    bt_msg_t msg;
+    for (;;) {
+        if (xQueueReceive(core_base_queue, &msg, portMAX_DELAY) == pdTRUE) {
+            sim_core_bench_cb(NULL, msg.event, msg.param);
+            atomic_fetch_sub(&core_base_in_flight, msg.param_len);
+            free(msg.param);
+        }
+    }
+}
+
+static bool sim_core_base_dispatch(uint16_t event, void* params,
+                                   uint32_t param_len) {
+    bt_msg_t msg = {.id = BT_SIG_A2DP, .event = event,
+                    .param_len = param_len};
+    if ((msg.param = malloc(param_len)) == NULL) {
+        return false;
+    }
+    memcpy(msg.param, params, param_len);
+    atomic_fetch_add(&core_base_allocs, 1);
+    uint32_t bytes = atomic_fetch_add(&core_base_in_flight, param_len) +
+                     param_len;
+    if (bytes > atomic_load(&core_base_peak)) {
+        atomic_store(&core_base_peak, bytes);
+    }
+    if (xQueueSend(core_base_queue, &msg, pdMS_TO_TICKS(10)) != pdTRUE) {
+        atomic_fetch_sub(&core_base_in_flight, param_len);
+        free(msg.param);
+        return false;
+    }
+    return true;
+}
+
+// Stands in for the Bluedroid task: bursts of A2DP sized callbacks, each
+// burst handled before the next
+static void sim_core_bench_task(void* arg) {
+    esp_a2d_cb_param_t param = {0};
+    while (!atomic_load(&core_bench.go)) {
+        vTaskDelay(1);
+    }
+    for (uint32_t i = 0; i < SIM_CORE_BENCH_MSGS; i++) {
+        int64_t start = esp_timer_get_time();
+        memcpy(&param, &start, sizeof(start));
+        bool ok = core_bench_baseline
+                      ? sim_core_base_dispatch(ESP_A2D_AUDIO_STATE_EVT,
+                                               &param, sizeof(param))
+                      : bt_core_dispatch(core_bench_ctx, BT_SIG_A2DP,
+                                         ESP_A2D_AUDIO_STATE_EVT, &param,
+                                         sizeof(param));
+        core_bench.dispatch_us += esp_timer_get_time() - start;
+        core_bench.dispatched += ok;
+        if (i % SIM_CORE_BENCH_BURST == SIM_CORE_BENCH_BURST - 1) {
+            vTaskDelay(1);
+        }
+    }
+    atomic_store(&core_bench.sent, true);
+    vTaskDelete(NULL);
+}
+
+static void sim_core_bench_run(const char* name, bool baseline) {
+    memset(&core_bench, 0, sizeof(core_bench));
+    core_bench_baseline = baseline;
+    xTaskCreate(sim_core_bench_task, "SimBenchTask", 3072, NULL,
+                CONFIG_SYS_TASK_BT_CORE_PRIO + 1, NULL);
+#if CONFIG_SYS_MEM_GUARD
+    // from the sender's first dispatch, the task creation allocates
+    if (!baseline) {
+        sys_mem_guard_arm();
+    }
+#endif
+    atomic_store(&core_bench.go, true);
+    while (!atomic_load(&core_bench.sent) ||
+           atomic_load(&core_bench.handled) < core_bench.dispatched) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+#if CONFIG_SYS_MEM_GUARD
+    sys_mem_guard_disarm();
+#endif
+    printf("%-9s dispatch avg %3" PRIu64 " us, to handler avg %3" PRIu64
+           " us, max %4" PRIu32 " us, %" PRIu32 " of %d delivered\n",
+           name, core_bench.dispatch_us / SIM_CORE_BENCH_MSGS,
+           core_bench.latency_us / SIM_CORE_BENCH_MSGS,
+           core_bench.latency_max, core_bench.dispatched,
+           SIM_CORE_BENCH_MSGS);
+}
+
+void sim_core_bench(bt_ctx_t* ctx) {
+    core_bench_ctx = ctx;
+    bt_core_subscribe(ctx, BT_SIG_A2DP, sim_core_bench_cb);
+    bt_core_start(ctx);
+    core_base_queue = xQueueCreate(CONFIG_BT_CORE_QUEUE_LEN, sizeof(bt_msg_t));
+    xTaskCreate(sim_core_base_task, "SimBaseTask", 3072, NULL,
+                CONFIG_SYS_TASK_BT_CORE_PRIO, NULL);
+
+    sim_core_bench_run("malloc", true);
+    printf("%9s %" PRIu32 " heap allocations, peak %" PRIu32
+           " bytes in flight\n", "",
+           atomic_load(&core_base_allocs), atomic_load(&core_base_peak));
+    sim_core_bench_run("pool", false);
+#if CONFIG_SYS_MEM_GUARD
+    sys_mem_guard_stats_t guard;
+    sys_mem_guard_get_stats(&guard);
+    printf("%9s %" PRIu32 " heap allocations\n", "", guard.count);
+#endif
+    bt_core_pool_stats_t pool;
+    bt_core_get_pool_stats(&pool);
+    printf("%9s high water %" PRIu32 " of %" PRIu32 " slots of %" PRIu32
+           " bytes, %" PRIu32 " exhausted\n", "",
+           pool.high_water, pool.slots, pool.slot_size, pool.exhausted);
+
+    bool ok = core_bench.dispatched == SIM_CORE_BENCH_MSGS &&
+              pool.exhausted == 0 && pool.in_use == 0;
+#if CONFIG_SYS_MEM_GUARD
+    ok &= guard.count == 0;
+#endif
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+
+// Flood of the core stress: tasks standing in for Bluedroid, each sending
+// bursts of inquiry results, volume changes, play status changes and one
+// connection state change
+#define SIM_CORE_FLOODS 3
+#define SIM_CORE_BURSTS 400
+#define SIM_CORE_DISC 8
+#define SIM_CORE_VOLUME 4
+#define SIM_CORE_NOTIFY 8
+// Handler time of an inquiry result and a play status change, about a
+// formatted log line each
+#define SIM_CORE_DISC_US 50
+#define SIM_CORE_NOTIFY_US 20
+// The volume sent after the flood, the last one handled must be it
+#define SIM_CORE_LAST_VOLUME 42
+#define SIM_CORE_DRAIN_MS 5000
+
+typedef struct {
+    _Atomic uint32_t disc, volume, notify, conn;
+} sim_core_count_t;
+
+static bt_ctx_t* core_stress_ctx;
+static sim_core_count_t core_sent, core_handled;
+static _Atomic uint32_t core_conn_tried;
+static _Atomic uint32_t core_low_peak; // depth of the low queue seen
+static _Atomic uint32_t core_floods_done;
+static _Atomic uint8_t core_volume;
+
+static void sim_core_spin(uint32_t us) {
+    int64_t end = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end) {
+    }
+}
+
+static void sim_core_gap_cb(bt_ctx_t* ctx, uint16_t event, void* param) {
+    sim_core_spin(SIM_CORE_DISC_US);
+    atomic_fetch_add(&core_handled.disc, 1);
+}
+
+static void sim_core_avrc_cb(bt_ctx_t* ctx, uint16_t event, void* param) {
+    esp_avrc_ct_cb_param_t* p = param;
+    if (p->change_ntf.event_id == ESP_AVRC_RN_VOLUME_CHANGE) {
+        atomic_store(&core_volume, p->change_ntf.event_parameter.volume);
+        atomic_fetch_add(&core_handled.volume, 1);
+    } else {
+        sim_core_spin(SIM_CORE_NOTIFY_US);
+        atomic_fetch_add(&core_handled.notify, 1);
+    }
+}
+
+static void sim_core_a2dp_cb(bt_ctx_t* ctx, uint16_t event, void* param) {
+    atomic_fetch_add(&core_handled.conn, 1);
+}
+
+// The flags bt_a2dp dispatches each of these with
+static void sim_core_flood_task(void* arg) {
+    esp_bt_gap_cb_param_t disc = {0};
+    esp_avrc_ct_cb_param_t ntf = {0};
+    esp_a2d_cb_param_t conn = {0};
+    for (uint32_t b = 0; b < SIM_CORE_BURSTS; b++) {
+        for (int i = 0; i < SIM_CORE_DISC; i++) {
+            disc.disc_res.bda[5] = i;
+            if (bt_core_dispatch(core_stress_ctx, BT_SIG_GAP,
+                                 ESP_BT_GAP_DISC_RES_EVT, &disc,
+                                 sizeof(disc))) {
+                atomic_fetch_add(&core_sent.disc, 1);
+            }
+            // only non-critical messages go to the low queue
+            uint32_t depth = uxQueueMessagesWaiting(
+                core_stress_ctx->event_queue[BT_PRIO_LOW]);
+            if (depth > atomic_load(&core_low_peak)) {
+                atomic_store(&core_low_peak, depth);
+            }
+        }
+        ntf.change_ntf.event_id = ESP_AVRC_RN_VOLUME_CHANGE;
+        for (int i = 0; i < SIM_CORE_VOLUME; i++) {
+            ntf.change_ntf.event_parameter.volume = (b + i) & 0x7f;
+            if (bt_core_dispatch_ex(core_stress_ctx, BT_SIG_AVRC_CT,
+                                    ESP_AVRC_CT_CHANGE_NOTIFY_EVT, &ntf,
+                                    sizeof(ntf), BT_MSG_F_COALESCE)) {
+                atomic_fetch_add(&core_sent.volume, 1);
+            }
+        }
+        ntf.change_ntf.event_id = ESP_AVRC_RN_PLAY_STATUS_CHANGE;
+        for (int i = 0; i < SIM_CORE_NOTIFY; i++) {
+            if (bt_core_dispatch(core_stress_ctx, BT_SIG_AVRC_CT,
+                                 ESP_AVRC_CT_CHANGE_NOTIFY_EVT, &ntf,
+                                 sizeof(ntf))) {
+                atomic_fetch_add(&core_sent.notify, 1);
+            }
+        }
+        // last, into queues the burst has filled
+        conn.conn_stat.state = b & 1 ? ESP_A2D_CONNECTION_STATE_CONNECTED
+                                     : ESP_A2D_CONNECTION_STATE_DISCONNECTED;
+        atomic_fetch_add(&core_conn_tried, 1);
+        if (bt_core_dispatch_ex(core_stress_ctx, BT_SIG_A2DP,
+                                ESP_A2D_CONNECTION_STATE_EVT, &conn,
+                                sizeof(conn), BT_MSG_F_CRITICAL)) {
+            atomic_fetch_add(&core_sent.conn, 1);
+        }
+        vTaskDelay(1);
+    }
+    atomic_fetch_add(&core_floods_done, 1);
+    vTaskDelete(NULL);
+}
+
+void sim_core_stress(bt_ctx_t* ctx) {
+    core_stress_ctx = ctx;
+    bt_core_subscribe(ctx, BT_SIG_GAP, sim_core_gap_cb);
+    bt_core_subscribe(ctx, BT_SIG_AVRC_CT, sim_core_avrc_cb);
+    bt_core_subscribe(ctx, BT_SIG_A2DP, sim_core_a2dp_cb);
+    bt_core_start(ctx);
+    for (int i = 0; i < SIM_CORE_FLOODS; i++) {
+        xTaskCreate(sim_core_flood_task, "SimFloodTask", 3072, NULL,
+                    CONFIG_SYS_TASK_BT_CORE_PRIO + 1, NULL);
+    }
+    while (atomic_load(&core_floods_done) < SIM_CORE_FLOODS) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+
+    // the newest volume wins over one still pending
+    esp_avrc_ct_cb_param_t ntf = {0};
+    ntf.change_ntf.event_id = ESP_AVRC_RN_VOLUME_CHANGE;
+    ntf.change_ntf.event_parameter.volume = SIM_CORE_LAST_VOLUME;
+    bt_core_dispatch_ex(ctx, BT_SIG_AVRC_CT, ESP_AVRC_CT_CHANGE_NOTIFY_EVT,
+                        &ntf, sizeof(ntf), BT_MSG_F_COALESCE);
+    bt_core_pool_stats_t pool;
+    for (int ms = 0; ms < SIM_CORE_DRAIN_MS; ms += 10) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        bt_core_get_pool_stats(&pool);
+        if (pool.in_use == 0) {
+            break;
+        }
+    }
+
+    bt_core_queue_stats_t q;
+    bt_core_get_queue_stats(&q);
+    printf("sent:            disc %" PRIu32 ", volume %" PRIu32
+           ", notify %" PRIu32 ", conn %" PRIu32 " of %" PRIu32 "\n",
+           atomic_load(&core_sent.disc), atomic_load(&core_sent.volume),
+           atomic_load(&core_sent.notify), atomic_load(&core_sent.conn),
+           atomic_load(&core_conn_tried));
+    printf("handled:         disc %" PRIu32 ", volume %" PRIu32
+           ", notify %" PRIu32 ", conn %" PRIu32 "\n",
+           atomic_load(&core_handled.disc),
+           atomic_load(&core_handled.volume),
+           atomic_load(&core_handled.notify),
+           atomic_load(&core_handled.conn));
+    printf("dropped:         low %" PRIu32 ", high %" PRIu32
+           ", critical %" PRIu32 "\n",
+           q.dropped[BT_PRIO_LOW], q.dropped[BT_PRIO_HIGH],
+           q.dropped_critical);
+    printf("coalesced:       %" PRIu32 ", last volume %d\n", q.coalesced,
+           atomic_load(&core_volume));
+    printf("low queue peak:  %" PRIu32 " of %d, %d reserved\n",
+           atomic_load(&core_low_peak), CONFIG_BT_CORE_QUEUE_LEN,
+           CONFIG_BT_CORE_RESERVED_SLOTS);
+    printf("pool:            high water %" PRIu32 " of %" PRIu32
+           ", %" PRIu32 " exhausted\n",
+           pool.high_water, pool.slots, pool.exhausted);
+    printf("batches:         %" PRIu32 ", largest %" PRIu32 "\n", q.batches,
+           q.max_batch);
+
+    // every state change arrives, however full the flood keeps the queues
+    bool ok = q.dropped_critical == 0 &&
+              atomic_load(&core_handled.conn) ==
+                  atomic_load(&core_conn_tried);
+    ok &= q.coalesced > 0 && atomic_load(&core_volume) == SIM_CORE_LAST_VOLUME;
+    // the flood was refused before it reached the reserved slots
+    ok &= q.dropped[BT_PRIO_LOW] > 0 &&
+          atomic_load(&core_low_peak) <=
+              CONFIG_BT_CORE_QUEUE_LEN - CONFIG_BT_CORE_RESERVED_SLOTS;
+    ok &= pool.in_use == 0;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
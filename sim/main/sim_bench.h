@@ -0,0 +1,69 @@
+#pragma once
+#include "bt_core.h"
+#include <stdint.h>
+
+// Read path through stream_reader as fast as the consumer can take it and
+// print the sustained throughput and the worst stall, then exit
+void sim_stream_bench(const char* path);
+
+// Index the MP3s below root into root/MEDIA_LIB_INDEX_FILE, then exit
+void sim_lib_build(const char* root);
+
+// Build, open, browse and rescan the index of a synthetic tree of files
+// MP3s, print the timings, then exit
+void sim_lib_bench(uint32_t files);
+
+// Time seeks across path by hopping frame headers, through its TOC if it
+// has one and through a seek table, print them with the table build, save
+// and load times, then exit
+void sim_seek_bench(const char* path);
+
+// Play dir/a.mp3 then dir/b.mp3, the halves of a 6 s 1 kHz tone, and check
+// the output is the whole tone without a gap or a shift at the splice
+void sim_gapless_check(const char* dir);
+
+// Time the resampler from 48 and 32 kHz at every quality tier and check
+// its accuracy on tones against the ideal output, then exit
+void sim_resample_bench(void);
+
+// Time the gain stage holding and ramping its gain on data callback sized
+// blocks, check the ramp and saturation, then exit
+void sim_gain_bench(void);
+
+// Time the equalizer with 1 to PCM_EQ_MAX_BANDS bands, per second of
+// 44.1 kHz audio, check the response of each band type, then exit
+void sim_eq_bench(void);
+
+// Check the PCM ring's reserve/commit across the buffer end and the
+// counter wrap, underrun padding and its counters, the fill limit, then
+// time a producer task feeding this one and print the MB/s, then exit
+void sim_ring_check(void);
+
+// Drive the jitter buffer and a PCM ring from synthetic read traces:
+// steady, retransmission bursts, card stalls and a sink delay. Print the
+// depth decisions and check each adapts as intended, then exit.
+void sim_jitter_check(void);
+
+// Replay playback traces through the power policy: MP3 with and without
+// light sleep, a heavy FLAC, card stalls, a silent passage and the end of
+// the music. Print the time at each frequency and asleep, the current
+// estimated for each mode, and check the decisions, then exit.
+void sim_pm_check(void);
+
+// Decode every MP3, WAV and FLAC in dir through the codec interface and
+// print each one's speed as a multiple of real time. A file with a WAV of
+// the same name beside it must decode to the same PCM, also after a seek
+// to a third of it. Then exit.
+void sim_codec_bench(const char* dir);
+
+// Dispatch bursts of A2DP callback params to the core task, through the
+// pool and through the malloc path it replaced, print the dispatch cost,
+// the delay to the handler, the heap used by the malloc path and the pool
+// high water, then exit. Call after bt_init, the handlers are its own.
+void sim_core_bench(bt_ctx_t* ctx);
+
+// Flood the core from several tasks with the events bt_a2dp dispatches,
+// check that no critical event is dropped, that volume changes coalesce
+// and that the flood stops short of the reserved slots, then exit. Call
+// after bt_init, the handlers are its own.
+void sim_core_stress(bt_ctx_t* ctx);
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "audio_dec.h"
+#include "bt_a2dp.h"
+#include "bt_core.h"
+#include "bt_dlog.h"
+#include "bt_instr.h"
+#include "bt_sim.h"
+#include "bt_trace.h"
+#include "pcm_ring.h"
+#include "sim_bench.h"
+#include "sys_boot.h"
+#include "sys_mem.h"
+#include "sys_task.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+// Simulated ms to run the scenario for
+#define SIM_RUN_MS 120000
+// Simulated ms at which playback is paused and resumed
+#define SIM_SUSPEND_MS 90000
+#define SIM_RESUME_MS 100000
+
+// discover -> connect -> stream -> volume -> link loss -> reconnect ->
+// stream -> suspend -> resume
+static const bt_sim_step_t sim_script[] = {
+    {30000, BT_SIM_ACT_VOLUME, 100},
+    {60000, BT_SIM_ACT_LINK_LOSS, 0},
+};
+
+// Stand-in for the decoder when there is no track: a square wave, so the
+// first non-silent pull is still visible in the report
+static void sim_tone_task(void* arg) {
+    pcm_ring_t* ring = arg;
+    int16_t frame[64 * 2];
+    for (int i = 0; i < 64; i++) {
+        frame[i * 2] = frame[i * 2 + 1] = i < 32 ? 4000 : -4000;
+    }
+    for (;;) {
+        if (pcm_ring_space(ring) < sizeof(frame)) {
+            vTaskDelay(1);
+            continue;
+        }
+        pcm_ring_write(ring, (const uint8_t*)frame, sizeof(frame));
+    }
+}
+
+// An MP3 frame of 16-bit stereo, what the decoder writes at once
+#define SIM_PREBUFFER_BYTES (1152 * 4)
+#define SIM_PREBUFFER_TIMEOUT_MS 2000
+#define SIM_RING_TIMEOUT_MS 10000
+
+static pcm_ring_t* pcm_ring;
+static audio_dec_t* dec;
+
+// The decoder stages of main/aura.c, the host has no card to mount
+static bool sim_dec_start(void* arg) {
+    if (!sys_boot_wait("pcm ring", SIM_RING_TIMEOUT_MS)) {
+        return false;
+    }
+    dec = audio_dec_start(CONFIG_AUDIO_DEC_TRACK_PATH, pcm_ring);
+    if (dec == nullptr) {
+        ESP_LOGW("SIM_MAIN", "No track, streaming a test tone\n");
+        xTaskCreate(sim_tone_task, "SimToneTask", 2048, pcm_ring, 5, NULL);
+    }
+    return true;
+}
+
+static bool sim_prebuffer(void* arg) {
+    TickType_t start = xTaskGetTickCount();
+    while (pcm_ring_fill(pcm_ring) < SIM_PREBUFFER_BYTES) {
+        if (xTaskGetTickCount() - start >=
+            pdMS_TO_TICKS(SIM_PREBUFFER_TIMEOUT_MS)) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+static const sys_boot_stage_t sim_boot_stages[] = {
+    {"decoder", sim_dec_start, NULL},
+    {"prebuffer", sim_prebuffer, NULL},
+};
+
+#if CONFIG_SIM_ALLOC_CHECK
+// Simulated ms of playback checked, and between its seeks
+#define SIM_ALLOC_RUN_MS 600000
+#define SIM_ALLOC_SEEK_MS 40000
+
+// Queue the track again as it starts, so playback goes on through track
+// changes
+static void sim_alloc_next(audio_dec_t* dec, void* arg) {
+    audio_dec_queue(dec, CONFIG_AUDIO_DEC_TRACK_PATH);
+}
+
+// Play ten simulated minutes with the allocation guard armed, through
+// track changes and seeks, and fail on any heap allocation
+static void sim_alloc_check(audio_dec_t* dec) {
+    if (dec == nullptr) {
+        ESP_LOGE("SIM_MAIN", "Allocation check needs a track\n");
+        exit(1);
+    }
+    audio_dec_set_next_cb(dec, sim_alloc_next, NULL);
+    audio_dec_queue(dec, CONFIG_AUDIO_DEC_TRACK_PATH);
+
+    // boot is over once the sink plays audio
+    bt_sim_report_t r;
+    do {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        bt_sim_get_report(&r);
+    } while (r.first_audio_ms == 0 && bt_sim_now_ms() < SIM_RUN_MS);
+    sys_mem_guard_arm();
+
+    uint32_t start = bt_sim_now_ms();
+    uint32_t next_seek = start + SIM_ALLOC_SEEK_MS;
+    uint32_t seeks = 0;
+    audio_dec_stats_t stats;
+    while (bt_sim_now_ms() - start < SIM_ALLOC_RUN_MS) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        if (bt_sim_now_ms() >= next_seek) {
+            // to 10, 50 and 90 % of the track, the last one ends it soon
+            audio_dec_get_stats(dec, &stats);
+            audio_dec_seek(dec, (uint64_t)stats.duration_ms *
+                                    (10 + 40 * (seeks % 3)) / 100);
+            seeks++;
+            next_seek += SIM_ALLOC_SEEK_MS;
+        }
+    }
+    sys_mem_guard_disarm();
+
+    sys_mem_guard_stats_t guard;
+    sys_mem_guard_get_stats(&guard);
+    audio_dec_get_stats(dec, &stats);
+    bt_sim_get_report(&r);
+    printf("first audio:     %" PRIu32 " ms\n", r.first_audio_ms);
+    printf("played:          %" PRIu32 " ms, tracks: %" PRIu32
+           ", seeks: %" PRIu32 "\n",
+           bt_sim_now_ms() - start, stats.tracks, seeks);
+    printf("allocations:     %" PRIu32 ", bytes: %" PRIu64 "\n",
+           guard.count, guard.bytes);
+    for (uint32_t i = 0; i < guard.records; i++) {
+        printf("  %zu bytes from %p\n", guard.rec[i].size,
+               guard.rec[i].caller);
+    }
+    bool ok = r.first_audio_ms != 0 && stats.tracks > 1 && guard.count == 0;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}
+#endif
+
+#if CONFIG_BT_CORE_TRACE
+// Replay a bt_trace_dump capture against the handlers and time them
+static void sim_replay(bt_ctx_t* bt_ctx, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        ESP_LOGE("SIM_MAIN", "Cannot open trace %s\n", path);
+        exit(1);
+    }
+
+    size_t count = 0, cap = 0;
+    bt_trace_rec_t* recs = NULL;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            recs = realloc(recs, cap * sizeof(bt_trace_rec_t));
+            if (recs == NULL) {
+                ESP_LOGE("SIM_MAIN", "Trace allocation failed\n");
+                exit(1);
+            }
+        }
+        if (bt_trace_parse(line, &recs[count])) {
+            count++;
+        }
+    }
+    fclose(f);
+
+    bt_trace_replay_stats_t stats;
+    bt_trace_replay(bt_ctx, recs, count, false, &stats);
+
+    printf("records:         %zu, handled: %" PRIu32 "\n", count,
+           stats.records);
+    printf("recorded span:   %" PRIu32 " us\n", stats.span_us);
+    printf("handler time:    %" PRIu32 " us\n", stats.handler_us);
+    printf("slowest:         record %" PRIu32 ", %" PRIu32 " us\n",
+           stats.slowest, stats.slowest_us);
+    printf("final state:     a2dp %d, media %d\n", bt_ctx->a2dp_state,
+           bt_ctx->media_state);
+    free(recs);
+    fflush(stdout);
+    exit(0);
+}
+#endif
+
+void app_main(void) {
+    if (CONFIG_SIM_STREAM_BENCH[0] != '\0') {
+        sim_stream_bench(CONFIG_SIM_STREAM_BENCH);
+    }
+    if (CONFIG_SIM_LIB_BUILD[0] != '\0') {
+        sim_lib_build(CONFIG_SIM_LIB_BUILD);
+    }
+    if (CONFIG_SIM_LIB_BENCH > 0) {
+        sim_lib_bench(CONFIG_SIM_LIB_BENCH);
+    }
+    if (CONFIG_SIM_SEEK_BENCH[0] != '\0') {
+        sim_seek_bench(CONFIG_SIM_SEEK_BENCH);
+    }
+    if (CONFIG_SIM_GAPLESS_CHECK[0] != '\0') {
+        sim_gapless_check(CONFIG_SIM_GAPLESS_CHECK);
+    }
+    if (CONFIG_SIM_CODEC_BENCH[0] != '\0') {
+        sim_codec_bench(CONFIG_SIM_CODEC_BENCH);
+    }
+#if CONFIG_SIM_RESAMPLE_BENCH
+    sim_resample_bench();
+#endif
+#if CONFIG_SIM_GAIN_BENCH
+    sim_gain_bench();
+#endif
+#if CONFIG_SIM_EQ_BENCH
+    sim_eq_bench();
+#endif
+#if CONFIG_SIM_RING_CHECK
+    sim_ring_check();
+#endif
+#if CONFIG_SIM_JITTER_CHECK
+    sim_jitter_check();
+#endif
+#if CONFIG_SIM_PM_CHECK
+    sim_pm_check();
+#endif
+
+    bt_sim_peer_t peer;
+    bt_sim_default_peer(&peer);
+    bt_sim_init(&peer);
+
+    // same bring-up as main/aura.c
+    sys_task_init();
+    sys_boot_init();
+    sys_boot_start(sim_boot_stages,
+                   sizeof(sim_boot_stages) / sizeof(sim_boot_stages[0]));
+#if CONFIG_SYS_MEM_STATIC
+    _Static_assert((CONFIG_PCM_RING_SIZE & (CONFIG_PCM_RING_SIZE - 1)) == 0,
+                   "PCM_RING_SIZE must be a power of two in static mode");
+    static uint8_t pcm_ring_buf[CONFIG_PCM_RING_SIZE] SYS_MEM_EXT;
+    static pcm_ring_t pcm_ring_storage;
+    pcm_ring_init(&pcm_ring_storage, pcm_ring_buf, sizeof(pcm_ring_buf));
+    pcm_ring = &pcm_ring_storage;
+    bt_a2dp_set_pcm_ring(pcm_ring);
+    sys_boot_mark("pcm ring");
+#endif
+    bt_ctx_t* bt_ctx = bt_init();
+    if (bt_ctx == nullptr || bt_ctx->state == BT_STATE_UNINITIALIZED) {
+        ESP_LOGE("SIM_MAIN", "Bluetooth initialization failed\n");
+        exit(1);
+    }
+#if CONFIG_SIM_CORE_BENCH
+    sim_core_bench(bt_ctx);
+#endif
+#if CONFIG_SIM_CORE_STRESS
+    sim_core_stress(bt_ctx);
+#endif
+    bt_a2dp_register(bt_ctx);
+    bt_core_start(bt_ctx);
+    sys_boot_mark("a2dp");
+
+#if CONFIG_BT_CORE_TRACE
+    if (CONFIG_SIM_REPLAY_TRACE[0] != '\0') {
+        sim_replay(bt_ctx, CONFIG_SIM_REPLAY_TRACE);
+    }
+#endif
+
+#if !CONFIG_SYS_MEM_STATIC
+    // the RAM trimming Bluetooth left deepens the ring, up to the most
+    // the jitter buffer fills at 44.1 kHz 16-bit stereo
+    size_t ring_size = sys_mem_ring_size(
+        CONFIG_PCM_RING_SIZE, CONFIG_BT_A2DP_JITTER_MAX_MS * 44100 * 4 / 1000);
+    pcm_ring = pcm_ring_create(ring_size);
+    if (pcm_ring == nullptr) {
+        ESP_LOGE("SIM_MAIN", "PCM ring allocation failed\n");
+        exit(1);
+    }
+    bt_a2dp_set_pcm_ring(pcm_ring);
+    sys_boot_mark("pcm ring");
+#endif
+#if !CONFIG_SIM_ALLOC_CHECK
+    bt_sim_run_script(sim_script, sizeof(sim_script) / sizeof(sim_script[0]));
+#endif
+    bt_core_dispatch_ex(bt_ctx, BT_SIG_STACK, BT_CORE_EVT_STACK_UP, nullptr,
+                        0, BT_MSG_F_CRITICAL);
+#if CONFIG_SIM_ALLOC_CHECK
+    sys_boot_wait("decoder", SIM_RING_TIMEOUT_MS);
+    sim_alloc_check(dec);
+#endif
+
+    bool suspended = false, resumed = false;
+    while (bt_sim_now_ms() < SIM_RUN_MS) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        if (!suspended && bt_sim_now_ms() >= SIM_SUSPEND_MS) {
+            bt_a2dp_suspend();
+            suspended = true;
+        }
+        if (!resumed && bt_sim_now_ms() >= SIM_RESUME_MS) {
+            bt_a2dp_resume();
+            resumed = true;
+        }
+    }
+
+    bt_dlog_flush();
+
+    bt_sim_report_t r;
+    pcm_ring_stats_t ring_stats;
+    pcm_jitter_stats_t jitter_stats;
+    bt_core_queue_stats_t queue_stats;
+    bt_sim_get_report(&r);
+    pcm_ring_get_stats(pcm_ring, &ring_stats);
+    bt_a2dp_get_jitter_stats(&jitter_stats);
+    bt_core_get_queue_stats(&queue_stats);
+
+    printf("discovered:      %" PRIu32 " ms\n", r.discovered_ms);
+    printf("connected:       %" PRIu32 " ms\n", r.connected_ms);
+    printf("media start:     %" PRIu32 " ms\n", r.media_start_ms);
+    printf("first pull:      %" PRIu32 " ms\n", r.first_pull_ms);
+    printf("first audio:     %" PRIu32 " ms\n", r.first_audio_ms);
+    printf("connects:        %" PRIu32 ", disconnects: %" PRIu32 "\n",
+           r.connects, r.disconnects);
+    printf("media starts:    %" PRIu32 ", suspends: %" PRIu32 "\n",
+           r.media_starts, r.media_suspends);
+    printf("data pulls:      %" PRIu32 ", bytes: %" PRIu64 "\n",
+           r.data_pulls, r.data_bytes);
+    printf("ring underruns:  %" PRIu32 ", min fill: %" PRIu32 "\n",
+           ring_stats.underruns, ring_stats.min_fill);
+    printf("ring depth:      %" PRIu32 " ms, grows: %" PRIu32
+           ", shrinks: %" PRIu32 "\n",
+           jitter_stats.target_ms, jitter_stats.grows, jitter_stats.shrinks);
+    printf("dropped msgs:    %" PRIu32 " critical\n",
+           queue_stats.dropped_critical);
+
+#if CONFIG_BT_CORE_INSTRUMENT
+    bt_instr_dump(bt_ctx);
+#endif
+    // over the whole scenario, playback most of it
+    sys_task_log_load();
+
+    // the link loss must be recovered from without a reboot
+    bool ok = r.first_audio_ms != 0 && r.connects >= 2 &&
+              r.media_starts >= 3 && r.media_suspends >= 1;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    if (!ok) {
+        // replayable with CONFIG_SIM_REPLAY_TRACE
+        bt_trace_dump();
+    }
+    fflush(stdout);
+    exit(ok ? 0 : 1);
+}